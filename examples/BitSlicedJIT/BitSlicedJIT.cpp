@@ -0,0 +1,97 @@
+//===-- examples/BitSlicedJIT/BitSlicedJIT.cpp - Key-specialized kernels --===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Runs a bit-sliced kernel void kernel(i8 *in, i8 *out) over standard input,
+// one batch at a time, after specializing it on the key given in hex:
+//
+//   opt -load LLVMBitSlicer.so aes.ll -o aes.bc
+//   BitSlicedJIT aes.bc -kernel=encrypt -key-global=key -key=000102...0f \
+//     -batch-bytes=512 < plain > cipher
+//
+//===----------------------------------------------------------------------===//
+
+#include "BitSlicedJIT.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include <cstdio>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+static cl::opt<std::string> InputFile(cl::Positional, cl::Required,
+                                      cl::desc("<bit-sliced module>"));
+
+static cl::opt<std::string> KernelName("kernel", cl::Required,
+                                       cl::desc("Kernel to run"));
+
+static cl::opt<std::string> KeyGlobal("key-global", cl::Required,
+                                      cl::desc("Global holding the key"));
+
+static cl::opt<std::string> KeyHex("key", cl::Required,
+                                   cl::desc("Key, in hexadecimal"));
+
+static cl::opt<unsigned> BatchBytes("batch-bytes", cl::init(512),
+                                    cl::desc("Bytes processed by one call of "
+                                             "the kernel"));
+
+int main(int argc, char **argv) {
+  sys::PrintStackTraceOnErrorSignal(argv[0]);
+  PrettyStackTraceProgram X(argc, argv);
+  llvm_shutdown_obj Y;
+  cl::ParseCommandLineOptions(argc, argv, "bit-sliced kernel JIT\n");
+
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+
+  std::vector<uint8_t> Key;
+  if (KeyHex.size() % 2) {
+    errs() << argv[0] << ": odd number of hex digits in the key\n";
+    return 1;
+  }
+  for (unsigned I = 0; I < KeyHex.size(); I += 2) {
+    unsigned Byte;
+    if (StringRef(KeyHex).substr(I, 2).getAsInteger(16, Byte)) {
+      errs() << argv[0] << ": invalid key " << KeyHex << "\n";
+      return 1;
+    }
+    Key.push_back(Byte);
+  }
+
+  LLVMContext Context;
+  SMDiagnostic Err;
+  std::unique_ptr<Module> M = parseIRFile(InputFile, Err, Context);
+  if (!M) {
+    Err.print(argv[0], errs());
+    return 1;
+  }
+
+  BitSlicedJIT JIT(std::move(M), KeyGlobal);
+  auto Addr = JIT.getKernel(KernelName, Key);
+  if (!Addr) {
+    logAllUnhandledErrors(Addr.takeError(), errs(), Twine(argv[0]) + ": ");
+    return 1;
+  }
+  auto *Kernel = (void (*)(uint8_t *, uint8_t *))(intptr_t)*Addr;
+
+  // The last batch is padded with zeros and written back truncated.
+  std::vector<uint8_t> In(BatchBytes), Out(BatchBytes);
+  size_t Read;
+  while ((Read = fread(In.data(), 1, In.size(), stdin)) > 0) {
+    std::fill(In.begin() + Read, In.end(), 0);
+    Kernel(In.data(), Out.data());
+    fwrite(Out.data(), 1, Read, stdout);
+  }
+  return 0;
+}
@@ -0,0 +1,219 @@
+//===----- BitSlicedJIT.h - Key-specialized bit-sliced kernels --*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// An ORC JIT session over a module produced by the BitSlicer. For every key
+// it clones the module, turns the key global into a constant initialized with
+// the key, reruns the scalar folding passes and compiles the result: the
+// round-key XORs of the bit-sliced code become slice inversions or vanish,
+// and key-dependent indices become fixed slice relabelings. The compiled
+// kernels are cached per key for the lifetime of the session.
+//
+// The key must be read from the global, the sliced copies filled at run time
+// by -bitslicer-preslice-keys cannot be folded.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXAMPLES_BITSLICEDJIT_BITSLICEDJIT_H
+#define LLVM_EXAMPLES_BITSLICEDJIT_BITSLICEDJIT_H
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/RuntimeDyld.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/IRTransformLayer.h"
+#include "llvm/ExecutionEngine/Orc/LambdaResolver.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Mangler.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/InstCombine/InstCombine.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Scalar/GVN.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+namespace orc {
+
+class BitSlicedJIT {
+private:
+  std::unique_ptr<TargetMachine> TM;
+  const DataLayout DL;
+  RTDyldObjectLinkingLayer<> ObjectLayer;
+  IRCompileLayer<decltype(ObjectLayer)> CompileLayer;
+
+  typedef std::function<std::unique_ptr<Module>(std::unique_ptr<Module>)>
+    OptimizeFunction;
+
+  IRTransformLayer<decltype(CompileLayer), OptimizeFunction> OptimizeLayer;
+
+  std::unique_ptr<Module> Kernels;
+  std::string KeyName;
+
+public:
+  typedef decltype(OptimizeLayer)::ModuleSetHandleT ModuleHandle;
+
+private:
+  // Specialized modules, by key.
+  std::map<std::vector<uint8_t>, ModuleHandle> Specialized;
+
+public:
+  BitSlicedJIT(std::unique_ptr<Module> Kernels, StringRef KeyName)
+      : TM(EngineBuilder().selectTarget()), DL(TM->createDataLayout()),
+        CompileLayer(ObjectLayer, SimpleCompiler(*TM)),
+        OptimizeLayer(CompileLayer,
+                      [this](std::unique_ptr<Module> M) {
+                        return optimizeModule(std::move(M));
+                      }),
+        Kernels(std::move(Kernels)), KeyName(KeyName) {
+    llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+    this->Kernels->setDataLayout(DL);
+  }
+
+  TargetMachine &getTargetMachine() { return *TM; }
+
+  /// Address of the kernel Name specialized on Key, compiling it the first
+  /// time the key is seen.
+  Expected<JITTargetAddress> getKernel(StringRef Name, ArrayRef<uint8_t> Key) {
+    std::vector<uint8_t> KeyBytes(Key.begin(), Key.end());
+    auto It = Specialized.find(KeyBytes);
+    if (It == Specialized.end()) {
+      auto M = specialize(Key);
+      if (!M)
+        return M.takeError();
+      It = Specialized.insert({KeyBytes, addModule(std::move(*M))}).first;
+    }
+
+    std::string MangledName;
+    raw_string_ostream MangledNameStream(MangledName);
+    Mangler::getNameWithPrefix(MangledNameStream, Name, DL);
+    auto Sym = OptimizeLayer.findSymbolIn(It->second, MangledNameStream.str(),
+                                          true);
+    if (!Sym)
+      return make_error<StringError>("kernel " + Name + " not found",
+                                     inconvertibleErrorCode());
+    return Sym.getAddress();
+  }
+
+  /// Drops the kernels compiled for Key.
+  void evict(ArrayRef<uint8_t> Key) {
+    auto It = Specialized.find(std::vector<uint8_t>(Key.begin(), Key.end()));
+    if (It == Specialized.end())
+      return;
+    OptimizeLayer.removeModuleSet(It->second);
+    Specialized.erase(It);
+  }
+
+private:
+  ModuleHandle addModule(std::unique_ptr<Module> M) {
+    // Every specialized module defines the same kernels: symbols are only
+    // looked up in the module itself, then in the host process.
+    auto Resolver = createLambdaResolver(
+        [](const std::string &Name) { return JITSymbol(nullptr); },
+        [](const std::string &Name) {
+          if (auto SymAddr =
+                RTDyldMemoryManager::getSymbolAddressInProcess(Name))
+            return JITSymbol(SymAddr, JITSymbolFlags::Exported);
+          return JITSymbol(nullptr);
+        });
+
+    std::vector<std::unique_ptr<Module>> Ms;
+    Ms.push_back(std::move(M));
+    return OptimizeLayer.addModuleSet(std::move(Ms),
+                                      make_unique<SectionMemoryManager>(),
+                                      std::move(Resolver));
+  }
+
+  // Clone of the kernels with the key global turned into a constant.
+  Expected<std::unique_ptr<Module>> specialize(ArrayRef<uint8_t> Key) {
+    std::unique_ptr<Module> M = CloneModule(Kernels.get());
+    GlobalVariable *KeyGV = M->getGlobalVariable(KeyName, true);
+    if (!KeyGV)
+      return make_error<StringError>("no key global " + KeyName,
+                                     inconvertibleErrorCode());
+
+    Type *Ty = KeyGV->getValueType();
+    if (DL.getTypeAllocSize(Ty) != Key.size())
+      return make_error<StringError>(
+          "key of " + Twine(Key.size()) + " bytes for " + KeyName + " of " +
+              Twine(DL.getTypeAllocSize(Ty)) + " bytes",
+          inconvertibleErrorCode());
+    Constant *Init = getKeyConstant(Ty, Key);
+    if (!Init)
+      return make_error<StringError>(KeyName +
+                                         " is not an integer or an array of "
+                                         "integers",
+                                     inconvertibleErrorCode());
+
+    KeyGV->setInitializer(Init);
+    KeyGV->setConstant(true);
+    KeyGV->setLinkage(GlobalValue::InternalLinkage);
+    return std::move(M);
+  }
+
+  Constant *getKeyConstant(Type *Ty, ArrayRef<uint8_t> Bytes) {
+    if (auto *IntTy = dyn_cast<IntegerType>(Ty)) {
+      unsigned Bits = Bytes.size() * 8;
+      APInt Val(Bits, 0);
+      for (unsigned I = 0; I < Bytes.size(); I++) {
+        unsigned Byte = DL.isLittleEndian() ? I : Bytes.size() - 1 - I;
+        Val |= APInt(Bits, Bytes[I]).shl(Byte * 8);
+      }
+      return ConstantInt::get(IntTy, Val.zextOrTrunc(IntTy->getBitWidth()));
+    }
+    if (auto *ArrTy = dyn_cast<ArrayType>(Ty)) {
+      uint64_t EltSize = DL.getTypeAllocSize(ArrTy->getElementType());
+      std::vector<Constant *> Elts;
+      for (uint64_t I = 0; I < ArrTy->getNumElements(); I++) {
+        Constant *Elt = getKeyConstant(ArrTy->getElementType(),
+                                       Bytes.slice(I * EltSize, EltSize));
+        if (!Elt)
+          return nullptr;
+        Elts.push_back(Elt);
+      }
+      return ConstantArray::get(ArrTy, Elts);
+    }
+    return nullptr;
+  }
+
+  std::unique_ptr<Module> optimizeModule(std::unique_ptr<Module> M) {
+    legacy::PassManager PM;
+
+    // Forward the constant key into the loads, then fold the broadcasts of
+    // its bits and the XORs with all-zeros and all-ones slices.
+    PM.add(createSROAPass());
+    PM.add(createGlobalOptimizerPass());
+    PM.add(createSCCPPass());
+    PM.add(createInstructionCombiningPass());
+    PM.add(createGVNPass());
+    PM.add(createDeadStoreEliminationPass());
+    PM.add(createCFGSimplificationPass());
+    PM.add(createInstructionCombiningPass());
+    PM.run(*M);
+
+    return M;
+  }
+};
+
+} // end namespace orc
+} // end namespace llvm
+
+#endif // LLVM_EXAMPLES_BITSLICEDJIT_BITSLICEDJIT_H
@@ -44,15 +44,43 @@ class Output;
 /// (opaquely) owns and manages the core "global" data of LLVM's core
 /// infrastructure, including the type and constant uniquing tables.
 /// LLVMContext itself provides no locking guarantees, so you should be careful
-/// to have one context per thread.
+/// to have one context per thread, unless it is created Concurrent.
 class LLVMContext {
 public:
   LLVMContextImpl *const pImpl;
+
+  /// How the threads may share a context.
+  enum ConcurrencyMode {
+    /// One thread at a time. Nothing is locked.
+    SingleThreaded,
+    /// Several threads at once, each on modules of its own. Types and
+    /// constants are uniqued in maps split into locked shards, metadata
+    /// behind one recursive lock, and value handles, metadata attachments,
+    /// attributes, block addresses and metadata kinds behind locks of their
+    /// own.
+    ///
+    /// The values that the threads share, see Value::isSharedByThreads, keep
+    /// no use list: they look unused, replaceAllUsesWith() does not find their
+    /// users, and destroyConstant() leaves them to be freed with the context.
+    /// All other values, globals and the constants that refer to them
+    /// included, belong to one module and only its thread may use them.
+    ///
+    /// The diagnostic and yield callbacks, the discarding of value names and
+    /// OptBisect are set before the threads start and then only read; the
+    /// diagnostic handler may be called by any thread. The garbage collector
+    /// names of functions still take one thread at a time.
+    Concurrent
+  };
+
   LLVMContext();
+  explicit LLVMContext(ConcurrencyMode Mode);
   LLVMContext(LLVMContext &) = delete;
   LLVMContext &operator=(const LLVMContext &) = delete;
   ~LLVMContext();
 
+  /// Whether the context was created Concurrent.
+  bool isConcurrent() const;
+
   // Pinned metadata names, which always have the same value.  This is a
   // compile-time performance optimization, not a correctness optimization.
   enum {
@@ -147,8 +147,15 @@ private:
     *List = this;
   }
 
+  /// Leave the use out of the use list of its value, which keeps none. See
+  /// Value::isSharedByThreads.
+  void setUntracked() { setPrev(nullptr); }
+  bool isTracked() const { return Prev.getPointer(); }
+
   void removeFromList() {
     Use **StrippedPrev = Prev.getPointer();
+    if (!StrippedPrev)
+      return;
     *StrippedPrev = Next;
     if (Next)
       Next->setPrev(StrippedPrev);
@@ -412,7 +412,23 @@ public:
   unsigned getNumUses() const;
 
   /// \brief This method should only be used by the Use class.
-  void addUse(Use &U) { U.addToList(&UseList); }
+  void addUse(Use &U) {
+    if (SubclassID >= ConstantExprVal && SubclassID <= InlineAsmVal &&
+        isSharedByThreads())
+      return U.setUntracked();
+    U.addToList(&UseList);
+  }
+
+  /// \brief Return true if this value is shared by the threads of a
+  /// concurrent LLVMContext.
+  ///
+  /// Constant data and inline asm, and the constant expressions, aggregates
+  /// and metadata values made only of them, are uniqued by the context without
+  /// belonging to any module. In a concurrent context they keep no use list:
+  /// use_empty() holds, users() is empty and replaceAllUsesWith() replaces
+  /// nothing, and they are freed with the context. See
+  /// LLVMContext::Concurrent.
+  bool isSharedByThreads() const;
 
   /// \brief Concrete subclass of this.
   ///
@@ -47,7 +47,7 @@ protected:
   ValueHandleBase(HandleBaseKind Kind, const ValueHandleBase &RHS)
       : PrevPair(nullptr, Kind), Next(nullptr), V(RHS.V) {
     if (isValid(V))
-      AddToExistingUseList(RHS.getPrevPtr());
+      AddToUseListOf(RHS);
   }
 
 private:
@@ -82,7 +82,7 @@ public:
     if (V == RHS.V) return RHS.V;
     if (isValid(V)) RemoveFromUseList();
     V = RHS.V;
-    if (isValid(V)) AddToExistingUseList(RHS.getPrevPtr());
+    if (isValid(V)) AddToUseListOf(RHS);
     return V;
   }
 
@@ -129,6 +129,9 @@ private:
 
   /// \brief Add this ValueHandle to the use list for V.
   void AddToUseList();
+
+  /// \brief Add this ValueHandle to the use list of RHS, which watches V too.
+  void AddToUseListOf(const ValueHandleBase &RHS);
 };
 
 /// \brief Value handle that is nullable, but tries to track the Value.
@@ -0,0 +1,215 @@
+//===- llvm/Support/Parallel.h - Parallel algorithms ------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines chunked parallel algorithms over random-access ranges,
+// running on a ThreadPool shared by the whole process.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_SUPPORT_PARALLEL_H
+#define LLVM_SUPPORT_PARALLEL_H
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/ThreadPool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+namespace llvm {
+namespace parallel {
+
+/// How a parallel algorithm may schedule and combine its chunks.
+enum class Order {
+  /// Chunks are cut by number of threads and run in any order.
+  Any,
+  /// Chunks are cut by size only and reductions combine their results in the
+  /// order of the range: the result does not depend on the number of threads
+  /// or on timing, even for an operation that is not associative.
+  Deterministic,
+  /// Everything runs in the order of the range on the calling thread.
+  Sequential
+};
+
+/// The pool the algorithms run on, created with one thread per hardware
+/// thread on first use.
+ThreadPool &getDefaultPool();
+
+namespace detail {
+
+/// Elements per chunk when they are cut by size only.
+const size_t DeterministicChunkSize = 1024;
+
+/// Chunks per thread when they are cut by number of threads, so that stealing
+/// can even out chunks of uneven cost.
+const size_t ChunksPerThread = 4;
+
+inline size_t getChunkSize(size_t NumElements, Order O, size_t ChunkSize) {
+  if (ChunkSize)
+    return ChunkSize;
+  if (O == Order::Deterministic)
+    return DeterministicChunkSize;
+  size_t Chunks = std::max<size_t>(getDefaultPool().getThreadCount(), 1) *
+                  ChunksPerThread;
+  return std::max<size_t>((NumElements + Chunks - 1) / Chunks, 1);
+}
+
+/// Run Fn(I) for the chunk indices I of [0, NumChunks): the first chunk on the
+/// calling thread, the others on the pool. Waiting helps with queued work, so
+/// this can be called from a task of the pool.
+template <class FuncTy> void forEachChunk(size_t NumChunks, FuncTy Fn) {
+  if (NumChunks == 0)
+    return;
+  ThreadPool &Pool = getDefaultPool();
+  std::vector<std::shared_future<ThreadPool::VoidTy>> Futures;
+  Futures.reserve(NumChunks - 1);
+  for (size_t I = 1; I < NumChunks; ++I)
+    Futures.push_back(Pool.async([&Fn, I] { Fn(I); }));
+  Fn(0);
+  for (auto &F : Futures)
+    Pool.waitFor(F);
+}
+
+template <class RandomAccessIterator, class Comparator>
+void parallelQuickSort(RandomAccessIterator Start, RandomAccessIterator End,
+                       const Comparator &Comp, unsigned Depth) {
+  // Below this size, or once the partitions turn out unbalanced, the
+  // sequential sort is faster.
+  const ptrdiff_t MinParallelSize = 1024;
+  if (End - Start < MinParallelSize || Depth == 0) {
+    std::sort(Start, End, Comp);
+    return;
+  }
+
+  // Median of three as the pivot, moved out of the way to the end.
+  RandomAccessIterator Mid = Start + (End - Start) / 2;
+  if (Comp(*Mid, *Start))
+    std::iter_swap(Start, Mid);
+  if (Comp(*(End - 1), *Start))
+    std::iter_swap(Start, End - 1);
+  if (Comp(*Mid, *(End - 1)))
+    std::iter_swap(Mid, End - 1);
+  auto &Pivot = *(End - 1);
+  RandomAccessIterator Split = std::partition(
+      Start, End - 1,
+      [&Comp, &Pivot](decltype(Pivot) V) { return Comp(V, Pivot); });
+  std::iter_swap(Split, End - 1);
+
+  ThreadPool &Pool = getDefaultPool();
+  auto Left = Pool.async([=, &Comp] {
+    parallelQuickSort(Start, Split, Comp, Depth - 1);
+  });
+  parallelQuickSort(Split + 1, End, Comp, Depth - 1);
+  Pool.waitFor(Left);
+}
+
+} // namespace detail
+
+/// Call \p Fn on every element of [Begin, End), in chunks of \p ChunkSize
+/// elements, or of a size picked by \p O if it is 0.
+template <class RandomAccessIterator, class FuncTy>
+void parallel_for_each(RandomAccessIterator Begin, RandomAccessIterator End,
+                       FuncTy Fn, Order O = Order::Any, size_t ChunkSize = 0) {
+  size_t NumElements = std::distance(Begin, End);
+  if (O == Order::Sequential || NumElements < 2) {
+    std::for_each(Begin, End, Fn);
+    return;
+  }
+  size_t Chunk = detail::getChunkSize(NumElements, O, ChunkSize);
+  detail::forEachChunk((NumElements + Chunk - 1) / Chunk, [&](size_t I) {
+    RandomAccessIterator ChunkBegin = Begin + I * Chunk;
+    std::for_each(ChunkBegin,
+                  ChunkBegin + std::min(Chunk, NumElements - I * Chunk), Fn);
+  });
+}
+
+/// Call \p Fn on every index of [Begin, End).
+template <class IndexTy, class FuncTy>
+void parallel_for_each_n(IndexTy Begin, IndexTy End, FuncTy Fn,
+                         Order O = Order::Any, size_t ChunkSize = 0) {
+  if (Begin >= End)
+    return;
+  size_t NumElements = End - Begin;
+  if (O == Order::Sequential) {
+    for (IndexTy I = Begin; I != End; ++I)
+      Fn(I);
+    return;
+  }
+  size_t Chunk = detail::getChunkSize(NumElements, O, ChunkSize);
+  detail::forEachChunk((NumElements + Chunk - 1) / Chunk, [&](size_t C) {
+    IndexTy ChunkBegin = Begin + C * Chunk;
+    IndexTy ChunkEnd = ChunkBegin + std::min(Chunk, NumElements - C * Chunk);
+    for (IndexTy I = ChunkBegin; I != ChunkEnd; ++I)
+      Fn(I);
+  });
+}
+
+/// Sort [Start, End) with \p Comp. The partitions are split the same way
+/// whatever the number of threads, so the resulting order of equivalent
+/// elements only depends on the input; pass Order::Sequential to use
+/// std::sort instead.
+template <class RandomAccessIterator,
+          class Comparator = std::less<
+              typename std::iterator_traits<RandomAccessIterator>::value_type>>
+void parallel_sort(RandomAccessIterator Start, RandomAccessIterator End,
+                   const Comparator &Comp = Comparator(),
+                   Order O = Order::Any) {
+  if (O == Order::Sequential) {
+    std::sort(Start, End, Comp);
+    return;
+  }
+  detail::parallelQuickSort(Start, End, Comp,
+                            Log2_64(std::max<size_t>(End - Start, 1)) * 2);
+}
+
+/// Reduce the \p Transform of the elements of [Begin, End) with \p Reduce,
+/// starting from \p Init. \p Reduce must be associative: every chunk is reduced
+/// on its own and the chunk results are then reduced in order. With
+/// Order::Deterministic the result is the same on any machine; with
+/// Order::Any the chunks, and so the grouping of the operands, follow the
+/// number of threads.
+template <class RandomAccessIterator, class T, class ReduceFuncTy,
+          class TransformFuncTy>
+T parallel_transform_reduce(RandomAccessIterator Begin,
+                            RandomAccessIterator End, T Init,
+                            ReduceFuncTy Reduce, TransformFuncTy Transform,
+                            Order O = Order::Any, size_t ChunkSize = 0) {
+  size_t NumElements = std::distance(Begin, End);
+  if (O == Order::Sequential) {
+    for (; Begin != End; ++Begin)
+      Init = Reduce(Init, Transform(*Begin));
+    return Init;
+  }
+  size_t Chunk = detail::getChunkSize(NumElements, O, ChunkSize);
+  size_t NumChunks = (NumElements + Chunk - 1) / Chunk;
+  // One result per chunk, combined in order once all are done. The results
+  // are kept apart so that writing one does not race with its neighbours,
+  // which a vector<bool> would not guarantee.
+  std::vector<Optional<T>> Results(NumChunks);
+  detail::forEachChunk(NumChunks, [&](size_t I) {
+    RandomAccessIterator It = Begin + I * Chunk;
+    RandomAccessIterator ChunkEnd = It + std::min(Chunk, NumElements - I * Chunk);
+    T R = Transform(*It);
+    for (++It; It != ChunkEnd; ++It)
+      R = Reduce(R, Transform(*It));
+    Results[I] = std::move(R);
+  });
+  T R = Init;
+  for (size_t I = 0; I < NumChunks; ++I)
+    R = Reduce(R, std::move(*Results[I]));
+  return R;
+}
+
+} // namespace parallel
+} // namespace llvm
+
+#endif // LLVM_SUPPORT_PARALLEL_H
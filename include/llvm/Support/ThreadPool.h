@@ -7,7 +7,7 @@
 //
 //===----------------------------------------------------------------------===//
 //
-// This file defines a crude C++11 based thread pool.
+// This file defines a work-stealing C++11 based thread pool.
 //
 //===----------------------------------------------------------------------===//
 
@@ -20,19 +20,133 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <cstddef>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 namespace llvm {
 
+/// Order in which queued tasks are picked: every queued High task runs before
+/// any Normal one, and every Normal task before any Low one.
+enum class TaskPriority { High = 0, Normal = 1, Low = 2 };
+
+/// A move-only nullary callable. Callables of up to InlineSize bytes are
+/// stored in place, so that queuing a small task does not allocate; larger
+/// ones are moved to the heap.
+class ThreadPoolTask {
+public:
+  static const size_t InlineSize = 6 * sizeof(void *);
+
+  ThreadPoolTask() = default;
+
+  template <typename Callable,
+            typename = typename std::enable_if<!std::is_same<
+                typename std::decay<Callable>::type, ThreadPoolTask>::value>::type>
+  ThreadPoolTask(Callable &&F) {
+    using T = typename std::decay<Callable>::type;
+    Callbacks = &CallbacksFor<T>::Table;
+    CallbacksFor<T>::construct(&Storage, std::forward<Callable>(F));
+  }
+
+  ThreadPoolTask(ThreadPoolTask &&Other) : Callbacks(Other.Callbacks) {
+    if (Callbacks)
+      Callbacks->Move(&Storage, &Other.Storage);
+    Other.Callbacks = nullptr;
+  }
+
+  ThreadPoolTask &operator=(ThreadPoolTask &&Other) {
+    if (this != &Other) {
+      reset();
+      Callbacks = Other.Callbacks;
+      if (Callbacks)
+        Callbacks->Move(&Storage, &Other.Storage);
+      Other.Callbacks = nullptr;
+    }
+    return *this;
+  }
+
+  ThreadPoolTask(const ThreadPoolTask &) = delete;
+  ThreadPoolTask &operator=(const ThreadPoolTask &) = delete;
+
+  ~ThreadPoolTask() { reset(); }
+
+  explicit operator bool() const { return Callbacks != nullptr; }
+
+  void operator()() { Callbacks->Call(&Storage); }
+
+private:
+  using StorageTy =
+      typename std::aligned_storage<InlineSize, alignof(void *)>::type;
+
+  struct CallbackTable {
+    void (*Call)(void *Storage);
+    void (*Move)(void *Dst, void *Src);
+    void (*Destroy)(void *Storage);
+  };
+
+  template <typename T,
+            bool Inline = sizeof(T) <= InlineSize &&
+                          alignof(T) <= alignof(StorageTy) &&
+                          std::is_nothrow_move_constructible<T>::value>
+  struct CallbacksFor {
+    template <typename Callable> static void construct(void *S, Callable &&F) {
+      new (S) T(std::forward<Callable>(F));
+    }
+    static void call(void *S) { (*static_cast<T *>(S))(); }
+    static void move(void *Dst, void *Src) {
+      new (Dst) T(std::move(*static_cast<T *>(Src)));
+      static_cast<T *>(Src)->~T();
+    }
+    static void destroy(void *S) { static_cast<T *>(S)->~T(); }
+    static const CallbackTable Table;
+  };
+
+  template <typename T> struct CallbacksFor<T, false> {
+    template <typename Callable> static void construct(void *S, Callable &&F) {
+      *static_cast<T **>(S) = new T(std::forward<Callable>(F));
+    }
+    static void call(void *S) { (**static_cast<T **>(S))(); }
+    static void move(void *Dst, void *Src) {
+      *static_cast<T **>(Dst) = *static_cast<T **>(Src);
+    }
+    static void destroy(void *S) { delete *static_cast<T **>(S); }
+    static const CallbackTable Table;
+  };
+
+  void reset() {
+    if (Callbacks)
+      Callbacks->Destroy(&Storage);
+    Callbacks = nullptr;
+  }
+
+  StorageTy Storage;
+  const CallbackTable *Callbacks = nullptr;
+};
+
+template <typename T, bool Inline>
+const ThreadPoolTask::CallbackTable ThreadPoolTask::CallbacksFor<T, Inline>::Table = {
+    &CallbacksFor<T, Inline>::call, &CallbacksFor<T, Inline>::move,
+    &CallbacksFor<T, Inline>::destroy};
+
+template <typename T>
+const ThreadPoolTask::CallbackTable ThreadPoolTask::CallbacksFor<T, false>::Table = {
+    &CallbacksFor<T, false>::call, &CallbacksFor<T, false>::move,
+    &CallbacksFor<T, false>::destroy};
+
 /// A ThreadPool for asynchronous parallel execution on a defined number of
 /// threads.
 ///
-/// The pool keeps a vector of threads alive, waiting on a condition variable
-/// for some work to become available.
+/// Every thread owns a queue of tasks per priority, each behind its own lock.
+/// Tasks submitted from outside the pool are spread over the queues round
+/// robin; tasks submitted by a task go to the front of the queue of its
+/// thread. A thread that runs out of work steals from the queues of the
+/// others before going to sleep, and threads blocked in wait() or waitFor()
+/// run queued tasks instead of idling.
 class ThreadPool {
 public:
 #ifndef _MSC_VER
@@ -64,14 +178,14 @@ public:
     auto Task =
         std::bind(std::forward<Function>(F), std::forward<Args>(ArgList)...);
 #ifndef _MSC_VER
-    return asyncImpl(std::move(Task));
+    return asyncImpl(std::move(Task), TaskPriority::Normal);
 #else
     // This lambda has to be marked mutable because MSVC 2013's std::bind call
     // operator isn't const qualified.
     return asyncImpl([Task](VoidTy) mutable -> VoidTy {
       Task();
       return VoidTy();
-    });
+    }, TaskPriority::Normal);
 #endif
   }
 
@@ -79,39 +193,96 @@ public:
   /// used to wait for the task to finish and is *non-blocking* on destruction.
   template <typename Function>
   inline std::shared_future<VoidTy> async(Function &&F) {
+    return asyncWithPriority(TaskPriority::Normal, std::forward<Function>(F));
+  }
+
+  /// Asynchronous submission of a task to the pool, picked before or after the
+  /// tasks of other priorities.
+  template <typename Function>
+  inline std::shared_future<VoidTy> asyncWithPriority(TaskPriority Priority,
+                                                     Function &&F) {
 #ifndef _MSC_VER
-    return asyncImpl(std::forward<Function>(F));
+    return asyncImpl(std::forward<Function>(F), Priority);
 #else
-    return asyncImpl([F] (VoidTy) -> VoidTy { F(); return VoidTy(); });
+    return asyncImpl([F] (VoidTy) -> VoidTy { F(); return VoidTy(); },
+                     Priority);
 #endif
   }
 
+  /// Submission of a task nobody waits for individually: there is no future,
+  /// and no allocation when \p F fits in a ThreadPoolTask. wait() covers it.
+  template <typename Function>
+  inline void spawn(Function &&F,
+                    TaskPriority Priority = TaskPriority::Normal) {
+    enqueue(ThreadPoolTask(std::forward<Function>(F)), Priority);
+  }
+
   /// Blocking wait for all the threads to complete and the queue to be empty.
-  /// It is an error to try to add new tasks while blocking on this call.
+  /// The calling thread runs queued tasks while it waits. It is an error to
+  /// call it from a task of the pool, use waitFor() to wait for nested tasks.
   void wait();
 
+  /// Wait for \p Future, running queued tasks meanwhile. This is how a task
+  /// waits for the tasks it submitted without keeping a thread of the pool
+  /// blocked.
+  void waitFor(const std::shared_future<VoidTy> &Future);
+
+  /// Number of threads of the pool, not counting the ones helping in wait().
+  unsigned getThreadCount() const { return Threads.size(); }
+
 private:
+  static const unsigned NumPriorities = 3;
+
+  /// The queues of tasks of one thread, one per priority.
+  struct WorkerQueue {
+    WorkerQueue() : Queued(0) {}
+    std::mutex Lock;
+    std::deque<ThreadPoolTask> Tasks[NumPriorities];
+    /// Tasks of all priorities, read without the lock to skip empty queues.
+    std::atomic<unsigned> Queued;
+  };
+
   /// Asynchronous submission of a task to the pool. The returned future can be
   /// used to wait for the task to finish and is *non-blocking* on destruction.
-  std::shared_future<VoidTy> asyncImpl(TaskTy F);
+  std::shared_future<VoidTy> asyncImpl(TaskTy F, TaskPriority Priority);
+
+  /// Queue a task and wake up a sleeping thread if any.
+  void enqueue(ThreadPoolTask Task, TaskPriority Priority);
+
+  /// Pop a task of the highest priority available, from the queue of \p Self
+  /// first and then from the others. Returns false if none is queued.
+  bool popTask(unsigned Self, ThreadPoolTask &Task);
+
+  /// Run a queued task on the calling thread, returns false if none is queued.
+  bool runQueuedTask();
+
+  /// Run \p Task and signal its completion.
+  void runTask(ThreadPoolTask &Task);
 
   /// Threads in flight
   std::vector<llvm::thread> Threads;
 
-  /// Tasks waiting for execution in the pool.
-  std::queue<PackagedTaskTy> Tasks;
+  /// Tasks waiting for execution, one set of queues per thread.
+  std::vector<std::unique_ptr<WorkerQueue>> Queues;
+
+  /// Next queue for the tasks submitted from outside the pool.
+  std::atomic<unsigned> NextQueue;
+
+  /// Tasks queued and not picked yet.
+  std::atomic<int> PendingTasks;
 
-  /// Locking and signaling for accessing the Tasks queue.
-  std::mutex QueueLock;
-  std::condition_variable QueueCondition;
+  /// Tasks submitted and not completed yet.
+  std::atomic<unsigned> OutstandingTasks;
+
+  /// Locking and signaling for the threads sleeping until work is queued.
+  std::atomic<unsigned> SleepingThreads;
+  std::mutex SleepLock;
+  std::condition_variable SleepCondition;
 
   /// Locking and signaling for job completion
   std::mutex CompletionLock;
   std::condition_variable CompletionCondition;
 
-  /// Keep track of the number of thread actually busy
-  std::atomic<unsigned> ActiveThreads;
-
 #if LLVM_ENABLE_THREADS // avoids warning for unused variable
   /// Signal for the destruction of the pool, asking thread to exit.
   bool EnableFlag;
@@ -83,6 +83,7 @@ Attribute Attribute::get(LLVMContext &Context, Attribute::AttrKind Kind,
   ID.AddInteger(Kind);
   if (Val) ID.AddInteger(Val);
 
+  auto AttrLock = pImpl->lockAttributes();
   void *InsertPoint;
   AttributeImpl *PA = pImpl->AttrsSet.FindNodeOrInsertPos(ID, InsertPoint);
 
@@ -106,6 +107,7 @@ Attribute Attribute::get(LLVMContext &Context, StringRef Kind, StringRef Val) {
   ID.AddString(Kind);
   if (!Val.empty()) ID.AddString(Val);
 
+  auto AttrLock = pImpl->lockAttributes();
   void *InsertPoint;
   AttributeImpl *PA = pImpl->AttrsSet.FindNodeOrInsertPos(ID, InsertPoint);
 
@@ -586,6 +588,7 @@ AttributeSetNode *AttributeSetNode::get(LLVMContext &C,
   for (Attribute Attr : SortedAttrs)
     Attr.Profile(ID);
 
+  auto AttrLock = pImpl->lockAttributes();
   void *InsertPoint;
   AttributeSetNode *PA =
     pImpl->AttrsSetNodes.FindNodeOrInsertPos(ID, InsertPoint);
@@ -791,6 +794,7 @@ AttributeList AttributeList::getImpl(
   FoldingSetNodeID ID;
   AttributeListImpl::Profile(ID, Attrs);
 
+  auto AttrLock = pImpl->lockAttributes();
   void *InsertPoint;
   AttributeListImpl *PA =
       pImpl->AttrsLists.FindNodeOrInsertPos(ID, InsertPoint);
@@ -286,6 +286,11 @@ Constant *Constant::getAggregateElement(Constant *Elt) const {
 }
 
 void Constant::destroyConstant() {
+  // Other threads can start using a shared constant at any time, it is freed
+  // with the context instead.
+  if (isSharedByThreads())
+    return;
+
   /// First call destroyConstantImpl on the subclass.  This gives the subclass
   /// a chance to remove the constant from any maps/pools it's contained in.
   switch (getValueID()) {
@@ -537,7 +542,8 @@ Constant *ConstantInt::getFalse(Type *Ty) {
 ConstantInt *ConstantInt::get(LLVMContext &Context, const APInt &V) {
   // get an existing value or the insertion position
   LLVMContextImpl *pImpl = Context.pImpl;
-  std::unique_ptr<ConstantInt> &Slot = pImpl->IntConstants[V];
+  auto Shard = pImpl->IntConstants.lock(DenseMapAPIntKeyInfo::getHashValue(V));
+  std::unique_ptr<ConstantInt> &Slot = (*Shard)[V];
   if (!Slot) {
     // Get the corresponding integer type for the bit width of the value.
     IntegerType *ITy = IntegerType::get(Context, V.getBitWidth());
@@ -677,7 +683,8 @@ Constant *ConstantFP::getZeroValueForNegation(Type *Ty) {
 ConstantFP* ConstantFP::get(LLVMContext &Context, const APFloat& V) {
   LLVMContextImpl* pImpl = Context.pImpl;
 
-  std::unique_ptr<ConstantFP> &Slot = pImpl->FPConstants[V];
+  auto Shard = pImpl->FPConstants.lock(DenseMapAPFloatKeyInfo::getHashValue(V));
+  std::unique_ptr<ConstantFP> &Slot = (*Shard)[V];
 
   if (!Slot) {
     Type *Ty;
@@ -1247,8 +1254,9 @@ ConstantAggregateZero *ConstantAggregateZero::get(Type *Ty) {
   assert((Ty->isStructTy() || Ty->isArrayTy() || Ty->isVectorTy()) &&
          "Cannot create an aggregate zero of non-aggregate type!");
 
-  std::unique_ptr<ConstantAggregateZero> &Entry =
-      Ty->getContext().pImpl->CAZConstants[Ty];
+  auto Shard = Ty->getContext().pImpl->CAZConstants.lock(
+      DenseMapInfo<Type *>::getHashValue(Ty));
+  std::unique_ptr<ConstantAggregateZero> &Entry = (*Shard)[Ty];
   if (!Entry)
     Entry.reset(new ConstantAggregateZero(Ty));
 
@@ -1257,7 +1265,9 @@ ConstantAggregateZero *ConstantAggregateZero::get(Type *Ty) {
 
 /// Remove the constant from the constant table.
 void ConstantAggregateZero::destroyConstantImpl() {
-  getContext().pImpl->CAZConstants.erase(getType());
+  getContext()
+      .pImpl->CAZConstants.lock(DenseMapInfo<Type *>::getHashValue(getType()))
+      ->erase(getType());
 }
 
 /// Remove the constant from the constant table.
@@ -1313,8 +1323,9 @@ const APInt &Constant::getUniqueInteger() const {
 //
 
 ConstantPointerNull *ConstantPointerNull::get(PointerType *Ty) {
-  std::unique_ptr<ConstantPointerNull> &Entry =
-      Ty->getContext().pImpl->CPNConstants[Ty];
+  auto Shard = Ty->getContext().pImpl->CPNConstants.lock(
+      DenseMapInfo<PointerType *>::getHashValue(Ty));
+  std::unique_ptr<ConstantPointerNull> &Entry = (*Shard)[Ty];
   if (!Entry)
     Entry.reset(new ConstantPointerNull(Ty));
 
@@ -1323,11 +1334,16 @@ ConstantPointerNull *ConstantPointerNull::get(PointerType *Ty) {
 
 /// Remove the constant from the constant table.
 void ConstantPointerNull::destroyConstantImpl() {
-  getContext().pImpl->CPNConstants.erase(getType());
+  getContext()
+      .pImpl->CPNConstants
+      .lock(DenseMapInfo<PointerType *>::getHashValue(getType()))
+      ->erase(getType());
 }
 
 UndefValue *UndefValue::get(Type *Ty) {
-  std::unique_ptr<UndefValue> &Entry = Ty->getContext().pImpl->UVConstants[Ty];
+  auto Shard = Ty->getContext().pImpl->UVConstants.lock(
+      DenseMapInfo<Type *>::getHashValue(Ty));
+  std::unique_ptr<UndefValue> &Entry = (*Shard)[Ty];
   if (!Entry)
     Entry.reset(new UndefValue(Ty));
 
@@ -1337,7 +1353,9 @@ UndefValue *UndefValue::get(Type *Ty) {
 /// Remove the constant from the constant table.
 void UndefValue::destroyConstantImpl() {
   // Free the constant and any dangling references to it.
-  getContext().pImpl->UVConstants.erase(getType());
+  getContext()
+      .pImpl->UVConstants.lock(DenseMapInfo<Type *>::getHashValue(getType()))
+      ->erase(getType());
 }
 
 BlockAddress *BlockAddress::get(BasicBlock *BB) {
@@ -1346,6 +1364,7 @@ BlockAddress *BlockAddress::get(BasicBlock *BB) {
 }
 
 BlockAddress *BlockAddress::get(Function *F, BasicBlock *BB) {
+  auto StateLock = F->getContext().pImpl->lockState();
   BlockAddress *&BA =
     F->getContext().pImpl->BlockAddresses[std::make_pair(F, BB)];
   if (!BA)
@@ -1369,6 +1388,7 @@ BlockAddress *BlockAddress::lookup(const BasicBlock *BB) {
 
   const Function *F = BB->getParent();
   assert(F && "Block must have a parent");
+  auto StateLock = F->getContext().pImpl->lockState();
   BlockAddress *BA =
       F->getContext().pImpl->BlockAddresses.lookup(std::make_pair(F, BB));
   assert(BA && "Refcount and block address map disagree!");
@@ -1377,8 +1397,9 @@ BlockAddress *BlockAddress::lookup(const BasicBlock *BB) {
 
 /// Remove the constant from the constant table.
 void BlockAddress::destroyConstantImpl() {
-  getFunction()->getType()->getContext().pImpl
-    ->BlockAddresses.erase(std::make_pair(getFunction(), getBasicBlock()));
+  auto StateLock = getContext().pImpl->lockState();
+  getContext().pImpl->BlockAddresses.erase(
+      std::make_pair(getFunction(), getBasicBlock()));
   getBasicBlock()->AdjustBlockAddressRefCount(-1);
 }
 
@@ -1397,6 +1418,7 @@ Value *BlockAddress::handleOperandChangeImpl(Value *From, Value *To) {
 
   // See if the 'new' entry already exists, if not, just update this in place
   // and return early.
+  auto StateLock = getContext().pImpl->lockState();
   BlockAddress *&NewBA =
     getContext().pImpl->BlockAddresses[std::make_pair(NewF, NewBB)];
   if (NewBA)
@@ -2341,10 +2363,8 @@ Constant *ConstantDataSequential::getImpl(StringRef Elements, Type *Ty) {
     return ConstantAggregateZero::get(Ty);
 
   // Do a lookup to see if we have already formed one of these.
-  auto &Slot =
-      *Ty->getContext()
-           .pImpl->CDSConstants.insert(std::make_pair(Elements, nullptr))
-           .first;
+  auto Shard = Ty->getContext().pImpl->CDSConstants.lock(HashString(Elements));
+  auto &Slot = *Shard->insert(std::make_pair(Elements, nullptr)).first;
 
   // The bucket can point to a linked list of different CDS's that have the same
   // body but different types.  For example, 0,0,0,1 could be a 4 element array
@@ -2367,13 +2387,13 @@ Constant *ConstantDataSequential::getImpl(StringRef Elements, Type *Ty) {
 
 void ConstantDataSequential::destroyConstantImpl() {
   // Remove the constant from the StringMap.
-  StringMap<ConstantDataSequential*> &CDSConstants = 
-    getType()->getContext().pImpl->CDSConstants;
+  auto CDSConstants = getType()->getContext().pImpl->CDSConstants.lock(
+      HashString(getRawDataValues()));
 
   StringMap<ConstantDataSequential*>::iterator Slot =
-    CDSConstants.find(getRawDataValues());
+    CDSConstants->find(getRawDataValues());
 
-  assert(Slot != CDSConstants.end() && "CDS not found in uniquing table");
+  assert(Slot != CDSConstants->end() && "CDS not found in uniquing table");
 
   ConstantDataSequential **Entry = &Slot->getValue();
 
@@ -2382,7 +2402,7 @@ void ConstantDataSequential::destroyConstantImpl() {
     // If there is only one value in the bucket (common case) it must be this
     // entry, and removing the entry should remove the bucket completely.
     assert((*Entry) == this && "Hash mismatch in ConstantDataSequential");
-    getContext().pImpl->CDSConstants.erase(Slot);
+    CDSConstants->erase(Slot);
   } else {
     // Otherwise, there are multiple entries linked off the bucket, unlink the 
     // node we care about but keep the bucket around.
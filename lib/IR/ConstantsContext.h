@@ -15,11 +15,13 @@
 #ifndef LLVM_LIB_IR_CONSTANTSCONTEXT_H
 #define LLVM_LIB_IR_CONSTANTSCONTEXT_H
 
+#include "ShardedMap.h"
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/DenseMapInfo.h"
 #include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/Hashing.h"
 #include "llvm/ADT/None.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/IR/Constants.h"
@@ -646,23 +648,35 @@ public:
   typedef DenseSet<ConstantClass *, MapInfo> MapTy;
 
 private:
-  MapTy Map;
+  ShardedMap<MapTy> Map;
 
 public:
-  typename MapTy::iterator begin() { return Map.begin(); }
-  typename MapTy::iterator end() { return Map.end(); }
+  explicit ConstantUniqueMap(bool Concurrent) : Map(Concurrent) {}
+
+  /// Call \p Fn on every constant of the map, without locking.
+  template <typename FnT> void forEach(FnT Fn) {
+    Map.forEachShard([&](MapTy &Shard) {
+      for (ConstantClass *C : Shard)
+        Fn(C);
+    });
+  }
+
+  /// Call \p Fn on the map of every shard, without locking.
+  template <typename FnT> void forEachShard(FnT Fn) { Map.forEachShard(Fn); }
 
   void freeConstants() {
-    for (auto &I : Map)
-      delete I; // Asserts that use_empty().
+    forEach([](ConstantClass *C) {
+      delete C; // Asserts that use_empty().
+    });
   }
 
 private:
-  ConstantClass *create(TypeClass *Ty, ValType V, LookupKeyHashed &HashKey) {
+  ConstantClass *create(MapTy &Shard, TypeClass *Ty, ValType V,
+                        LookupKeyHashed &HashKey) {
     ConstantClass *Result = V.create(Ty);
 
     assert(Result->getType() == Ty && "Type specified is not correct!");
-    Map.insert_as(Result, HashKey);
+    Shard.insert_as(Result, HashKey);
 
     return Result;
   }
@@ -676,9 +690,10 @@ public:
 
     ConstantClass *Result = nullptr;
 
-    auto I = Map.find_as(Lookup);
-    if (I == Map.end())
-      Result = create(Ty, V, Lookup);
+    auto Shard = Map.lock(Lookup.first);
+    auto I = Shard->find_as(Lookup);
+    if (I == Shard->end())
+      Result = create(*Shard, Ty, V, Lookup);
     else
       Result = *I;
     assert(Result && "Unexpected nullptr");
@@ -688,27 +703,41 @@ public:
 
   /// Remove this constant from the map
   void remove(ConstantClass *CP) {
-    typename MapTy::iterator I = Map.find(CP);
-    assert(I != Map.end() && "Constant not found in constant table!");
+    auto Shard = Map.lock(MapInfo::getHashValue(CP));
+    typename MapTy::iterator I = Shard->find(CP);
+    assert(I != Shard->end() && "Constant not found in constant table!");
     assert(*I == CP && "Didn't find correct element?");
-    Map.erase(I);
+    Shard->erase(I);
   }
 
   ConstantClass *replaceOperandsInPlace(ArrayRef<Constant *> Operands,
                                         ConstantClass *CP, Value *From,
                                         Constant *To, unsigned NumUpdated = 0,
                                         unsigned OperandNo = ~0u) {
+    // Updated in place, a constant made only of shared operands would be
+    // shared by the threads with its users still tracked. Give the caller a
+    // new one to replace it with instead.
+    if (Map.isConcurrent() &&
+        all_of(Operands, [](Constant *C) { return C->isSharedByThreads(); }))
+      return getOrCreate(CP->getType(), ValType(Operands, CP));
+
     LookupKey Key(CP->getType(), ValType(Operands, CP));
     /// Hash once, and reuse it for the lookup and the insertion if needed.
     LookupKeyHashed Lookup(MapInfo::getHashValue(Key), Key);
 
-    auto I = Map.find_as(Lookup);
-    if (I != Map.end())
+    // The constant moves from the shard of its old operands to the one of its
+    // new operands, both stay locked until it is there.
+    auto Shards = Map.lock(MapInfo::getHashValue(CP), Lookup.first);
+    MapTy &OldShard = *Shards.first, &NewShard = *Shards.second;
+    auto I = NewShard.find_as(Lookup);
+    if (I != NewShard.end())
       return *I;
 
     // Update to the new value.  Optimize for the case when we have a single
     // operand that we're changing, but handle bulk updates efficiently.
-    remove(CP);
+    auto Old = OldShard.find(CP);
+    assert(Old != OldShard.end() && "Constant not found in constant table!");
+    OldShard.erase(Old);
     if (NumUpdated == 1) {
       assert(OperandNo < CP->getNumOperands() && "Invalid index");
       assert(CP->getOperand(OperandNo) != To && "I didn't contain From!");
@@ -718,7 +747,7 @@ public:
         if (CP->getOperand(I) == From)
           CP->setOperand(I, To);
     }
-    Map.insert_as(CP, Lookup);
+    NewShard.insert_as(CP, Lookup);
     return nullptr;
   }
 
@@ -32,7 +32,10 @@
 
 using namespace llvm;
 
-LLVMContext::LLVMContext() : pImpl(new LLVMContextImpl(*this)) {
+LLVMContext::LLVMContext() : LLVMContext(SingleThreaded) {}
+
+LLVMContext::LLVMContext(ConcurrencyMode Mode)
+    : pImpl(new LLVMContextImpl(*this, Mode == Concurrent)) {
   // Create the fixed metadata kinds. This is done in the same order as the
   // MD_* enum values so that they correspond.
   std::pair<unsigned, StringRef> MDKinds[] = {
@@ -81,15 +84,27 @@ LLVMContext::LLVMContext() : pImpl(new LLVMContextImpl(*this)) {
   assert(GCTransitionEntry->second == LLVMContext::OB_gc_transition &&
          "gc-transition operand bundle id drifted!");
   (void)GCTransitionEntry;
+
+  if (Mode == Concurrent) {
+    // The constants cached outside of the uniquing maps are created here, so
+    // that the threads only ever read them.
+    ConstantInt::getTrue(*this);
+    ConstantInt::getFalse(*this);
+    ConstantTokenNone::get(*this);
+  }
 }
 
 LLVMContext::~LLVMContext() { delete pImpl; }
 
+bool LLVMContext::isConcurrent() const { return pImpl->Concurrent; }
+
 void LLVMContext::addModule(Module *M) {
+  auto StateLock = pImpl->lockState();
   pImpl->OwnedModules.insert(M);
 }
 
 void LLVMContext::removeModule(Module *M) {
+  auto StateLock = pImpl->lockState();
   pImpl->OwnedModules.erase(M);
 }
 
@@ -224,6 +239,7 @@ void LLVMContext::emitError(unsigned LocCookie, const Twine &ErrorStr) {
 
 /// Return a unique non-zero ID for the specified metadata kind.
 unsigned LLVMContext::getMDKindID(StringRef Name) const {
+  auto StateLock = pImpl->lockState();
   // If this is new, assign it its ID.
   return pImpl->CustomMDKindNames.insert(
                                      std::make_pair(
@@ -234,6 +250,7 @@ unsigned LLVMContext::getMDKindID(StringRef Name) const {
 /// getHandlerNames - Populate client-supplied smallvector using custom
 /// metadata name and ID.
 void LLVMContext::getMDKindNames(SmallVectorImpl<StringRef> &Names) const {
+  auto StateLock = pImpl->lockState();
   Names.resize(pImpl->CustomMDKindNames.size());
   for (StringMap<unsigned>::const_iterator I = pImpl->CustomMDKindNames.begin(),
        E = pImpl->CustomMDKindNames.end(); I != E; ++I)
@@ -21,8 +21,17 @@
 #include <algorithm>
 using namespace llvm;
 
-LLVMContextImpl::LLVMContextImpl(LLVMContext &C)
-  : TheTrueVal(nullptr), TheFalseVal(nullptr),
+LLVMContextImpl::LLVMContextImpl(LLVMContext &C, bool Concurrent)
+  : Concurrent(Concurrent),
+    IntConstants(Concurrent), FPConstants(Concurrent),
+    MDStringCache(Concurrent),
+    CAZConstants(Concurrent),
+    ArrayConstants(Concurrent), StructConstants(Concurrent),
+    VectorConstants(Concurrent),
+    CPNConstants(Concurrent), UVConstants(Concurrent),
+    CDSConstants(Concurrent),
+    ExprConstants(Concurrent), InlineAsms(Concurrent),
+    TheTrueVal(nullptr), TheFalseVal(nullptr),
     VoidTy(C, Type::VoidTyID),
     LabelTy(C, Type::LabelTyID),
     HalfTy(C, Type::HalfTyID),
@@ -39,7 +48,11 @@ LLVMContextImpl::LLVMContextImpl(LLVMContext &C)
     Int16Ty(C, 16),
     Int32Ty(C, 32),
     Int64Ty(C, 64),
-    Int128Ty(C, 128) {
+    Int128Ty(C, 128),
+    IntegerTypes(Concurrent), FunctionTypes(Concurrent),
+    AnonStructTypes(Concurrent), ArrayTypes(Concurrent),
+    VectorTypes(Concurrent), PointerTypes(Concurrent),
+    ASPointerTypes(Concurrent) {
   InlineAsmDiagHandler = nullptr;
   InlineAsmDiagContext = nullptr;
   DiagnosticHandler = nullptr;
@@ -82,14 +95,10 @@ LLVMContextImpl::~LLVMContextImpl() {
 #include "llvm/IR/Metadata.def"
 
   // Free the constants.
-  for (auto *I : ExprConstants)
-    I->dropAllReferences();
-  for (auto *I : ArrayConstants)
-    I->dropAllReferences();
-  for (auto *I : StructConstants)
-    I->dropAllReferences();
-  for (auto *I : VectorConstants)
-    I->dropAllReferences();
+  ExprConstants.forEach([](ConstantExpr *C) { C->dropAllReferences(); });
+  ArrayConstants.forEach([](ConstantArray *C) { C->dropAllReferences(); });
+  StructConstants.forEach([](ConstantStruct *C) { C->dropAllReferences(); });
+  VectorConstants.forEach([](ConstantVector *C) { C->dropAllReferences(); });
   ExprConstants.freeConstants();
   ArrayConstants.freeConstants();
   StructConstants.freeConstants();
@@ -102,8 +111,10 @@ LLVMContextImpl::~LLVMContextImpl() {
   IntConstants.clear();
   FPConstants.clear();
 
-  for (auto &CDSConstant : CDSConstants)
-    delete CDSConstant.second;
+  CDSConstants.forEachShard([](CDSMapTy &Map) {
+    for (auto &CDSConstant : Map)
+      delete CDSConstant.second;
+  });
   CDSConstants.clear();
 
   // Destroy attributes.
@@ -145,16 +156,24 @@ LLVMContextImpl::~LLVMContextImpl() {
 }
 
 void LLVMContextImpl::dropTriviallyDeadConstantArrays() {
+  // The arrays of the other threads can't be told from ours, nor the shared
+  // ones destroyed: they are all freed with the context.
+  if (Concurrent)
+    return;
+
   bool Changed;
   do {
     Changed = false;
 
-    for (auto I = ArrayConstants.begin(), E = ArrayConstants.end(); I != E;) {
-      auto *C = *I++;
-      if (C->use_empty()) {
-        Changed = true;
-        C->destroyConstant();
-      }
+    // Destroying a constant erases it from its shard, so walk a copy.
+    std::vector<ConstantArray *> Dead;
+    ArrayConstants.forEach([&](ConstantArray *C) {
+      if (C->use_empty())
+        Dead.push_back(C);
+    });
+    for (ConstantArray *C : Dead) {
+      Changed = true;
+      C->destroyConstant();
     }
 
   } while (Changed);
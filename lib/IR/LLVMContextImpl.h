@@ -17,6 +17,7 @@
 
 #include "AttributeImpl.h"
 #include "ConstantsContext.h"
+#include "ShardedMap.h"
 #include "llvm/ADT/APFloat.h"
 #include "llvm/ADT/APInt.h"
 #include "llvm/ADT/ArrayRef.h"
@@ -35,6 +36,7 @@
 #include "llvm/IR/ValueHandle.h"
 #include "llvm/Support/Dwarf.h"
 #include "llvm/Support/YAMLTraits.h"
+#include <mutex>
 #include <vector>
 
 namespace llvm {
@@ -1094,6 +1096,11 @@ public:
 
 class LLVMContextImpl {
 public:
+  /// Whether the context was created LLVMContext::Concurrent. The uniquing
+  /// maps are then split into locked shards, see ShardedMap, and the state
+  /// they share is guarded by the locks below.
+  const bool Concurrent;
+
   /// OwnedModules - The set of modules instantiated in this context, and which
   /// will be automatically deleted if this context is deleted.
   SmallPtrSet<Module*, 4> OwnedModules;
@@ -1112,17 +1119,18 @@ public:
 
   typedef DenseMap<APInt, std::unique_ptr<ConstantInt>, DenseMapAPIntKeyInfo>
       IntMapTy;
-  IntMapTy IntConstants;
+  ShardedMap<IntMapTy> IntConstants;
 
   typedef DenseMap<APFloat, std::unique_ptr<ConstantFP>, DenseMapAPFloatKeyInfo>
       FPMapTy;
-  FPMapTy FPConstants;
+  ShardedMap<FPMapTy> FPConstants;
 
   FoldingSet<AttributeImpl> AttrsSet;
   FoldingSet<AttributeListImpl> AttrsLists;
   FoldingSet<AttributeSetNode> AttrsSetNodes;
 
-  StringMap<MDString, BumpPtrAllocator> MDStringCache;
+  typedef StringMap<MDString, BumpPtrAllocator> MDStringMapTy;
+  ShardedMap<MDStringMapTy> MDStringCache;
   DenseMap<Value *, ValueAsMetadata *> ValuesAsMetadata;
   DenseMap<Metadata *, MetadataAsValue *> MetadataAsValues;
 
@@ -1141,7 +1149,8 @@ public:
   // them on context teardown.
   std::vector<MDNode *> DistinctMDNodes;
 
-  DenseMap<Type *, std::unique_ptr<ConstantAggregateZero>> CAZConstants;
+  typedef DenseMap<Type *, std::unique_ptr<ConstantAggregateZero>> CAZMapTy;
+  ShardedMap<CAZMapTy> CAZConstants;
 
   typedef ConstantUniqueMap<ConstantArray> ArrayConstantsTy;
   ArrayConstantsTy ArrayConstants;
@@ -1152,11 +1161,15 @@ public:
   typedef ConstantUniqueMap<ConstantVector> VectorConstantsTy;
   VectorConstantsTy VectorConstants;
 
-  DenseMap<PointerType *, std::unique_ptr<ConstantPointerNull>> CPNConstants;
+  typedef DenseMap<PointerType *, std::unique_ptr<ConstantPointerNull>>
+      CPNMapTy;
+  ShardedMap<CPNMapTy> CPNConstants;
 
-  DenseMap<Type *, std::unique_ptr<UndefValue>> UVConstants;
+  typedef DenseMap<Type *, std::unique_ptr<UndefValue>> UVMapTy;
+  ShardedMap<UVMapTy> UVConstants;
 
-  StringMap<ConstantDataSequential*> CDSConstants;
+  typedef StringMap<ConstantDataSequential *> CDSMapTy;
+  ShardedMap<CDSMapTy> CDSConstants;
 
   DenseMap<std::pair<const Function *, const BasicBlock *>, BlockAddress *>
     BlockAddresses;
@@ -1179,19 +1192,81 @@ public:
   /// They live forever until the context is torn down.
   BumpPtrAllocator TypeAllocator;
   
-  DenseMap<unsigned, IntegerType*> IntegerTypes;
+  typedef DenseMap<unsigned, IntegerType*> IntegerTypeMapTy;
+  ShardedMap<IntegerTypeMapTy> IntegerTypes;
 
   typedef DenseSet<FunctionType *, FunctionTypeKeyInfo> FunctionTypeSet;
-  FunctionTypeSet FunctionTypes;
+  ShardedMap<FunctionTypeSet> FunctionTypes;
   typedef DenseSet<StructType *, AnonStructTypeKeyInfo> StructTypeSet;
-  StructTypeSet AnonStructTypes;
+  ShardedMap<StructTypeSet> AnonStructTypes;
   StringMap<StructType*> NamedStructTypes;
   unsigned NamedStructTypesUniqueID;
     
-  DenseMap<std::pair<Type *, uint64_t>, ArrayType*> ArrayTypes;
-  DenseMap<std::pair<Type *, unsigned>, VectorType*> VectorTypes;
-  DenseMap<Type*, PointerType*> PointerTypes;  // Pointers in AddrSpace = 0
-  DenseMap<std::pair<Type*, unsigned>, PointerType*> ASPointerTypes;
+  typedef DenseMap<std::pair<Type *, uint64_t>, ArrayType*> ArrayTypeMapTy;
+  ShardedMap<ArrayTypeMapTy> ArrayTypes;
+  typedef DenseMap<std::pair<Type *, unsigned>, VectorType*> VectorTypeMapTy;
+  ShardedMap<VectorTypeMapTy> VectorTypes;
+  typedef DenseMap<Type*, PointerType*> PointerTypeMapTy;
+  ShardedMap<PointerTypeMapTy> PointerTypes;  // Pointers in AddrSpace = 0
+  typedef DenseMap<std::pair<Type*, unsigned>, PointerType*> ASPointerTypeMapTy;
+  ShardedMap<ASPointerTypeMapTy> ASPointerTypes;
+
+  /// Guards TypeAllocator, NamedStructTypes and NamedStructTypesUniqueID in a
+  /// concurrent context.
+  std::mutex TypeLock;
+
+  /// Lock TypeLock if the context is concurrent.
+  std::unique_lock<std::mutex> lockTypes() {
+    if (!Concurrent)
+      return std::unique_lock<std::mutex>();
+    return std::unique_lock<std::mutex>(TypeLock);
+  }
+
+  /// Guards the uniquing of MDNodes, DistinctMDNodes, ValuesAsMetadata,
+  /// MetadataAsValues and the metadata attachments in a concurrent context.
+  /// Recursive because uniquing a node can resolve and unique the nodes that
+  /// refer to it.
+  std::recursive_mutex MetadataLock;
+
+  /// Lock MetadataLock if the context is concurrent.
+  std::unique_lock<std::recursive_mutex> lockMetadata() {
+    if (!Concurrent)
+      return std::unique_lock<std::recursive_mutex>();
+    return std::unique_lock<std::recursive_mutex>(MetadataLock);
+  }
+
+  /// Guards ValueHandles and the lists of value handles in a concurrent
+  /// context. Recursive because the callbacks of the handles run under it and
+  /// can add and remove handles.
+  std::recursive_mutex HandleLock;
+
+  /// Lock HandleLock if the context is concurrent.
+  std::unique_lock<std::recursive_mutex> lockHandles() {
+    if (!Concurrent)
+      return std::unique_lock<std::recursive_mutex>();
+    return std::unique_lock<std::recursive_mutex>(HandleLock);
+  }
+
+  /// Guards AttrsSet, AttrsLists and AttrsSetNodes in a concurrent context.
+  std::mutex AttributeLock;
+
+  /// Lock AttributeLock if the context is concurrent.
+  std::unique_lock<std::mutex> lockAttributes() {
+    if (!Concurrent)
+      return std::unique_lock<std::mutex>();
+    return std::unique_lock<std::mutex>(AttributeLock);
+  }
+
+  /// Guards OwnedModules, BlockAddresses and CustomMDKindNames in a concurrent
+  /// context.
+  std::mutex StateLock;
+
+  /// Lock StateLock if the context is concurrent.
+  std::unique_lock<std::mutex> lockState() {
+    if (!Concurrent)
+      return std::unique_lock<std::mutex>();
+    return std::unique_lock<std::mutex>(StateLock);
+  }
 
 
   /// ValueHandles - This map keeps track of all of the value handles that are
@@ -1244,7 +1319,7 @@ public:
   /// not.
   bool DiscardValueNames = false;
 
-  LLVMContextImpl(LLVMContext &C);
+  LLVMContextImpl(LLVMContext &C, bool Concurrent);
   ~LLVMContextImpl();
 
   /// Destroy the ConstantArrays if they are not used.
@@ -24,6 +24,7 @@
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/IR/Argument.h"
@@ -64,6 +65,7 @@ MetadataAsValue::MetadataAsValue(Type *Ty, Metadata *MD)
 }
 
 MetadataAsValue::~MetadataAsValue() {
+  auto MDLock = getType()->getContext().pImpl->lockMetadata();
   getType()->getContext().pImpl->MetadataAsValues.erase(MD);
   untrack();
 }
@@ -103,6 +105,7 @@ static Metadata *canonicalizeMetadataForValue(LLVMContext &Context,
 
 MetadataAsValue *MetadataAsValue::get(LLVMContext &Context, Metadata *MD) {
   MD = canonicalizeMetadataForValue(Context, MD);
+  auto MDLock = Context.pImpl->lockMetadata();
   auto *&Entry = Context.pImpl->MetadataAsValues[MD];
   if (!Entry)
     Entry = new MetadataAsValue(Type::getMetadataTy(Context), MD);
@@ -112,6 +115,7 @@ MetadataAsValue *MetadataAsValue::get(LLVMContext &Context, Metadata *MD) {
 MetadataAsValue *MetadataAsValue::getIfExists(LLVMContext &Context,
                                               Metadata *MD) {
   MD = canonicalizeMetadataForValue(Context, MD);
+  auto MDLock = Context.pImpl->lockMetadata();
   auto &Store = Context.pImpl->MetadataAsValues;
   return Store.lookup(MD);
 }
@@ -119,6 +123,7 @@ MetadataAsValue *MetadataAsValue::getIfExists(LLVMContext &Context,
 void MetadataAsValue::handleChangedMetadata(Metadata *MD) {
   LLVMContext &Context = getContext();
   MD = canonicalizeMetadataForValue(Context, MD);
+  auto MDLock = Context.pImpl->lockMetadata();
   auto &Store = Context.pImpl->MetadataAsValues;
 
   // Stop tracking the old metadata.
@@ -340,6 +345,7 @@ ValueAsMetadata *ValueAsMetadata::get(Value *V) {
   assert(V && "Unexpected null Value");
 
   auto &Context = V->getContext();
+  auto MDLock = Context.pImpl->lockMetadata();
   auto *&Entry = Context.pImpl->ValuesAsMetadata[V];
   if (!Entry) {
     assert((isa<Constant>(V) || isa<Argument>(V) || isa<Instruction>(V)) &&
@@ -357,12 +363,14 @@ ValueAsMetadata *ValueAsMetadata::get(Value *V) {
 
 ValueAsMetadata *ValueAsMetadata::getIfExists(Value *V) {
   assert(V && "Unexpected null Value");
+  auto MDLock = V->getContext().pImpl->lockMetadata();
   return V->getContext().pImpl->ValuesAsMetadata.lookup(V);
 }
 
 void ValueAsMetadata::handleDeletion(Value *V) {
   assert(V && "Expected valid value");
 
+  auto MDLock = V->getType()->getContext().pImpl->lockMetadata();
   auto &Store = V->getType()->getContext().pImpl->ValuesAsMetadata;
   auto I = Store.find(V);
   if (I == Store.end())
@@ -386,6 +394,7 @@ void ValueAsMetadata::handleRAUW(Value *From, Value *To) {
   assert(From->getType() == To->getType() && "Unexpected type change");
 
   LLVMContext &Context = From->getType()->getContext();
+  auto MDLock = Context.pImpl->lockMetadata();
   auto &Store = Context.pImpl->ValuesAsMetadata;
   auto I = Store.find(From);
   if (I == Store.end()) {
@@ -442,8 +451,8 @@ void ValueAsMetadata::handleRAUW(Value *From, Value *To) {
 //
 
 MDString *MDString::get(LLVMContext &Context, StringRef Str) {
-  auto &Store = Context.pImpl->MDStringCache;
-  auto I = Store.try_emplace(Str);
+  auto Store = Context.pImpl->MDStringCache.lock(HashString(Str));
+  auto I = Store->try_emplace(Str);
   auto &MapEntry = I.first->getValue();
   if (!I.second)
     return &MapEntry;
@@ -771,6 +780,7 @@ template <class NodeTy> struct MDNode::HasCachedHash {
 
 MDNode *MDNode::uniquify() {
   assert(!hasSelfReference(this) && "Cannot uniquify a self-referencing node");
+  auto MDLock = getContext().pImpl->lockMetadata();
 
   // Try to insert into uniquing store.
   switch (getMetadataID()) {
@@ -789,6 +799,7 @@ MDNode *MDNode::uniquify() {
 }
 
 void MDNode::eraseFromStore() {
+  auto MDLock = getContext().pImpl->lockMetadata();
   switch (getMetadataID()) {
   default:
     llvm_unreachable("Invalid or non-uniquable subclass of MDNode");
@@ -803,6 +814,7 @@ void MDNode::eraseFromStore() {
 MDTuple *MDTuple::getImpl(LLVMContext &Context, ArrayRef<Metadata *> MDs,
                           StorageType Storage, bool ShouldCreate) {
   unsigned Hash = 0;
+  auto MDLock = Context.pImpl->lockMetadata();
   if (Storage == Uniqued) {
     MDTupleInfo::KeyTy Key(MDs);
     if (auto *N = getUniqued(Context.pImpl->MDTuples, Key))
@@ -843,6 +855,7 @@ void MDNode::storeDistinctInContext() {
 #include "llvm/IR/Metadata.def"
   }
 
+  auto MDLock = getContext().pImpl->lockMetadata();
   getContext().pImpl->DistinctMDNodes.push_back(this);
 }
 
@@ -1186,6 +1199,7 @@ void Instruction::dropUnknownNonDebugMetadata(ArrayRef<unsigned> KnownIDs) {
   if (!hasMetadataHashEntry())
     return; // Nothing to remove!
 
+  auto MDLock = getContext().pImpl->lockMetadata();
   auto &InstructionMetadata = getContext().pImpl->InstructionMetadata;
 
   SmallSet<unsigned, 4> KnownSet;
@@ -1219,6 +1233,8 @@ void Instruction::setMetadata(unsigned KindID, MDNode *Node) {
     return;
   }
 
+  auto MDLock = getContext().pImpl->lockMetadata();
+
   // Handle the case when we're adding/updating metadata on an instruction.
   if (Node) {
     auto &Info = getContext().pImpl->InstructionMetadata[this];
@@ -1261,6 +1277,7 @@ MDNode *Instruction::getMetadataImpl(unsigned KindID) const {
 
   if (!hasMetadataHashEntry())
     return nullptr;
+  auto MDLock = getContext().pImpl->lockMetadata();
   auto &Info = getContext().pImpl->InstructionMetadata[this];
   assert(!Info.empty() && "bit out of sync with hash table");
 
@@ -1279,6 +1296,7 @@ void Instruction::getAllMetadataImpl(
       return;
   }
 
+  auto MDLock = getContext().pImpl->lockMetadata();
   assert(hasMetadataHashEntry() &&
          getContext().pImpl->InstructionMetadata.count(this) &&
          "Shouldn't have called this");
@@ -1290,6 +1308,7 @@ void Instruction::getAllMetadataImpl(
 void Instruction::getAllMetadataOtherThanDebugLocImpl(
     SmallVectorImpl<std::pair<unsigned, MDNode *>> &Result) const {
   Result.clear();
+  auto MDLock = getContext().pImpl->lockMetadata();
   assert(hasMetadataHashEntry() &&
          getContext().pImpl->InstructionMetadata.count(this) &&
          "Shouldn't have called this");
@@ -1361,14 +1380,17 @@ bool Instruction::extractProfTotalWeight(uint64_t &TotalVal) const {
 
 void Instruction::clearMetadataHashEntries() {
   assert(hasMetadataHashEntry() && "Caller should check");
+  auto MDLock = getContext().pImpl->lockMetadata();
   getContext().pImpl->InstructionMetadata.erase(this);
   setHasMetadataHashEntry(false);
 }
 
 void GlobalObject::getMetadata(unsigned KindID,
                                SmallVectorImpl<MDNode *> &MDs) const {
-  if (hasMetadata())
-    getContext().pImpl->GlobalObjectMetadata[this].get(KindID, MDs);
+  if (!hasMetadata())
+    return;
+  auto MDLock = getContext().pImpl->lockMetadata();
+  getContext().pImpl->GlobalObjectMetadata[this].get(KindID, MDs);
 }
 
 void GlobalObject::getMetadata(StringRef Kind,
@@ -1381,6 +1403,7 @@ void GlobalObject::addMetadata(unsigned KindID, MDNode &MD) {
   if (!hasMetadata())
     setHasMetadataHashEntry(true);
 
+  auto MDLock = getContext().pImpl->lockMetadata();
   getContext().pImpl->GlobalObjectMetadata[this].insert(KindID, MD);
 }
 
@@ -1393,6 +1416,7 @@ void GlobalObject::eraseMetadata(unsigned KindID) {
   if (!hasMetadata())
     return;
 
+  auto MDLock = getContext().pImpl->lockMetadata();
   auto &Store = getContext().pImpl->GlobalObjectMetadata[this];
   Store.erase(KindID);
   if (Store.empty())
@@ -1406,12 +1430,14 @@ void GlobalObject::getAllMetadata(
   if (!hasMetadata())
     return;
 
+  auto MDLock = getContext().pImpl->lockMetadata();
   getContext().pImpl->GlobalObjectMetadata[this].getAll(MDs);
 }
 
 void GlobalObject::clearMetadata() {
   if (!hasMetadata())
     return;
+  auto MDLock = getContext().pImpl->lockMetadata();
   getContext().pImpl->GlobalObjectMetadata.erase(this);
   setHasMetadataHashEntry(false);
 }
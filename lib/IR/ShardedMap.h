@@ -0,0 +1,112 @@
+//===- ShardedMap.h - Uniquing maps split into locked shards ----*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines ShardedMap, which splits a uniquing map of a concurrent
+// LLVMContext into shards by hash, each behind a lock of its own.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LIB_IR_SHARDEDMAP_H
+#define LLVM_LIB_IR_SHARDEDMAP_H
+
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace llvm {
+
+/// A uniquing map of type \p MapT, split into shards by the hash of its keys.
+///
+/// In a context created LLVMContext::Concurrent, every shard has a lock and
+/// threads looking up keys of different shards don't wait for each other.
+/// Otherwise there is one shard and nothing is locked, so that the single
+/// threaded case pays nothing.
+template <typename MapT> class ShardedMap {
+  struct Shard {
+    std::mutex Lock;
+    MapT Map;
+  };
+
+public:
+  /// Shards of the maps of a concurrent context.
+  static const unsigned NumConcurrentShards = 16;
+
+  /// The map of one shard, locked as long as this lives when the map is
+  /// concurrent.
+  class LockedMap {
+    std::unique_lock<std::mutex> Lock;
+    MapT *Map;
+
+  public:
+    LockedMap(Shard &S, bool Locked)
+        : Lock(S.Lock, std::defer_lock), Map(&S.Map) {
+      if (Locked)
+        Lock.lock();
+    }
+
+    MapT &operator*() const { return *Map; }
+    MapT *operator->() const { return Map; }
+  };
+
+  explicit ShardedMap(bool Concurrent)
+      : NumShards(Concurrent ? NumConcurrentShards : 1),
+        Shards(new Shard[NumShards]) {}
+
+  bool isConcurrent() const { return NumShards > 1; }
+
+  /// Lock the shard holding the keys of hash \p Hash.
+  LockedMap lock(unsigned Hash) {
+    return LockedMap(Shards[getShard(Hash)], isConcurrent());
+  }
+
+  /// Lock the shards of the keys of hashes \p Hash1 and \p Hash2, in the order
+  /// of the shards so that two threads can't each wait for the other. Both
+  /// maps are the same when the hashes share a shard.
+  std::pair<LockedMap, LockedMap> lock(unsigned Hash1, unsigned Hash2) {
+    unsigned S1 = getShard(Hash1), S2 = getShard(Hash2);
+    if (S1 == S2) {
+      LockedMap M1(Shards[S1], isConcurrent());
+      return std::make_pair(std::move(M1), LockedMap(Shards[S2], false));
+    }
+    if (S1 < S2) {
+      LockedMap M1(Shards[S1], isConcurrent());
+      LockedMap M2(Shards[S2], isConcurrent());
+      return std::make_pair(std::move(M1), std::move(M2));
+    }
+    LockedMap M2(Shards[S2], isConcurrent());
+    LockedMap M1(Shards[S1], isConcurrent());
+    return std::make_pair(std::move(M1), std::move(M2));
+  }
+
+  /// Call \p Fn on the map of every shard, without locking: only for the
+  /// destruction of the context and other single threaded walks.
+  template <typename FnT> void forEachShard(FnT Fn) {
+    for (unsigned I = 0; I < NumShards; ++I)
+      Fn(Shards[I].Map);
+  }
+
+  void clear() {
+    forEachShard([](MapT &Map) { Map.clear(); });
+  }
+
+private:
+  unsigned getShard(unsigned Hash) const {
+    // The maps pick their buckets with the low bits of the hash, so the shard
+    // is picked with the high bits of a scrambled hash: keys of one shard
+    // still spread over all the buckets of its map.
+    return ((Hash * 0x9E3779B9u) >> 16) % NumShards;
+  }
+
+  unsigned NumShards;
+  std::unique_ptr<Shard[]> Shards;
+};
+
+} // end namespace llvm
+
+#endif
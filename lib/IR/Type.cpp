@@ -241,10 +241,14 @@ IntegerType *IntegerType::get(LLVMContext &C, unsigned NumBits) {
     break;
   }
   
-  IntegerType *&Entry = C.pImpl->IntegerTypes[NumBits];
+  auto Shard =
+      C.pImpl->IntegerTypes.lock(DenseMapInfo<unsigned>::getHashValue(NumBits));
+  IntegerType *&Entry = (*Shard)[NumBits];
 
-  if (!Entry)
+  if (!Entry) {
+    auto Lock = C.pImpl->lockTypes();
     Entry = new (C.pImpl->TypeAllocator) IntegerType(C, NumBits);
+  }
   
   return Entry;
 }
@@ -286,15 +290,20 @@ FunctionType *FunctionType::get(Type *ReturnType,
                                 ArrayRef<Type*> Params, bool isVarArg) {
   LLVMContextImpl *pImpl = ReturnType->getContext().pImpl;
   FunctionTypeKeyInfo::KeyTy Key(ReturnType, Params, isVarArg);
-  auto I = pImpl->FunctionTypes.find_as(Key);
+  auto Shard =
+      pImpl->FunctionTypes.lock(FunctionTypeKeyInfo::getHashValue(Key));
+  auto I = Shard->find_as(Key);
   FunctionType *FT;
 
-  if (I == pImpl->FunctionTypes.end()) {
-    FT = (FunctionType *)pImpl->TypeAllocator.Allocate(
-        sizeof(FunctionType) + sizeof(Type *) * (Params.size() + 1),
-        alignof(FunctionType));
+  if (I == Shard->end()) {
+    {
+      auto Lock = pImpl->lockTypes();
+      FT = (FunctionType *)pImpl->TypeAllocator.Allocate(
+          sizeof(FunctionType) + sizeof(Type *) * (Params.size() + 1),
+          alignof(FunctionType));
+    }
     new (FT) FunctionType(ReturnType, Params, isVarArg);
-    pImpl->FunctionTypes.insert(FT);
+    Shard->insert(FT);
   } else {
     FT = *I;
   }
@@ -325,15 +334,20 @@ StructType *StructType::get(LLVMContext &Context, ArrayRef<Type*> ETypes,
                             bool isPacked) {
   LLVMContextImpl *pImpl = Context.pImpl;
   AnonStructTypeKeyInfo::KeyTy Key(ETypes, isPacked);
-  auto I = pImpl->AnonStructTypes.find_as(Key);
+  auto Shard =
+      pImpl->AnonStructTypes.lock(AnonStructTypeKeyInfo::getHashValue(Key));
+  auto I = Shard->find_as(Key);
   StructType *ST;
 
-  if (I == pImpl->AnonStructTypes.end()) {
+  if (I == Shard->end()) {
     // Value not found.  Create a new type!
-    ST = new (Context.pImpl->TypeAllocator) StructType(Context);
+    {
+      auto Lock = pImpl->lockTypes();
+      ST = new (Context.pImpl->TypeAllocator) StructType(Context);
+    }
     ST->setSubclassData(SCDB_IsLiteral);  // Literal struct.
     ST->setBody(ETypes, isPacked);
-    Context.pImpl->AnonStructTypes.insert(ST);
+    Shard->insert(ST);
   } else {
     ST = *I;
   }
@@ -355,12 +369,14 @@ void StructType::setBody(ArrayRef<Type*> Elements, bool isPacked) {
     return;
   }
 
+  auto Lock = getContext().pImpl->lockTypes();
   ContainedTys = Elements.copy(getContext().pImpl->TypeAllocator).data();
 }
 
 void StructType::setName(StringRef Name) {
   if (Name == getName()) return;
 
+  auto Lock = getContext().pImpl->lockTypes();
   StringMap<StructType *> &SymbolTable = getContext().pImpl->NamedStructTypes;
   typedef StringMap<StructType *>::MapEntryTy EntryTy;
 
@@ -409,7 +425,11 @@ void StructType::setName(StringRef Name) {
 // StructType Helper functions.
 
 StructType *StructType::create(LLVMContext &Context, StringRef Name) {
-  StructType *ST = new (Context.pImpl->TypeAllocator) StructType(Context);
+  StructType *ST;
+  {
+    auto Lock = Context.pImpl->lockTypes();
+    ST = new (Context.pImpl->TypeAllocator) StructType(Context);
+  }
   if (!Name.empty())
     ST->setName(Name);
   return ST;
@@ -537,6 +557,7 @@ bool StructType::isLayoutIdentical(StructType *Other) const {
 }
 
 StructType *Module::getTypeByName(StringRef Name) const {
+  auto Lock = getContext().pImpl->lockTypes();
   return getContext().pImpl->NamedStructTypes.lookup(Name);
 }
 
@@ -601,11 +622,15 @@ ArrayType *ArrayType::get(Type *ElementType, uint64_t NumElements) {
   assert(isValidElementType(ElementType) && "Invalid type for array element!");
 
   LLVMContextImpl *pImpl = ElementType->getContext().pImpl;
-  ArrayType *&Entry = 
-    pImpl->ArrayTypes[std::make_pair(ElementType, NumElements)];
+  auto Key = std::make_pair(ElementType, NumElements);
+  auto Shard = pImpl->ArrayTypes.lock(
+      DenseMapInfo<decltype(Key)>::getHashValue(Key));
+  ArrayType *&Entry = (*Shard)[Key];
 
-  if (!Entry)
+  if (!Entry) {
+    auto Lock = pImpl->lockTypes();
     Entry = new (pImpl->TypeAllocator) ArrayType(ElementType, NumElements);
+  }
   return Entry;
 }
 
@@ -629,11 +654,15 @@ VectorType *VectorType::get(Type *ElementType, unsigned NumElements) {
                                             "pointer type.");
 
   LLVMContextImpl *pImpl = ElementType->getContext().pImpl;
-  VectorType *&Entry = ElementType->getContext().pImpl
-    ->VectorTypes[std::make_pair(ElementType, NumElements)];
+  auto Key = std::make_pair(ElementType, NumElements);
+  auto Shard = pImpl->VectorTypes.lock(
+      DenseMapInfo<decltype(Key)>::getHashValue(Key));
+  VectorType *&Entry = (*Shard)[Key];
 
-  if (!Entry)
+  if (!Entry) {
+    auto Lock = pImpl->lockTypes();
     Entry = new (pImpl->TypeAllocator) VectorType(ElementType, NumElements);
+  }
   return Entry;
 }
 
@@ -653,11 +682,25 @@ PointerType *PointerType::get(Type *EltTy, unsigned AddressSpace) {
   LLVMContextImpl *CImpl = EltTy->getContext().pImpl;
   
   // Since AddressSpace #0 is the common case, we special case it.
-  PointerType *&Entry = AddressSpace == 0 ? CImpl->PointerTypes[EltTy]
-     : CImpl->ASPointerTypes[std::make_pair(EltTy, AddressSpace)];
+  if (AddressSpace == 0) {
+    auto Shard =
+        CImpl->PointerTypes.lock(DenseMapInfo<Type *>::getHashValue(EltTy));
+    PointerType *&Entry = (*Shard)[EltTy];
+    if (!Entry) {
+      auto Lock = CImpl->lockTypes();
+      Entry = new (CImpl->TypeAllocator) PointerType(EltTy, AddressSpace);
+    }
+    return Entry;
+  }
 
-  if (!Entry)
+  auto Key = std::make_pair(EltTy, AddressSpace);
+  auto Shard = CImpl->ASPointerTypes.lock(
+      DenseMapInfo<decltype(Key)>::getHashValue(Key));
+  PointerType *&Entry = (*Shard)[Key];
+  if (!Entry) {
+    auto Lock = CImpl->lockTypes();
     Entry = new (CImpl->TypeAllocator) PointerType(EltTy, AddressSpace);
+  }
   return Entry;
 }
 
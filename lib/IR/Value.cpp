@@ -14,6 +14,7 @@
 #include "llvm/IR/Value.h"
 #include "LLVMContextImpl.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/IR/CallSite.h"
 #include "llvm/IR/Constant.h"
@@ -96,6 +97,59 @@ void Value::destroyValueName() {
   setValueName(nullptr);
 }
 
+/// Whether \p MD refers to no value or node tied to a module, so that the
+/// threads of a concurrent context can all use it. Called under the metadata
+/// lock.
+static bool isSharedMetadata(const Metadata *MD) {
+  SmallVector<const Metadata *, 8> Worklist(1, MD);
+  SmallPtrSet<const Metadata *, 8> Visited;
+  while (!Worklist.empty()) {
+    MD = Worklist.pop_back_val();
+    if (!MD || isa<MDString>(MD) || !Visited.insert(MD).second)
+      continue;
+    if (auto *C = dyn_cast<ConstantAsMetadata>(MD)) {
+      if (!C->getValue()->isSharedByThreads())
+        return false;
+      continue;
+    }
+    // Distinct and temporary nodes belong to the module that made them, and
+    // unresolved ones change when resolved.
+    auto *N = dyn_cast<MDNode>(MD);
+    if (!N || !N->isUniqued() || !N->isResolved())
+      return false;
+    for (const MDOperand &Op : N->operands())
+      Worklist.push_back(Op);
+  }
+  return true;
+}
+
+bool Value::isSharedByThreads() const {
+  if (SubclassID < ConstantExprVal || SubclassID > InlineAsmVal ||
+      !getContext().pImpl->Concurrent)
+    return false;
+
+  switch (SubclassID) {
+  case InlineAsmVal:
+    return true;
+  case MetadataAsValueVal: {
+    auto MDLock = getContext().pImpl->lockMetadata();
+    return isSharedMetadata(cast<MetadataAsValue>(this)->getMetadata());
+  }
+  case ConstantExprVal:
+    // The placeholders of the bitcode reader are replaced once read.
+    if (cast<ConstantExpr>(this)->getOpcode() == Instruction::UserOp1)
+      return false;
+    break;
+  }
+
+  // Constant data has no operands. The others are shared when all of their
+  // operands are, which is when none of their operands is in a use list.
+  for (const Use &Op : cast<User>(this)->operands())
+    if (Op.isTracked())
+      return false;
+  return true;
+}
+
 bool Value::hasNUses(unsigned N) const {
   const_use_iterator UI = use_begin(), E = use_end();
 
@@ -729,6 +783,7 @@ void ValueHandleBase::AddToUseList() {
   assert(V && "Null pointer doesn't have a use list!");
 
   LLVMContextImpl *pImpl = V->getContext().pImpl;
+  auto HandleLock = pImpl->lockHandles();
 
   if (V->HasValueHandle) {
     // If this value already has a ValueHandle, then it must be in the
@@ -768,9 +823,17 @@ void ValueHandleBase::AddToUseList() {
   }
 }
 
+void ValueHandleBase::AddToUseListOf(const ValueHandleBase &RHS) {
+  // Other threads can move RHS in the list until it is locked.
+  auto HandleLock = V->getContext().pImpl->lockHandles();
+  AddToExistingUseList(RHS.getPrevPtr());
+}
+
 void ValueHandleBase::RemoveFromUseList() {
-  assert(V && V->HasValueHandle &&
-         "Pointer doesn't have a use list!");
+  assert(V && "Pointer doesn't have a use list!");
+  LLVMContextImpl *pImpl = V->getContext().pImpl;
+  auto HandleLock = pImpl->lockHandles();
+  assert(V->HasValueHandle && "Pointer doesn't have a use list!");
 
   // Unlink this from its use list.
   ValueHandleBase **PrevPtr = getPrevPtr();
@@ -786,7 +849,6 @@ void ValueHandleBase::RemoveFromUseList() {
   // If the Next pointer was null, then it is possible that this was the last
   // ValueHandle watching VP.  If so, delete its entry from the ValueHandles
   // map.
-  LLVMContextImpl *pImpl = V->getContext().pImpl;
   DenseMap<Value*, ValueHandleBase*> &Handles = pImpl->ValueHandles;
   if (Handles.isPointerIntoBucketsArray(PrevPtr)) {
     Handles.erase(V);
@@ -800,6 +862,7 @@ void ValueHandleBase::ValueIsDeleted(Value *V) {
   // Get the linked list base, which is guaranteed to exist since the
   // HasValueHandle flag is set.
   LLVMContextImpl *pImpl = V->getContext().pImpl;
+  auto HandleLock = pImpl->lockHandles();
   ValueHandleBase *Entry = pImpl->ValueHandles[V];
   assert(Entry && "Value bit set but no entries exist");
 
@@ -859,6 +922,7 @@ void ValueHandleBase::ValueIsRAUWd(Value *Old, Value *New) {
   // Get the linked list base, which is guaranteed to exist since the
   // HasValueHandle flag is set.
   LLVMContextImpl *pImpl = Old->getContext().pImpl;
+  auto HandleLock = pImpl->lockHandles();
   ValueHandleBase *Entry = pImpl->ValueHandles[Old];
 
   assert(Entry && "Value bit set but no entries exist");
@@ -7,105 +7,194 @@
 //
 //===----------------------------------------------------------------------===//
 //
-// This file implements a crude C++11 based thread pool.
+// This file implements a work-stealing C++11 based thread pool.
 //
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Support/ThreadPool.h"
 
 #include "llvm/Config/llvm-config.h"
+#include "llvm/Support/Compiler.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
+
 using namespace llvm;
 
+/// Pool and queue of the thread running this code, if it belongs to a pool.
+static LLVM_THREAD_LOCAL ThreadPool *CurrentPool = nullptr;
+static LLVM_THREAD_LOCAL unsigned CurrentQueue = 0;
+
+bool ThreadPool::popTask(unsigned Self, ThreadPoolTask &Task) {
+  // Pick by priority first: a High task queued anywhere goes before our own
+  // Normal tasks.
+  for (unsigned Priority = 0; Priority < NumPriorities; ++Priority) {
+    for (unsigned I = 0, E = Queues.size(); I < E; ++I) {
+      WorkerQueue &Queue = *Queues[(Self + I) % E];
+      if (!Queue.Queued)
+        continue;
+      std::deque<ThreadPoolTask> &Tasks = Queue.Tasks[Priority];
+      std::unique_lock<std::mutex> LockGuard(Queue.Lock);
+      if (Tasks.empty())
+        continue;
+      Task = std::move(Tasks.front());
+      Tasks.pop_front();
+      --Queue.Queued;
+      --PendingTasks;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::runTask(ThreadPoolTask &Task) {
+  Task();
+  // Release what the task captured before signaling its completion.
+  Task = ThreadPoolTask();
+  if (--OutstandingTasks == 0) {
+    // Notify task completion, in case someone waits on ThreadPool::wait()
+    std::lock_guard<std::mutex> LockGuard(CompletionLock);
+    CompletionCondition.notify_all();
+  }
+}
+
+bool ThreadPool::runQueuedTask() {
+  ThreadPoolTask Task;
+  unsigned Self =
+      CurrentPool == this ? CurrentQueue : NextQueue.load() % Queues.size();
+  if (!popTask(Self, Task))
+    return false;
+  runTask(Task);
+  return true;
+}
+
 #if LLVM_ENABLE_THREADS
 
 // Default to std::thread::hardware_concurrency
 ThreadPool::ThreadPool() : ThreadPool(std::thread::hardware_concurrency()) {}
 
 ThreadPool::ThreadPool(unsigned ThreadCount)
-    : ActiveThreads(0), EnableFlag(true) {
-  // Create ThreadCount threads that will loop forever, wait on QueueCondition
-  // for tasks to be queued or the Pool to be destroyed.
+    : NextQueue(0), PendingTasks(0), OutstandingTasks(0), SleepingThreads(0),
+      EnableFlag(true) {
+  // A pool without threads still queues its tasks: wait() runs them.
+  for (unsigned I = 0, E = std::max(ThreadCount, 1u); I < E; ++I)
+    Queues.emplace_back(new WorkerQueue());
+
+  // Create ThreadCount threads that will loop forever, running the tasks of
+  // their queue or stolen from the others, and sleep on SleepCondition when
+  // no task is queued anywhere until there is one or the Pool is destroyed.
   Threads.reserve(ThreadCount);
   for (unsigned ThreadID = 0; ThreadID < ThreadCount; ++ThreadID) {
-    Threads.emplace_back([&] {
+    Threads.emplace_back([this, ThreadID] {
+      CurrentPool = this;
+      CurrentQueue = ThreadID;
       while (true) {
-        PackagedTaskTy Task;
-        {
-          std::unique_lock<std::mutex> LockGuard(QueueLock);
-          // Wait for tasks to be pushed in the queue
-          QueueCondition.wait(LockGuard,
-                              [&] { return !EnableFlag || !Tasks.empty(); });
-          // Exit condition
-          if (!EnableFlag && Tasks.empty())
-            return;
-          // Yeah, we have a task, grab it and release the lock on the queue
-
-          // We first need to signal that we are active before popping the queue
-          // in order for wait() to properly detect that even if the queue is
-          // empty, there is still a task in flight.
-          {
-            ++ActiveThreads;
-            std::unique_lock<std::mutex> LockGuard(CompletionLock);
-          }
-          Task = std::move(Tasks.front());
-          Tasks.pop();
-        }
-        // Run the task we just grabbed
-#ifndef _MSC_VER
-        Task();
-#else
-        Task(/* unused */ false);
-#endif
-
-        {
-          // Adjust `ActiveThreads`, in case someone waits on ThreadPool::wait()
-          std::unique_lock<std::mutex> LockGuard(CompletionLock);
-          --ActiveThreads;
+        ThreadPoolTask Task;
+        if (popTask(ThreadID, Task)) {
+          runTask(Task);
+          continue;
         }
 
-        // Notify task completion, in case someone waits on ThreadPool::wait()
-        CompletionCondition.notify_all();
+        std::unique_lock<std::mutex> LockGuard(SleepLock);
+        // A submitter that did not see us sleeping queued its task before
+        // checking, the predicate sees it.
+        ++SleepingThreads;
+        SleepCondition.wait(LockGuard,
+                            [&] { return !EnableFlag || PendingTasks > 0; });
+        --SleepingThreads;
+        // Exit condition
+        if (!EnableFlag && PendingTasks <= 0)
+          return;
       }
     });
   }
 }
 
+void ThreadPool::enqueue(ThreadPoolTask Task, TaskPriority Priority) {
+  // Don't allow enqueueing after disabling the pool
+  assert(EnableFlag && "Queuing a thread during ThreadPool destruction");
+
+  // Counted before being visible, so that wait() can't see an empty pool
+  // while a task is on its way to a queue.
+  ++OutstandingTasks;
+  ++PendingTasks;
+
+  // A task submitted by a task of the pool goes to the front of the queue
+  // of its thread: it is picked next, while the data it shares with its
+  // parent is still in cache, and nested tasks complete depth first. Other
+  // tasks are queued in order of submission.
+  bool Nested = CurrentPool == this;
+  WorkerQueue &Queue =
+      *Queues[Nested ? CurrentQueue : NextQueue++ % Queues.size()];
+  {
+    std::lock_guard<std::mutex> LockGuard(Queue.Lock);
+    std::deque<ThreadPoolTask> &Tasks =
+        Queue.Tasks[static_cast<unsigned>(Priority)];
+    if (Nested)
+      Tasks.push_front(std::move(Task));
+    else
+      Tasks.push_back(std::move(Task));
+    ++Queue.Queued;
+  }
+
+  if (SleepingThreads) {
+    // Taking the lock orders the wake up after the sleeper started waiting.
+    std::lock_guard<std::mutex> LockGuard(SleepLock);
+    SleepCondition.notify_one();
+  }
+}
+
 void ThreadPool::wait() {
-  // Wait for all threads to complete and the queue to be empty
-  std::unique_lock<std::mutex> LockGuard(CompletionLock);
-  // The order of the checks for ActiveThreads and Tasks.empty() matters because
-  // any active threads might be modifying the Tasks queue, and this would be a
-  // race.
-  CompletionCondition.wait(LockGuard,
-                           [&] { return !ActiveThreads && Tasks.empty(); });
+  assert(CurrentPool != this && "ThreadPool::wait() called from a task");
+  while (OutstandingTasks) {
+    // Help with the queued tasks rather than blocking.
+    if (runQueuedTask())
+      continue;
+    // Wait for the tasks in flight to complete.
+    std::unique_lock<std::mutex> LockGuard(CompletionLock);
+    CompletionCondition.wait(LockGuard, [&] {
+      return !OutstandingTasks || PendingTasks > 0;
+    });
+  }
 }
 
-std::shared_future<ThreadPool::VoidTy> ThreadPool::asyncImpl(TaskTy Task) {
+void ThreadPool::waitFor(const std::shared_future<VoidTy> &Future) {
+  while (Future.wait_for(std::chrono::seconds(0)) !=
+         std::future_status::ready) {
+    if (runQueuedTask())
+      continue;
+    // Nothing to help with: the task is running on another thread, and so
+    // will be any it submits once it waits for them in turn.
+    Future.wait();
+  }
+}
+
+std::shared_future<ThreadPool::VoidTy>
+ThreadPool::asyncImpl(TaskTy Task, TaskPriority Priority) {
   /// Wrap the Task in a packaged_task to return a future object.
   PackagedTaskTy PackagedTask(std::move(Task));
   auto Future = PackagedTask.get_future();
-  {
-    // Lock the queue and push the new task
-    std::unique_lock<std::mutex> LockGuard(QueueLock);
-
-    // Don't allow enqueueing after disabling the pool
-    assert(EnableFlag && "Queuing a thread during ThreadPool destruction");
-
-    Tasks.push(std::move(PackagedTask));
-  }
-  QueueCondition.notify_one();
+  // The packaged_task is two pointers at most, it is queued in place.
+#ifndef _MSC_VER
+  enqueue(std::move(PackagedTask), Priority);
+#else
+  struct RunPackagedTask {
+    PackagedTaskTy Task;
+    void operator()() { Task(/* unused */ false); }
+  };
+  enqueue(RunPackagedTask{std::move(PackagedTask)}, Priority);
+#endif
   return Future.share();
 }
 
 // The destructor joins all threads, waiting for completion.
 ThreadPool::~ThreadPool() {
+  wait();
   {
-    std::unique_lock<std::mutex> LockGuard(QueueLock);
+    std::unique_lock<std::mutex> LockGuard(SleepLock);
     EnableFlag = false;
   }
-  QueueCondition.notify_all();
+  SleepCondition.notify_all();
   for (auto &Worker : Threads)
     Worker.join();
 }
@@ -116,38 +205,44 @@ ThreadPool::ThreadPool() : ThreadPool(0) {}
 
 // No threads are launched, issue a warning if ThreadCount is not 0
 ThreadPool::ThreadPool(unsigned ThreadCount)
-    : ActiveThreads(0) {
+    : NextQueue(0), PendingTasks(0), OutstandingTasks(0), SleepingThreads(0) {
   if (ThreadCount) {
     errs() << "Warning: request a ThreadPool with " << ThreadCount
            << " threads, but LLVM_ENABLE_THREADS has been turned off\n";
   }
+  Queues.emplace_back(new WorkerQueue());
+}
+
+void ThreadPool::enqueue(ThreadPoolTask Task, TaskPriority Priority) {
+  ++OutstandingTasks;
+  ++PendingTasks;
+  Queues[0]->Tasks[static_cast<unsigned>(Priority)].push_back(std::move(Task));
+  ++Queues[0]->Queued;
 }
 
 void ThreadPool::wait() {
   // Sequential implementation running the tasks
-  while (!Tasks.empty()) {
-    auto Task = std::move(Tasks.front());
-    Tasks.pop();
-#ifndef _MSC_VER
-        Task();
-#else
-        Task(/* unused */ false);
-#endif
-  }
+  while (runQueuedTask())
+    ;
+}
+
+void ThreadPool::waitFor(const std::shared_future<VoidTy> &Future) {
+  // The future is deferred, getting it runs the task.
+  Future.wait();
 }
 
-std::shared_future<ThreadPool::VoidTy> ThreadPool::asyncImpl(TaskTy Task) {
+std::shared_future<ThreadPool::VoidTy>
+ThreadPool::asyncImpl(TaskTy Task, TaskPriority Priority) {
 #ifndef _MSC_VER
   // Get a Future with launch::deferred execution using std::async
   auto Future = std::async(std::launch::deferred, std::move(Task)).share();
   // Wrap the future so that both ThreadPool::wait() can operate and the
   // returned future can be sync'ed on.
-  PackagedTaskTy PackagedTask([Future]() { Future.get(); });
+  enqueue([Future]() { Future.get(); }, Priority);
 #else
   auto Future = std::async(std::launch::deferred, std::move(Task), false).share();
-  PackagedTaskTy PackagedTask([Future](bool) -> bool { Future.get(); return false; });
+  enqueue([Future]() { Future.get(); }, Priority);
 #endif
-  Tasks.push(std::move(PackagedTask));
   return Future;
 }
 
@@ -31424,6 +31424,122 @@ static SDValue combineANDXORWithAllOnesIntoANDNP(SDNode *N, SelectionDAG &DAG) {
   return SDValue();
 }
 
+static bool isTernlogNot(SDValue V) {
+  return V.getOpcode() == ISD::XOR &&
+         ISD::isBuildVectorAllOnes(V.getOperand(1).getNode());
+}
+
+static bool isTernlogGate(SDValue V) {
+  switch (V.getOpcode()) {
+  case ISD::AND:
+  case ISD::OR:
+  case ISD::XOR:
+  case X86ISD::ANDNP:
+    return true;
+  }
+  return false;
+}
+
+/// Constant leaves are folded as (broadcast) loads by the single gates, a
+/// VPTERNLOG can fold at most one of them.
+static bool isTernlogConstant(SDValue V) {
+  V = peekThroughBitcasts(V);
+  if (V.getOpcode() == X86ISD::VBROADCAST)
+    V = peekThroughBitcasts(V.getOperand(0));
+  return isa<ConstantSDNode>(V) ||
+         ISD::isBuildVectorOfConstantSDNodes(V.getNode()) ||
+         ISD::isBuildVectorOfConstantFPSDNodes(V.getNode()) ||
+         getTargetConstantFromNode(V);
+}
+
+/// Grow the cone of logic gates rooted at V. An operand is expanded when it is
+/// a single-use gate of the same type and the cone keeps at most three leaves,
+/// otherwise it becomes a leaf itself.
+static bool collectTernlogCone(SDValue V, EVT VT,
+                               SmallVectorImpl<SDValue> &Leaves,
+                               SmallPtrSetImpl<SDNode *> &Gates,
+                               unsigned Depth) {
+  Gates.insert(V.getNode());
+  unsigned NumOps = isTernlogNot(V) ? 1 : 2;
+  for (unsigned i = 0; i != NumOps; ++i) {
+    SDValue Op = V.getOperand(i);
+    if (Depth < 6 && isTernlogGate(Op) && Op.getValueType() == VT &&
+        Op.hasOneUse()) {
+      SmallVector<SDValue, 3> SavedLeaves(Leaves.begin(), Leaves.end());
+      SmallPtrSet<SDNode *, 8> SavedGates(Gates.begin(), Gates.end());
+      if (collectTernlogCone(Op, VT, Leaves, Gates, Depth + 1))
+        continue;
+      Leaves.clear();
+      Leaves.append(SavedLeaves.begin(), SavedLeaves.end());
+      Gates.clear();
+      Gates.insert(SavedGates.begin(), SavedGates.end());
+    }
+    if (!is_contained(Leaves, Op)) {
+      if (Leaves.size() == 3)
+        return false;
+      Leaves.push_back(Op);
+    }
+  }
+  return true;
+}
+
+/// Truth table of the cone rooted at V, in the VPTERNLOG immediate encoding.
+static uint8_t evalTernlogCone(SDValue V, ArrayRef<SDValue> Leaves,
+                               const SmallPtrSetImpl<SDNode *> &Gates) {
+  static const uint8_t LeafTables[3] = {0xF0, 0xCC, 0xAA};
+  for (unsigned i = 0, e = Leaves.size(); i != e; ++i)
+    if (Leaves[i] == V)
+      return LeafTables[i];
+  assert(Gates.count(V.getNode()) && "Value outside of the cone");
+
+  uint8_t A = evalTernlogCone(V.getOperand(0), Leaves, Gates);
+  if (isTernlogNot(V))
+    return ~A;
+  uint8_t B = evalTernlogCone(V.getOperand(1), Leaves, Gates);
+  switch (V.getOpcode()) {
+  case ISD::AND:        return A & B;
+  case ISD::OR:         return A | B;
+  case ISD::XOR:        return A ^ B;
+  case X86ISD::ANDNP:   return ~A & B;
+  }
+  llvm_unreachable("Unexpected gate");
+}
+
+/// Fold a cone of two or more vector AND/OR/XOR/ANDNP/NOT gates with at most
+/// three distinct inputs into a single VPTERNLOG. Bit-sliced code is made of
+/// long chains of two-input gates over few values, which otherwise take one
+/// instruction per gate.
+static SDValue combineLogicToTernlog(SDNode *N, SelectionDAG &DAG,
+                                     const X86Subtarget &Subtarget) {
+  EVT VT = N->getValueType(0);
+  if (!Subtarget.hasAVX512() || !VT.isSimple() || !VT.isVector() ||
+      !VT.isInteger())
+    return SDValue();
+  if (VT.getScalarSizeInBits() != 32 && VT.getScalarSizeInBits() != 64)
+    return SDValue();
+  if (!VT.is512BitVector() && !Subtarget.hasVLX())
+    return SDValue();
+
+  SDValue Root(N, 0);
+  SmallVector<SDValue, 3> Leaves;
+  SmallPtrSet<SDNode *, 8> Gates;
+  if (!collectTernlogCone(Root, VT, Leaves, Gates, 0))
+    return SDValue();
+
+  // Only fold when it saves instructions, counting one for each constant.
+  unsigned NumConstants = count_if(Leaves, isTernlogConstant);
+  if (Gates.size() < 2 + NumConstants)
+    return SDValue();
+
+  uint8_t Imm = evalTernlogCone(Root, Leaves, Gates);
+  while (Leaves.size() < 3)
+    Leaves.push_back(Leaves[0]);
+
+  SDLoc DL(N);
+  return DAG.getNode(X86ISD::VPTERNLOG, DL, VT, Leaves[0], Leaves[1],
+                     Leaves[2], DAG.getConstant(Imm, DL, MVT::i8));
+}
+
 // On AVX/AVX2 the type v8i1 is legalized to v8i16, which is an XMM sized
 // register. In most cases we actually compare or select YMM-sized registers
 // and mixing the two types creates horrible code. This method optimizes
@@ -31607,6 +31723,9 @@ static SDValue combineAnd(SDNode *N, SelectionDAG &DAG,
       return SDValue(); // This routine will use CombineTo to replace N.
   }
 
+  if (SDValue R = combineLogicToTernlog(N, DAG, Subtarget))
+    return R;
+
   // Create BEXTR instructions
   // BEXTR is ((X >> imm) & (2**size-1))
   if (VT != MVT::i32 && VT != MVT::i64)
@@ -31883,6 +32002,9 @@ static SDValue combineOr(SDNode *N, SelectionDAG &DAG,
   if (SDValue R = combineLogicBlendIntoPBLENDV(N, DAG, Subtarget))
     return R;
 
+  if (SDValue R = combineLogicToTernlog(N, DAG, Subtarget))
+    return R;
+
   SDValue N0 = N->getOperand(0);
   SDValue N1 = N->getOperand(1);
   EVT VT = N->getValueType(0);
@@ -33550,6 +33672,9 @@ static SDValue combineXor(SDNode *N, SelectionDAG &DAG,
   if (SDValue RV = foldXorTruncShiftIntoCmp(N, DAG))
     return RV;
 
+  if (SDValue R = combineLogicToTernlog(N, DAG, Subtarget))
+    return R;
+
   if (Subtarget.hasCMov())
     if (SDValue RV = combineIntegerAbs(N, DAG))
       return RV;
@@ -33765,6 +33890,9 @@ static SDValue combineAndnp(SDNode *N, SelectionDAG &DAG,
       return SDValue(); // This routine will use CombineTo to replace N.
   }
 
+  if (SDValue R = combineLogicToTernlog(N, DAG, Subtarget))
+    return R;
+
   return SDValue();
 }
 
@@ -1,15 +1,37 @@
+#include "ConstantTimeCheck.h"
 #include "llvm/Pass.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/CallSite.h"
 #include "llvm/IR/Constant.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/InlineAsm.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/CodeExtractor.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/AssumptionCache.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/PostOrderIterator.h"
 
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm/IR/LegacyPassManager.h"
@@ -28,6 +50,47 @@
 
 using namespace llvm;
 
+static cl::opt<bool> PreSliceKeys("bitslicer-preslice-keys", cl::init(false),
+	cl::desc("Read batch-invariant global key arrays from a pre-sliced copy, "
+			 "refilled on entry to the kernels once the host bumps "
+			 "bitslicer_round_key_generation"));
+
+static cl::opt<unsigned> MaskingOrder("bitslicer-masking-order", cl::init(0),
+	cl::desc("Boolean masking order of the bit-sliced data and gates (0: no masking). "
+			 "Random words are read from the thread's bitslicer_randomness buffer"));
+
+//bits of a block held by every lane of a slice
+enum SliceLayout { BitSliced = 1, NibbleSliced = 4, ByteSliced = 8 };
+
+static cl::opt<SliceLayout> Layout("bitslicer-layout", cl::init(BitSliced),
+	cl::desc("Slicing layout of the bit-sliced buffers"),
+	cl::values(clEnumValN(BitSliced, "bit", "one slice per bit position, 32 blocks"),
+			   clEnumValN(NibbleSliced, "nibble", "one slice per nibble position, 8 blocks"),
+			   clEnumValN(ByteSliced, "byte", "one slice per byte position, 4 blocks")));
+
+static cl::list<std::string> DriverKernels("bitslicer-driver", cl::CommaSeparated,
+	cl::desc("Emit a multi-core batch driver <kernel>.batched(in, out, nblocks) for each "
+			 "kernel void <kernel>(i8 *in, i8 *out) processing one batch of blocks"),
+	cl::value_desc("kernels"));
+
+static cl::opt<unsigned> DriverBlockLen("bitslicer-driver-block-len", cl::init(16),
+	cl::desc("Byte length of the blocks of the batch drivers"));
+
+static cl::opt<bool> Instrument("bitslicer-instrument", cl::init(false),
+	cl::desc("Count the cycles spent in transpositions, orthogonal operations and "
+			 "functions holding bit-sliced code, summed over the threads in bitslicer_cycles_total"));
+
+static cl::opt<bool> PipelineTransposes("bitslicer-pipeline", cl::init(false),
+	cl::desc("Double-buffer the slices of batch loops and transpose the next batch "
+			 "while the current one is computed on"));
+
+static cl::opt<bool> GFMulPaar("bitslicer-gfmul-paar", cl::init(true),
+	cl::desc("Share the common XOR pairs of the gfmul descriptions (Paar's heuristic)"));
+
+static cl::opt<bool> RingBuffers("bitslicer-ring-buffers", cl::init(true),
+	cl::desc("Rotate the buffers that descriptions only rotate by constants by "
+			 "moving a head index instead of their slices"));
+
 
 std::vector<Instruction *> eraseList;
 std::vector<Instruction *> OrthEraseList;
@@ -37,10 +100,11 @@ std::vector<CallInst *> startSplitPoints;
 std::vector<CallInst *> endSplitPoints;
 std::vector<CallInst *> BitSliceCalls;
 std::vector<CallInst *> UnBitSliceCalls;
+std::vector<CallInst *> TransposeCalls;
 std::vector<StringRef> Descriptions;
 std::vector<StringRef> AllocOldNames;
 std::vector<AllocaInst *> AllocInstBuff;
-std::vector<AllocaInst *> AllocNewInstBuff;
+std::vector<Value *> AllocNewInstBuff;
 std::vector<StringRef> BitSlicedAllocNames;
 std::vector<AllocaInst *> BitSlicedAllocInstBuff;
 std::vector<uint64_t> BlocksNumList;
@@ -53,39 +117,264 @@ std::vector<Value *> CastInstBuff;
 std::vector<CastInst *> CastOldInstBuff;
 std::vector<Value *> BinaryOpInstBuff;
 std::vector<BinaryOperator *> BinaryOpOldInstBuff;
+std::vector<unsigned> BinaryOpSliceIdx;
+std::vector<Value *> PHIInstBuff;
+std::vector<PHINode *> PHIOldInstBuff;
+std::vector<Value *> BitCallInstBuff;
+std::vector<CallInst *> BitCallOldInstBuff;
+std::vector<GlobalVariable *> RoundKeys;
+std::vector<GlobalVariable *> SlicedRoundKeys;
+std::vector<Function *> RoundKeyUsers;
 std::vector<BinaryOperator *> ShiftInstList;
+std::vector<Function *> InstrumentedFns;
+std::vector<StringRef> RingNames;
+std::vector<StringRef> FlatNames;
+DenseMap<Value *, AllocaInst *> RingHeads;
+DenseMap<Value *, Value *> RingSliceLogicalIdx;
+
+
+//Entries of the bitslicer_cycles table of -bitslicer-instrument.
+enum InstrumentedCost { TransposeCycles, UntransposeCycles, OrthogonalCycles, RegionCycles, NumCycleCounters };
+
+
+//Blocks sliced together and slices per byte of a block, for a layout of
+//laneBits bits per lane.
+unsigned LanesPerSlice(unsigned laneBits = Layout){
+	return 32/laneBits;				//FIXME: dependant on the target machine
+}
+
+unsigned SlicesPerByte(unsigned laneBits = Layout){
+	return 8/laneBits;
+}
+
+//Number of slices holding a value of type Ty.
+unsigned NumSlices(Type *Ty){
+	return cast<IntegerType>(Ty)->getBitWidth()/Layout;
+}
+
+//Lane-wise multiplier that copies a lane element into every lane.
+uint32_t LaneRepeat(unsigned laneBits = Layout){
+	uint32_t rep = 0;
+	for(unsigned j=0; j<LanesPerSlice(laneBits); j++)
+		rep |= 1u << (j*laneBits);
+	return rep;
+}
+
+//Slice i of a value that is the same for every block: its i-th lane element
+//repeated in every lane. For the bit layout that is all-ones or zero.
+Value *BroadcastLaneElement(IRBuilder<> &builder, Value *V, unsigned i){
+	Type *Ty = V->getType();
+	uint64_t laneMask = (1u << Layout) - 1;
+	Value *elem = builder.CreateLShr(V, ConstantInt::get(Ty, i*Layout));
+	elem = builder.CreateAnd(elem, ConstantInt::get(Ty, laneMask));
+	if(Layout == BitSliced)
+		return builder.CreateMul(elem, ConstantInt::get(Ty, cast<IntegerType>(Ty)->getBitMask()));
+	return builder.CreateMul(elem, ConstantInt::get(Ty, LaneRepeat()));
+}
+
+//Moves the laneBits-bit element of Byte starting at bit elemShift to the lane
+//starting at bit laneShift of a slice.
+Value *ExtractLaneElement(IRBuilder<> &builder, Value *Byte, Value *elemShift, unsigned laneBits, Value *laneShift){
+	Type *sliceTy = builder.getInt32Ty();
+	Value *elem = builder.CreateZExt(Byte, sliceTy);
+	elem = builder.CreateLShr(elem, elemShift);
+	elem = builder.CreateAnd(elem, ConstantInt::get(sliceTy, (1u << laneBits) - 1));
+	return builder.CreateShl(elem, laneShift);
+}
+
+
+//Static array alloca behind a buffer operand, nullptr if the buffer comes from
+//anywhere else (argument, global, heap).
+AllocaInst *GetArrayAlloca(Value *V){
+	while(!isa<AllocaInst>(V)){
+		auto *Inst = dyn_cast<Instruction>(V);
+		if(!Inst || !(isa<CastInst>(Inst) || isa<GetElementPtrInst>(Inst)))
+			return nullptr;
+		V = Inst->getOperand(0);
+	}
+	AllocaInst *all = cast<AllocaInst>(V);
+	if(!isa<ArrayType>(all->getAllocatedType()))
+		return nullptr;
+	return all;
+}
+
+//Array type of a slice buffer: the alloca of a sliced region or the slice
+//parameter of a bit-sliced clone.
+ArrayType *SlicedArrayType(Value *V){
+	return cast<ArrayType>(cast<PointerType>(V->getType())->getElementType());
+}
+
+//A shift register clocked by D:all:=:D:all::rotL::k descriptions is kept as a
+//ring of slices: the slices stay where they are and a head index says which
+//one is logical slice 0. Buffers any other description touches stay flat.
+void NoteRingBuffer(StringRef Description){
+	SmallVector<StringRef, 12> tokens;
+	Description.split(tokens, ':');
+	auto eq = std::find(tokens.begin(), tokens.end(), "=");
+	if(eq == tokens.end() || eq+1 == tokens.end())
+		return;
+	auto op = std::find(eq, tokens.end(), "");
+	if(op == tokens.end() || op+1 == tokens.end())
+		return;
+	StringRef dest = tokens.front(), left = eq[1];
+	StringRef right = tokens.end() - op > 3 ? op[3] : "";
+	unsigned amount;
+	if((op[1] == "rotL" || op[1] == "rotR") && dest == left && !right.getAsInteger(10, amount)){
+		RingNames.push_back(dest);
+		return;
+	}
+	FlatNames.push_back(dest);
+	FlatNames.push_back(left);
+	FlatNames.push_back(right);
+}
+
+bool IsRingBuffer(StringRef Name){
+	return RingBuffers && is_contained(RingNames, Name) && !is_contained(FlatNames, Name);
+}
+
+//Physical slot of logical slice idx of a slice buffer: (head + idx) mod size
+//for rings, idx otherwise. Once the rotations are unrolled the head is a
+//constant and this folds away.
+Value *RingSliceIdx(IRBuilder<> &builder, Value *buf, Value *idx){
+	auto it = RingHeads.find(buf);
+	if(it == RingHeads.end())
+		return idx;
+	uint64_t size = SlicedArrayType(buf)->getNumElements();
+	Value *head = builder.CreateLoad(it->second, "ring.head");
+	Value *slot = builder.CreateAdd(idx, head, "ring.idx");
+	if(isPowerOf2_64(size))
+		return builder.CreateAnd(slot, size-1, "ring.idx");
+	Value *wrap = builder.CreateICmpUGE(slot, ConstantInt::get(slot->getType(), size), "ring.wrap");
+	return builder.CreateSelect(wrap, builder.CreateSub(slot, ConstantInt::get(slot->getType(), size)),
+								slot, "ring.idx");
+}
+
+bool IsRingSlice(Value *gep){
+	auto *GEP = dyn_cast<GetElementPtrInst>(gep);
+	return GEP && RingHeads.count(GEP->getPointerOperand());
+}
+
+//The slice GEPs of a ring are computed from the head of the time they are
+//emitted at, so an access after a rotation, or in a later iteration of a loop
+//clocking the ring, would reach the wrong slot. Every access that does not
+//follow its GEP in the same block without a call in between gets its own
+//GEP, computed right before it. Run once the rewrite walk is over.
+void RefreshRingSlices(){
+	for(auto &R : RingSliceLogicalIdx){
+		auto *GEP = cast<GetElementPtrInst>(R.first);
+		std::vector<Use *> Uses;
+		for(Use &U : GEP->uses())
+			Uses.push_back(&U);
+		for(Use *U : Uses){
+			auto *at = cast<Instruction>(U->getUser());
+			if(auto *phi = dyn_cast<PHINode>(at))
+				at = phi->getIncomingBlock(*U)->getTerminator();
+			if(at->getParent() == GEP->getParent()){
+				BasicBlock::iterator it = GEP->getIterator();
+				while(&*it != at && !isa<CallInst>(&*it))
+					++it;
+				if(&*it == at)
+					continue;
+			}
+			IRBuilder<> builder(at);
+			Value *idx = RingSliceIdx(builder, GEP->getPointerOperand(), R.second);
+			Instruction *fresh = GEP->clone();
+			fresh->setOperand(GEP->getNumOperands() - 1, idx);
+			U->set(builder.Insert(fresh));
+		}
+		if(GEP->use_empty()){
+			Value *idx = GEP->getOperand(GEP->getNumOperands() - 1);
+			GEP->eraseFromParent();
+			RecursivelyDeleteTriviallyDeadInstructions(idx);
+		}
+	}
+}
+
+bool IsBitCall(Instruction *I, Intrinsic::ID ID){
+	auto *call = dyn_cast<IntrinsicInst>(I);
+	return call && call->getIntrinsicID() == ID;
+}
+
+
+//Order of the blocks handed to llvm.bitslice.order / llvm.unbitslice.order:
+//bit 0 of the order operand numbers the bits of a byte MSB first, bits 8-15
+//give the byte size of the big-endian words the blocks are made of (0 or 1
+//for plain bytes). Both are folded into the indices of the transposition.
+struct TransposeOrder {
+	bool msbFirst = false;
+	unsigned wordBytes = 1;
+};
+
+bool GetTransposeOrder(CallInst *call, uint64_t blocksLen, TransposeOrder &order){
+	Value *op = nullptr;
+	if(IsBitCall(call, Intrinsic::bitslice_order_i32))
+		op = call->getArgOperand(3);
+	else if(IsBitCall(call, Intrinsic::unbitslice_order_i32))
+		op = call->getArgOperand(1);
+	if(!op)
+		return true;
+	
+	auto *C = dyn_cast<ConstantInt>(op);
+	if(!C){
+		errs() << "ERROR: the byte and bit order of a transposition must be a constant\n";
+		return false;
+	}
+	order.msbFirst = C->getZExtValue() & 1;
+	order.wordBytes = std::max<unsigned>((C->getZExtValue() >> 8) & 0xFF, 1);
+	if(!isPowerOf2_32(order.wordBytes) || blocksLen % order.wordBytes){
+		errs() << "ERROR: blocks of " << blocksLen << " bytes are not made of " 
+			   << order.wordBytes << "-byte words\n";
+		return false;
+	}
+	return true;
+}
+
+//Memory position of byte idx of a block: reversed within its word.
+Value *OrderedByteIdx(IRBuilder<> &builder, Value *idx, const TransposeOrder &order){
+	if(order.wordBytes == 1)
+		return idx;
+	return builder.CreateXor(idx, ConstantInt::get(idx->getType(), order.wordBytes - 1));
+}
+
+//Bit position in its byte of the element elem: counted from the top when
+//the bits are numbered MSB first.
+Value *OrderedElemShift(IRBuilder<> &builder, Value *elem, const TransposeOrder &order){
+	Value *shift = builder.CreateNSWMul(elem, ConstantInt::get(elem->getType(), Layout));
+	if(order.msbFirst)
+		shift = builder.CreateSub(ConstantInt::get(elem->getType(), 8 - Layout), shift);
+	return shift;
+}
 
 
 bool GetBitSlicedData(CallInst *call, LLVMContext &Context){
 	IRBuilder<> builder(call);
 		
-	Instruction *inputInst = cast<Instruction>(call->getArgOperand(0));
-	for(; !isa<AllocaInst>(inputInst); inputInst = cast<Instruction>(inputInst->getOperand(0)));
-	AllocaInst *blocksAlloca = cast<AllocaInst>(inputInst);
-	if(!isa<ArrayType>(blocksAlloca->getAllocatedType())){
-		errs() << "ERROR: argument 1 not a static array\n";
-	//	return false;
+	AllocaInst *blocksAlloca = GetArrayAlloca(call->getArgOperand(0));
+	if(!blocksAlloca){
+		errs() << "ERROR: argument 1 not a static array, use __builtin_i32_get_bitsliced_data_n\n";
+		return false;
 	}
 	uint64_t inputSize = cast<ArrayType>(blocksAlloca->getAllocatedType())->getNumElements();
 		
-	Instruction *outputSize = cast<Instruction>(call->getArgOperand(1));
-	for(; !isa<AllocaInst>(outputSize); outputSize = cast<Instruction>(outputSize->getOperand(0)));
-	AllocaInst *slicesAlloca = cast<AllocaInst>(outputSize);
-	
-	if(!isa<ArrayType>(slicesAlloca->getAllocatedType())){
-		errs() << "ERROR: argument 1 not a static array\n";
-	//	return false;
+	AllocaInst *slicesAlloca = GetArrayAlloca(call->getArgOperand(1));
+	if(!slicesAlloca){
+		errs() << "ERROR: argument 2 not a static array, use __builtin_i32_get_bitsliced_data_n\n";
+		return false;
 	}
-	uint64_t newSize = dyn_cast<ArrayType>(slicesAlloca->getAllocatedType())->getNumElements();	
+	uint64_t newSize = cast<ArrayType>(slicesAlloca->getAllocatedType())->getNumElements();	
 	
-	if(newSize < (inputSize/32)*8){
-		errs() << "ERROR: insufficient size of second operand.\nIt should be at least: ( " << inputSize << " / sizeof(int) ) * 8\n";
+	if(newSize < (inputSize/LanesPerSlice())*SlicesPerByte()){
+		errs() << "ERROR: insufficient size of second operand.\nIt should be at least: ( " << inputSize 
+			   << " / " << LanesPerSlice() << " ) * " << SlicesPerByte() << "\n";
 		return false;
 	}
 
 	
 	//	MDNode *MData = MDNode::get(Context, 
 	//							MDString::get(Context, "bitsliced"));
+	MDNode *MData = MDNode::get(Context, MDString::get(Context, "bit-sliced-data"));
+	blocksAlloca->setMetadata("bit-sliced-data", MData);
+	slicesAlloca->setMetadata("bit-sliced-data", MData);
 	Type *sliceTy = IntegerType::getInt32Ty(Context);						//FIXME: dependant on the target machine
 	int i, j;
 	
@@ -99,20 +388,19 @@ bool GetBitSlicedData(CallInst *call, LLVMContext &Context){
 	Value *bitVal;
 	Value *Byte;
 	int inputBits = newSize;
+	int perByte = SlicesPerByte();
 		
 	for( i = 0; i < inputBits; i++ ){
 		IdxList.at(1) = ConstantInt::get(idxTy, i);
 		sliceAddr = builder.CreateGEP(slicesAlloca, ArrayRef <Value *>(IdxList), "sliceAddr");
 		tmp = ConstantInt::get(sliceTy, 0);	
-		for( j = 0; j < 32; j++){				//FIXME: dependant on the target machine
-			IdxList.at(1) = ConstantInt::get(idxTy, j*inputBits/8+i/8);
+		for( j = 0; j < (int)LanesPerSlice(); j++){
+			IdxList.at(1) = ConstantInt::get(idxTy, j*inputBits/perByte+i/perByte);
 			Byte = builder.CreateGEP(blocksAlloca, ArrayRef <Value *>(IdxList), "Block");
 			Byte = builder.CreateLoad(Byte);
 
-			bitVal = builder.CreateZExt(Byte, sliceTy);			
-			bitVal = builder.CreateLShr(bitVal, ConstantInt::get(sliceTy, i%8));
-			bitVal = builder.CreateAnd(bitVal, ConstantInt::get(sliceTy, 1));
-			bitVal = builder.CreateShl(bitVal, ConstantInt::get(sliceTy, j));
+			bitVal = ExtractLaneElement(builder, Byte, ConstantInt::get(sliceTy, (i%perByte)*Layout), Layout,
+										ConstantInt::get(sliceTy, j*Layout));
 			tmp = builder.CreateOr(tmp, bitVal);
 		}
 		builder.CreateStore(tmp, sliceAddr);
@@ -126,29 +414,23 @@ bool GetUnBitSlicedData(CallInst *call, LLVMContext &Context){
 	IRBuilder<> builder(call);
 	int i, j, k;
 	
-	Instruction *inputInst = cast<Instruction>(call->getArgOperand(0));
-	for(; !isa<AllocaInst>(inputInst); inputInst = cast<Instruction>(inputInst->getOperand(0)));
-	AllocaInst *slicesAlloca = cast<AllocaInst>(inputInst);
-	
-	if(!isa<ArrayType>(slicesAlloca->getAllocatedType())){
-		errs() << "ERROR: argument 1 not a static array\n";
-	//	return false;
+	AllocaInst *slicesAlloca = GetArrayAlloca(call->getArgOperand(0));
+	if(!slicesAlloca){
+		errs() << "ERROR: argument 1 not a static array, use __builtin_i32_get_unbitsliced_data_n\n";
+		return false;
 	}
 	uint64_t inputSize = cast<ArrayType>(slicesAlloca->getAllocatedType())->getNumElements();
 	
-	Instruction *outputSize = cast<Instruction>(call->getArgOperand(1));
-	for(; !isa<AllocaInst>(outputSize); outputSize = cast<Instruction>(outputSize->getOperand(0)));
-	AllocaInst *outputAlloca = cast<AllocaInst>(outputSize);
-	
-	if(!isa<ArrayType>(outputAlloca->getAllocatedType())){
-		errs() << "ERROR: argument 1 not a static array\n";
-	//	return false;
+	AllocaInst *outputAlloca = GetArrayAlloca(call->getArgOperand(1));
+	if(!outputAlloca){
+		errs() << "ERROR: argument 2 not a static array, use __builtin_i32_get_unbitsliced_data_n\n";
+		return false;
 	}
 	uint64_t newSize = cast<ArrayType>(outputAlloca->getAllocatedType())->getNumElements();
 	
-	if(newSize < (inputSize/32)*8){
+	if(newSize < (inputSize/SlicesPerByte())*LanesPerSlice()){
 		errs() << "ERROR: insufficient size of second operand.\nIt should be at least: (" 
-			   << inputSize << " / sizeof(int)) * 8\n";
+			   << inputSize << " / " << SlicesPerByte() << ") * " << LanesPerSlice() << "\n";
 		return false;
 	}
 		
@@ -163,21 +445,22 @@ bool GetUnBitSlicedData(CallInst *call, LLVMContext &Context){
 	
 	Value *bitVal, *tmp;
 	Type *sliceTy = IntegerType::getInt32Ty(Context);			//FIXME: dependant on the target machine
-	int outputLen = inputSize/8;
+	int perByte = SlicesPerByte();
+	int outputLen = inputSize/perByte;
 	
-	for(i=0; i<32; i++){			//FIXME: dependant on the target machine
+	for(i=0; i<(int)LanesPerSlice(); i++){
 		for(j=0; j < outputLen; j++){
 			IdxList.at(1) = ConstantInt::get(idxTy, i*outputLen + j);
 			newByteAddr = builder.CreateGEP(outputAlloca, ArrayRef <Value *>(IdxList));
 			tmp = ConstantInt::get(byteTy, 0);
-			for(k=0;k<8;k++){
-				IdxList.at(1) = ConstantInt::get(idxTy, j*8 + k);
+			for(k=0;k<perByte;k++){
+				IdxList.at(1) = ConstantInt::get(idxTy, j*perByte + k);
 				
 				sliceAddr = builder.CreateGEP(slicesAlloca, ArrayRef <Value *>(IdxList));
 				bitVal = builder.CreateLoad(sliceAddr);
-				bitVal = builder.CreateLShr(bitVal, ConstantInt::get(sliceTy, i));
-				bitVal = builder.CreateAnd(bitVal, ConstantInt::get(sliceTy, 1));
-				bitVal = builder.CreateShl(bitVal, k);
+				bitVal = builder.CreateLShr(bitVal, ConstantInt::get(sliceTy, i*Layout));
+				bitVal = builder.CreateAnd(bitVal, ConstantInt::get(sliceTy, (1u << Layout) - 1));
+				bitVal = builder.CreateShl(bitVal, k*Layout);
 				bitVal = builder.CreateTrunc(bitVal, byteTy);
 				tmp = builder.CreateOr(tmp, bitVal);
 			}
@@ -190,122 +473,892 @@ bool GetUnBitSlicedData(CallInst *call, LLVMContext &Context){
 }
 
 
-bool BitSlice(CallInst *call, LLVMContext &Context){
+//Marks the object behind a buffer operand as holding bit-sliced data, when it
+//is something metadata can be attached to (an argument is not).
+void TagBitSlicedData(Value *ptr, CallInst *call){
+	LLVMContext &Context = call->getContext();
+	Value *obj = GetUnderlyingObject(ptr, call->getModule()->getDataLayout(), 0);
+	MDNode *MData = MDNode::get(Context, MDString::get(Context, "bit-sliced-data"));
+	if(auto *Inst = dyn_cast<Instruction>(obj))
+		Inst->setMetadata("bit-sliced-data", MData);
+	else if(auto *G = dyn_cast<GlobalVariable>(obj))
+		G->setMetadata("bit-sliced-data", MData);
+}
+
+
+//Emits for(idx = 0; idx < count; idx++) at the call and returns the loop body
+//with the loaded index; the body still needs its branch to forInc.
+BasicBlock *EmitTransposeLoop(CallInst *call, Value *count, Value *&idx, BasicBlock *&forInc){
+	LLVMContext &Context = call->getContext();
 	IRBuilder<> builder(call);
+	Type *idxTy = IntegerType::getInt64Ty(Context);
+	Value *idxZero = ConstantInt::get(idxTy, 0);
 	
-	uint64_t blocks = cast<ConstantInt>(call->getArgOperand(1))->getZExtValue();
-	uint64_t blocksLen = cast<ConstantInt>(call->getArgOperand(2))->getZExtValue();
+	IRBuilder<> entryBuilder(&*call->getFunction()->getEntryBlock().getFirstInsertionPt());
+	AllocaInst *idxAlloca = entryBuilder.CreateAlloca(idxTy, 0, "idx_i");
+	builder.CreateStore(idxZero, idxAlloca);
+	BasicBlock *head = call->getParent();
+	BasicBlock *forEnd = head->splitBasicBlock(call, "for.end");
+	
+	BasicBlock *forCond = BasicBlock::Create(Context, "for.cond", call->getFunction(), forEnd);
+	head->getTerminator()->setSuccessor(0, forCond);
+	
+	IRBuilder<> forCondBuilder(forCond);
+	idx = forCondBuilder.CreateLoad(idxAlloca);
+	Value *cmp = forCondBuilder.CreateICmpULT(idx, count, "cmp");
+	BasicBlock *forBody = BasicBlock::Create(Context, "for.body", call->getFunction(), forEnd);
+	forCondBuilder.CreateCondBr(cmp, forBody, forEnd);
+	
+	forInc = BasicBlock::Create(Context, "for.inc", call->getFunction(), forEnd);
+	IRBuilder<> forIncBuilder(forInc);
+	Value *inc = forIncBuilder.CreateLoad(idxAlloca);
+	inc = forIncBuilder.CreateAdd(inc, ConstantInt::get(idxTy, 1), "inc");
+	forIncBuilder.CreateStore(inc, idxAlloca);
+	forIncBuilder.CreateBr(forCond);
+	
+	IRBuilder<> forBodyBuilder(forBody);
+	idx = forBodyBuilder.CreateLoad(idxAlloca, "idxprom");
+	return forBody;
+}
 
-	BlocksNumList.push_back(blocks);
 
-	bool mark = false;
-/*	
-	BasicBlock *Pred = call->getParent();
-	BasicBlock *Succ = call->getParent()->splitBasicBlock(call, "for(alloca).end");
-	BasicBlock *New = BasicBlock::Create(Context, "for(alloca).cond");
-	New->insertInto(call->getFunction(), Succ);
-	Pred->getTerminator()->setSuccessor(0, New);
-*/		
-	Instruction *inputInst = cast<Instruction>(call->getArgOperand(0));
-	for(; !isa<AllocaInst>(inputInst); inputInst = cast<Instruction>(inputInst->getOperand(0)));
-	AllocaInst *oldAlloca = cast<AllocaInst>(inputInst);
-//	if(oldAlloca->getAllocatedType()->isPointerTy())
-//		isPtr = true;
-	AllocOldNames.push_back(oldAlloca->getName());
-/*
-	if(!isa<ArrayType>(oldAlloca->getAllocatedType())){
-		errs() << "ERROR: argument 1 not a static array\n";
-	//	return false;
-	}
-*/
-	MDNode *MData;
-	if(blocks > 1){
-		MData = MDNode::get(Context, 
-							MDString::get(Context, "bit-sliced-multi"));
-		oldAlloca->setMetadata("bit-sliced-multi", MData);
-	}else if(blocks == 1){
-		MData = MDNode::get(Context, 
-							MDString::get(Context, "bit-sliced"));
-		oldAlloca->setMetadata("bit-sliced", MData);
+//The byte length of a _n transposition must split evenly between the lanes of
+//a slice: a constant one is checked here, a runtime one traps when it does not.
+bool CheckLanesLength(CallInst *call, unsigned lanes){
+	Value *len = call->getArgOperand(2);
+	if(auto *C = dyn_cast<ConstantInt>(len)){
+		if(C->getZExtValue() % lanes == 0)
+			return true;
+		errs() << "ERROR: the length " << C->getZExtValue() << " of the blocks is not a multiple of the "
+			   << lanes << " lanes of a slice\n";
+		return false;
 	}
+	
+	IRBuilder<> builder(call);
+	Value *rem = builder.CreateURem(len, ConstantInt::get(len->getType(), lanes), "rem");
+	Value *uneven = builder.CreateICmpNE(rem, ConstantInt::get(len->getType(), 0), "uneven");
+	TerminatorInst *trapTerm = SplitBlockAndInsertIfThen(uneven, call, true);
+	IRBuilder<> trapBuilder(trapTerm);
+	trapBuilder.CreateCall(Intrinsic::getDeclaration(call->getModule(), Intrinsic::trap));
+	return true;
+}
 
-/*	
-	bool mark = false;
-	for(auto& U : oldAlloca->uses()){
-		User *user = U.getUser();
-		
-		auto *Inst = dyn_cast<Instruction>(user);
-		
-		if(auto *GEPInst = dyn_cast<GetElementPtrInst>(Inst)){
-			
-		}
-Inst->dump();
-		if(auto *dualCall = dyn_cast<CallInst>(Inst)){
 
-			Function *Fn = dualCall->getCalledFunction();
-			if(Fn && Fn->getIntrinsicID() == Intrinsic::bitslice_i32){
+//Same transposition as GetBitSlicedData for a buffer of any origin: the third
+//operand is the byte length of the input blocks, and may be a runtime value.
+bool GetBitSlicedDataN(CallInst *call, LLVMContext &Context){
+	Value *blocks = call->getArgOperand(0);
+	Value *slices = call->getArgOperand(1);
+	Type *sliceTy = IntegerType::getInt32Ty(Context);					//FIXME: dependant on the target machine
+	Type *idxTy = IntegerType::getInt64Ty(Context);
+	unsigned laneBits = Layout;
+	unsigned lanes = LanesPerSlice(laneBits);
+	unsigned perByte = SlicesPerByte(laneBits);
+	if(!CheckLanesLength(call, lanes))
+		return false;
+	
+	IRBuilder<> builder(call);
+	Value *len = builder.CreateZExt(call->getArgOperand(2), idxTy, "len");
+	Value *blockLen = builder.CreateUDiv(len, ConstantInt::get(idxTy, lanes), "blockLen");
+	Value *slicesNum = builder.CreateMul(blockLen, ConstantInt::get(idxTy, perByte), "slicesNum");
+	
+	Value *i;
+	BasicBlock *forInc;
+	BasicBlock *forBody = EmitTransposeLoop(call, slicesNum, i, forInc);
+	IRBuilder<> forBodyBuilder(forBody);
+	
+	Value *byteIdx = forBodyBuilder.CreateUDiv(i, ConstantInt::get(idxTy, perByte));
+	Value *elemShift = forBodyBuilder.CreateURem(i, ConstantInt::get(idxTy, perByte));
+	elemShift = forBodyBuilder.CreateMul(elemShift, ConstantInt::get(idxTy, laneBits));
+	elemShift = forBodyBuilder.CreateTrunc(elemShift, sliceTy);
+	Value *tmp = ConstantInt::get(sliceTy, 0);
+	for(unsigned j = 0; j < lanes; j++){
+		Value *off = forBodyBuilder.CreateAdd(forBodyBuilder.CreateMul(blockLen, ConstantInt::get(idxTy, j)), byteIdx);
+		Value *Byte = forBodyBuilder.CreateInBoundsGEP(blocks, off, "Block");
+		Byte = forBodyBuilder.CreateLoad(Byte);
+		
+		Value *bitVal = ExtractLaneElement(forBodyBuilder, Byte, elemShift, laneBits,
+										   ConstantInt::get(sliceTy, j*laneBits));
+		tmp = forBodyBuilder.CreateOr(tmp, bitVal);
+	}
+	Value *sliceAddr = forBodyBuilder.CreateInBoundsGEP(slices, i, "sliceAddr");
+	forBodyBuilder.CreateStore(tmp, sliceAddr);
+	forBodyBuilder.CreateBr(forInc);
+	
+	TagBitSlicedData(blocks, call);
+	TagBitSlicedData(slices, call);
+	return true;
+}
 
-				mark = true;
-			}
-			if(Fn && Fn->getIntrinsicID() == Intrinsic::unbitslice_i32){
 
-				mark = false;
-			}
-		}
-		
-		if(mark){
+//Inverse of GetBitSlicedDataN, the third operand is the byte length of the
+//output blocks.
+bool GetUnBitSlicedDataN(CallInst *call, LLVMContext &Context){
+	Value *slices = call->getArgOperand(0);
+	Value *blocks = call->getArgOperand(1);
+	Type *byteTy = IntegerType::getInt8Ty(Context);					//FIXME: dependant on the type used by the block cipher
+	Type *sliceTy = IntegerType::getInt32Ty(Context);					//FIXME: dependant on the target machine
+	Type *idxTy = IntegerType::getInt64Ty(Context);
+	unsigned laneBits = Layout;
+	unsigned lanes = LanesPerSlice(laneBits);
+	unsigned perByte = SlicesPerByte(laneBits);
+	if(!CheckLanesLength(call, lanes))
+		return false;
 	
-			MDNode *mdata = MDNode::get(oldAlloca->getContext(), 
-										MDString::get(oldAlloca->getContext(), "to_be_bit-sliced"));
-			Inst->setMetadata("to_be_bit-sliced", mdata);
-		}
+	IRBuilder<> builder(call);
+	Value *len = builder.CreateZExt(call->getArgOperand(2), idxTy, "len");
+	Value *blockLen = builder.CreateUDiv(len, ConstantInt::get(idxTy, lanes), "blockLen");
+	Value *outputLen = builder.CreateMul(blockLen, ConstantInt::get(idxTy, lanes), "outputLen");
+	
+	Value *o;
+	BasicBlock *forInc;
+	BasicBlock *forBody = EmitTransposeLoop(call, outputLen, o, forInc);
+	IRBuilder<> forBodyBuilder(forBody);
+	
+	Value *lane = forBodyBuilder.CreateUDiv(o, blockLen);
+	lane = forBodyBuilder.CreateTrunc(forBodyBuilder.CreateMul(lane, ConstantInt::get(idxTy, laneBits)), sliceTy, "lane");
+	Value *byteIdx = forBodyBuilder.CreateURem(o, blockLen);
+	Value *tmp = ConstantInt::get(byteTy, 0);
+	for(unsigned k = 0; k < perByte; k++){
+		Value *off = forBodyBuilder.CreateAdd(forBodyBuilder.CreateMul(byteIdx, ConstantInt::get(idxTy, perByte)),
+											  ConstantInt::get(idxTy, k));
+		Value *sliceAddr = forBodyBuilder.CreateInBoundsGEP(slices, off);
+		Value *bitVal = forBodyBuilder.CreateLoad(sliceAddr);
+		bitVal = forBodyBuilder.CreateLShr(bitVal, lane);
+		bitVal = forBodyBuilder.CreateAnd(bitVal, ConstantInt::get(sliceTy, (1u << laneBits) - 1));
+		bitVal = forBodyBuilder.CreateShl(bitVal, k*laneBits);
+		bitVal = forBodyBuilder.CreateTrunc(bitVal, byteTy);
+		tmp = forBodyBuilder.CreateOr(tmp, bitVal);
 	}
-*/
-	mark = false;
-	for(BasicBlock &B : *call->getFunction()){
-		for(Instruction &I : B){
-			MDNode *mdata = MDNode::get(oldAlloca->getContext(), 
-										MDString::get(oldAlloca->getContext(), "after-slice"));
-			
-			
-			if(mark)
-				I.setMetadata("after-slice", mdata);
+	Value *newByteAddr = forBodyBuilder.CreateInBoundsGEP(blocks, o);
+	forBodyBuilder.CreateStore(tmp, newByteAddr);
+	forBodyBuilder.CreateBr(forInc);
+	
+	TagBitSlicedData(slices, call);
+	return true;
+}
+
+
+//Strips the casts and all-zero GEPs off a pointer.
+Value *StripZeroOffsets(Value *V){
+	while(true){
+		V = V->stripPointerCasts();
+		auto *gep = dyn_cast<GEPOperator>(V);
+		if(!gep || !gep->hasAllZeroIndices())
+			return V;
+		V = gep->getPointerOperand();
+	}
+}
+
+
+//True if something in L other than the transposition A may write the input
+//of the next batch. The untransposition B may write the same buffer in place.
+bool ClobbersNextBatch(Loop *L, CallInst *A, CallInst *B, Value *inObj, ScalarEvolution &SE){
+	const DataLayout &DL = A->getModule()->getDataLayout();
+	for(BasicBlock *BB : L->blocks()){
+		for(Instruction& I : *BB){
+			if(&I == A || !I.mayWriteToMemory())
+				continue;
+			if(auto *II = dyn_cast<IntrinsicInst>(&I)){
+				if(II->getIntrinsicID() == Intrinsic::lifetime_start ||
+				   II->getIntrinsicID() == Intrinsic::lifetime_end)
+					continue;
+			}
 			
-			if(I.getMetadata("bit-slice-call")){
-				mark = true;
+			Value *ptr = nullptr;
+			if(auto *st = dyn_cast<StoreInst>(&I))
+				ptr = st->getPointerOperand();
+			else if(auto *mi = dyn_cast<MemIntrinsic>(&I))
+				ptr = mi->getDest();
+			else if(&I == B)
+				ptr = B->getArgOperand(1);
+			else if(auto *call = dyn_cast<CallInst>(&I)){
+				Function *Fn = call->getCalledFunction();
+				if(Fn && (Fn->getIntrinsicID() == Intrinsic::getbitsliced_n_i32 ||
+						  Fn->getIntrinsicID() == Intrinsic::getunbitsliced_n_i32))
+					ptr = call->getArgOperand(1);
 			}
+			if(!ptr)
+				return true;		//unknown call
+			
+			Value *obj = GetUnderlyingObject(ptr, DL, 0);
+			if(obj != inObj && isIdentifiedObject(obj) && isIdentifiedObject(inObj))
+				continue;
+			if(&I == B && SE.getSCEV(ptr) == SE.getSCEV(A->getArgOperand(0)))
+				continue;		//in place: batch k is written over itself
+			return true;
 		}
 	}
+	return false;
+}
+
+
+//Software-pipelines a loop over batches that transposes each batch with
+//llvm.getbitsliced.n, computes on the slices and transposes them back with
+//llvm.getunbitsliced.n. The slices get a second buffer: batch 0 is transposed
+//ahead of the loop, and each iteration transposes the next batch into the
+//spare buffer before computing on the current one, the two buffers swapping
+//at the latch. The shuffles of one batch and the logic of the other are then
+//independent, for the scheduler and the out-of-order core to overlap.
+//Returns true if a loop of F was transformed; the analyses are stale then.
+bool PipelineBatchLoop(Function &F){
+	DominatorTree DT(F);
+	LoopInfo LI(DT);
+	AssumptionCache AC(F);
+	TargetLibraryInfoImpl TLII(Triple(F.getParent()->getTargetTriple()));
+	TargetLibraryInfo TLI(TLII);
+	ScalarEvolution SE(F, TLI, AC, DT, LI);
+	const DataLayout &DL = F.getParent()->getDataLayout();
+	LLVMContext &Context = F.getContext();
 	
-	mark = false;
-	
-	for(auto& U : oldAlloca->uses()){
-		User *user = U.getUser();
-		MDNode *mdata = MDNode::get(oldAlloca->getContext(), 
-										MDString::get(oldAlloca->getContext(), "to_be_bit-sliced"));
-		auto *Inst = cast<Instruction>(user);
+	for(CallInst *A : TransposeCalls){
+		if(A->getFunction() != &F || A->getMetadata("bitslicer-pipelined") ||
+		   A->getCalledFunction()->getIntrinsicID() != Intrinsic::getbitsliced_n_i32)
+			continue;
+		Loop *L = LI.getLoopFor(A->getParent());
+		if(!L || !L->getLoopPreheader() || !L->getLoopLatch() || !L->getExitingBlock())
+			continue;
+		BasicBlock *preheader = L->getLoopPreheader();
+		BasicBlock *latch = L->getLoopLatch();
+		BasicBlock *header = L->getHeader();
 		
-		if(Inst->getMetadata("after-slice"))
-			Inst->setMetadata("to_be_bit-sliced", mdata);
+		//the slices must be a whole local array, the same for every batch
+		auto *S = dyn_cast<AllocaInst>(StripZeroOffsets(A->getArgOperand(1)));
+		if(!S || L->contains(S) || !L->isLoopInvariant(A->getArgOperand(2)))
+			continue;
+		CallInst *B = nullptr;
+		for(CallInst *c : TransposeCalls){
+			if(c->getCalledFunction()->getIntrinsicID() == Intrinsic::getunbitsliced_n_i32 &&
+			   L->contains(c) && StripZeroOffsets(c->getArgOperand(0)) == S)
+				B = c;
+		}
+		if(!B || !DT.dominates(A->getParent(), latch) || A->getParent() == header)
+			continue;
 		
-	}
-
-	/*
-	Module *M = call->getModule();
-	for(Function& F : *M){
-		for(BasicBlock& B : F){
-			for(Instruction& I : B){
-				if(auto *tmpCall = dyn_cast<CallInst>(&I)){
-					if(tmpCall == call)
-						mark = true;
+		//the slices are only touched after A in an iteration, through addresses
+		//computed in the loop
+		bool ordered = true;
+		for(BasicBlock *BB : L->blocks()){
+			for(Instruction& I : *BB){
+				if(&I == A || isa<PHINode>(&I))
+					continue;
+				for(Value *op : I.operands()){
+					if(!op->getType()->isPointerTy() || GetUnderlyingObject(op, DL, 0) != S)
+						continue;
+					auto *opInst = dyn_cast<Instruction>(op);
+					if(StripZeroOffsets(op) != S && !(opInst && L->contains(opInst)))
+						ordered = false;
+					if(!isa<GetElementPtrInst>(&I) && !isa<CastInst>(&I) && !DT.dominates(A, &I))
+						ordered = false;
 				}
-				if(I.getMetadata("to_be_bit-sliced") && mark){
-					MDNode *mdata = MDNode::get(I.getContext(), 
-									MDString::get(I.getContext(), "to_be_transformed"));
-					I.setMetadata("to_be_transformed", mdata);
+			}
+		}
+		
+		//the input pointer steps by a fixed amount per batch, the trip count is known
+		auto *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(A->getArgOperand(0)));
+		const SCEV *BTC = SE.getBackedgeTakenCount(L);
+		if(!ordered || !AR || AR->getLoop() != L || !AR->isAffine() || isa<SCEVCouldNotCompute>(BTC))
+			continue;
+		//the next batch is read while the current one is computed on, they must not overlap
+		auto *Step = dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE));
+		auto *Len = dyn_cast<ConstantInt>(A->getArgOperand(2));
+		if(!Step || !Len)
+			continue;
+		if(Step->getAPInt().abs().ult(Len->getZExtValue())){
+			errs() << "ERROR: batches of " << Len->getZExtValue() << " bytes " << Step->getAPInt().abs()
+				   << " bytes apart overlap, not pipelining the loop in " << F.getName() << "\n";
+			continue;
+		}
+		Value *inObj = GetUnderlyingObject(A->getArgOperand(0), DL, 0);
+		if(ClobbersNextBatch(L, A, B, inObj, SE))
+			continue;
+		
+		//A runs once per iteration: one more time than the back-edge when the loop
+		//exits from the latch, as many times when it exits from the header
+		Type *countTy = BTC->getType();
+		const SCEV *Count = BTC;
+		if(L->getExitingBlock() == latch)
+			Count = SE.getAddExpr(BTC, SE.getOne(countTy));
+		else if(L->getExitingBlock() != header)
+			continue;
+		const SCEV *Last = SE.getMinusSCEV(Count, SE.getOne(countTy));
+		
+		SCEVExpander Exp(SE, DL, "pipe");
+		Type *inTy = A->getArgOperand(0)->getType();
+		Type *slicesTy = A->getArgOperand(1)->getType();
+		Value *inFirst = Exp.expandCodeFor(AR->getStart(), inTy, preheader->getTerminator());
+		Value *count = Exp.expandCodeFor(Count, countTy, preheader->getTerminator());
+		Value *last = Exp.expandCodeFor(Last, countTy, preheader->getTerminator());
+		Value *inNext = Exp.expandCodeFor(AR->getPostIncExpr(SE), inTy, A);
+		Value *iter = Exp.expandCodeFor(SE.getAddRecExpr(SE.getZero(countTy), SE.getOne(countTy), L, SCEV::FlagAnyWrap),
+										countTy, A);
+		
+		//batch 0, if there is one
+		TerminatorInst *firstTerm = preheader->getTerminator();
+		if(L->getExitingBlock() == header){
+			IRBuilder<> builder(firstTerm);
+			Value *any = builder.CreateICmpNE(count, ConstantInt::get(countTy, 0), "any");
+			firstTerm = SplitBlockAndInsertIfThen(any, preheader->getTerminator(), false);
+			preheader = firstTerm->getSuccessor(0);		//the tail now enters the loop
+		}
+		auto *first = cast<CallInst>(A->clone());
+		first->insertBefore(firstTerm);
+		first->setArgOperand(0, inFirst);
+		first->setArgOperand(1, IRBuilder<>(first).CreatePointerCast(S, slicesTy));
+		
+		//the spare buffer and the two swapping pointers
+		auto *spare = cast<AllocaInst>(S->clone());
+		spare->insertAfter(S);
+		spare->setName(S->getName() + ".next");
+		PHINode *cur = PHINode::Create(S->getType(), 2, "slices.cur", &header->front());
+		PHINode *next = PHINode::Create(S->getType(), 2, "slices.next", &header->front());
+		cur->addIncoming(S, preheader);
+		cur->addIncoming(next, latch);
+		next->addIncoming(spare, preheader);
+		next->addIncoming(cur, latch);
+		
+		IRBuilder<> headerBuilder(&*header->getFirstInsertionPt());
+		for(BasicBlock *BB : L->blocks()){
+			for(Instruction& I : *BB){
+				if(isa<PHINode>(&I))
+					continue;
+				for(Use &U : I.operands()){
+					if(U->getType()->isPointerTy() && StripZeroOffsets(U) == S)
+						U.set(headerBuilder.CreatePointerCast(cur, U->getType()));
 				}
 			}
-			//B.dump();
+		}
+		
+		//batch k+1, but for the last batch
+		IRBuilder<> builder(A);
+		Value *more = builder.CreateICmpNE(iter, last, "more");
+		TerminatorInst *nextTerm = SplitBlockAndInsertIfThen(more, A, false);
+		A->moveBefore(nextTerm);
+		A->setArgOperand(0, inNext);
+		A->setArgOperand(1, IRBuilder<>(A).CreatePointerCast(next, slicesTy));
+		
+		MDNode *MData = MDNode::get(Context, MDString::get(Context, "bitslicer-pipelined"));
+		A->setMetadata("bitslicer-pipelined", MData);
+		first->setMetadata("bitslicer-pipelined", MData);
+		TransposeCalls.push_back(first);
+		eraseList.push_back(first);
+		return true;
+	}
+	return false;
+}
+
+
+//Transposes the 32x32 bit matrix whose row k is rows[k]: afterwards bit k of
+//rows[p] is what bit p of rows[k] was. The transposition is its own inverse.
+void TransposeTile(IRBuilder<> &builder, std::vector<Value *> &rows){
+	Type *sliceTy = builder.getInt32Ty();
+	uint32_t m = 0x0000FFFF;
+	
+	for(unsigned j = 16; j != 0; j >>= 1, m ^= m << j){
+		for(unsigned k = 0; k < 32; k = ((k | j) + 1) & ~j){
+			Value *t = builder.CreateLShr(rows[k], ConstantInt::get(sliceTy, j));
+			t = builder.CreateXor(t, rows[k | j]);
+			t = builder.CreateAnd(t, ConstantInt::get(sliceTy, m));
+			rows[k] = builder.CreateXor(rows[k], builder.CreateShl(t, ConstantInt::get(sliceTy, j)));
+			rows[k | j] = builder.CreateXor(rows[k | j], t);
+		}
+	}
+}
+
+
+//Word that the in-place transposition moves word p to: after the tile
+//transpositions slice 32*c + k sits in word c of block k.
+uint64_t InPlaceSliceWord(uint64_t p, uint64_t wordsPerBlock, bool inverse){
+	if(inverse)
+		return (p % 32)*wordsPerBlock + p/32;
+	return (p % wordsPerBlock)*32 + p/wordsPerBlock;
+}
+
+
+//Bit-slices the 32 blocks in their own buffer, no stack copy: every 32-bit
+//column of the blocks is a 32x32 bit tile transposed in registers, then the
+//words are permuted along the cycles of the block/slice index permutation, so
+//slice i ends up in word i as with GetBitSlicedData. The inverse runs the
+//same steps backwards.
+bool TransposeInPlace(CallInst *call, LLVMContext &Context, bool inverse){
+	IRBuilder<> builder(call);
+	Type *sliceTy = IntegerType::getInt32Ty(Context);					//FIXME: dependant on the target machine
+	Type *idxTy = IntegerType::getInt64Ty(Context);
+	
+	if(Layout != BitSliced){
+		errs() << "ERROR: in-place transposition only supports the bit layout, use the _n form\n";
+		return false;
+	}
+	if(!isa<ConstantInt>(call->getArgOperand(1))){
+		errs() << "ERROR: in-place transposition needs a constant length, use the _n form\n";
+		return false;
+	}
+	uint64_t len = cast<ConstantInt>(call->getArgOperand(1))->getZExtValue();
+	if(len % 128){
+		errs() << "ERROR: in-place transposition needs blocks of a multiple of 4 bytes\n";
+		return false;
+	}
+	//bit p of a tile row must be bit p%8 of byte p/8 of the column: on a
+	//big-endian target the words of the blocks are byte-swapped around the tiles
+	bool swap = call->getModule()->getDataLayout().isBigEndian();
+	Function *bswap = Intrinsic::getDeclaration(call->getModule(), Intrinsic::bswap, sliceTy);
+	uint64_t wordsPerBlock = len/128;
+	uint64_t words = len/4;
+	Value *buf = builder.CreateBitCast(call->getArgOperand(0), PointerType::getUnqual(sliceTy), "words");
+	
+	auto transposeTiles = [&](){
+		for(uint64_t c = 0; c < wordsPerBlock; c++){
+			std::vector<Value *> rows;
+			std::vector<Value *> addrs;
+			for(uint64_t k = 0; k < 32; k++){
+				addrs.push_back(builder.CreateInBoundsGEP(buf, ConstantInt::get(idxTy, k*wordsPerBlock + c)));
+				rows.push_back(builder.CreateAlignedLoad(addrs.back(), 1));
+				if(swap && !inverse)
+					rows.back() = builder.CreateCall(bswap, rows.back());
+			}
+			TransposeTile(builder, rows);
+			for(uint64_t k = 0; k < 32; k++){
+				if(swap && inverse)
+					rows[k] = builder.CreateCall(bswap, rows[k]);
+				builder.CreateAlignedStore(rows[k], addrs[k], 1);
+			}
+		}
+	};
+	
+	auto permuteWords = [&](){
+		std::vector<bool> moved(words, false);
+		for(uint64_t s = 0; s < words; s++){
+			if(moved[s] || InPlaceSliceWord(s, wordsPerBlock, inverse) == s)
+				continue;
+			Value *carry = builder.CreateAlignedLoad(builder.CreateInBoundsGEP(buf, ConstantInt::get(idxTy, s)), 1);
+			uint64_t cur = s;
+			do{
+				uint64_t next = InPlaceSliceWord(cur, wordsPerBlock, inverse);
+				Value *addr = builder.CreateInBoundsGEP(buf, ConstantInt::get(idxTy, next));
+				Value *tmp = next != s ? builder.CreateAlignedLoad(addr, 1) : nullptr;
+				builder.CreateAlignedStore(carry, addr, 1);
+				moved[next] = true;
+				carry = tmp;
+				cur = next;
+			}while(cur != s);
+		}
+	};
+	
+	if(inverse){
+		permuteWords();
+		transposeTiles();
+	}else{
+		transposeTiles();
+		permuteWords();
+	}
+	
+	TagBitSlicedData(call->getArgOperand(0), call);
+	return true;
+}
+
+
+//Lane j of a batch counts j blocks past the IV: bit b of the lane index, seen
+//across the lanes, is the same constant slice for every batch. Lane indices
+//fit in 5 bits, the slices of the bits above are 0.
+uint32_t LaneIndexSlice(unsigned b){
+	uint32_t slice = 0;
+	if(b >= 5)
+		return 0;
+	for(unsigned j=0; j<32; j++){			//FIXME: dependant on the target machine
+		if((j >> b) & 1)
+			slice |= 1u << j;
+	}
+	return slice;
+}
+
+
+//Index of the slice holding bit b of the big-endian counter ending the block.
+uint64_t CounterSliceIdx(uint64_t blockLen, uint64_t b){
+	return (blockLen - 1 - b/8)*8 + b%8;
+}
+
+
+//Adds the broadcast constant K to the sliced counter, one full-adder per bit
+//(a half-adder chain once the bits of K are over). Slices that the addition
+//leaves untouched are not stored.
+void AddToBitSlicedCounter(IRBuilder<> &builder, Value *slices, uint64_t blockLen, 
+						   uint64_t ctrBits, uint64_t K){
+	Type *idxTy = IntegerType::getInt64Ty(builder.getContext());
+	Value *carry = nullptr;
+	
+	for(uint64_t b=0; b<ctrBits; b++){
+		bool kb = (b < 64) && ((K >> b) & 1);
+		if(!kb && !carry)
+			continue;
+		Value *sliceAddr = builder.CreateInBoundsGEP(slices, ConstantInt::get(idxTy, CounterSliceIdx(blockLen, b)));
+		Value *x = builder.CreateLoad(sliceAddr, "ctr");
+		Value *sum;
+		if(kb){
+			sum = builder.CreateNot(carry ? builder.CreateXor(x, carry) : x, "ctr");
+			carry = carry ? builder.CreateOr(x, carry, "carry") : x;
+		}else{
+			sum = builder.CreateXor(x, carry, "ctr");
+			carry = builder.CreateAnd(x, carry, "carry");
+		}
+		builder.CreateStore(sum, sliceAddr);
+	}
+}
+
+
+//Writes the bit-sliced form of the CTR blocks IV, IV+1, ... IV+31 without
+//transposing them: the nonce bits are the same for every lane and the counter
+//is the broadcast of the IV counter plus the constant lane-index slices.
+bool BitSliceCounter(CallInst *call, LLVMContext &Context){
+	IRBuilder<> builder(call);
+	Value *slices = call->getArgOperand(0);
+	Value *iv = call->getArgOperand(1);
+	
+	if(Layout != BitSliced){
+		errs() << "ERROR: sliced counters are only supported with the bit layout\n";
+		return false;
+	}
+	if(!isa<ConstantInt>(call->getArgOperand(2)) || !isa<ConstantInt>(call->getArgOperand(3))){
+		errs() << "ERROR: block and counter sizes must be constants\n";
+		return false;
+	}
+	uint64_t blockLen = cast<ConstantInt>(call->getArgOperand(2))->getZExtValue();
+	uint64_t ctrBits = cast<ConstantInt>(call->getArgOperand(3))->getZExtValue()*8;
+	if(ctrBits > blockLen*8){
+		errs() << "ERROR: counter larger than the block\n";
+		return false;
+	}
+	
+	Type *sliceTy = IntegerType::getInt32Ty(Context);				//FIXME: dependant on the target machine
+	Type *idxTy = IntegerType::getInt64Ty(Context);
+	std::vector<Value *> bitMasks;
+	uint64_t i;
+	
+	for(i=0; i<blockLen*8; i++){
+		Value *Byte = builder.CreateInBoundsGEP(iv, ConstantInt::get(idxTy, i/8), "Block");
+		Byte = builder.CreateLoad(Byte);
+		Value *bitVal = builder.CreateZExt(Byte, sliceTy);
+		bitVal = builder.CreateLShr(bitVal, ConstantInt::get(sliceTy, i%8));
+		bitVal = builder.CreateAnd(bitVal, ConstantInt::get(sliceTy, 1));
+		bitMasks.push_back(builder.CreateNeg(bitVal, "broadcast"));		//0 or ~0
+	}
+	
+	Value *carry = nullptr;
+	for(uint64_t b=0; b<ctrBits; b++){
+		uint64_t sliceIdx = CounterSliceIdx(blockLen, b);
+		Value *a = bitMasks.at(sliceIdx);
+		uint32_t lane = LaneIndexSlice(b);
+		Value *t = lane ? builder.CreateXor(a, ConstantInt::get(sliceTy, lane)) : a;
+		Value *sum = carry ? builder.CreateXor(t, carry, "ctr") : t;
+		if(lane)
+			carry = carry ? builder.CreateOr(builder.CreateAnd(a, ConstantInt::get(sliceTy, lane)),
+											 builder.CreateAnd(carry, t), "carry")
+						  : builder.CreateAnd(a, ConstantInt::get(sliceTy, lane), "carry");
+		else if(carry)
+			carry = builder.CreateAnd(a, carry, "carry");
+		bitMasks.at(sliceIdx) = sum;
+	}
+	
+	for(i=0; i<blockLen*8; i++){
+		Value *sliceAddr = builder.CreateInBoundsGEP(slices, ConstantInt::get(idxTy, i), "sliceAddr");
+		builder.CreateStore(bitMasks.at(i), sliceAddr);
+	}
+	
+	TagBitSlicedData(slices, call);
+	return true;
+}
+
+
+//Moves a sliced CTR batch to the next one: every lane advances by the number
+//of lanes.
+bool IncrementBitSlicedCounter(CallInst *call, LLVMContext &Context){
+	IRBuilder<> builder(call);
+	
+	if(Layout != BitSliced){
+		errs() << "ERROR: sliced counters are only supported with the bit layout\n";
+		return false;
+	}
+	if(!isa<ConstantInt>(call->getArgOperand(1)) || !isa<ConstantInt>(call->getArgOperand(2))){
+		errs() << "ERROR: block and counter sizes must be constants\n";
+		return false;
+	}
+	uint64_t blockLen = cast<ConstantInt>(call->getArgOperand(1))->getZExtValue();
+	uint64_t ctrBits = cast<ConstantInt>(call->getArgOperand(2))->getZExtValue()*8;
+	if(ctrBits > blockLen*8){
+		errs() << "ERROR: counter larger than the block\n";
+		return false;
+	}
+	
+	AddToBitSlicedCounter(builder, call->getArgOperand(0), blockLen, ctrBits, 32);	//FIXME: dependant on the target machine
+	return true;
+}
+
+
+
+//Column scan, BitWeaving style: bit j of bitmap[k] is set if the code
+//codes[32*k + j], an unsigned integer of width bits, is in [lo, hi]. Every
+//chunk of 32 codes is bit-sliced in registers and compared against the
+//bounds most significant bit first; the comparison stops as soon as every
+//lane differs from both bounds. The last, partial chunk is read from a zeroed
+//copy and its unused lanes are cleared. A bound past the width is clamped to
+//the largest code, and an empty range (lo > hi) clears the whole bitmap: a
+//comparison col < C is the range [0, C-1] only for C > 0.
+bool BitSlicedScan(CallInst *call, LLVMContext &Context){
+	Value *codes = call->getArgOperand(0);
+	Value *bitmap = call->getArgOperand(1);
+	Type *sliceTy = IntegerType::getInt32Ty(Context);					//FIXME: dependant on the target machine
+	Type *idxTy = IntegerType::getInt64Ty(Context);
+	Value *allOnes = Constant::getAllOnesValue(sliceTy);
+	
+	auto *widthC = dyn_cast<ConstantInt>(call->getArgOperand(3));
+	if(!widthC || widthC->getZExtValue() == 0 || widthC->getZExtValue() > 32){
+		errs() << "ERROR: the code width of a scan must be a constant between 1 and 32 bits\n";
+		return false;
+	}
+	unsigned width = widthC->getZExtValue();
+	
+	IRBuilder<> builder(call);
+	IRBuilder<> entryBuilder(&*call->getFunction()->getEntryBlock().getFirstInsertionPt());
+	ArrayType *chunkTy = ArrayType::get(sliceTy, 32);
+	AllocaInst *tail = entryBuilder.CreateAlloca(chunkTy, 0, "tail");
+	builder.CreateStore(Constant::getNullValue(chunkTy), tail);
+	AllocaInst *ltLo = entryBuilder.CreateAlloca(sliceTy, 0, "ltLo");
+	AllocaInst *eqLo = entryBuilder.CreateAlloca(sliceTy, 0, "eqLo");
+	AllocaInst *gtHi = entryBuilder.CreateAlloca(sliceTy, 0, "gtHi");
+	AllocaInst *eqHi = entryBuilder.CreateAlloca(sliceTy, 0, "eqHi");
+	Value *count = builder.CreateZExt(call->getArgOperand(2), idxTy, "count");
+	Value *full = builder.CreateLShr(count, ConstantInt::get(idxTy, 5), "full");
+	Value *rem = builder.CreateAnd(count, ConstantInt::get(idxTy, 31), "rem");
+	Value *chunks = builder.CreateAdd(full, builder.CreateZExt(builder.CreateICmpNE(rem, ConstantInt::get(idxTy, 0)), idxTy), "chunks");
+	Value *tailMask = builder.CreateShl(ConstantInt::get(idxTy, 1), rem);
+	tailMask = builder.CreateTrunc(builder.CreateSub(tailMask, ConstantInt::get(idxTy, 1)), sliceTy, "tailMask");
+	Value *lo = call->getArgOperand(4);
+	Value *hi = call->getArgOperand(5);
+	//only width bits of the bounds are compared
+	Value *maxCode = ConstantInt::get(sliceTy, width == 32 ? ~0u : (1u << width) - 1);
+	hi = builder.CreateSelect(builder.CreateICmpUGT(hi, maxCode), maxCode, hi, "hi");
+	Value *rangeMask = builder.CreateSelect(builder.CreateICmpUGT(lo, hi), ConstantInt::get(sliceTy, 0), 
+											allOnes, "rangeMask");
+	
+	//copy of the partial chunk
+	Value *j;
+	BasicBlock *forInc;
+	BasicBlock *forBody = EmitTransposeLoop(call, rem, j, forInc);
+	IRBuilder<> copyBuilder(forBody);
+	Value *src = copyBuilder.CreateAdd(copyBuilder.CreateShl(full, ConstantInt::get(idxTy, 5)), j);
+	src = copyBuilder.CreateLoad(copyBuilder.CreateInBoundsGEP(codes, src));
+	Value *tailIdx[] = {ConstantInt::get(idxTy, 0), j};
+	copyBuilder.CreateStore(src, copyBuilder.CreateInBoundsGEP(tail, tailIdx));
+	copyBuilder.CreateBr(forInc);
+	
+	Value *k;
+	forBody = EmitTransposeLoop(call, chunks, k, forInc);
+	IRBuilder<> forBodyBuilder(forBody);
+	Value *isFull = forBodyBuilder.CreateICmpULT(k, full);
+	Value *chunk = forBodyBuilder.CreateInBoundsGEP(codes, forBodyBuilder.CreateShl(k, ConstantInt::get(idxTy, 5)));
+	chunk = forBodyBuilder.CreateSelect(isFull, chunk, forBodyBuilder.CreateBitCast(tail, chunk->getType()), "chunk");
+	std::vector<Value *> rows;
+	for(unsigned r = 0; r < 32; r++)
+		rows.push_back(forBodyBuilder.CreateLoad(forBodyBuilder.CreateInBoundsGEP(chunk, ConstantInt::get(idxTy, r))));
+	TransposeTile(forBodyBuilder, rows);			//rows[b] holds bit b of the 32 codes
+	forBodyBuilder.CreateStore(ConstantInt::get(sliceTy, 0), ltLo);
+	forBodyBuilder.CreateStore(allOnes, eqLo);
+	forBodyBuilder.CreateStore(ConstantInt::get(sliceTy, 0), gtHi);
+	forBodyBuilder.CreateStore(allOnes, eqHi);
+	
+	BasicBlock *scanEnd = BasicBlock::Create(Context, "scan.end", call->getFunction(), forInc);
+	BasicBlock *bitBlock = forBody;
+	for(int b = width - 1; b >= 0; b--){
+		IRBuilder<> bitBuilder(bitBlock);
+		Value *x = rows[b];
+		//bit b of a bound broadcast to every lane
+		Value *loBit = bitBuilder.CreateAnd(bitBuilder.CreateLShr(lo, b), ConstantInt::get(sliceTy, 1));
+		loBit = bitBuilder.CreateNeg(loBit, "loBit");
+		Value *hiBit = bitBuilder.CreateAnd(bitBuilder.CreateLShr(hi, b), ConstantInt::get(sliceTy, 1));
+		hiBit = bitBuilder.CreateNeg(hiBit, "hiBit");
+		
+		Value *eq = bitBuilder.CreateLoad(eqLo);
+		Value *lt = bitBuilder.CreateAnd(eq, bitBuilder.CreateAnd(bitBuilder.CreateNot(x), loBit));
+		bitBuilder.CreateStore(bitBuilder.CreateOr(bitBuilder.CreateLoad(ltLo), lt), ltLo);
+		Value *newEqLo = bitBuilder.CreateAnd(eq, bitBuilder.CreateNot(bitBuilder.CreateXor(x, loBit)));
+		bitBuilder.CreateStore(newEqLo, eqLo);
+		
+		eq = bitBuilder.CreateLoad(eqHi);
+		Value *gt = bitBuilder.CreateAnd(eq, bitBuilder.CreateAnd(x, bitBuilder.CreateNot(hiBit)));
+		bitBuilder.CreateStore(bitBuilder.CreateOr(bitBuilder.CreateLoad(gtHi), gt), gtHi);
+		Value *newEqHi = bitBuilder.CreateAnd(eq, bitBuilder.CreateNot(bitBuilder.CreateXor(x, hiBit)));
+		bitBuilder.CreateStore(newEqHi, eqHi);
+		
+		if(b == 0){
+			bitBuilder.CreateBr(scanEnd);
+			break;
+		}
+		//early pruning: every lane is already decided
+		Value *undecided = bitBuilder.CreateOr(newEqLo, newEqHi);
+		Value *decided = bitBuilder.CreateICmpEQ(undecided, ConstantInt::get(sliceTy, 0), "decided");
+		bitBlock = BasicBlock::Create(Context, "scan.bit", call->getFunction(), scanEnd);
+		bitBuilder.CreateCondBr(decided, scanEnd, bitBlock);
+	}
+	
+	IRBuilder<> endBuilder(scanEnd);
+	Value *res = endBuilder.CreateOr(endBuilder.CreateLoad(ltLo), endBuilder.CreateLoad(gtHi));
+	res = endBuilder.CreateNot(res, "inRange");
+	res = endBuilder.CreateAnd(res, endBuilder.CreateSelect(isFull, allOnes, tailMask));
+	res = endBuilder.CreateAnd(res, rangeMask);
+	endBuilder.CreateStore(res, endBuilder.CreateInBoundsGEP(bitmap, k));
+	endBuilder.CreateBr(forInc);
+	return true;
+}
+
+bool BitSlice(CallInst *call, LLVMContext &Context){
+	IRBuilder<> builder(call);
+	
+	uint64_t blocks = cast<ConstantInt>(call->getArgOperand(1))->getZExtValue();
+	uint64_t blocksLen = cast<ConstantInt>(call->getArgOperand(2))->getZExtValue();
+
+	if(blocks > LanesPerSlice())
+		Context.emitError(call, "more blocks than lanes in a slice for the selected layout");
+	TransposeOrder order;
+	if(!GetTransposeOrder(call, blocksLen, order))
+		return false;
+
+	BlocksNumList.push_back(blocks);
+
+	bool mark = false;
+/*	
+	BasicBlock *Pred = call->getParent();
+	BasicBlock *Succ = call->getParent()->splitBasicBlock(call, "for(alloca).end");
+	BasicBlock *New = BasicBlock::Create(Context, "for(alloca).cond");
+	New->insertInto(call->getFunction(), Succ);
+	Pred->getTerminator()->setSuccessor(0, New);
+*/		
+	Instruction *inputInst = cast<Instruction>(call->getArgOperand(0));
+	for(; !isa<AllocaInst>(inputInst); inputInst = cast<Instruction>(inputInst->getOperand(0)));
+	AllocaInst *oldAlloca = cast<AllocaInst>(inputInst);
+//	if(oldAlloca->getAllocatedType()->isPointerTy())
+//		isPtr = true;
+	AllocOldNames.push_back(oldAlloca->getName());
+/*
+	if(!isa<ArrayType>(oldAlloca->getAllocatedType())){
+		errs() << "ERROR: argument 1 not a static array\n";
+	//	return false;
+	}
+*/
+	MDNode *MData;
+	if(blocks > 1){
+		MData = MDNode::get(Context, 
+							MDString::get(Context, "bit-sliced-multi"));
+		oldAlloca->setMetadata("bit-sliced-multi", MData);
+	}else if(blocks == 1){
+		MData = MDNode::get(Context, 
+							MDString::get(Context, "bit-sliced"));
+		oldAlloca->setMetadata("bit-sliced", MData);
+	}
+
+/*	
+	bool mark = false;
+	for(auto& U : oldAlloca->uses()){
+		User *user = U.getUser();
+		
+		auto *Inst = dyn_cast<Instruction>(user);
+		
+		if(auto *GEPInst = dyn_cast<GetElementPtrInst>(Inst)){
+			
+		}
+Inst->dump();
+		if(auto *dualCall = dyn_cast<CallInst>(Inst)){
+
+			Function *Fn = dualCall->getCalledFunction();
+			if(Fn && Fn->getIntrinsicID() == Intrinsic::bitslice_i32){
+
+				mark = true;
+			}
+			if(Fn && Fn->getIntrinsicID() == Intrinsic::unbitslice_i32){
+
+				mark = false;
+			}
+		}
+		
+		if(mark){
+	
+			MDNode *mdata = MDNode::get(oldAlloca->getContext(), 
+										MDString::get(oldAlloca->getContext(), "to_be_bit-sliced"));
+			Inst->setMetadata("to_be_bit-sliced", mdata);
+		}
+	}
+*/
+	mark = false;
+	//only the uses after this call read the slices: with several buffers, the
+	//ones between two calls are already after the first one
+	bool afterCall = false;
+	SmallPtrSet<Instruction *, 32> AfterCall;
+	for(BasicBlock &B : *call->getFunction()){
+		for(Instruction &I : B){
+			MDNode *mdata = MDNode::get(oldAlloca->getContext(), 
+										MDString::get(oldAlloca->getContext(), "after-slice"));
+			
+			
+			if(mark)
+				I.setMetadata("after-slice", mdata);
+			if(afterCall)
+				AfterCall.insert(&I);
+			
+			if(I.getMetadata("bit-slice-call")){
+				mark = true;
+			}
+			if(&I == call)
+				afterCall = true;
+		}
+	}
+	
+	mark = false;
+	
+	//CSE may have merged the address of byte 0 with the buffer pointer of the
+	//intrinsics: the accesses after the call get their own copy of it
+	if(auto *ptr = dyn_cast<GetElementPtrInst>(call->getArgOperand(0))){
+		Instruction *copy = nullptr;
+		for(auto UI = ptr->use_begin(); UI != ptr->use_end();){
+			Use &U = *UI++;
+			auto *Inst = cast<Instruction>(U.getUser());
+			if(isa<CallInst>(Inst) || !AfterCall.count(Inst))
+				continue;
+			if(!copy){
+				copy = ptr->clone();
+				copy->insertAfter(call);
+				copy->setMetadata("after-slice", MDNode::get(oldAlloca->getContext(), 
+										MDString::get(oldAlloca->getContext(), "after-slice")));
+				AfterCall.insert(copy);
+			}
+			U.set(copy);
+		}
+	}
+	
+	for(auto& U : oldAlloca->uses()){
+		User *user = U.getUser();
+		MDNode *mdata = MDNode::get(oldAlloca->getContext(), 
+										MDString::get(oldAlloca->getContext(), "to_be_bit-sliced"));
+		auto *Inst = cast<Instruction>(user);
+		
+		if(Inst->getMetadata("after-slice") && AfterCall.count(Inst))
+			Inst->setMetadata("to_be_bit-sliced", mdata);
+		
+	}
+
+	/*
+	Module *M = call->getModule();
+	for(Function& F : *M){
+		for(BasicBlock& B : F){
+			for(Instruction& I : B){
+				if(auto *tmpCall = dyn_cast<CallInst>(&I)){
+					if(tmpCall == call)
+						mark = true;
+				}
+				if(I.getMetadata("to_be_bit-sliced") && mark){
+					MDNode *mdata = MDNode::get(I.getContext(), 
+									MDString::get(I.getContext(), "to_be_transformed"));
+					I.setMetadata("to_be_transformed", mdata);
+				}
+			}
+			//B.dump();
 		}
 	}
 	*/
@@ -325,10 +1378,17 @@ Inst->dump();
 
 	Type *sliceTy = IntegerType::getInt32Ty(Context);
 	ArrayType *arrTy;
-	arrTy = ArrayType::get(sliceTy, blocksLen*8);		//FIXME: need to make it type dependent.
+	arrTy = ArrayType::get(sliceTy, blocksLen*SlicesPerByte());		//FIXME: need to make it type dependent.
 	
 	AllocaInst *all = builder.CreateAlloca(arrTy, 0, "SLICES");
+	all->setMetadata("bit-sliced-data", MDNode::get(Context, MDString::get(Context, "bit-sliced-data")));
 	AllocNewInstBuff.push_back(all);
+	if(IsRingBuffer(oldAlloca->getName())){
+		IRBuilder<> entryBuilder(&*call->getFunction()->getEntryBlock().getFirstInsertionPt());
+		AllocaInst *head = entryBuilder.CreateAlloca(IntegerType::getInt64Ty(Context), 0, "ring.head");
+		builder.CreateStore(ConstantInt::get(head->getAllocatedType(), 0), head);
+		RingHeads[all] = head;
+	}
 	
 	//int i, j;
 	
@@ -346,6 +1406,8 @@ Inst->dump();
 	Value *bitVal;
 	Value *sliceAddr;
 	int BitSizeOfInput = blocksLen*8;
+	int perByte = SlicesPerByte();
+	Value *laneMask = ConstantInt::get(sliceTy, (1u << Layout) - 1);
 
 if(blocks > 1){			//FIXME: ADD THIS WARNING IN THE DOCUMENTATION: if a different size of the program dependent on the number of blocks processed in parallel is not an issue and you want more efficiency you'd better specify that you use just 1 block. If the different size of the program is an issue you should put always 32 as number of blocks (or the maximum value you use in your program). In that case, ALLOCATE FOR 32 BLOCKS AS WELL, AND FILL THE REMAINING SPACE WITH ZEROS!!
 
@@ -361,7 +1423,7 @@ if(blocks > 1){			//FIXME: ADD THIS WARNING IN THE DOCUMENTATION: if a different
 
 	IRBuilder<> forCondBuilder(forCond);
 	Value *idx = forCondBuilder.CreateLoad(idxAlloca);
-	Value *cmp = forCondBuilder.CreateICmpSLT(idx, ConstantInt::get(idxTy, BitSizeOfInput), "cmp");
+	Value *cmp = forCondBuilder.CreateICmpSLT(idx, ConstantInt::get(idxTy, blocksLen*perByte), "cmp");
 	BasicBlock *forBody = BasicBlock::Create(Context, "for.body", call->getFunction(), forEnd);
 	forCondBuilder.CreateCondBr(cmp, forBody, forEnd);
 	
@@ -384,7 +1446,8 @@ if(blocks > 1){			//FIXME: ADD THIS WARNING IN THE DOCUMENTATION: if a different
 //	
 	IRBuilder<> forBody2Builder(forBody2);
 	idx = forBody2Builder.CreateLoad(idxAlloca, "idxprom");
-	Value *div = forBody2Builder.CreateSDiv(idx, ConstantInt::get(idxTy, 8), "div"); //coloumn i = 0, 1,... #input-elements
+	Value *div = forBody2Builder.CreateSDiv(idx, ConstantInt::get(idxTy, perByte), "div"); //coloumn i = 0, 1,... #input-elements
+	div = OrderedByteIdx(forBody2Builder, div, order);
 	idx2 = forBody2Builder.CreateLoad(idx2Alloca, "idxprom");
 	//Value *div2 = forBody2Builder.CreateSDiv(idx2, ConstantInt::get(idxTy, 8), "div");
 	Value *mul = forBody2Builder.CreateNSWMul(idx2, ConstantInt::get(idxTy, blocksLen), "mul"); //row j*sizeof(row)
@@ -404,11 +1467,13 @@ if(blocks > 1){			//FIXME: ADD THIS WARNING IN THE DOCUMENTATION: if a different
 	Byte = forBody2Builder.CreateLoad(Byte);
 	tmp = forBody2Builder.CreateLoad(tmpAlloca);
 	bitVal = forBody2Builder.CreateZExt(Byte, sliceTy);
-	Value *bitShift = forBody2Builder.CreateSRem(idx, ConstantInt::get(idxTy, 8));
+	Value *bitShift = forBody2Builder.CreateSRem(idx, ConstantInt::get(idxTy, perByte));
+	bitShift = OrderedElemShift(forBody2Builder, bitShift, order);
 	bitShift = forBody2Builder.CreateTrunc(bitShift, sliceTy);
 	bitVal = forBody2Builder.CreateLShr(bitVal, bitShift);
-	bitVal = forBody2Builder.CreateAnd(bitVal, ConstantInt::get(sliceTy, 1));
-	Value *blockShift = forBody2Builder.CreateTrunc(idx2, sliceTy);
+	bitVal = forBody2Builder.CreateAnd(bitVal, laneMask);
+	Value *blockShift = forBody2Builder.CreateNSWMul(idx2, ConstantInt::get(idxTy, Layout));
+	blockShift = forBody2Builder.CreateTrunc(blockShift, sliceTy);
 	bitVal = forBody2Builder.CreateShl(bitVal, blockShift);
 	tmp = forBody2Builder.CreateOr(tmp, bitVal);
 	forBody2Builder.CreateStore(tmp, tmpAlloca);
@@ -454,12 +1519,13 @@ if(blocks > 1){			//FIXME: ADD THIS WARNING IN THE DOCUMENTATION: if a different
 	IRBuilder<> forBodyBuilder(forBody);
 	idx = forBodyBuilder.CreateLoad(idxAlloca, "idxprom");
 	//Value *div = forBodyBuilder.CreateSDiv(idx, ConstantInt::get(idxTy, 8), "div"); //8, #bits per element
+	Value *byteIdx = OrderedByteIdx(forBodyBuilder, idx, order);
 	if(oldAlloca->getAllocatedType()->isPointerTy()){
-		IdxList.at(0) = idx;
+		IdxList.at(0) = byteIdx;
 		Value *ptrVal = forBodyBuilder.CreateLoad(oldAlloca);
 		Byte = forBodyBuilder.CreateGEP(ptrVal, ArrayRef <Value *>(IdxList));
 	}else{
-		IdxList.at(1) = idx;
+		IdxList.at(1) = byteIdx;
 		Byte = forBodyBuilder.CreateGEP(oldAlloca, ArrayRef <Value *>(IdxList));
 	}
 	//Byte = forBodyBuilder.CreateGEP(oldAlloca, ArrayRef <Value *>(IdxList));
@@ -471,7 +1537,7 @@ if(blocks > 1){			//FIXME: ADD THIS WARNING IN THE DOCUMENTATION: if a different
 
 	IRBuilder<> forCond2Builder(forCond2);
 	Value *idx2 = forCond2Builder.CreateLoad(idx2Alloca);
-	Value *cmp2 = forCond2Builder.CreateICmpSLT(idx2, ConstantInt::get(idxTy, 8), "cmp");	//8, #bits per element
+	Value *cmp2 = forCond2Builder.CreateICmpSLT(idx2, ConstantInt::get(idxTy, perByte), "cmp");	//#slices per element
 	BasicBlock *forBody2 = BasicBlock::Create(Context, "for.body", call->getFunction(), forEnd);
 	BasicBlock *forEnd2 = BasicBlock::Create(Context, "for.end", call->getFunction(), forEnd);
 	forCond2Builder.CreateCondBr(cmp2, forBody2, forEnd2);
@@ -479,15 +1545,16 @@ if(blocks > 1){			//FIXME: ADD THIS WARNING IN THE DOCUMENTATION: if a different
 	IRBuilder<> forBody2Builder(forBody2);
 	//Value *bitShift = forBody2Builder.CreateSRem(idx, ConstantInt::get(idxTy, 8));
 	idx2 = forBody2Builder.CreateLoad(idx2Alloca);
-	Value *bitShift = forBody2Builder.CreateTrunc(idx2, sliceTy);
-	bitVal = forBody2Builder.CreateLShr(bitVal, bitShift);
-	bitVal = forBody2Builder.CreateAnd(bitVal, ConstantInt::get(sliceTy, 1));
+	Value *bitShift = OrderedElemShift(forBody2Builder, idx2, order);
+	bitShift = forBody2Builder.CreateTrunc(bitShift, sliceTy);
+	Value *elem = forBody2Builder.CreateLShr(bitVal, bitShift);
+	elem = forBody2Builder.CreateAnd(elem, laneMask);
 	idx = forBody2Builder.CreateLoad(idxAlloca);
-	Value *idxMul = forBody2Builder.CreateNSWMul(idx, ConstantInt::get(idxTy, 8));
+	Value *idxMul = forBody2Builder.CreateNSWMul(idx, ConstantInt::get(idxTy, perByte));
 	Value *idxAdd = forBody2Builder.CreateNSWAdd(idxMul, idx2);
 	SliceIdxList.at(1) = idxAdd;
-	sliceAddr = forBody2Builder.CreateGEP(all, ArrayRef <Value *>(IdxList), "sliceAddr");
-	forBody2Builder.CreateStore(bitVal, sliceAddr);
+	sliceAddr = forBody2Builder.CreateGEP(all, ArrayRef <Value *>(SliceIdxList), "sliceAddr");
+	forBody2Builder.CreateStore(elem, sliceAddr);
 	BasicBlock *forInc2 = BasicBlock::Create(Context, "for.inc", call->getFunction(), forEnd2);
 	forBody2Builder.CreateBr(forInc2);
 
@@ -566,7 +1633,7 @@ bool UnBitSlice(CallInst *call, LLVMContext &Context){
 	}
 	*/
 	
-	AllocaInst *slicesAlloca = AllocNewInstBuff.at(i);
+	Value *slicesAlloca = AllocNewInstBuff.at(i);
 
 	uint64_t blocks = BlocksNumList.at(i);
 
@@ -585,11 +1652,16 @@ bool UnBitSlice(CallInst *call, LLVMContext &Context){
 	//	return false;
 	}
 */
-	uint64_t ByteSizeOfOutput = cast<ArrayType>(slicesAlloca->getAllocatedType())->getNumElements()/8; 
+	uint64_t ByteSizeOfOutput = cast<ArrayType>(cast<PointerType>(slicesAlloca->getType())
+												->getElementType())->getNumElements()/SlicesPerByte(); 
 																				//FIXME: check this when creating support 
 																				//for other types than uint8_t
 
 	Type *byteTy = IntegerType::getInt8Ty(Context);
+	int perByte = SlicesPerByte();
+	TransposeOrder order;
+	if(!GetTransposeOrder(call, ByteSizeOfOutput, order))
+		return false;
 	
 	if(blocks > 1){
 		IRBuilder<> builder(call);
@@ -604,7 +1676,7 @@ bool UnBitSlice(CallInst *call, LLVMContext &Context){
 
 		IRBuilder<> forCondBuilder(forCond);
 		Value *idx = forCondBuilder.CreateLoad(idxAlloca);
-		Value *cmp = forCondBuilder.CreateICmpSLT(idx, ConstantInt::get(idxTy, ByteSizeOfOutput*32), "cmp");
+		Value *cmp = forCondBuilder.CreateICmpSLT(idx, ConstantInt::get(idxTy, ByteSizeOfOutput*LanesPerSlice()), "cmp");
 		BasicBlock *forBody = BasicBlock::Create(Context, "for.body", call->getFunction(), forEnd);
 		forCondBuilder.CreateCondBr(cmp, forBody, forEnd);
 	
@@ -616,7 +1688,7 @@ bool UnBitSlice(CallInst *call, LLVMContext &Context){
 
 		IRBuilder<> forCond2Builder(forCond2);
 		Value *idx2 = forCond2Builder.CreateLoad(idx2Alloca);
-		Value *cmp2 = forCond2Builder.CreateICmpSLT(idx2, ConstantInt::get(idxTy, 8), "cmp");
+		Value *cmp2 = forCond2Builder.CreateICmpSLT(idx2, ConstantInt::get(idxTy, perByte), "cmp");
 		BasicBlock *forBody2 = BasicBlock::Create(Context, "for.body", call->getFunction(), forEnd);
 		BasicBlock *forEnd2 = BasicBlock::Create(Context, "for.end", call->getFunction(), forEnd);
 		forCond2Builder.CreateCondBr(cmp2, forBody2, forEnd2);
@@ -624,17 +1696,19 @@ bool UnBitSlice(CallInst *call, LLVMContext &Context){
 		IRBuilder<> forBody2Builder(forBody2);
 		idx = forBody2Builder.CreateLoad(idxAlloca, "idxprom");
 		Value *idxMod = forBody2Builder.CreateSRem(idx, ConstantInt::get(idxTy, ByteSizeOfOutput), "idx_mod");
-		Value *idxMul = forBody2Builder.CreateNSWMul(idxMod, ConstantInt::get(idxTy, 8), "idx_mul");
+		idxMod = OrderedByteIdx(forBody2Builder, idxMod, order);
+		Value *idxMul = forBody2Builder.CreateNSWMul(idxMod, ConstantInt::get(idxTy, perByte), "idx_mul");
 		idx2 = forBody2Builder.CreateLoad(idx2Alloca);
 		Value *idxAdd = forBody2Builder.CreateNSWAdd(idxMul, idx2);
-		SliceIdxList.at(1) = idxAdd;
+		SliceIdxList.at(1) = RingSliceIdx(forBody2Builder, slicesAlloca, idxAdd);
 		Value *sliceAddr = forBody2Builder.CreateGEP(slicesAlloca, ArrayRef <Value *>(SliceIdxList));
 		Value *slice = forBody2Builder.CreateLoad(sliceAddr);
 		Value *sliceShift = forBody2Builder.CreateSDiv(idx, ConstantInt::get(idxTy, ByteSizeOfOutput));
+		sliceShift = forBody2Builder.CreateNSWMul(sliceShift, ConstantInt::get(idxTy, Layout));
 		Value *byte = forBody2Builder.CreateZExt(slice, idxTy);
 		byte = forBody2Builder.CreateLShr(byte, sliceShift);
-		byte = forBody2Builder.CreateAnd(byte, ConstantInt::get(idxTy, 1));
-		byte = forBody2Builder.CreateShl(byte, idx2);
+		byte = forBody2Builder.CreateAnd(byte, ConstantInt::get(idxTy, (1u << Layout) - 1));
+		byte = forBody2Builder.CreateShl(byte, OrderedElemShift(forBody2Builder, idx2, order));
 		Value *tmp = forBody2Builder.CreateLoad(tmpAlloca);
 		byte = forBody2Builder.CreateTrunc(byte, byteTy);
 		tmp = forBody2Builder.CreateOr(tmp, byte);
@@ -685,76 +1759,1407 @@ bool UnBitSlice(CallInst *call, LLVMContext &Context){
 		BasicBlock *forCond = BasicBlock::Create(Context, "for.cond", call->getFunction(), forEnd);
 		idxAlloca->getParent()->getTerminator()->setSuccessor(0, forCond);
 
-		IRBuilder<> forCondBuilder(forCond);
-		Value *idx = forCondBuilder.CreateLoad(idxAlloca);
-		Value *cmp = forCondBuilder.CreateICmpSLT(idx, ConstantInt::get(idxTy, ByteSizeOfOutput), "cmp");
-		BasicBlock *forBody = BasicBlock::Create(Context, "for.body", call->getFunction(), forEnd);
-		forCondBuilder.CreateCondBr(cmp, forBody, forEnd);
+		IRBuilder<> forCondBuilder(forCond);
+		Value *idx = forCondBuilder.CreateLoad(idxAlloca);
+		Value *cmp = forCondBuilder.CreateICmpSLT(idx, ConstantInt::get(idxTy, ByteSizeOfOutput), "cmp");
+		BasicBlock *forBody = BasicBlock::Create(Context, "for.body", call->getFunction(), forEnd);
+		forCondBuilder.CreateCondBr(cmp, forBody, forEnd);
+
+		IRBuilder<> forBodyBuilder(forBody);
+		forBodyBuilder.CreateStore(ConstantInt::get(byteTy, 0), tmpAlloca);
+		forBodyBuilder.CreateStore(idxZero, idx2Alloca);
+		BasicBlock *forCond2 = BasicBlock::Create(Context, "for.cond", call->getFunction(), forEnd);
+		forBodyBuilder.CreateBr(forCond2);
+
+		IRBuilder<> forCond2Builder(forCond2);
+		Value *idx2 = forCond2Builder.CreateLoad(idx2Alloca);
+		Value *cmp2 = forCond2Builder.CreateICmpSLT(idx2, ConstantInt::get(idxTy, perByte), "cmp");
+		BasicBlock *forBody2 = BasicBlock::Create(Context, "for.body", call->getFunction(), forEnd);
+		BasicBlock *forEnd2 = BasicBlock::Create(Context, "for.end", call->getFunction(), forEnd);
+		forCond2Builder.CreateCondBr(cmp2, forBody2, forEnd2);
+
+		IRBuilder<> forBody2Builder(forBody2);
+		idx = forBody2Builder.CreateLoad(idxAlloca);
+		idx2 = forBody2Builder.CreateLoad(idx2Alloca);
+		idx = OrderedByteIdx(forBody2Builder, idx, order);
+		Value *idxMul = forBody2Builder.CreateNSWMul(idx, ConstantInt::get(idxTy, perByte));
+		Value *idxAdd = forBody2Builder.CreateNSWAdd(idxMul, idx2);
+		SliceIdxList.at(1) = RingSliceIdx(forBody2Builder, slicesAlloca, idxAdd);
+		Value *slice = forBody2Builder.CreateGEP(slicesAlloca, ArrayRef <Value *>(SliceIdxList));
+		slice = forBody2Builder.CreateLoad(slice);
+		slice = forBody2Builder.CreateZExt(slice, idxTy);
+		slice = forBody2Builder.CreateAnd(slice, ConstantInt::get(idxTy, (1u << Layout) - 1));
+		slice = forBody2Builder.CreateShl(slice, OrderedElemShift(forBody2Builder, idx2, order));
+		Value *tmp = forBody2Builder.CreateLoad(tmpAlloca);
+		slice = forBody2Builder.CreateTrunc(slice, byteTy);
+		tmp = forBody2Builder.CreateOr(tmp, slice);
+		forBody2Builder.CreateStore(tmp, tmpAlloca);
+		BasicBlock *forInc2 = BasicBlock::Create(Context, "for.inc", call->getFunction(), forEnd2);
+		forBody2Builder.CreateBr(forInc2);
+
+		IRBuilder<> forInc2Builder(forInc2);
+		Value *inc2 = forInc2Builder.CreateLoad(idx2Alloca);
+		inc2 = forInc2Builder.CreateNSWAdd(inc2, ConstantInt::get(idxTy, 1));
+		forInc2Builder.CreateStore(inc2 ,idx2Alloca);
+		forInc2Builder.CreateBr(forCond2);
+
+		IRBuilder<> forEnd2Builder(forEnd2);
+		Value *newByte = forEnd2Builder.CreateLoad(tmpAlloca);
+		idx = forEnd2Builder.CreateLoad(idxAlloca, "idxprom");
+		Value *byteAddr;
+		if(oldAlloca->getAllocatedType()->isPointerTy()){
+			IdxList.at(0) = idx;
+			Value *ptrVal = forEnd2Builder.CreateLoad(oldAlloca);
+			byteAddr = forEnd2Builder.CreateGEP(ptrVal, ArrayRef <Value *>(IdxList));
+		}else{
+			IdxList.at(1) = idx;
+			byteAddr = forEnd2Builder.CreateGEP(oldAlloca, ArrayRef <Value *>(IdxList));
+		}
+		//Value *byteAddr = forEnd2Builder.CreateGEP(oldAlloca, ArrayRef <Value *>(IdxList), "byteAddr");
+		forEnd2Builder.CreateStore(newByte, byteAddr);
+		BasicBlock *forInc = BasicBlock::Create(Context, "for.inc", call->getFunction(), forEnd);
+		forEnd2Builder.CreateBr(forInc);
+
+		IRBuilder<> forIncBuilder(forInc);
+		Value *inc = forIncBuilder.CreateLoad(idxAlloca);
+		inc = forIncBuilder.CreateNSWAdd(inc, ConstantInt::get(idxTy, 1));
+		forIncBuilder.CreateStore(inc, idxAlloca);
+		forIncBuilder.CreateBr(forCond);
+	}
+	return true;
+}
+
+
+
+/*
+ * Resolves the bit-sliced array a call argument points to, if any. Only
+ * arguments marked by BitSlice() (direct users of the sliced alloca, like the
+ * array decay passed to a helper) are considered, so the pointer always
+ * addresses the whole buffer.
+ */
+int BitSlicedArgIdx(Value *arg){
+	if(!isa<Instruction>(arg) || !cast<Instruction>(arg)->getMetadata("to_be_bit-sliced"))
+		return -1;
+
+	Value *base = arg;
+	for(; isa<GetElementPtrInst>(base) || isa<LoadInst>(base) || isa<CastInst>(base);
+		base = cast<Instruction>(base)->getOperand(0));
+	if(!isa<AllocaInst>(base))
+		return -1;
+
+	int nameIdx = 0;
+	for(auto name : AllocOldNames){
+		if(base->getName().equals(name))
+			return nameIdx;
+		nameIdx++;
+	}
+	return -1;
+}
+
+
+/*
+ * Clones Fn so that the parameters listed in SlicedArgs take the slice array
+ * of the caller instead of the byte buffer. Inside the clone the parameter is
+ * spilled to a pointer alloca, which is the same shape that the GEP/load
+ * rewriting in runOnModule already handles for pointer buffers, and the
+ * alloca is registered as bit-sliced so that the second walk transforms the
+ * body like any other sliced region.
+ */
+Function *CloneBitSlicedCallee(Function *Fn, std::vector<unsigned> &SlicedArgs,
+							   std::vector<int> &SliceIdxs){
+	Module *M = Fn->getParent();
+	std::string CloneName = Fn->getName().str() + ".bitsliced";
+	for(unsigned argNo : SlicedArgs)
+		CloneName += "." + std::to_string(argNo);
+
+	//the head of a ring lives in the caller
+	for(int sliceIdx : SliceIdxs){
+		if(RingHeads.count(AllocNewInstBuff.at(sliceIdx))){
+			errs() << "error: ring buffer " << AllocOldNames.at(sliceIdx) 
+				   << " passed to " << Fn->getName() << "\n";
+			return nullptr;
+		}
+	}
+
+	std::vector<Type *> ParamTys;
+	for(Argument &Arg : Fn->args())
+		ParamTys.push_back(Arg.getType());
+	for(unsigned i=0; i<SlicedArgs.size(); i++)
+		ParamTys.at(SlicedArgs.at(i)) = AllocNewInstBuff.at(SliceIdxs.at(i))->getType();
+
+	FunctionType *CloneTy = FunctionType::get(Fn->getReturnType(), ParamTys, Fn->isVarArg());
+
+	if(Function *Existing = M->getFunction(CloneName)){
+		if(Existing->getFunctionType() != CloneTy){
+			errs() << "error: " << Fn->getName() 
+				   << " called with bit-sliced arrays of different size\n";
+			return nullptr;
+		}
+		return Existing;
+	}
+
+	Function *Clone = Function::Create(CloneTy, GlobalValue::InternalLinkage, CloneName, M);
+	ValueToValueMapTy VMap;
+	std::vector<AllocaInst *> ArgAddrs;
+	std::vector<LoadInst *> ArgLoads;
+	Function::arg_iterator NewArg = Clone->arg_begin();
+	unsigned argNo = 0;
+
+	for(Argument &Arg : Fn->args()){
+		NewArg->setName(Arg.getName());
+		if(std::find(SlicedArgs.begin(), SlicedArgs.end(), argNo) != SlicedArgs.end()){
+			AllocaInst *argAddr = new AllocaInst(Arg.getType(), 0, 
+												 CloneName + "." + Arg.getName() + ".addr");
+			LoadInst *argLoad = new LoadInst(argAddr, Arg.getName());
+			ArgAddrs.push_back(argAddr);
+			ArgLoads.push_back(argLoad);
+			VMap[&Arg] = argLoad;
+		}else{
+			VMap[&Arg] = &*NewArg;
+		}
+		NewArg++;
+		argNo++;
+	}
+
+	SmallVector<ReturnInst *, 8> Returns;
+	CloneFunctionInto(Clone, Fn, VMap, false, Returns);
+
+	IRBuilder<> builder(&*Clone->getEntryBlock().getFirstInsertionPt());
+	LLVMContext &Context = M->getContext();
+	MDNode *mdata = MDNode::get(Context, MDString::get(Context, "to_be_bit-sliced"));
+
+	for(unsigned i=0; i<SlicedArgs.size(); i++){
+		AllocaInst *argAddr = ArgAddrs.at(i);
+		LoadInst *argLoad = ArgLoads.at(i);
+		Argument *SlicesArg = &*(Clone->arg_begin() + SlicedArgs.at(i));
+		Clone->addAttribute(SlicedArgs.at(i) + 1, Attribute::get(Context, "bit-sliced"));
+
+		//the old byte-level code stays valid (it becomes dead after the rewrite)
+		builder.Insert(argAddr);
+		builder.CreateStore(builder.CreatePointerCast(SlicesArg, argAddr->getAllocatedType()), argAddr);
+		builder.Insert(argLoad);
+
+		//at -O0 the parameter is spilled to its own ".addr" alloca: that is the one
+		//the GEPs of the body resolve to
+		AllocaInst *slicedAddr = argAddr;
+		if(argLoad->hasOneUse()){
+			if(auto *st = dyn_cast<StoreInst>(*argLoad->user_begin())){
+				if(auto *spill = dyn_cast<AllocaInst>(st->getPointerOperand())){
+					if(spill->getAllocatedType()->isPointerTy() && st->getValueOperand() == argLoad){
+						spill->setName(argAddr->getName());
+						slicedAddr = spill;
+					}
+				}
+			}
+		}
+
+		for(auto& U : slicedAddr->uses()){
+			if(auto *ld = dyn_cast<LoadInst>(U.getUser()))
+				ld->setMetadata("to_be_bit-sliced", mdata);
+		}
+		argLoad->setMetadata("to_be_bit-sliced", mdata);
+
+		AllocOldNames.push_back(slicedAddr->getName());
+		AllocNewInstBuff.push_back(SlicesArg);
+		BlocksNumList.push_back(BlocksNumList.at(SliceIdxs.at(i)));
+	}
+
+	return Clone;
+}
+
+
+/*
+ * Propagates bit-sliced buffers through the call graph: every call that
+ * passes a bit-sliced array to a defined function is redirected to a clone
+ * of the callee taking the slice array, and the clones are scanned in turn.
+ */
+bool BitSliceCallees(Module &M){
+	std::vector<Function *> WorkList;
+	bool changed = false;
+
+	for(CallInst *c : BitSliceCalls){
+		if(std::find(WorkList.begin(), WorkList.end(), c->getFunction()) == WorkList.end())
+			WorkList.push_back(c->getFunction());
+	}
+
+	for(unsigned w=0; w<WorkList.size(); w++){
+		std::vector<CallInst *> Calls;
+		for(BasicBlock& B : *WorkList.at(w)){
+			for(Instruction& I : B){
+				if(auto *call = dyn_cast<CallInst>(&I)){
+					Function *Fn = call->getCalledFunction();
+					if(Fn && !Fn->isDeclaration() && !Fn->isIntrinsic())
+						Calls.push_back(call);
+				}
+			}
+		}
+
+		for(CallInst *call : Calls){
+			std::vector<unsigned> SlicedArgs;
+			std::vector<int> SliceIdxs;
+			for(unsigned argNo=0; argNo<call->getNumArgOperands(); argNo++){
+				int nameIdx = BitSlicedArgIdx(call->getArgOperand(argNo));
+				if(nameIdx < 0)
+					continue;
+				SlicedArgs.push_back(argNo);
+				SliceIdxs.push_back(nameIdx);
+			}
+			if(SlicedArgs.empty())
+				continue;
+
+			Function *Clone = CloneBitSlicedCallee(call->getCalledFunction(), SlicedArgs, SliceIdxs);
+			if(!Clone)
+				continue;
+
+			std::vector<Value *> Args(call->arg_begin(), call->arg_end());
+			for(unsigned i=0; i<SlicedArgs.size(); i++)
+				Args.at(SlicedArgs.at(i)) = AllocNewInstBuff.at(SliceIdxs.at(i));
+
+			IRBuilder<> builder(call);
+			CallInst *newCall = builder.CreateCall(Clone, ArrayRef <Value *>(Args));
+			newCall->setCallingConv(call->getCallingConv());
+			call->replaceAllUsesWith(newCall);
+			call->eraseFromParent();
+
+			if(std::find(WorkList.begin(), WorkList.end(), Clone) == WorkList.end())
+				WorkList.push_back(Clone);
+			changed = true;
+		}
+	}
+
+	return changed;
+}
+
+
+
+//Tags every transitive user of a to_be_bit-sliced instruction. Unlike the
+//forward walk of runOnModule this reaches users placed before their
+//definitions, like the PHIs of loop headers fed by the latch.
+void PropagateBitSlicedMetadata(Function &F){
+	std::vector<Instruction *> WorkList;
+	for(BasicBlock& B : F){
+		for(Instruction& I : B){
+			if(I.getMetadata("to_be_bit-sliced"))
+				WorkList.push_back(&I);
+		}
+	}
+
+	while(!WorkList.empty()){
+		Instruction *I = WorkList.back();
+		WorkList.pop_back();
+		if(IsBitCall(I, Intrinsic::bitsliced_i8_lane_bit))	//yields a plain byte
+			continue;
+		for(auto& U : I->uses()){
+			auto *Inst = dyn_cast<Instruction>(U.getUser());
+			if(!Inst || Inst->getMetadata("to_be_bit-sliced"))
+				continue;
+			MDNode *mdata = MDNode::get(I->getContext(), 
+										MDString::get(I->getContext(), "bitsliced"));
+			Inst->setMetadata("to_be_bit-sliced", mdata);
+			WorkList.push_back(Inst);
+		}
+	}
+}
+
+
+//A local byte array written with bit-sliced bytes holds one array per lane,
+//like a key schedule expanded from per-lane keys: it becomes a bit-sliced
+//buffer itself, so its reads stay per-lane instead of being broadcast. It is
+//only ever filled in sliced form, so there is nothing to transpose.
+//Returns true if an array was promoted.
+bool PromoteSlicedArrays(Function &F){
+	LLVMContext &Context = F.getContext();
+	bool changed = false;
+	for(BasicBlock& B : F){
+		for(Instruction& I : B){
+			auto *st = dyn_cast<StoreInst>(&I);
+			if(!st)
+				continue;
+			auto *val = dyn_cast<Instruction>(st->getValueOperand());
+			auto *gep = dyn_cast<GetElementPtrInst>(st->getPointerOperand());
+			if(!val || !val->getMetadata("to_be_bit-sliced") || !gep || gep->getMetadata("to_be_bit-sliced"))
+				continue;
+			auto *all = dyn_cast<AllocaInst>(gep->getPointerOperand());
+			auto *arrTy = all ? dyn_cast<ArrayType>(all->getAllocatedType()) : nullptr;
+			if(!arrTy || !arrTy->getElementType()->isIntegerTy(8))
+				continue;
+			
+			for(User *U : all->users()){
+				auto *allGEP = dyn_cast<GetElementPtrInst>(U);
+				if(!allGEP || allGEP->getNumIndices() != 2)
+					report_fatal_error("array holding bit-sliced values escapes");
+				for(User *GU : allGEP->users()){
+					if(!isa<LoadInst>(GU) && !(isa<StoreInst>(GU) && GU->getOperand(1) == allGEP))
+						report_fatal_error("array holding bit-sliced values escapes");
+				}
+			}
+			
+			if(!all->hasName())
+				all->setName("sliced.arr");
+			Type *sliceTy = IntegerType::getInt32Ty(Context);
+			IRBuilder<> builder(all);
+			AllocaInst *slices = builder.CreateAlloca(ArrayType::get(sliceTy, arrTy->getNumElements()*SlicesPerByte()),
+													  0, "SLICES");
+			slices->setMetadata("bit-sliced-data", MDNode::get(Context, MDString::get(Context, "bit-sliced-data")));
+			AllocOldNames.push_back(all->getName());
+			AllocNewInstBuff.push_back(slices);
+			BlocksNumList.push_back(LanesPerSlice());
+			
+			MDNode *mdata = MDNode::get(Context, MDString::get(Context, "bitsliced"));
+			for(User *U : all->users())
+				cast<Instruction>(U)->setMetadata("to_be_bit-sliced", mdata);
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+
+//Returns the i-th slice already built for V by the rewrite walk, or nullptr
+//if V has not been transformed (yet).
+Value *GetSlicedValue(Value *V, unsigned i){
+	unsigned idx = 0;
+	for(auto *ld : LoadOldInstBuff){
+		if(ld == V)
+			return (i < SlicesPerByte() && idx+i < LoadInstBuff.size()) ? LoadInstBuff.at(idx+i) : nullptr;
+		idx += SlicesPerByte();
+	}
+	
+	idx = 0;
+	for(auto *ci : CastOldInstBuff){
+		if(ci == V)
+			return (idx+i < CastInstBuff.size()) ? CastInstBuff.at(idx+i) : nullptr;
+		idx += NumSlices(ci->getDestTy());
+	}
+	
+	for(unsigned j=0; j<BinaryOpOldInstBuff.size(); j++){
+		if(BinaryOpOldInstBuff.at(j) == V){
+			idx = BinaryOpSliceIdx.at(j);
+			return (idx+i < BinaryOpInstBuff.size()) ? BinaryOpInstBuff.at(idx+i) : nullptr;
+		}
+	}
+	
+	idx = 0;
+	for(auto *phi : PHIOldInstBuff){
+		if(phi == V)
+			return PHIInstBuff.at(idx+i);
+		idx += NumSlices(phi->getType());
+	}
+	
+	idx = 0;
+	for(auto *call : BitCallOldInstBuff){
+		if(call == V)
+			return (i < SlicesPerByte()) ? BitCallInstBuff.at(idx+i) : nullptr;
+		idx += SlicesPerByte();
+	}
+	return nullptr;
+}
+
+
+//Returns the slice holding bit n of the byte passed to llvm.bitsliced.i8.bit
+//or llvm.bitsliced.i8.lane.bit. A byte read straight from a bit-sliced buffer
+//costs a single slice load and n may be a runtime value, taken modulo 8; a
+//computed byte takes its slice from the rewrite walk, so n must be a constant.
+Value *GetBitSlice(IRBuilder<> &builder, CallInst *call){
+	Value *x = call->getArgOperand(0);
+	Value *n = call->getArgOperand(1);
+	auto *C = dyn_cast<ConstantInt>(n);
+	if(C && C->getZExtValue() >= 8)
+		report_fatal_error("bit index into a bit-sliced byte is out of range");
+	
+	if(auto *ld = dyn_cast<LoadInst>(x)){
+		auto it = std::find(GEPOldInstBuff.begin(), GEPOldInstBuff.end(), ld->getPointerOperand());
+		if(it != GEPOldInstBuff.end()){
+			Value *base = GEPInstBuff.at((it - GEPOldInstBuff.begin())*SlicesPerByte());
+			//the slices of a ring byte are not contiguous
+			if(IsRingSlice(base)){
+				if(!C)
+					report_fatal_error("bit index into a byte of a ring buffer must be a constant");
+				base = GEPInstBuff.at((it - GEPOldInstBuff.begin())*SlicesPerByte() + C->getZExtValue()/Layout);
+				return builder.CreateLoad(base, "bit.slice");
+			}
+			if(!C)
+				n = builder.CreateAnd(n, 7, "bit.idx");
+			Value *sliceIdx = builder.CreateLShr(n, Log2_32(Layout));
+			sliceIdx = builder.CreateZExt(sliceIdx, builder.getInt64Ty());
+			return builder.CreateLoad(builder.CreateInBoundsGEP(base, sliceIdx), "bit.slice");
+		}
+	}
+	
+	if(!C)
+		report_fatal_error("bit index into a computed bit-sliced byte must be a constant");
+	Value *slice = GetSlicedValue(x, C->getZExtValue()/Layout);
+	if(!slice)
+		report_fatal_error("operand of a bit-sliced bit access has no slices");
+	return slice;
+}
+
+
+//Lowers the per-bit accessors left on plain bytes, and the originals of the
+//bit-sliced ones, to a scalar shift and mask. The lane index only has a
+//meaning for sliced data.
+void LowerScalarBitCalls(Module &M){
+	std::vector<CallInst *> Calls;
+	for(Function& F : M){
+		for(BasicBlock& B : F){
+			for(Instruction& I : B){
+				if(IsBitCall(&I, Intrinsic::bitsliced_i8_bit) ||
+				   IsBitCall(&I, Intrinsic::bitsliced_i8_lane_bit))
+					Calls.push_back(cast<CallInst>(&I));
+			}
+		}
+	}
+	
+	for(CallInst *call : Calls){
+		IRBuilder<> builder(call);
+		Value *n = builder.CreateTrunc(call->getArgOperand(1), builder.getInt8Ty());
+		n = builder.CreateAnd(n, 7);
+		Value *bit = builder.CreateAnd(builder.CreateLShr(call->getArgOperand(0), n), 1);
+		call->replaceAllUsesWith(bit);
+		call->eraseFromParent();
+	}
+}
+
+
+//Fills the incoming values of the slice PHIs created by the rewrite walk.
+//This has to wait until the whole function is transformed, since back-edge
+//values are defined after the loop header.
+bool ResolveBitSlicedPHIs(){
+	unsigned idx = 0;
+	for(auto *phi : PHIOldInstBuff){
+		unsigned numSlices = NumSlices(phi->getType());
+		for(unsigned i=0; i<numSlices; i++){
+			PHINode *newPHI = cast<PHINode>(PHIInstBuff.at(idx+i));
+			Type *sliceTy = newPHI->getType();
+			for(unsigned in=0; in<phi->getNumIncomingValues(); in++){
+				Value *inVal = phi->getIncomingValue(in);
+				BasicBlock *inBlock = phi->getIncomingBlock(in);
+				Value *slice = nullptr;
+				
+				if(auto *inInst = dyn_cast<Instruction>(inVal)){
+					if(inInst->getMetadata("to_be_bit-sliced")){
+						slice = GetSlicedValue(inVal, i);
+						if(!slice){
+							errs() << "ERROR: incoming value " << inVal->getName() << " of the bit-sliced PHI "
+								   << phi->getName() << " has no slice " << i << "\n";
+							return false;
+						}
+					}
+				}
+				
+				if(!slice){	//not bit-sliced: every block sees the same value, broadcast its element
+					if(auto *C = dyn_cast<ConstantInt>(inVal)){
+						uint64_t elem = C->getValue().lshr(i*Layout).getLoBits(Layout).getZExtValue();
+						slice = ConstantInt::get(sliceTy, elem*LaneRepeat());
+					}else{
+						IRBuilder<> builder(inBlock->getTerminator());
+						slice = builder.CreateZExtOrTrunc(inVal, sliceTy);
+						slice = BroadcastLaneElement(builder, slice, i);
+					}
+				}
+				newPHI->addIncoming(slice, inBlock);
+			}
+		}
+		idx += numSlices;
+	}
+	
+	//the byte-level PHIs would keep the erased instructions alive
+	for(auto *phi : PHIOldInstBuff){
+		phi->replaceAllUsesWith(UndefValue::get(phi->getType()));
+		phi->dropAllReferences();
+		eraseList.push_back(phi);
+	}
+	return true;
+}
+
+
+
+//Walks back to the global array a (possibly constant expression) GEP points into.
+GlobalVariable *GetKeyGlobal(Value *ptr){
+	for(; isa<GEPOperator>(ptr); ptr = cast<GEPOperator>(ptr)->getPointerOperand());
+	return dyn_cast<GlobalVariable>(ptr);
+}
+
+
+//Collects F and the functions it calls, transitively. Returns false if F may
+//also run code the pass cannot see (indirect calls or external functions).
+bool GetCallTree(Function *F, SmallPtrSetImpl<Function *> &Tree){
+	bool closed = true;
+	std::vector<Function *> WorkList(1, F);
+	Tree.insert(F);
+	while(!WorkList.empty()){
+		Function *Fn = WorkList.back();
+		WorkList.pop_back();
+		for(BasicBlock& B : *Fn){
+			for(Instruction& I : B){
+				auto CS = CallSite(&I);
+				if(!CS || isa<IntrinsicInst>(&I))
+					continue;
+				Function *Callee = CS.getCalledFunction();
+				if(!Callee || Callee->isDeclaration()){
+					closed = false;
+					continue;
+				}
+				if(Tree.insert(Callee).second)
+					WorkList.push_back(Callee);
+			}
+		}
+	}
+	return closed;
+}
+
+
+//A key is the same for the whole batch if nothing F may run writes it: in
+//the call tree of F every use of the array is a load, and its address never
+//escapes, since a write through an alias could happen anywhere. Writes made
+//between two calls of the kernel are fine, the sliced copy is refreshed on
+//entry.
+bool IsBatchInvariantKey(GlobalVariable *key, Function *F){
+	if(key->isConstant())
+		return true;
+
+	SmallPtrSet<Function *, 8> Tree;
+	if(!GetCallTree(F, Tree) && !key->hasLocalLinkage())
+		return false;
+
+	std::vector<Value *> WorkList(1, key);
+	while(!WorkList.empty()){
+		Value *V = WorkList.back();
+		WorkList.pop_back();
+		for(User *U : V->users()){
+			if(isa<GEPOperator>(U) || isa<BitCastOperator>(U)){
+				WorkList.push_back(U);
+				continue;
+			}
+			auto *I = dyn_cast<Instruction>(U);
+			if(!I)
+				return false;		//address taken by another constant
+			if(isa<LoadInst>(I))
+				continue;
+			bool inTree = Tree.count(I->getFunction());
+			if(auto *st = dyn_cast<StoreInst>(I)){
+				if(st->getValueOperand() == V || inTree)
+					return false;
+				continue;
+			}
+			if(auto *MI = dyn_cast<MemIntrinsic>(I)){
+				auto *MT = dyn_cast<MemTransferInst>(MI);
+				if(!inTree || (MT && MT->getRawDest() != V))
+					continue;
+				return false;
+			}
+			return false;			//calls, ptrtoint, PHIs...: the address escapes
+		}
+	}
+	return true;
+}
+
+
+//Returns the pre-sliced copy of the global byte array V is loaded from, if the
+//array is not written while F runs (so it is the same for the whole batch).
+//keyIdx is set to the index of the loaded element.
+GlobalVariable *GetSlicedRoundKey(Value *V, Function *F, Value *&keyIdx){
+	if(auto *ext = dyn_cast<ZExtInst>(V))
+		V = ext->getOperand(0);
+	auto *ld = dyn_cast<LoadInst>(V);
+	if(!ld || !ld->getType()->isIntegerTy(8))
+		return nullptr;
+
+	GlobalVariable *key = GetKeyGlobal(ld->getPointerOperand());
+	if(!key)
+		return nullptr;
+	
+	auto *arrTy = dyn_cast<ArrayType>(key->getValueType());
+	if(!arrTy || !arrTy->getElementType()->isIntegerTy(8))
+		return nullptr;
+	
+	auto *gep = dyn_cast<GEPOperator>(ld->getPointerOperand());
+	if(!gep || gep->getPointerOperand() != key || gep->getNumIndices() != 2)
+		return nullptr;
+	keyIdx = gep->getOperand(2);
+
+	if(!IsBatchInvariantKey(key, F))
+		return nullptr;
+	
+	if(!key->isConstant() && std::find(RoundKeyUsers.begin(), RoundKeyUsers.end(), F) == RoundKeyUsers.end())
+		RoundKeyUsers.push_back(F);
+
+	for(unsigned i=0; i<RoundKeys.size(); i++){
+		if(RoundKeys.at(i) == key)
+			return SlicedRoundKeys.at(i);
+	}
+
+	LLVMContext &Context = F->getContext();
+	Type *sliceTy = IntegerType::getInt32Ty(Context);
+	uint64_t keyLen = arrTy->getNumElements();
+	ArrayType *slicedTy = ArrayType::get(sliceTy, keyLen*8);
+	Constant *init = ConstantAggregateZero::get(slicedTy);
+	
+	//a constant key is sliced right away, anything else is sliced on entry to the
+	//kernels by bitslicer_setup_round_keys(), in a per-thread copy
+	if(key->isConstant() && key->hasDefinitiveInitializer()){
+		std::vector<Constant *> slices;
+		for(uint64_t j=0; j<keyLen; j++){
+			auto *byte = cast<ConstantInt>(key->getInitializer()->getAggregateElement(j));
+			for(unsigned i=0; i<8; i++)
+				slices.push_back(byte->getValue()[i] ? Constant::getAllOnesValue(sliceTy) 
+													  : Constant::getNullValue(sliceTy));
+		}
+		init = ConstantArray::get(slicedTy, slices);
+	}
+	
+	GlobalVariable *sliced = new GlobalVariable(*F->getParent(), slicedTy, key->isConstant(),
+												GlobalValue::InternalLinkage, init,
+												key->getName() + ".sliced");
+	sliced->setAlignment(64);		//one cache line per 16 slices
+	if(!key->isConstant())
+		sliced->setThreadLocal(true);
+	sliced->setMetadata("bit-sliced-data", MDNode::get(Context, MDString::get(Context, "bit-sliced-data")));
+	RoundKeys.push_back(key);
+	SlicedRoundKeys.push_back(sliced);
+	return sliced;
+}
+
+
+//Loads the i-th slice of element keyIdx from a pre-sliced key: each slice is
+//already the 0 / ~0 broadcast of the corresponding key bit.
+Value *PreSlicedKeyBit(IRBuilder<> &builder, GlobalVariable *sliced, Value *keyIdx, int i){
+	Type *sliceTy = sliced->getValueType()->getArrayElementType();
+	if(i >= 8)
+		return ConstantInt::get(sliceTy, 0);	//zero-extended key byte
+	
+	Type *idxTy = IntegerType::getInt64Ty(builder.getContext());
+	std::vector<Value *> IdxList;
+	IdxList.push_back(ConstantInt::get(idxTy, 0));
+	Value *idx = builder.CreateSExtOrTrunc(keyIdx, idxTy);
+	idx = builder.CreateShl(idx, ConstantInt::get(idxTy, 3));
+	idx = builder.CreateAdd(idx, ConstantInt::get(idxTy, i));
+	IdxList.push_back(idx);
+	Value *slice = builder.CreateInBoundsGEP(sliced, ArrayRef <Value *>(IdxList), "keySlice");
+	return builder.CreateLoad(slice, "keySlice");
+}
+
+
+//Emits bitslicer_setup_round_keys(), which transposes the non-constant key
+//arrays into their sliced copies, and calls it on entry to every function
+//reading them. The host bumps bitslicer_round_key_generation whenever it
+//writes the keys (bitslicer_round_keys_changed() in the runtime); each thread
+//keeps the generation its copies were sliced at and only re-slices on a change.
+void EmitRoundKeySetup(Module &M){
+	LLVMContext &Context = M.getContext();
+	if(RoundKeyUsers.empty())
+		return;
+	Type *genTy = IntegerType::getInt64Ty(Context);
+	GlobalVariable *Generation = M.getGlobalVariable("bitslicer_round_key_generation");
+	if(!Generation)
+		Generation = new GlobalVariable(M, genTy, false, GlobalValue::WeakAnyLinkage,
+										ConstantInt::get(genTy, 0), "bitslicer_round_key_generation");
+	auto *Seen = new GlobalVariable(M, genTy, false, GlobalValue::InternalLinkage,
+									Constant::getAllOnesValue(genTy), "bitslicer_round_key_seen");
+	Seen->setThreadLocal(true);
+	Function *Setup = Function::Create(FunctionType::get(Type::getVoidTy(Context), false),
+									   GlobalValue::InternalLinkage, "bitslicer_setup_round_keys", &M);
+	for(Function *F : RoundKeyUsers)
+		IRBuilder<>(&*F->getEntryBlock().getFirstInsertionPt()).CreateCall(Setup);
+	
+	Type *sliceTy = IntegerType::getInt32Ty(Context);
+	Type *idxTy = IntegerType::getInt64Ty(Context);
+	Value *idxZero = ConstantInt::get(idxTy, 0);
+	std::vector<Value *> IdxList;
+	IdxList.push_back(idxZero);
+	IdxList.push_back(idxZero);
+	
+	BasicBlock *entry = BasicBlock::Create(Context, "entry", Setup);
+	BasicBlock *refresh = BasicBlock::Create(Context, "refresh", Setup);
+	BasicBlock *done = BasicBlock::Create(Context, "done", Setup);
+	IRBuilder<> builder(entry);
+	AllocaInst *idxAlloca = builder.CreateAlloca(idxTy, 0, "idx");
+	LoadInst *gen = builder.CreateLoad(Generation, "generation");
+	gen->setAtomic(AtomicOrdering::Acquire);		//pairs with the release of the bump
+	gen->setAlignment(8);
+	Value *fresh = builder.CreateICmpEQ(gen, builder.CreateLoad(Seen, "seen"), "fresh");
+	builder.CreateCondBr(fresh, done, refresh);
+	ReturnInst::Create(Context, done);
+	builder.SetInsertPoint(refresh);
+	
+	for(unsigned k=0; k<RoundKeys.size(); k++){
+		GlobalVariable *key = RoundKeys.at(k);
+		GlobalVariable *sliced = SlicedRoundKeys.at(k);
+		if(key->isConstant())
+			continue;
+		uint64_t slices = sliced->getValueType()->getArrayNumElements();
+		
+		builder.CreateStore(idxZero, idxAlloca);
+		BasicBlock *forCond = BasicBlock::Create(Context, "for.cond", Setup);
+		BasicBlock *forBody = BasicBlock::Create(Context, "for.body", Setup);
+		BasicBlock *forEnd = BasicBlock::Create(Context, "for.end", Setup);
+		builder.CreateBr(forCond);
+		
+		IRBuilder<> forCondBuilder(forCond);
+		Value *idx = forCondBuilder.CreateLoad(idxAlloca, "idx");
+		Value *cmp = forCondBuilder.CreateICmpSLT(idx, ConstantInt::get(idxTy, slices), "cmp");
+		forCondBuilder.CreateCondBr(cmp, forBody, forEnd);
+		
+		IRBuilder<> forBodyBuilder(forBody);
+		idx = forBodyBuilder.CreateLoad(idxAlloca, "idxprom");
+		IdxList.at(1) = forBodyBuilder.CreateLShr(idx, ConstantInt::get(idxTy, 3));
+		Value *byte = forBodyBuilder.CreateInBoundsGEP(key, ArrayRef <Value *>(IdxList));
+		byte = forBodyBuilder.CreateLoad(byte);
+		Value *bitVal = forBodyBuilder.CreateZExt(byte, sliceTy);
+		Value *bitShift = forBodyBuilder.CreateAnd(idx, ConstantInt::get(idxTy, 7));
+		bitShift = forBodyBuilder.CreateTrunc(bitShift, sliceTy);
+		bitVal = forBodyBuilder.CreateLShr(bitVal, bitShift);
+		bitVal = forBodyBuilder.CreateAnd(bitVal, ConstantInt::get(sliceTy, 1));
+		bitVal = forBodyBuilder.CreateNeg(bitVal, "mask");		//0 or ~0
+		IdxList.at(1) = idx;
+		Value *sliceAddr = forBodyBuilder.CreateInBoundsGEP(sliced, ArrayRef <Value *>(IdxList), "sliceAddr");
+		forBodyBuilder.CreateStore(bitVal, sliceAddr);
+		Value *inc = forBodyBuilder.CreateNSWAdd(idx, ConstantInt::get(idxTy, 1), "inc");
+		forBodyBuilder.CreateStore(inc, idxAlloca);
+		forBodyBuilder.CreateBr(forCond);
+		
+		builder.SetInsertPoint(forEnd);
+	}
+	builder.CreateStore(gen, Seen);
+	builder.CreateBr(done);
+}
+
+
+
+//Returns the function handing out the random words of the masking, one per
+//call, so that a gate in a loop gets fresh randomness on every iteration. The
+//words come from the thread's bitslicer_randomness buffer; once its
+//bitslicer_randomness_len words are used, bitslicer_refill_randomness() must
+//refill it and reset bitslicer_randomness_used.
+Function *GetRandomnessSource(Module &M){
+	if(Function *Random = M.getFunction("bitslicer.random"))
+		return Random;
+	LLVMContext &Context = M.getContext();
+	Type *sliceTy = IntegerType::getInt32Ty(Context);
+	Type *lenTy = IntegerType::getInt64Ty(Context);
+	auto GetThreadLocal = [&](StringRef Name, Type *Ty){
+		GlobalVariable *G = M.getGlobalVariable(Name);
+		if(!G){
+			G = new GlobalVariable(M, Ty, false, GlobalValue::WeakAnyLinkage, Constant::getNullValue(Ty), Name);
+			G->setThreadLocal(true);
+		}
+		return G;
+	};
+	GlobalVariable *Buf = GetThreadLocal("bitslicer_randomness", PointerType::getUnqual(sliceTy));
+	GlobalVariable *Len = GetThreadLocal("bitslicer_randomness_len", lenTy);
+	GlobalVariable *Used = GetThreadLocal("bitslicer_randomness_used", lenTy);
+	Constant *Refill = M.getOrInsertFunction("bitslicer_refill_randomness", 
+											 FunctionType::get(Type::getVoidTy(Context), false));
+	
+	Function *Random = Function::Create(FunctionType::get(sliceTy, false), GlobalValue::InternalLinkage, 
+										"bitslicer.random", &M);
+	Random->addFnAttr(Attribute::AlwaysInline);
+	BasicBlock *entry = BasicBlock::Create(Context, "entry", Random);
+	BasicBlock *refill = BasicBlock::Create(Context, "refill", Random);
+	BasicBlock *take = BasicBlock::Create(Context, "take", Random);
+	IRBuilder<> builder(entry);
+	Value *empty = builder.CreateICmpUGE(builder.CreateLoad(Used), builder.CreateLoad(Len), "empty");
+	builder.CreateCondBr(empty, refill, take);
+	builder.SetInsertPoint(refill);
+	builder.CreateCall(Refill);
+	builder.CreateBr(take);
+	builder.SetInsertPoint(take);
+	Value *used = builder.CreateLoad(Used, "used");
+	Value *rnd = builder.CreateInBoundsGEP(builder.CreateLoad(Buf), used);
+	rnd = builder.CreateLoad(rnd, "rnd");
+	builder.CreateStore(builder.CreateAdd(used, ConstantInt::get(lenTy, 1)), Used);
+	builder.CreateRet(rnd);
+	return Random;
+}
+
+//Hides a share from the optimizer, which could otherwise fold it with its mask
+//or reassociate the XORs of the ISW products.
+Value *OpaqueShare(IRBuilder<> &builder, Value *v){
+	FunctionType *asmTy = FunctionType::get(v->getType(), {v->getType()}, false);
+	return builder.CreateCall(InlineAsm::get(asmTy, "", "=r,0", false), v, "share");
+}
+
+//Splits the unmasked v in MaskingOrder+1 shares with fresh random words. Each
+//random word masks all the blocks of a slice at once, so the randomness cost is
+//shared by the whole batch.
+SmallVector<Value *, 4> MaskValue(IRBuilder<> &builder, Value *v, Function *Random){
+	SmallVector<Value *, 4> shares(1, v);
+	for(unsigned s=0; s<MaskingOrder; s++){
+		if(isa<Constant>(v)){
+			shares.push_back(Constant::getNullValue(v->getType()));
+			continue;
+		}
+		Value *rnd = builder.CreateCall(Random, {}, "rnd");
+		shares[0] = OpaqueShare(builder, builder.CreateXor(shares[0], rnd));
+		shares.push_back(rnd);
+	}
+	return shares;
+}
+
+//Shares of v, masking it right after its definition when it is not shared yet,
+//so that every gate using it is dominated.
+SmallVector<Value *, 4> &GetShares(Value *v, DenseMap<Value *, SmallVector<Value *, 4>> &Shares, Function *Random){
+	auto it = Shares.find(v);
+	if(it != Shares.end())
+		return it->second;
+	
+	Instruction *insertPt;
+	if(auto *vInst = dyn_cast<Instruction>(v)){
+		if(isa<PHINode>(vInst))
+			insertPt = &*vInst->getParent()->getFirstInsertionPt();
+		else
+			insertPt = vInst->getNextNode();
+	}else if(auto *arg = dyn_cast<Argument>(v)){
+		insertPt = &*arg->getParent()->getEntryBlock().getFirstInsertionPt();
+	}else{
+		insertPt = nullptr;
+	}
+	IRBuilder<> builder(v->getContext());
+	if(insertPt)
+		builder.SetInsertPoint(insertPt);
+	Shares[v] = MaskValue(builder, v, Random);
+	return Shares[v];
+}
+
+//Recombines shares in the unmasked value.
+Value *Unmask(IRBuilder<> &builder, SmallVector<Value *, 4> &shares){
+	Value *unmasked = shares[0];
+	for(unsigned i=1; i<=MaskingOrder; i++)
+		unmasked = builder.CreateXor(unmasked, shares[i], "unmask");
+	return unmasked;
+}
+
+
+//ISW multiplication of two shared values.
+SmallVector<Value *, 4> MaskedAnd(IRBuilder<> &builder, SmallVector<Value *, 4> &a, 
+								  SmallVector<Value *, 4> &b, Function *Random){
+	SmallVector<Value *, 4> c;
+	for(unsigned i=0; i<=MaskingOrder; i++)
+		c.push_back(builder.CreateAnd(a[i], b[i], "isw"));
+	
+	for(unsigned i=0; i<=MaskingOrder; i++){
+		for(unsigned j=i+1; j<=MaskingOrder; j++){
+			Value *rnd = builder.CreateCall(Random, {}, "rnd");
+			Value *rji = OpaqueShare(builder, builder.CreateXor(rnd, builder.CreateAnd(a[i], b[j]), "isw"));
+			rji = builder.CreateXor(rji, builder.CreateAnd(a[j], b[i]), "isw");
+			c[i] = builder.CreateXor(c[i], rnd, "isw");
+			c[j] = builder.CreateXor(c[j], rji, "isw");
+		}
+	}
+	return c;
+}
+
+
+//Alloca ptr points into through GEPs and casts, if any.
+AllocaInst *GetMaskedBuffer(Value *ptr){
+	while(isa<GEPOperator>(ptr) || isa<BitCastOperator>(ptr))
+		ptr = cast<Operator>(ptr)->getOperand(0);
+	return dyn_cast<AllocaInst>(ptr);
+}
+
+//Address of the slice ptr points to in buf, rebased on its share buffer.
+Value *SharePointer(IRBuilder<> &builder, Value *ptr, AllocaInst *buf, AllocaInst *share){
+	if(ptr == buf)
+		return share;
+	if(auto *gep = dyn_cast<GEPOperator>(ptr)){
+		SmallVector<Value *, 4> IdxList(gep->idx_begin(), gep->idx_end());
+		return builder.CreateGEP(SharePointer(builder, gep->getPointerOperand(), buf, share), IdxList);
+	}
+	return builder.CreatePointerCast(SharePointer(builder, cast<Operator>(ptr)->getOperand(0), buf, share), 
+									 ptr->getType());
+}
+
+bool IsGate(Instruction *I){
+	return I->getOpcode() == Instruction::And || I->getOpcode() == Instruction::Or || 
+		   I->getOpcode() == Instruction::Xor;
+}
+
+//Masks the bit-sliced data of F. Every sliced buffer gets MaskingOrder share
+//buffers, and the transpositions store their slices already split with fresh
+//random words. The slices loaded from the buffers stay in shares through the
+//AND/OR/XOR gates (XOR share-wise, AND with the ISW multiplication, OR as
+//NOT(AND(NOT, NOT))), the PHIs and the stores into other local buffers; they
+//are recombined only where they leave the gates, as when the inverse
+//transposition shifts the bits out of the slices.
+void MaskBitSlicedFunction(Function &F, SmallPtrSetImpl<Value *> &Erased){
+	LLVMContext &Context = F.getContext();
+	Type *sliceTy = IntegerType::getInt32Ty(Context);
+	SmallPtrSet<AllocaInst *, 8> Buffers;
+	SmallPtrSet<Value *, 32> Shared;
+	
+	for(BasicBlock &B : F){
+		for(Instruction &I : B){
+			auto *all = dyn_cast<AllocaInst>(&I);
+			if(all && all->getMetadata("bit-sliced-data") && all->getAllocatedType()->isArrayTy() &&
+			   all->getAllocatedType()->getArrayElementType() == sliceTy)
+				Buffers.insert(all);
+		}
+	}
+	if(Buffers.empty())
+		return;
+	
+	//the shared values, and the local buffers they are stored to
+	bool changed = true;
+	while(changed){
+		changed = false;
+		for(BasicBlock &B : F){
+			for(Instruction &I : B){
+				if(Erased.count(&I) || (I.getType() != sliceTy && !isa<StoreInst>(&I)))
+					continue;
+				if(auto *ld = dyn_cast<LoadInst>(&I)){
+					if(Buffers.count(GetMaskedBuffer(ld->getPointerOperand())))
+						changed |= Shared.insert(ld).second;
+				}else if(auto *st = dyn_cast<StoreInst>(&I)){
+					AllocaInst *buf = GetMaskedBuffer(st->getPointerOperand());
+					if(buf && Shared.count(st->getValueOperand()))
+						changed |= Buffers.insert(buf).second;
+				}else if(isa<BinaryOperator>(&I) && IsGate(&I)){
+					if(Shared.count(I.getOperand(0)) || Shared.count(I.getOperand(1)))
+						changed |= Shared.insert(&I).second;
+				}else if(auto *phi = dyn_cast<PHINode>(&I)){
+					for(Value *in : phi->incoming_values()){
+						if(Shared.count(in))
+							changed |= Shared.insert(phi).second;
+					}
+				}
+			}
+		}
+	}
+	
+	//the shares of a buffer must be kept in step with it, so a buffer may only
+	//be accessed by slice loads and stores
+	for(AllocaInst *buf : Buffers){
+		std::vector<Value *> Ptrs(1, buf);
+		while(!Ptrs.empty()){
+			Value *ptr = Ptrs.back();
+			Ptrs.pop_back();
+			for(User *U : ptr->users()){
+				auto *st = dyn_cast<StoreInst>(U);
+				auto *II = dyn_cast<IntrinsicInst>(U);
+				if(Erased.count(U) || (isa<LoadInst>(U) && U->getType() == sliceTy) ||
+				   (st && st->getPointerOperand() == ptr && st->getValueOperand()->getType() == sliceTy) ||
+				   (II && (II->getIntrinsicID() == Intrinsic::lifetime_start || 
+						   II->getIntrinsicID() == Intrinsic::lifetime_end)))
+					continue;
+				if(isa<GEPOperator>(U) || isa<BitCastOperator>(U)){
+					Ptrs.push_back(U);
+					continue;
+				}
+				report_fatal_error("masking: the bit-sliced buffer " + buf->getName() + " of " + F.getName() +
+								   " is accessed other than by slice loads and stores; inline its bit-sliced "
+								   "callees");
+			}
+		}
+	}
+	
+	Function *Random = GetRandomnessSource(*F.getParent());
+	const DataLayout &DL = F.getParent()->getDataLayout();
+	IRBuilder<> entryBuilder(&*F.getEntryBlock().getFirstInsertionPt());
+	DenseMap<AllocaInst *, SmallVector<AllocaInst *, 2>> ShareBuffers;
+	for(AllocaInst *buf : Buffers){
+		if(!isa<Constant>(buf->getArraySize()))
+			report_fatal_error("masking: the bit-sliced buffer " + buf->getName() + " has a dynamic size");
+		for(unsigned s=0; s<MaskingOrder; s++){
+			AllocaInst *share = entryBuilder.CreateAlloca(buf->getAllocatedType(), buf->getArraySize(), 
+														  buf->getName() + ".share");
+			share->setMetadata("bit-sliced-data", MDNode::get(Context, MDString::get(Context, "bit-sliced-data")));
+			ShareBuffers[buf].push_back(share);
+		}
+	}
+	//a slot never stored to recombines to its share 0, as it read unmasked
+	for(auto &SB : ShareBuffers){
+		for(AllocaInst *share : SB.second){
+			uint64_t size = DL.getTypeAllocSize(share->getAllocatedType()) * 
+							cast<ConstantInt>(share->getArraySize())->getZExtValue();
+			entryBuilder.CreateMemSet(share, entryBuilder.getInt8(0), size, share->getAlignment());
+		}
+	}
+	
+	//the uses through which a shared value leaves the masked domain
+	DenseMap<Value *, SmallVector<Use *, 4>> Leaving;
+	for(Value *v : Shared){
+		for(Use &U : v->uses()){
+			auto *st = dyn_cast<StoreInst>(U.getUser());
+			if(Shared.count(U.getUser()) || Erased.count(U.getUser()) || 
+			   (st && U.getOperandNo() == 0 && Buffers.count(GetMaskedBuffer(st->getPointerOperand()))))
+				continue;
+			Leaving[v].push_back(&U);
+		}
+	}
+	
+	DenseMap<Value *, SmallVector<Value *, 4>> Shares;
+	std::vector<Instruction *> Masked;
+	for(Value *v : Shared){
+		if(auto *phi = dyn_cast<PHINode>(v)){
+			IRBuilder<> builder(phi);
+			for(unsigned i=0; i<=MaskingOrder; i++)
+				Shares[phi].push_back(builder.CreatePHI(sliceTy, phi->getNumIncomingValues(), "share"));
+			Masked.push_back(phi);
+		}
+	}
+	
+	ReversePostOrderTraversal<Function *> RPOT(&F);
+	for(BasicBlock *B : RPOT){
+		for(Instruction &I : *B){
+			if(Erased.count(&I))
+				continue;
+			IRBuilder<> builder(&I);
+			if(auto *ld = dyn_cast<LoadInst>(&I)){
+				if(!Shared.count(ld))
+					continue;
+				AllocaInst *buf = GetMaskedBuffer(ld->getPointerOperand());
+				SmallVector<Value *, 4> &shares = Shares[ld];
+				shares.push_back(ld);
+				for(AllocaInst *share : ShareBuffers[buf])
+					shares.push_back(builder.CreateLoad(SharePointer(builder, ld->getPointerOperand(), buf, share), "share"));
+			}else if(auto *st = dyn_cast<StoreInst>(&I)){
+				AllocaInst *buf = GetMaskedBuffer(st->getPointerOperand());
+				if(!Buffers.count(buf))
+					continue;
+				SmallVector<Value *, 4> shares = Shared.count(st->getValueOperand()) ? 
+													Shares[st->getValueOperand()] :
+													MaskValue(builder, st->getValueOperand(), Random);
+				st->setOperand(0, shares[0]);
+				for(unsigned s=0; s<MaskingOrder; s++)
+					builder.CreateStore(shares[s+1], SharePointer(builder, st->getPointerOperand(), buf, 
+																  ShareBuffers[buf][s]));
+			}else if(isa<BinaryOperator>(&I) && Shared.count(&I)){
+				SmallVector<Value *, 4> a = GetShares(I.getOperand(0), Shares, Random);
+				SmallVector<Value *, 4> b = GetShares(I.getOperand(1), Shares, Random);
+				SmallVector<Value *, 4> c;
+				switch(I.getOpcode()){
+					case Instruction::Xor:
+						for(unsigned i=0; i<=MaskingOrder; i++)
+							c.push_back(builder.CreateXor(a[i], b[i], "share"));
+					break;
+					case Instruction::And:
+						if(isa<Constant>(I.getOperand(0)) || isa<Constant>(I.getOperand(1))){
+							Value *mask = isa<Constant>(I.getOperand(0)) ? I.getOperand(0) : I.getOperand(1);
+							for(unsigned i=0; i<=MaskingOrder; i++)
+								c.push_back(builder.CreateAnd(isa<Constant>(I.getOperand(0)) ? b[i] : a[i], 
+															  mask, "share"));
+						}else{
+							c = MaskedAnd(builder, a, b, Random);
+						}
+					break;
+					case Instruction::Or:
+						a[0] = builder.CreateNot(a[0], "share");
+						b[0] = builder.CreateNot(b[0], "share");
+						c = MaskedAnd(builder, a, b, Random);
+						c[0] = builder.CreateNot(c[0], "share");
+					break;
+					default:
+					break;
+				}
+				Shares[&I] = c;
+				Masked.push_back(&I);
+			}
+		}
+	}
+	
+	for(Instruction *I : Masked){
+		auto *phi = dyn_cast<PHINode>(I);
+		if(!phi)
+			continue;
+		for(unsigned k=0; k<phi->getNumIncomingValues(); k++){
+			SmallVector<Value *, 4> shares = GetShares(phi->getIncomingValue(k), Shares, Random);
+			for(unsigned i=0; i<=MaskingOrder; i++)
+				cast<PHINode>(Shares[phi][i])->addIncoming(shares[i], phi->getIncomingBlock(k));
+		}
+	}
+	
+	for(auto &L : Leaving){
+		Instruction *insertPt = cast<Instruction>(L.first);
+		if(isa<PHINode>(insertPt))
+			insertPt = &*insertPt->getParent()->getFirstInsertionPt();
+		else if(isa<LoadInst>(insertPt))
+			insertPt = insertPt->getNextNode();
+		IRBuilder<> builder(insertPt);
+		Value *unmasked = Unmask(builder, Shares[L.first]);
+		for(Use *U : L.second)
+			U->set(unmasked);
+	}
+	
+	for(Instruction *I : Masked)
+		I->replaceAllUsesWith(UndefValue::get(I->getType()));
+	for(Instruction *I : Masked)
+		I->eraseFromParent();
+}
+
+
+//Masks the bit-sliced data of every function, after the orthogonal
+//transformations have been emitted so that they compute on the shares too.
+void MaskBitSlicedModule(Module &M){
+	SmallPtrSet<Value *, 32> Erased(eraseList.begin(), eraseList.end());
+	for(Function& F : M){
+		if(!F.isDeclaration())
+			MaskBitSlicedFunction(F, Erased);
+	}
+}
+
+
+//Per-thread table of the cycle counters, exposed to the runtime by its name.
+GlobalVariable *GetCycleTable(Module &M){
+	if(GlobalVariable *Table = M.getGlobalVariable("bitslicer_cycles"))
+		return Table;
+	ArrayType *tableTy = ArrayType::get(Type::getInt64Ty(M.getContext()), NumCycleCounters);
+	auto *Table = new GlobalVariable(M, tableTy, false, GlobalValue::WeakAnyLinkage,
+									 Constant::getNullValue(tableTy), "bitslicer_cycles");
+	Table->setThreadLocal(true);
+	return Table;
+}
+
+//Sums of the per-thread tables, the regions flush their thread's table into it.
+GlobalVariable *GetCycleTotals(Module &M){
+	if(GlobalVariable *Totals = M.getGlobalVariable("bitslicer_cycles_total"))
+		return Totals;
+	ArrayType *tableTy = ArrayType::get(Type::getInt64Ty(M.getContext()), NumCycleCounters);
+	return new GlobalVariable(M, tableTy, false, GlobalValue::WeakAnyLinkage,
+							  Constant::getNullValue(tableTy), "bitslicer_cycles_total");
+}
+
+//Moves the counters of the running thread to the totals. Each thread runs it
+//once, at its exit, and the dump runs it for its own thread.
+Function *GetCycleFlush(Module &M){
+	if(Function *Flush = M.getFunction("bitslicer_flush_cycles"))
+		return Flush;
+	LLVMContext &Context = M.getContext();
+	FunctionType *flushTy = FunctionType::get(Type::getVoidTy(Context), {Type::getInt8PtrTy(Context)}, false);
+	Function *Flush = Function::Create(flushTy, GlobalValue::WeakAnyLinkage, "bitslicer_flush_cycles", &M);
+	IRBuilder<> builder(BasicBlock::Create(Context, "entry", Flush));
+	for(unsigned cost = 0; cost < NumCycleCounters; cost++){
+		Value *IdxList[] = {builder.getInt64(0), builder.getInt64(cost)};
+		Value *counter = builder.CreateInBoundsGEP(GetCycleTable(M), IdxList, "cycles");
+		Value *total = builder.CreateInBoundsGEP(GetCycleTotals(M), IdxList, "total");
+		builder.CreateAtomicRMW(AtomicRMWInst::Add, total, builder.CreateLoad(counter), AtomicOrdering::Monotonic);
+		builder.CreateStore(builder.getInt64(0), counter);
+	}
+	builder.CreateRetVoid();
+	return Flush;
+}
 
-		IRBuilder<> forBodyBuilder(forBody);
-		forBodyBuilder.CreateStore(ConstantInt::get(byteTy, 0), tmpAlloca);
-		forBodyBuilder.CreateStore(idxZero, idx2Alloca);
-		BasicBlock *forCond2 = BasicBlock::Create(Context, "for.cond", call->getFunction(), forEnd);
-		forBodyBuilder.CreateBr(forCond2);
+//Right before I, registers the flush of the running thread's table for the
+//exit of the thread, the first time the thread gets there. This is the hook
+//of the destructors of C++ thread_local objects.
+void RegisterCycleFlush(Instruction *I){
+	Module *M = I->getModule();
+	LLVMContext &Context = M->getContext();
+	Type *flagTy = Type::getInt8Ty(Context);
+	GlobalVariable *Registered = M->getGlobalVariable("bitslicer_cycles_registered");
+	if(!Registered){
+		Registered = new GlobalVariable(*M, flagTy, false, GlobalValue::WeakAnyLinkage,
+										ConstantInt::get(flagTy, 0), "bitslicer_cycles_registered");
+		Registered->setThreadLocal(true);
+	}
+	GlobalVariable *DSO = M->getGlobalVariable("__dso_handle");
+	if(!DSO){
+		DSO = new GlobalVariable(*M, flagTy, false, GlobalValue::ExternalLinkage, nullptr, "__dso_handle");
+		DSO->setVisibility(GlobalValue::HiddenVisibility);
+	}
+	
+	IRBuilder<> builder(I);
+	Value *first = builder.CreateICmpEQ(builder.CreateLoad(Registered), builder.getInt8(0), "first");
+	TerminatorInst *then = SplitBlockAndInsertIfThen(first, I, false);
+	then->getParent()->setName("cycles.register");
+	I->getParent()->setName("cycles.registered");
+	builder.SetInsertPoint(then);
+	builder.CreateStore(builder.getInt8(1), Registered);
+	Function *Flush = GetCycleFlush(*M);
+	Type *ptrTy = builder.getInt8PtrTy();
+	Constant *AtExit = M->getOrInsertFunction("__cxa_thread_atexit", builder.getInt32Ty(), 
+											  Flush->getType(), ptrTy, ptrTy);
+	builder.CreateCall(AtExit, {Flush, ConstantPointerNull::get(cast<PointerType>(ptrTy)), DSO});
+}
 
-		IRBuilder<> forCond2Builder(forCond2);
-		Value *idx2 = forCond2Builder.CreateLoad(idx2Alloca);
-		Value *cmp2 = forCond2Builder.CreateICmpSLT(idx2, ConstantInt::get(idxTy, 8), "cmp");
-		BasicBlock *forBody2 = BasicBlock::Create(Context, "for.body", call->getFunction(), forEnd);
-		BasicBlock *forEnd2 = BasicBlock::Create(Context, "for.end", call->getFunction(), forEnd);
-		forCond2Builder.CreateCondBr(cmp2, forBody2, forEnd2);
+//Adds the cycles elapsed since start to the counter of cost, right before I.
+void AddCycles(Instruction *I, Value *start, InstrumentedCost cost){
+	Module *M = I->getModule();
+	IRBuilder<> builder(I);
+	Value *stop = builder.CreateCall(Intrinsic::getDeclaration(M, Intrinsic::readcyclecounter));
+	Value *IdxList[] = {builder.getInt64(0), builder.getInt64(cost)};
+	Value *counter = builder.CreateInBoundsGEP(GetCycleTable(*M), IdxList, "cycles");
+	Value *cycles = builder.CreateAdd(builder.CreateLoad(counter), builder.CreateSub(stop, start));
+	builder.CreateStore(cycles, counter);
+}
 
-		IRBuilder<> forBody2Builder(forBody2);
-		idx = forBody2Builder.CreateLoad(idxAlloca);
-		idx2 = forBody2Builder.CreateLoad(idx2Alloca);
-		Value *idxMul = forBody2Builder.CreateNSWMul(idx, ConstantInt::get(idxTy, 8));
-		Value *idxAdd = forBody2Builder.CreateNSWAdd(idxMul, idx2);
-		SliceIdxList.at(1) = idxAdd;
-		Value *slice = forBody2Builder.CreateGEP(slicesAlloca, ArrayRef <Value *>(SliceIdxList));
-		slice = forBody2Builder.CreateLoad(slice);
-		slice = forBody2Builder.CreateZExt(slice, idxTy);
-		slice = forBody2Builder.CreateAnd(slice, ConstantInt::get(idxTy, 1));
-		slice = forBody2Builder.CreateShl(slice, idx2);
-		Value *tmp = forBody2Builder.CreateLoad(tmpAlloca);
-		slice = forBody2Builder.CreateTrunc(slice, byteTy);
-		tmp = forBody2Builder.CreateOr(tmp, slice);
-		forBody2Builder.CreateStore(tmp, tmpAlloca);
-		BasicBlock *forInc2 = BasicBlock::Create(Context, "for.inc", call->getFunction(), forEnd2);
-		forBody2Builder.CreateBr(forInc2);
+//Counts the cycles of what gets emitted in place of the call: the expansions
+//insert before it and split the blocks at it, so the counter stays after it.
+void InstrumentCall(CallInst *call, InstrumentedCost cost){
+	if(!Instrument)
+		return;
+	IRBuilder<> builder(call);
+	Value *start = builder.CreateCall(Intrinsic::getDeclaration(call->getModule(), Intrinsic::readcyclecounter));
+	AddCycles(call->getNextNode(), start, cost);
+	if(std::find(InstrumentedFns.begin(), InstrumentedFns.end(), call->getFunction()) == InstrumentedFns.end())
+		InstrumentedFns.push_back(call->getFunction());
+}
 
-		IRBuilder<> forInc2Builder(forInc2);
-		Value *inc2 = forInc2Builder.CreateLoad(idx2Alloca);
-		inc2 = forInc2Builder.CreateNSWAdd(inc2, ConstantInt::get(idxTy, 1));
-		forInc2Builder.CreateStore(inc2 ,idx2Alloca);
-		forInc2Builder.CreateBr(forCond2);
+//Counts the whole run of the functions holding instrumented calls. The
+//counters stay in the thread's table, which is flushed into
+//bitslicer_cycles_total when the thread exits; every module registers a
+//destructor to dump the totals, the first one to run prints them.
+void EmitCycleRegions(Module &M){
+	LLVMContext &Context = M.getContext();
+	for(Function *F : InstrumentedFns){
+		IRBuilder<> builder(&*F->getEntryBlock().getFirstInsertionPt());
+		Value *start = builder.CreateCall(Intrinsic::getDeclaration(&M, Intrinsic::readcyclecounter), {}, "start");
+		std::vector<Instruction *> Returns;
+		for(BasicBlock &B : *F){
+			if(isa<ReturnInst>(B.getTerminator()))
+				Returns.push_back(B.getTerminator());
+		}
+		for(Instruction *ret : Returns){
+			AddCycles(ret, start, RegionCycles);
+			RegisterCycleFlush(ret);
+		}
+	}
+	
+	if(M.getFunction("bitslicer_dump_cycles"))
+		return;
+	FunctionType *dumpTy = FunctionType::get(Type::getVoidTy(Context), false);
+	Function *Dump = Function::Create(dumpTy, GlobalValue::WeakAnyLinkage, "bitslicer_dump_cycles", &M);
+	BasicBlock *entry = BasicBlock::Create(Context, "entry", Dump);
+	BasicBlock *print = BasicBlock::Create(Context, "print", Dump);
+	BasicBlock *done = BasicBlock::Create(Context, "done", Dump);
+	IRBuilder<> builder(entry);
+	Type *intTy = builder.getInt32Ty();
+	auto *Dumped = new GlobalVariable(M, intTy, false, GlobalValue::WeakAnyLinkage,
+									  ConstantInt::get(intTy, 0), "bitslicer_cycles_dumped");
+	Value *dumped = builder.CreateAtomicRMW(AtomicRMWInst::Xchg, Dumped, builder.getInt32(1), 
+											AtomicOrdering::Monotonic);
+	builder.CreateCondBr(builder.CreateICmpEQ(dumped, builder.getInt32(0)), print, done);
+	ReturnInst::Create(Context, done);
+	
+	builder.SetInsertPoint(print);
+	builder.CreateCall(GetCycleFlush(M), ConstantPointerNull::get(builder.getInt8PtrTy()));	//the dumping thread
+	Constant *Dprintf = M.getOrInsertFunction("dprintf", FunctionType::get(intTy, {intTy, builder.getInt8PtrTy()}, true));
+	std::vector<Value *> Args;
+	Args.push_back(builder.getInt32(2));
+	Args.push_back(builder.CreateGlobalStringPtr("bitslicer cycles: transpose %llu, inverse transpose %llu, "
+												 "orthogonal %llu, bit-sliced functions %llu\n"));
+	for(unsigned cost = 0; cost < NumCycleCounters; cost++){
+		Value *IdxList[] = {builder.getInt64(0), builder.getInt64(cost)};
+		Args.push_back(builder.CreateLoad(builder.CreateInBoundsGEP(GetCycleTotals(M), IdxList)));
+	}
+	builder.CreateCall(Dprintf, Args);
+	builder.CreateBr(done);
+	appendToGlobalDtors(M, Dump, 0);
+}
 
-		IRBuilder<> forEnd2Builder(forEnd2);
-		Value *newByte = forEnd2Builder.CreateLoad(tmpAlloca);
-		idx = forEnd2Builder.CreateLoad(idxAlloca, "idxprom");
-		Value *byteAddr;
-		if(oldAlloca->getAllocatedType()->isPointerTy()){
-			IdxList.at(0) = idx;
-			Value *ptrVal = forEnd2Builder.CreateLoad(oldAlloca);
-			byteAddr = forEnd2Builder.CreateGEP(ptrVal, ArrayRef <Value *>(IdxList));
-		}else{
-			IdxList.at(1) = idx;
-			byteAddr = forEnd2Builder.CreateGEP(oldAlloca, ArrayRef <Value *>(IdxList));
+//Matrix over GF(2) of the multiplication by c in GF(2)[x]/poly, n being the
+//degree of poly: bit i of rows[j] is set if input bit i contributes to output bit j.
+std::vector<BitVector> GFMulMatrix(uint64_t poly, uint64_t c, unsigned n){
+	std::vector<BitVector> rows(n, BitVector(n));
+	uint64_t col = c;
+	for(unsigned i=0; i<n; i++){
+		for(unsigned j=0; j<n; j++){
+			if((col >> j) & 1)
+				rows.at(j).set(i);
 		}
-		//Value *byteAddr = forEnd2Builder.CreateGEP(oldAlloca, ArrayRef <Value *>(IdxList), "byteAddr");
-		forEnd2Builder.CreateStore(newByte, byteAddr);
-		BasicBlock *forInc = BasicBlock::Create(Context, "for.inc", call->getFunction(), forEnd);
-		forEnd2Builder.CreateBr(forInc);
+		col <<= 1;					//xtime
+		if((col >> n) & 1)
+			col ^= poly;
+	}
+	return rows;
+}
 
-		IRBuilder<> forIncBuilder(forInc);
-		Value *inc = forIncBuilder.CreateLoad(idxAlloca);
-		inc = forIncBuilder.CreateNSWAdd(inc, ConstantInt::get(idxTy, 1));
-		forIncBuilder.CreateStore(inc, idxAlloca);
-		forIncBuilder.CreateBr(forCond);
+//Emits the XOR network computing out[j] = XOR of the in[i] selected by rows[j].
+//With GFMulPaar the pair of signals shared by most rows is repeatedly replaced
+//by a new signal, until no pair is shared (Paar's cancellation-free heuristic).
+void EmitXorNetwork(IRBuilder<> &builder, std::vector<Value *> in, std::vector<BitVector> rows,
+					std::vector<Value *> &out){
+	for(auto &row : rows)
+		row.resize(in.size());
+	
+	while(GFMulPaar){
+		unsigned best = 1, bestA = 0, bestB = 0;
+		for(unsigned a=0; a<in.size(); a++){
+			for(unsigned b=a+1; b<in.size(); b++){
+				unsigned shared = 0;
+				for(auto &row : rows)
+					shared += row.test(a) && row.test(b);
+				if(shared > best){
+					best = shared;
+					bestA = a;
+					bestB = b;
+				}
+			}
+		}
+		if(best < 2)
+			break;
+		
+		in.push_back(builder.CreateXor(in.at(bestA), in.at(bestB), "gfmul"));
+		for(auto &row : rows){
+			row.resize(in.size());
+			if(row.test(bestA) && row.test(bestB)){
+				row.reset(bestA);
+				row.reset(bestB);
+				row.set(in.size()-1);
+			}
+		}
 	}
-	return true;
+	
+	out.clear();
+	for(auto &row : rows){
+		Value *res = nullptr;
+		for(int i = row.find_first(); i != -1; i = row.find_next(i))
+			res = res ? builder.CreateXor(res, in.at(i), "gfmul") : in.at(i);
+		out.push_back(res ? res : Constant::getNullValue(in.at(0)->getType()));
+	}
+}
+
+//Carry-less product of two polynomials given by the slices of their
+//coefficients. Karatsuba halves the operands, three half products instead of
+//four, down to 16 coefficients where the schoolbook product is cheaper.
+std::vector<Value *> EmitClMul(IRBuilder<> &builder, ArrayRef<Value *> a, ArrayRef<Value *> b){
+	unsigned n = a.size();
+	std::vector<Value *> prod(2*n-1, nullptr);
+	auto accumulate = [&](unsigned k, Value *v){
+		prod.at(k) = prod.at(k) ? builder.CreateXor(prod.at(k), v, "clmul") : v;
+	};
+	
+	if(n <= 16 || n % 2){
+		for(unsigned i=0; i<n; i++)
+			for(unsigned j=0; j<n; j++)
+				accumulate(i+j, builder.CreateAnd(a[i], b[j], "clmul"));
+		return prod;
+	}
+	
+	unsigned h = n/2;
+	std::vector<Value *> aSum, bSum;
+	for(unsigned i=0; i<h; i++){
+		aSum.push_back(builder.CreateXor(a[i], a[i+h], "clmul"));
+		bSum.push_back(builder.CreateXor(b[i], b[i+h], "clmul"));
+	}
+	std::vector<Value *> lo = EmitClMul(builder, a.slice(0, h), b.slice(0, h));
+	std::vector<Value *> hi = EmitClMul(builder, a.slice(h), b.slice(h));
+	std::vector<Value *> mid = EmitClMul(builder, aSum, bSum);
+	for(unsigned k=0; k<lo.size(); k++){
+		accumulate(k, lo.at(k));
+		accumulate(k+2*h, hi.at(k));
+		accumulate(k+h, builder.CreateXor(mid.at(k), builder.CreateXor(lo.at(k), hi.at(k), "clmul"), "clmul"));
+	}
+	return prod;
 }
 
+//Slice of coefficient i of a GF(2^128) element: POLYVAL order, x^i is bit i of
+//the little-endian block, or GHASH order, x^i is bit 7-i%8 of byte i/8
+unsigned GF128Slice(unsigned i, bool ghash){
+	return ghash ? (i & ~7u) + 7 - (i & 7) : i;
+}
 
+//converts a range of bits [begin, end] of a description into a range of slices
+bool BitRangeToSlices(bool ranged, uint64_t &begin, uint64_t &end){
+	if(!ranged)
+		return true;
+	if(begin % Layout || (end+1) % Layout){
+		errs() << "error: range " << begin << "," << end << " is not aligned to the lane width\n";
+		return false;
+	}
+	begin /= Layout;
+	end = (end+1)/Layout - 1;
+	return true;
+}
 
 void OrthogonalTransformation(CallInst *call, StringRef Description){
 	//StringRef Description = cast<ConstantDataSequential>(cast<User>(cast<User>(call->getArgOperand(1))
@@ -764,7 +3169,7 @@ void OrthogonalTransformation(CallInst *call, StringRef Description){
 	IRBuilder<> builder(call);
 	
 	Value *DOper, *LOper, *ROper;
-	AllocaInst *allDOper, *allLOper, *allROper;
+	Value *allDOper, *allLOper, *allROper;
 	GlobalVariable *glOper;
 	int constOper;
 	std::vector<Value *> IdxList;
@@ -904,20 +3309,26 @@ void OrthogonalTransformation(CallInst *call, StringRef Description){
 		errs() << s << "\n";
 	}
 	
+	//with wider lanes the descriptions still count bits, only whole elements can be addressed
+	if(Layout != BitSliced && op.equals("move")){
+		errs() << "error: bit permutations are only supported with the bit layout\n";
+		return;
+	}
+	
 /*----------------------------------------XOR---------------------------------------*/	
 	
 	if(op.equals("^")){
 		for(i=0; i<AllocOldNames.size(); i++){
 			if(AllocOldNames.at(i).equals(leftOperand.at(0))){
-				allLOper = cast<AllocaInst>(AllocNewInstBuff.at(i));
+				allLOper = AllocNewInstBuff.at(i);
 				foundLeftOperand = true;
 			}
 			if(AllocOldNames.at(i).equals(rightOperand.at(0))){
-				allROper = cast<AllocaInst>(AllocNewInstBuff.at(i));
+				allROper = AllocNewInstBuff.at(i);
 				foundRightOperand = true;
 			}
 			if(AllocOldNames.at(i).equals(destOperand.at(0))){
-				allDOper = cast<AllocaInst>(AllocNewInstBuff.at(i));
+				allDOper = AllocNewInstBuff.at(i);
 				foundDestOperand = true;
 			}
 			if((foundLeftOperand || foundRightOperand) && foundDestOperand) break;
@@ -946,13 +3357,13 @@ void OrthogonalTransformation(CallInst *call, StringRef Description){
 		}
 		
 		if(leftOperand.at(1).equals("all") && rightOperand.at(1).equals("all")){
-			arraySize = cast<ArrayType>(allLOper->getAllocatedType())->getNumElements();
+			arraySize = SlicedArrayType(allLOper)->getNumElements();
 				
-			if(arraySize != cast<ArrayType>(allROper->getAllocatedType())->getNumElements()){
+			if(arraySize != SlicedArrayType(allROper)->getNumElements()){
 				errs() << "error: operation addressing all of the bits of operands of different size\n";
 				return;
 			}
-			if(arraySize > cast<ArrayType>(allDOper->getAllocatedType())->getNumElements()){
+			if(arraySize > SlicedArrayType(allDOper)->getNumElements()){
 				errs() << "error: assignement to variable of insufficient size\n";
 				return;
 			}
@@ -1046,6 +3457,18 @@ void OrthogonalTransformation(CallInst *call, StringRef Description){
 				}
 			}
 			
+			if(Layout != BitSliced){
+				if(notBitSlicedLeftOperand || notBitSlicedRightOperand){
+					errs() << "error: operands that are not sliced are only supported with the bit layout\n";
+					return;
+				}
+				if(!BitRangeToSlices(rangedLeftOperand, rangeBeginLOp, rangeEndLOp) ||
+				   !BitRangeToSlices(rangedRightOperand, rangeBeginROp, rangeEndROp) ||
+				   !BitRangeToSlices(rangedDestOperand, rangeBeginDOp, rangeEndDOp))
+					return;
+				range /= Layout;
+			}
+			
 			AllocaInst *idxAlloca = builder.CreateAlloca(idxTy, 0, "idx");
 			builder.CreateStore(idxZero, idxAlloca);
 			BasicBlock *forEnd = call->getParent()->splitBasicBlock(call, "for.end");
@@ -1142,13 +3565,13 @@ void OrthogonalTransformation(CallInst *call, StringRef Description){
 	
 	/*
 		if(leftOperand.at(1).equals("all") && rightOperand.at(1).equals("all")){	//all ^ all
-				arraySize = cast<ArrayType>(allLOper->getAllocatedType())->getNumElements();
+				arraySize = SlicedArrayType(allLOper)->getNumElements();
 				
-				if(arraySize != cast<ArrayType>(allLOper->getAllocatedType())->getNumElements()){
+				if(arraySize != SlicedArrayType(allLOper)->getNumElements()){
 					errs() << "error: operation addressing all of the bits of operands of different size\n";
 					return;
 				}
-				if(arraySize > cast<ArrayType>(allDOper->getAllocatedType())->getNumElements()){
+				if(arraySize > SlicedArrayType(allDOper)->getNumElements()){
 					errs() << "error: assignement to variable of insufficient size\n";
 					return;
 				}
@@ -1176,11 +3599,11 @@ void OrthogonalTransformation(CallInst *call, StringRef Description){
 
 		for(i=0; i<AllocOldNames.size(); i++){
 			if(AllocOldNames.at(i).equals(leftOperand.at(0))){
-				allLOper = cast<AllocaInst>(AllocNewInstBuff.at(i));
+				allLOper = AllocNewInstBuff.at(i);
 				foundLeftOperand = true;
 			}
 			if(AllocOldNames.at(i).equals(rightOperand.at(0))){
-				allROper = cast<AllocaInst>(AllocNewInstBuff.at(i));
+				allROper = AllocNewInstBuff.at(i);
 				foundRightOperand = true;
 			}
 			if(!foundRightOperand){
@@ -1192,14 +3615,14 @@ void OrthogonalTransformation(CallInst *call, StringRef Description){
 				globalRightOperand = true;
 			}
 			if(AllocOldNames.at(i).equals(destOperand.at(0))){
-				allDOper = cast<AllocaInst>(AllocNewInstBuff.at(i));
+				allDOper = AllocNewInstBuff.at(i);
 				foundDestOperand = true;
 			}
 			if(foundLeftOperand && (foundRightOperand || globalRightOperand) && foundDestOperand) break;
 		}
 		
 		if(leftOperand.at(1).equals("all") && rightOperand.at(1).equals("all")){
-			arraySize = cast<ArrayType>(allLOper->getAllocatedType())->getNumElements();
+			arraySize = SlicedArrayType(allLOper)->getNumElements();
 			ArrayType *arrTy = ArrayType::get(sliceTy, arraySize);
 			AllocaInst *tmpArray = builder.CreateAlloca(arrTy, 0, "tmpArray");
 			AllocaInst *idxAlloca = builder.CreateAlloca(idxTy, 0, "idx");
@@ -1282,108 +3705,424 @@ void OrthogonalTransformation(CallInst *call, StringRef Description){
 			forInc2Builder.CreateBr(forCond2);
 		}
 	}
-
+
+	
+/*--------------------------------------ROT------------------------------------*/
+
+	if(op.equals("rotL") || op.equals("rotR")){
+		for(i=0; i<AllocOldNames.size(); i++){
+			if(AllocOldNames.at(i).equals(leftOperand.at(0))){
+				allLOper = AllocNewInstBuff.at(i);
+				foundLeftOperand = true;
+			}
+			if(AllocOldNames.at(i).equals(rightOperand.at(0))){
+				allROper = AllocNewInstBuff.at(i);
+				foundRightOperand = true;
+			}
+			if(!foundRightOperand){
+				constOper = std::stoi(rightOperand.at(0).str());
+				constantRightOperand = true;
+			}
+			if(AllocOldNames.at(i).equals(destOperand.at(0))){
+				allDOper = AllocNewInstBuff.at(i);
+				foundDestOperand = true;
+			}
+			if(foundLeftOperand && (foundRightOperand || constantRightOperand) && foundDestOperand) break;
+		}
+		
+		if(constantRightOperand && Layout != BitSliced){
+			if(constOper % Layout){
+				errs() << "error: rotation by " << constOper << " bits is not a multiple of the lane width\n";
+				return;
+			}
+			constOper /= Layout;
+		}
+		
+		arraySize = SlicedArrayType(allLOper)->getNumElements();
+		
+		//clocking a ring costs no gates: slot h+i holds logical slice i, so a
+		//left rotation by k moves the head back by k and a right one forward
+		auto ring = RingHeads.find(allLOper);
+		if(constantRightOperand && ring != RingHeads.end()){
+			uint64_t k = constOper % arraySize;
+			uint64_t step = op.equals("rotL") ? (arraySize - k) % arraySize : k;
+			builder.CreateStore(RingSliceIdx(builder, allLOper, ConstantInt::get(idxTy, step)), ring->second);
+			return;
+		}
+		
+		ArrayType *arrTy = ArrayType::get(sliceTy, arraySize);
+		AllocaInst *tmpArray = builder.CreateAlloca(arrTy, 0, "tmpArray");
+		AllocaInst *idxAlloca = builder.CreateAlloca(idxTy, 0, "idx");
+		builder.CreateStore(idxZero, idxAlloca);
+		BasicBlock *forEnd = call->getParent()->splitBasicBlock(call, "for.end");
+		BasicBlock *forCond = BasicBlock::Create(Context, "for.cond", call->getFunction(), forEnd);
+		idxAlloca->getParent()->getTerminator()->setSuccessor(0, forCond);
+			
+		IRBuilder<> forCondBuilder(forCond);
+		Value *idx = forCondBuilder.CreateLoad(idxAlloca, "idx");
+		Value *cmp = forCondBuilder.CreateICmpSLT(idx, ConstantInt::get(idxTy, arraySize), "cmp");
+		BasicBlock *forBody = BasicBlock::Create(Context, "for.body", call->getFunction(), forEnd);
+		forCondBuilder.CreateCondBr(cmp, forBody, forEnd);
+			
+		IRBuilder<> forBodyBuilder(forBody);
+		idx = forBodyBuilder.CreateLoad(idxAlloca, "idxprom");
+		IdxList.at(1) = idx;
+		LOper = forBodyBuilder.CreateGEP(allLOper, ArrayRef <Value *>(IdxList));
+		LOper = forBodyBuilder.CreateLoad(LOper);
+		Value *copy = forBodyBuilder.CreateGEP(tmpArray, ArrayRef <Value *>(IdxList));
+		forBodyBuilder.CreateStore(LOper, copy);
+		BasicBlock *forInc = BasicBlock::Create(Context, "for.inc", call->getFunction(), forEnd);
+		forBodyBuilder.CreateBr(forInc);
+	
+		IRBuilder<> forIncBuilder(forInc);
+		Value *inc = forIncBuilder.CreateLoad(idxAlloca);
+		inc = forIncBuilder.CreateNSWAdd(inc, ConstantInt::get(idxTy, 1), "inc");
+		forIncBuilder.CreateStore(inc, idxAlloca);
+		forIncBuilder.CreateBr(forCond);
+
+
+
+		BasicBlock *forEnd2 = call->getParent()->splitBasicBlock(call, "for.end");
+		IRBuilder<> forEndBuilder(forEnd->getTerminator());
+		forEndBuilder.CreateStore(idxZero, idxAlloca);
+		BasicBlock *forCond2 = BasicBlock::Create(Context, "for.cond", call->getFunction(), forEnd2);
+		forEnd->getTerminator()->setSuccessor(0, forCond2);
+		
+		IRBuilder<> forCond2Builder(forCond2);
+		idx = forCond2Builder.CreateLoad(idxAlloca, "idx");
+		cmp = forCond2Builder.CreateICmpSLT(idx, ConstantInt::get(idxTy, arraySize), "cmp");
+		BasicBlock *forBody2 = BasicBlock::Create(Context, "for.body", call->getFunction(), forEnd2);
+		forCond2Builder.CreateCondBr(cmp, forBody2, forEnd2);
+			
+		IRBuilder<> forBody2Builder(forBody2);
+		idx = forBody2Builder.CreateLoad(idxAlloca, "idxprom");
+		IdxList.at(1) = idx;
+		Value *tmp = forBody2Builder.CreateGEP(tmpArray, ArrayRef <Value *>(IdxList));
+		tmp = forBody2Builder.CreateLoad(tmp);
+		Value *rotIdx;
+		if(constantRightOperand){
+			if(op.equals("rotL"))	
+				rotIdx = forBody2Builder.CreateNSWAdd(idx, ConstantInt::get(idxTy, constOper));
+			else if(op.equals("rotR"))
+				rotIdx = forBody2Builder.CreateNSWAdd(idx, ConstantInt::get(idxTy, arraySize-constOper));
+		}else{
+			rotIdx = forBody2Builder.CreateLoad(allROper);
+			if(op.equals("rotL"))
+				rotIdx = forBody2Builder.CreateNSWAdd(idx, rotIdx);
+			else if(op.equals("rotR")){
+				Value *complement = forBody2Builder.CreateNSWSub(ConstantInt::get(idxTy, arraySize), rotIdx);
+				rotIdx = forBody2Builder.CreateNSWAdd(rotIdx, complement);
+			}	
+		}
+		rotIdx = forBody2Builder.CreateSRem(rotIdx, ConstantInt::get(idxTy, arraySize));
+		IdxList.at(1) = rotIdx;
+		DOper = forBody2Builder.CreateGEP(allLOper, ArrayRef <Value *>(IdxList), "LOper");
+		forBody2Builder.CreateStore(tmp, DOper);
+		BasicBlock *forInc2 = BasicBlock::Create(Context, "for.inc", call->getFunction(), forEnd2);
+		forBody2Builder.CreateBr(forInc2);
+		
+		IRBuilder<> forInc2Builder(forInc2);
+		Value *inc2 = forInc2Builder.CreateLoad(idxAlloca);
+		inc2 = forInc2Builder.CreateNSWAdd(inc2, ConstantInt::get(idxTy, 1), "inc");
+		forInc2Builder.CreateStore(inc2, idxAlloca);
+		forInc2Builder.CreateBr(forCond2);
+	}
+	
+	
+/*-------------------------------------GFMUL-----------------------------------*/
+
+	//D:all:=:S:all::gfmul::poly:const multiplies each group of n slices of S, one
+	//element of GF(2)[x]/poly of degree n, by const and stores the products in D
+	if(op.equals("gfmul")){
+		for(i=0; i<AllocOldNames.size(); i++){
+			if(AllocOldNames.at(i).equals(leftOperand.at(0))){
+				allLOper = AllocNewInstBuff.at(i);
+				foundLeftOperand = true;
+			}
+			if(AllocOldNames.at(i).equals(destOperand.at(0))){
+				allDOper = AllocNewInstBuff.at(i);
+				foundDestOperand = true;
+			}
+			if(foundLeftOperand && foundDestOperand) break;
+		}
+		
+		if(!foundLeftOperand || !foundDestOperand){
+			errs() << "error: gfmul operands must be bit-sliced\n";
+			return;
+		}
+		if(Layout != BitSliced){
+			errs() << "error: gfmul is only supported with the bit layout\n";
+			return;
+		}
+		
+		uint64_t poly, mulConst;
+		if(rightOperand.size() != 2 || rightOperand.at(0).getAsInteger(0, poly) ||
+		   rightOperand.at(1).getAsInteger(0, mulConst)){
+			errs() << "error: expected gfmul::poly:const\n";
+			return;
+		}
+		unsigned degree = poly ? Log2_64(poly) : 0;
+		if(degree == 0 || degree > 32 || (mulConst >> degree)){
+			errs() << "error: gfmul constant " << mulConst << " is not an element of GF(2)[x]/" << poly << "\n";
+			return;
+		}
+		
+		arraySize = SlicedArrayType(allLOper)->getNumElements();
+		if(arraySize % degree){
+			errs() << "error: " << arraySize << " slices are not a whole number of GF(2^" << degree << ") elements\n";
+			return;
+		}
+		if(arraySize > SlicedArrayType(allDOper)->getNumElements()){
+			errs() << "error: assignement to variable of insufficient size\n";
+			return;
+		}
+		
+		std::vector<BitVector> rows = GFMulMatrix(poly, mulConst, degree);
+		
+		IRBuilder<> entryBuilder(&*call->getFunction()->getEntryBlock().getFirstInsertionPt());
+		AllocaInst *idxAlloca = entryBuilder.CreateAlloca(idxTy, 0, "idx");
+		builder.CreateStore(idxZero, idxAlloca);
+		BasicBlock *head = call->getParent();
+		BasicBlock *forEnd = head->splitBasicBlock(call, "for.end");
+		BasicBlock *forCond = BasicBlock::Create(Context, "for.cond", call->getFunction(), forEnd);
+		head->getTerminator()->setSuccessor(0, forCond);
+		
+		IRBuilder<> forCondBuilder(forCond);
+		Value *idx = forCondBuilder.CreateLoad(idxAlloca, "idx");
+		Value *cmp = forCondBuilder.CreateICmpSLT(idx, ConstantInt::get(idxTy, arraySize), "cmp");
+		BasicBlock *forBody = BasicBlock::Create(Context, "for.body", call->getFunction(), forEnd);
+		forCondBuilder.CreateCondBr(cmp, forBody, forEnd);
+		
+		//all the slices of the element are read before writing, D may be S
+		IRBuilder<> forBodyBuilder(forBody);
+		idx = forBodyBuilder.CreateLoad(idxAlloca, "idxprom");
+		std::vector<Value *> in, out;
+		for(unsigned j=0; j<degree; j++){
+			IdxList.at(1) = forBodyBuilder.CreateNSWAdd(idx, ConstantInt::get(idxTy, j));
+			LOper = forBodyBuilder.CreateGEP(allLOper, ArrayRef <Value *>(IdxList), "LOper");
+			in.push_back(forBodyBuilder.CreateLoad(LOper));
+		}
+		EmitXorNetwork(forBodyBuilder, in, rows, out);
+		for(unsigned j=0; j<degree; j++){
+			IdxList.at(1) = forBodyBuilder.CreateNSWAdd(idx, ConstantInt::get(idxTy, j));
+			DOper = forBodyBuilder.CreateGEP(allDOper, ArrayRef <Value *>(IdxList), "DOper");
+			forBodyBuilder.CreateStore(out.at(j), DOper);
+		}
+		BasicBlock *forInc = BasicBlock::Create(Context, "for.inc", call->getFunction(), forEnd);
+		forBodyBuilder.CreateBr(forInc);
+		
+		IRBuilder<> forIncBuilder(forInc);
+		Value *inc = forIncBuilder.CreateLoad(idxAlloca);
+		inc = forIncBuilder.CreateNSWAdd(inc, ConstantInt::get(idxTy, degree), "inc");
+		forIncBuilder.CreateStore(inc, idxAlloca);
+		forIncBuilder.CreateBr(forCond);
+	}
 	
-/*--------------------------------------ROT------------------------------------*/
+/*------------------------------------GF128MUL---------------------------------*/
 
-	if(op.equals("rotL") || op.equals("rotR")){
+	//D:all:=:X:all::gf128mul::H[:ghash] multiplies each group of 128 slices of X
+	//by the element of H at the same place, or by H itself if it is a single
+	//element, modulo x^128 + x^7 + x^2 + x + 1. With :ghash this is the GHASH
+	//multiply. POLYVAL's dot(a, h) is a*h*x^-128 and the x^-128 is not applied
+	//here: the caller passes H*x^-128, computed once per key, in place of H.
+	if(op.equals("gf128mul")){
 		for(i=0; i<AllocOldNames.size(); i++){
 			if(AllocOldNames.at(i).equals(leftOperand.at(0))){
-				allLOper = cast<AllocaInst>(AllocNewInstBuff.at(i));
+				allLOper = AllocNewInstBuff.at(i);
 				foundLeftOperand = true;
 			}
 			if(AllocOldNames.at(i).equals(rightOperand.at(0))){
-				allROper = cast<AllocaInst>(AllocNewInstBuff.at(i));
+				allROper = AllocNewInstBuff.at(i);
 				foundRightOperand = true;
 			}
-			if(!foundRightOperand){
-				constOper = std::stoi(rightOperand.at(0).str());
-				constantRightOperand = true;
-			}
 			if(AllocOldNames.at(i).equals(destOperand.at(0))){
-				allDOper = cast<AllocaInst>(AllocNewInstBuff.at(i));
+				allDOper = AllocNewInstBuff.at(i);
 				foundDestOperand = true;
 			}
-			if(foundLeftOperand && (foundRightOperand || constantRightOperand) && foundDestOperand) break;
+			if(foundLeftOperand && foundRightOperand && foundDestOperand) break;
 		}
 		
-		arraySize = cast<ArrayType>(allLOper->getAllocatedType())->getNumElements();
-		ArrayType *arrTy = ArrayType::get(sliceTy, arraySize);
-		AllocaInst *tmpArray = builder.CreateAlloca(arrTy, 0, "tmpArray");
-		AllocaInst *idxAlloca = builder.CreateAlloca(idxTy, 0, "idx");
+		if(!foundLeftOperand || !foundRightOperand || !foundDestOperand){
+			errs() << "error: gf128mul operands must be bit-sliced\n";
+			return;
+		}
+		if(Layout != BitSliced){
+			errs() << "error: gf128mul is only supported with the bit layout\n";
+			return;
+		}
+		if(rightOperand.size() > 2 || (rightOperand.size() == 2 && !rightOperand.at(1).equals("ghash"))){
+			errs() << "error: expected gf128mul::H or gf128mul::H:ghash\n";
+			return;
+		}
+		bool ghash = rightOperand.size() == 2;
+		
+		arraySize = SlicedArrayType(allLOper)->getNumElements();
+		uint64_t keySize = SlicedArrayType(allROper)->getNumElements();
+		if(arraySize % 128 || (keySize != 128 && keySize != arraySize)){
+			errs() << "error: gf128mul operands must be whole GF(2^128) elements\n";
+			return;
+		}
+		if(arraySize > SlicedArrayType(allDOper)->getNumElements()){
+			errs() << "error: assignement to variable of insufficient size\n";
+			return;
+		}
+		
+		IRBuilder<> entryBuilder(&*call->getFunction()->getEntryBlock().getFirstInsertionPt());
+		AllocaInst *idxAlloca = entryBuilder.CreateAlloca(idxTy, 0, "idx");
 		builder.CreateStore(idxZero, idxAlloca);
-		BasicBlock *forEnd = call->getParent()->splitBasicBlock(call, "for.end");
+		BasicBlock *head = call->getParent();
+		BasicBlock *forEnd = head->splitBasicBlock(call, "for.end");
 		BasicBlock *forCond = BasicBlock::Create(Context, "for.cond", call->getFunction(), forEnd);
-		idxAlloca->getParent()->getTerminator()->setSuccessor(0, forCond);
-			
+		head->getTerminator()->setSuccessor(0, forCond);
+		
 		IRBuilder<> forCondBuilder(forCond);
 		Value *idx = forCondBuilder.CreateLoad(idxAlloca, "idx");
 		Value *cmp = forCondBuilder.CreateICmpSLT(idx, ConstantInt::get(idxTy, arraySize), "cmp");
 		BasicBlock *forBody = BasicBlock::Create(Context, "for.body", call->getFunction(), forEnd);
 		forCondBuilder.CreateCondBr(cmp, forBody, forEnd);
-			
+		
 		IRBuilder<> forBodyBuilder(forBody);
 		idx = forBodyBuilder.CreateLoad(idxAlloca, "idxprom");
-		IdxList.at(1) = idx;
-		LOper = forBodyBuilder.CreateGEP(allLOper, ArrayRef <Value *>(IdxList));
-		LOper = forBodyBuilder.CreateLoad(LOper);
-		Value *copy = forBodyBuilder.CreateGEP(tmpArray, ArrayRef <Value *>(IdxList));
-		forBodyBuilder.CreateStore(LOper, copy);
+		Value *keyIdx = keySize == 128 ? idxZero : idx;
+		std::vector<Value *> x, h;
+		for(unsigned j=0; j<128; j++){
+			Value *slice = ConstantInt::get(idxTy, GF128Slice(j, ghash));
+			IdxList.at(1) = forBodyBuilder.CreateNSWAdd(idx, slice);
+			LOper = forBodyBuilder.CreateGEP(allLOper, ArrayRef <Value *>(IdxList), "LOper");
+			x.push_back(forBodyBuilder.CreateLoad(LOper));
+			IdxList.at(1) = forBodyBuilder.CreateNSWAdd(keyIdx, slice);
+			ROper = forBodyBuilder.CreateGEP(allROper, ArrayRef <Value *>(IdxList), "ROper");
+			h.push_back(forBodyBuilder.CreateLoad(ROper));
+		}
+		
+		//the reduction is a fixed network: from the top, x^k = x^(k-121) +
+		//x^(k-126) + x^(k-127) + x^(k-128), folded terms are folded again
+		std::vector<Value *> prod = EmitClMul(forBodyBuilder, x, h);
+		for(unsigned k=254; k>=128; k--){
+			for(unsigned t : {0u, 1u, 2u, 7u})
+				prod.at(k-128+t) = forBodyBuilder.CreateXor(prod.at(k-128+t), prod.at(k), "gf128red");
+		}
+		
+		//all the slices of the element are read before writing, D may be X or H
+		for(unsigned j=0; j<128; j++){
+			IdxList.at(1) = forBodyBuilder.CreateNSWAdd(idx, ConstantInt::get(idxTy, GF128Slice(j, ghash)));
+			DOper = forBodyBuilder.CreateGEP(allDOper, ArrayRef <Value *>(IdxList), "DOper");
+			forBodyBuilder.CreateStore(prod.at(j), DOper);
+		}
 		BasicBlock *forInc = BasicBlock::Create(Context, "for.inc", call->getFunction(), forEnd);
 		forBodyBuilder.CreateBr(forInc);
-	
+		
 		IRBuilder<> forIncBuilder(forInc);
 		Value *inc = forIncBuilder.CreateLoad(idxAlloca);
-		inc = forIncBuilder.CreateNSWAdd(inc, ConstantInt::get(idxTy, 1), "inc");
+		inc = forIncBuilder.CreateNSWAdd(inc, ConstantInt::get(idxTy, 128), "inc");
 		forIncBuilder.CreateStore(inc, idxAlloca);
 		forIncBuilder.CreateBr(forCond);
+	}
+	
+/*-------------------------------------SBOX------------------------------------*/
 
-
-
-		BasicBlock *forEnd2 = call->getParent()->splitBasicBlock(call, "for.end");
-		IRBuilder<> forEndBuilder(forEnd->getTerminator());
-		forEndBuilder.CreateStore(idxZero, idxAlloca);
-		BasicBlock *forCond2 = BasicBlock::Create(Context, "for.cond", call->getFunction(), forEnd2);
-		forEnd->getTerminator()->setSuccessor(0, forCond2);
+	//D:all:=:S:all::sbox::table applies the 4-bit S-box whose entry k is nibble k
+	//of table to every nibble of the nibble-sliced S, and stores the results in D.
+	//With SSSE3 the eight lanes of a slice go through one pshufb, otherwise
+	//through shifts of the table held in a register; neither indexes memory.
+	if(op.equals("sbox")){
+		for(i=0; i<AllocOldNames.size(); i++){
+			if(AllocOldNames.at(i).equals(leftOperand.at(0))){
+				allLOper = AllocNewInstBuff.at(i);
+				foundLeftOperand = true;
+			}
+			if(AllocOldNames.at(i).equals(destOperand.at(0))){
+				allDOper = AllocNewInstBuff.at(i);
+				foundDestOperand = true;
+			}
+			if(foundLeftOperand && foundDestOperand) break;
+		}
 		
-		IRBuilder<> forCond2Builder(forCond2);
-		idx = forCond2Builder.CreateLoad(idxAlloca, "idx");
-		cmp = forCond2Builder.CreateICmpSLT(idx, ConstantInt::get(idxTy, arraySize), "cmp");
-		BasicBlock *forBody2 = BasicBlock::Create(Context, "for.body", call->getFunction(), forEnd2);
-		forCond2Builder.CreateCondBr(cmp, forBody2, forEnd2);
-			
-		IRBuilder<> forBody2Builder(forBody2);
-		idx = forBody2Builder.CreateLoad(idxAlloca, "idxprom");
+		if(!foundLeftOperand || !foundDestOperand){
+			errs() << "error: sbox operands must be bit-sliced\n";
+			return;
+		}
+		if(Layout != NibbleSliced){
+			errs() << "error: sbox is only supported with the nibble layout\n";
+			return;
+		}
+		uint64_t table;
+		if(rightOperand.size() != 1 || rightOperand.at(0).getAsInteger(0, table)){
+			errs() << "error: expected sbox::table\n";
+			return;
+		}
+		arraySize = SlicedArrayType(allLOper)->getNumElements();
+		if(arraySize > SlicedArrayType(allDOper)->getNumElements()){
+			errs() << "error: assignement to variable of insufficient size\n";
+			return;
+		}
+		
+		Function *F = call->getFunction();
+		bool ssse3 = F->hasFnAttribute("target-features") && 
+					 F->getFnAttribute("target-features").getValueAsString().contains("+ssse3");
+		
+		IRBuilder<> entryBuilder(&*F->getEntryBlock().getFirstInsertionPt());
+		AllocaInst *idxAlloca = entryBuilder.CreateAlloca(idxTy, 0, "idx");
+		builder.CreateStore(idxZero, idxAlloca);
+		BasicBlock *head = call->getParent();
+		BasicBlock *forEnd = head->splitBasicBlock(call, "for.end");
+		BasicBlock *forCond = BasicBlock::Create(Context, "for.cond", F, forEnd);
+		head->getTerminator()->setSuccessor(0, forCond);
+		
+		IRBuilder<> forCondBuilder(forCond);
+		Value *idx = forCondBuilder.CreateLoad(idxAlloca, "idx");
+		Value *cmp = forCondBuilder.CreateICmpSLT(idx, ConstantInt::get(idxTy, arraySize), "cmp");
+		BasicBlock *forBody = BasicBlock::Create(Context, "for.body", F, forEnd);
+		forCondBuilder.CreateCondBr(cmp, forBody, forEnd);
+		
+		IRBuilder<> forBodyBuilder(forBody);
+		idx = forBodyBuilder.CreateLoad(idxAlloca, "idxprom");
 		IdxList.at(1) = idx;
-		Value *tmp = forBody2Builder.CreateGEP(tmpArray, ArrayRef <Value *>(IdxList));
-		tmp = forBody2Builder.CreateLoad(tmp);
-		Value *rotIdx;
-		if(constantRightOperand){
-			if(op.equals("rotL"))	
-				rotIdx = forBody2Builder.CreateNSWAdd(idx, ConstantInt::get(idxTy, constOper));
-			else if(op.equals("rotR"))
-				rotIdx = forBody2Builder.CreateNSWAdd(idx, ConstantInt::get(idxTy, arraySize-constOper));
+		LOper = forBodyBuilder.CreateGEP(allLOper, ArrayRef <Value *>(IdxList), "LOper");
+		LOper = forBodyBuilder.CreateLoad(LOper);
+		Value *res;
+		if(ssse3){
+			//one byte per nibble: the low nibbles of the slice bytes, then the high ones
+			Type *byteVecTy = VectorType::get(forBodyBuilder.getInt8Ty(), 4);
+			Value *bytes = forBodyBuilder.CreateBitCast(LOper, byteVecTy);
+			Value *lo = forBodyBuilder.CreateAnd(bytes, ConstantInt::get(byteVecTy, 0x0F));
+			Value *hi = forBodyBuilder.CreateLShr(bytes, ConstantInt::get(byteVecTy, 4));
+			uint32_t Widen[16] = {0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7};
+			Value *nibbles = forBodyBuilder.CreateShuffleVector(lo, hi, Widen, "nibbles");
+			uint8_t Entries[16];
+			for(unsigned k=0; k<16; k++)
+				Entries[k] = (table >> (4*k)) & 0xF;
+			Value *lookup = forBodyBuilder.CreateCall(
+								Intrinsic::getDeclaration(call->getModule(), Intrinsic::x86_ssse3_pshuf_b_128),
+								{ConstantDataVector::get(Context, Entries), nibbles}, "sbox");
+			uint32_t Lo[4] = {0, 1, 2, 3}, Hi[4] = {4, 5, 6, 7};
+			lo = forBodyBuilder.CreateShuffleVector(lookup, UndefValue::get(lookup->getType()), Lo);
+			hi = forBodyBuilder.CreateShuffleVector(lookup, UndefValue::get(lookup->getType()), Hi);
+			hi = forBodyBuilder.CreateShl(hi, ConstantInt::get(byteVecTy, 4));
+			res = forBodyBuilder.CreateBitCast(forBodyBuilder.CreateOr(lo, hi), sliceTy, "sbox");
 		}else{
-			rotIdx = forBody2Builder.CreateLoad(allROper);
-			if(op.equals("rotL"))
-				rotIdx = forBody2Builder.CreateNSWAdd(idx, rotIdx);
-			else if(op.equals("rotR")){
-				Value *complement = forBody2Builder.CreateNSWSub(ConstantInt::get(idxTy, arraySize), rotIdx);
-				rotIdx = forBody2Builder.CreateNSWAdd(rotIdx, complement);
-			}	
+			Type *tableTy = forBodyBuilder.getInt64Ty();
+			res = ConstantInt::get(sliceTy, 0);
+			for(unsigned j=0; j<LanesPerSlice(); j++){
+				Value *nibble = forBodyBuilder.CreateLShr(LOper, ConstantInt::get(sliceTy, 4*j));
+				nibble = forBodyBuilder.CreateAnd(nibble, ConstantInt::get(sliceTy, 0xF));
+				nibble = forBodyBuilder.CreateShl(forBodyBuilder.CreateZExt(nibble, tableTy), 2);
+				Value *entry = forBodyBuilder.CreateLShr(ConstantInt::get(tableTy, table), nibble);
+				entry = forBodyBuilder.CreateAnd(entry, ConstantInt::get(tableTy, 0xF));
+				entry = forBodyBuilder.CreateShl(forBodyBuilder.CreateTrunc(entry, sliceTy), 4*j);
+				res = forBodyBuilder.CreateOr(res, entry, "sbox");
+			}
 		}
-		rotIdx = forBody2Builder.CreateSRem(rotIdx, ConstantInt::get(idxTy, arraySize));
-		IdxList.at(1) = rotIdx;
-		DOper = forBody2Builder.CreateGEP(allLOper, ArrayRef <Value *>(IdxList), "LOper");
-		forBody2Builder.CreateStore(tmp, DOper);
-		BasicBlock *forInc2 = BasicBlock::Create(Context, "for.inc", call->getFunction(), forEnd2);
-		forBody2Builder.CreateBr(forInc2);
+		DOper = forBodyBuilder.CreateGEP(allDOper, ArrayRef <Value *>(IdxList), "DOper");
+		forBodyBuilder.CreateStore(res, DOper);
+		BasicBlock *forInc = BasicBlock::Create(Context, "for.inc", F, forEnd);
+		forBodyBuilder.CreateBr(forInc);
 		
-		IRBuilder<> forInc2Builder(forInc2);
-		Value *inc2 = forInc2Builder.CreateLoad(idxAlloca);
-		inc2 = forInc2Builder.CreateNSWAdd(inc2, ConstantInt::get(idxTy, 1), "inc");
-		forInc2Builder.CreateStore(inc2, idxAlloca);
-		forInc2Builder.CreateBr(forCond2);
+		IRBuilder<> forIncBuilder(forInc);
+		Value *inc = forIncBuilder.CreateLoad(idxAlloca);
+		inc = forIncBuilder.CreateNSWAdd(inc, ConstantInt::get(idxTy, 1), "inc");
+		forIncBuilder.CreateStore(inc, idxAlloca);
+		forIncBuilder.CreateBr(forCond);
 	}
 }
 
@@ -1482,6 +4221,134 @@ void EndOrthogonalTransformation(BasicBlock *startBlock,
 */
 
 
+//Runtime entry point of the batch drivers: runs body(ctx, b) for b in
+//[0, batches). runtime/BitSlicerRT.c spreads the batches over one thread per
+//core; a weak serial definition keeps the modules linkable without it.
+Function *GetParallelFor(Module &M){
+	LLVMContext &Context = M.getContext();
+	Type *idxTy = IntegerType::getInt64Ty(Context);
+	Type *ctxTy = Type::getInt8PtrTy(Context);
+	FunctionType *bodyTy = FunctionType::get(Type::getVoidTy(Context), {ctxTy, idxTy}, false);
+	FunctionType *forTy = FunctionType::get(Type::getVoidTy(Context),
+											{PointerType::getUnqual(bodyTy), ctxTy, idxTy}, false);
+	Function *ParallelFor = cast<Function>(M.getOrInsertFunction("bitslicer_parallel_for", forTy));
+	if(!ParallelFor->isDeclaration())
+		return ParallelFor;
+	
+	ParallelFor->setLinkage(GlobalValue::WeakAnyLinkage);
+	auto arg = ParallelFor->arg_begin();
+	Value *body = &*arg++;
+	Value *ctx = &*arg++;
+	Value *batches = &*arg;
+	BasicBlock *entry = BasicBlock::Create(Context, "entry", ParallelFor);
+	BasicBlock *forCond = BasicBlock::Create(Context, "for.cond", ParallelFor);
+	BasicBlock *forBody = BasicBlock::Create(Context, "for.body", ParallelFor);
+	BasicBlock *forEnd = BasicBlock::Create(Context, "for.end", ParallelFor);
+	
+	IRBuilder<> builder(entry);
+	builder.CreateBr(forCond);
+	IRBuilder<> forCondBuilder(forCond);
+	PHINode *b = forCondBuilder.CreatePHI(idxTy, 2, "b");
+	b->addIncoming(ConstantInt::get(idxTy, 0), entry);
+	forCondBuilder.CreateCondBr(forCondBuilder.CreateICmpULT(b, batches), forBody, forEnd);
+	IRBuilder<> forBodyBuilder(forBody);
+	forBodyBuilder.CreateCall(body, {ctx, b});
+	b->addIncoming(forBodyBuilder.CreateAdd(b, ConstantInt::get(idxTy, 1), "inc"), forBody);
+	forBodyBuilder.CreateBr(forCond);
+	IRBuilder<> forEndBuilder(forEnd);
+	forEndBuilder.CreateRetVoid();
+	return ParallelFor;
+}
+
+
+//Emits kernel.batched(in, out, nblocks), running the kernel on every batch of
+//LanesPerSlice() blocks through bitslicer_parallel_for. Each batch is a task,
+//kernel.batch, and the last partial batch goes through zeroed copies so the
+//kernel never reads or writes past the buffers.
+bool EmitBatchDriver(Module &M, StringRef Name){
+	LLVMContext &Context = M.getContext();
+	Function *Kernel = M.getFunction(Name);
+	Type *bytePtrTy = Type::getInt8PtrTy(Context);
+	Type *idxTy = IntegerType::getInt64Ty(Context);
+	if(!Kernel || Kernel->isDeclaration()){
+		errs() << "ERROR: batch driver kernel " << Name << " is not defined in the module\n";
+		return false;
+	}
+	FunctionType *kernelTy = Kernel->getFunctionType();
+	if(kernelTy->getNumParams() != 2 || kernelTy->getParamType(0) != bytePtrTy ||
+	   kernelTy->getParamType(1) != bytePtrTy){
+		errs() << "ERROR: batch driver kernel " << Name << " must be void(i8 *in, i8 *out)\n";
+		return false;
+	}
+	
+	uint64_t batchBytes = (uint64_t)LanesPerSlice()*DriverBlockLen;
+	StructType *ctxTy = StructType::get(Context, {bytePtrTy, bytePtrTy, idxTy});
+	Function *ParallelFor = GetParallelFor(M);
+	
+	//task: one batch
+	FunctionType *batchTy = cast<FunctionType>(cast<PointerType>(
+								ParallelFor->getFunctionType()->getParamType(0))->getElementType());
+	Function *Batch = Function::Create(batchTy, GlobalValue::InternalLinkage, Name + ".batch", &M);
+	auto arg = Batch->arg_begin();
+	Value *ctx = &*arg++;
+	Value *b = &*arg;
+	BasicBlock *entry = BasicBlock::Create(Context, "entry", Batch);
+	BasicBlock *fullBatch = BasicBlock::Create(Context, "batch.full", Batch);
+	BasicBlock *tailBatch = BasicBlock::Create(Context, "batch.tail", Batch);
+	BasicBlock *batchEnd = BasicBlock::Create(Context, "batch.end", Batch);
+	
+	IRBuilder<> builder(entry);
+	ArrayType *bufTy = ArrayType::get(builder.getInt8Ty(), batchBytes);
+	AllocaInst *tailIn = builder.CreateAlloca(bufTy, 0, "tailIn");
+	AllocaInst *tailOut = builder.CreateAlloca(bufTy, 0, "tailOut");
+	ctx = builder.CreateBitCast(ctx, PointerType::getUnqual(ctxTy));
+	Value *in = builder.CreateLoad(builder.CreateStructGEP(ctxTy, ctx, 0), "in");
+	Value *out = builder.CreateLoad(builder.CreateStructGEP(ctxTy, ctx, 1), "out");
+	Value *totalBytes = builder.CreateLoad(builder.CreateStructGEP(ctxTy, ctx, 2));
+	totalBytes = builder.CreateMul(totalBytes, ConstantInt::get(idxTy, DriverBlockLen), "totalBytes");
+	Value *offset = builder.CreateMul(b, ConstantInt::get(idxTy, batchBytes), "offset");
+	in = builder.CreateInBoundsGEP(in, offset);
+	out = builder.CreateInBoundsGEP(out, offset);
+	Value *left = builder.CreateSub(totalBytes, offset, "left");
+	builder.CreateCondBr(builder.CreateICmpUGE(left, ConstantInt::get(idxTy, batchBytes)), fullBatch, tailBatch);
+	
+	IRBuilder<> fullBuilder(fullBatch);
+	fullBuilder.CreateCall(Kernel, {in, out});
+	fullBuilder.CreateBr(batchEnd);
+	
+	IRBuilder<> tailBuilder(tailBatch);
+	Value *tailInPtr = tailBuilder.CreateBitCast(tailIn, bytePtrTy);
+	Value *tailOutPtr = tailBuilder.CreateBitCast(tailOut, bytePtrTy);
+	tailBuilder.CreateMemSet(tailInPtr, tailBuilder.getInt8(0), batchBytes, 1);
+	tailBuilder.CreateMemCpy(tailInPtr, in, left, 1);
+	tailBuilder.CreateCall(Kernel, {tailInPtr, tailOutPtr});
+	tailBuilder.CreateMemCpy(out, tailOutPtr, left, 1);
+	tailBuilder.CreateBr(batchEnd);
+	
+	IRBuilder<> endBuilder(batchEnd);
+	endBuilder.CreateRetVoid();
+	
+	//driver
+	FunctionType *driverTy = FunctionType::get(Type::getVoidTy(Context), {bytePtrTy, bytePtrTy, idxTy}, false);
+	Function *Driver = Function::Create(driverTy, GlobalValue::ExternalLinkage, Name + ".batched", &M);
+	arg = Driver->arg_begin();
+	in = &*arg++;
+	out = &*arg++;
+	Value *nblocks = &*arg;
+	entry = BasicBlock::Create(Context, "entry", Driver);
+	IRBuilder<> driverBuilder(entry);
+	AllocaInst *ctxAlloca = driverBuilder.CreateAlloca(ctxTy, 0, "ctx");
+	driverBuilder.CreateStore(in, driverBuilder.CreateStructGEP(ctxTy, ctxAlloca, 0));
+	driverBuilder.CreateStore(out, driverBuilder.CreateStructGEP(ctxTy, ctxAlloca, 1));
+	driverBuilder.CreateStore(nblocks, driverBuilder.CreateStructGEP(ctxTy, ctxAlloca, 2));
+	Value *batches = driverBuilder.CreateAdd(nblocks, ConstantInt::get(idxTy, LanesPerSlice() - 1));
+	batches = driverBuilder.CreateUDiv(batches, ConstantInt::get(idxTy, LanesPerSlice()), "batches");
+	driverBuilder.CreateCall(ParallelFor, {Batch, driverBuilder.CreateBitCast(ctxAlloca, bytePtrTy), batches});
+	driverBuilder.CreateRetVoid();
+	return true;
+}
+
+
 namespace{
 	
 	struct BitSlicer : public ModulePass{
@@ -1491,6 +4358,8 @@ namespace{
 //		static int LAST_INSTR_TYPE;
 		static int done;
 		BitSlicer() : ModulePass(ID) {}
+
+		StringRef getPassName() const override { return "BitSlicer"; }
 		
 		BasicBlock *orthStartBlock = nullptr, *orthEndBlock = nullptr, *prevBB = nullptr;
 		Value *orthDescription;
@@ -1505,9 +4374,17 @@ namespace{
 		std::vector<StringRef> GEPOldNames;
 */
 			
+		//phases of runOnModule reported by -time-passes
+		Optional<NamedRegionTimer> Phase;
+		void StartPhase(StringRef Name, StringRef Description){
+			Phase.reset();
+			Phase.emplace(Name, Description, "bitslicer", "BitSlicer phases", TimePassesIsEnabled);
+		}
+			
 		bool runOnModule(Module &M) override {
 		//	int i;
 		
+		StartPhase("collect", "Collect and expand the transpositions");
 		for(Function& F : M){
 			for(BasicBlock& B : F){
 				
@@ -1519,20 +4396,56 @@ namespace{
 					if(auto *call = dyn_cast<CallInst>(&I)){
 						Function *Fn = call->getCalledFunction();
 						if(Fn && Fn->getIntrinsicID() == Intrinsic::getbitsliced_i32){
+							InstrumentCall(call, TransposeCycles);
 							if(!GetBitSlicedData(call, I.getModule()->getContext())){
 								errs() << "bit-slicing failed\n";
 								}
 							eraseList.push_back(&I);
 							done = 1;
+						}else if(Fn && (Fn->getIntrinsicID() == Intrinsic::getbitsliced_n_i32 ||
+									   Fn->getIntrinsicID() == Intrinsic::getunbitsliced_n_i32 ||
+									   Fn->getIntrinsicID() == Intrinsic::bitsliced_scan_i32)){
+							//the loops split the block, emitted after the walk
+							TransposeCalls.push_back(call);
+							eraseList.push_back(&I);
+							done = 1;
+						}else if(Fn && Fn->getIntrinsicID() == Intrinsic::getbitsliced_inplace_i32){
+							InstrumentCall(call, TransposeCycles);
+							if(!TransposeInPlace(call, I.getModule()->getContext(), false)){
+								errs() << "bit-slicing failed\n";
+								}
+							eraseList.push_back(&I);
+							done = 1;
+						}else if(Fn && Fn->getIntrinsicID() == Intrinsic::getunbitsliced_inplace_i32){
+							InstrumentCall(call, UntransposeCycles);
+							if(!TransposeInPlace(call, I.getModule()->getContext(), true)){
+								errs() << "bit-slicing inversion failed\n";
+								}
+							eraseList.push_back(&I);
+							done = 1;
+						}else if(Fn && Fn->getIntrinsicID() == Intrinsic::bitslice_ctr_i32){
+							if(!BitSliceCounter(call, I.getModule()->getContext())){
+								errs() << "bit-sliced counter generation failed\n";
+								}
+							eraseList.push_back(&I);
+							done = 1;
+						}else if(Fn && Fn->getIntrinsicID() == Intrinsic::bitslice_ctr_inc_i32){
+							if(!IncrementBitSlicedCounter(call, I.getModule()->getContext())){
+								errs() << "bit-sliced counter increment failed\n";
+								}
+							eraseList.push_back(&I);
+							done = 1;
 						}else if(Fn && Fn->getIntrinsicID() == Intrinsic::getunbitsliced_i32){
 					//		errs() << "args: \n" << call->getNumArgOperands() << "\n";
 							
+							InstrumentCall(call, UntransposeCycles);
 							if(!GetUnBitSlicedData(call, I.getModule()->getContext())){
 								errs() << "bit-slicing inversion failed\n";
 								}
 							eraseList.push_back(&I);
 							done = 1;
-						}else if(Fn && Fn->getIntrinsicID() == Intrinsic::bitslice_i32){
+						}else if(Fn && (Fn->getIntrinsicID() == Intrinsic::bitslice_i32 ||
+									   Fn->getIntrinsicID() == Intrinsic::bitslice_order_i32)){
 					//		errs() << "args: \n" << call->getNumArgOperands() << "\n";
 							MDNode *mdata = MDNode::get(call->getContext(), 
 										MDString::get(call->getContext(), "bit-slice-call"));
@@ -1546,7 +4459,8 @@ namespace{
 							if(!isa<AllocaInst>(call->getArgOperand(0)))
 								eraseList.push_back(cast<Instruction>(call->getArgOperand(0)));
 							done = 1;
-						}else if(Fn && Fn->getIntrinsicID() == Intrinsic::unbitslice_i32){
+						}else if(Fn && (Fn->getIntrinsicID() == Intrinsic::unbitslice_i32 ||
+									   Fn->getIntrinsicID() == Intrinsic::unbitslice_order_i32)){
 					//		errs() << "args: \n" << call->getNumArgOperands() << "\n";
 							UnBitSliceCalls.push_back(call);
 			
@@ -1563,6 +4477,8 @@ namespace{
 								MDString::get(I.getModule()->getContext(), "start-orthogonalization"));
 							call->setMetadata("start-orthogonalization", MData);
 							emitPoints.push_back(call);
+							NoteRingBuffer(cast<ConstantDataSequential>(cast<User>(cast<User>(call->getArgOperand(1))
+											->getOperand(0))->getOperand(0))->getAsCString());
 				
 						//	Descriptions.push_back(cast<ConstantDataSequential>(cast<User>(cast<User>(call->getArgOperand(1))
 						//							->getOperand(0))->getOperand(0))->getAsCString());
@@ -1646,6 +4562,7 @@ namespace{
 							all->replaceAllUsesWith(fakeAlloc);
 							AllocOldNames.push_back(fakeAlloc->getName());
 							AllocNewInstBuff.push_back(ret);
+							BlocksNumList.push_back(LanesPerSlice());	//kept parallel to AllocOldNames
 							eraseList.push_back(&I);
 							done = 1;
 						}	
@@ -1837,21 +4754,67 @@ namespace{
 			
 			}//F : M
 		
+			if(PipelineTransposes){
+				StartPhase("pipeline", "Pipeline the transpositions of batch loops");
+				for(Function& F : M){
+					if(F.isDeclaration())
+						continue;
+					while(PipelineBatchLoop(F))
+						done = 1;
+				}
+			}
+			
+			StartPhase("transpose", "Emit the transposition loops");
+			for(CallInst *c : TransposeCalls){
+				if(c->getCalledFunction()->getIntrinsicID() == Intrinsic::getbitsliced_n_i32){
+					InstrumentCall(c, TransposeCycles);
+					if(!GetBitSlicedDataN(c, c->getContext()))
+						errs() << "bit-slicing failed\n";
+				}else if(c->getCalledFunction()->getIntrinsicID() == Intrinsic::bitsliced_scan_i32){
+					if(!BitSlicedScan(c, c->getContext()))
+						errs() << "bit-sliced scan failed\n";
+				}else{
+					InstrumentCall(c, UntransposeCycles);
+					if(!GetUnBitSlicedDataN(c, c->getContext()))
+						errs() << "bit-slicing inversion failed\n";
+				}
+			}
+			
 			for(CallInst *c : BitSliceCalls){
+				InstrumentCall(c, TransposeCycles);
 				BitSlice(c, c->getModule()->getContext());
 			}
 			
 			for(CallInst *c : UnBitSliceCalls){
+				InstrumentCall(c, UntransposeCycles);
 				UnBitSlice(c, c->getModule()->getContext());
 			}
 			
+			StartPhase("callees", "Clone the callees of bit-sliced buffers");
+			if(BitSliceCallees(M))
+				done = 1;
+			
+			StartPhase("rewrite", "Rewrite the bit-sliced instructions");
 			for(Function& F : M){
-				for(BasicBlock& B : F){
+				if(F.isDeclaration())
+					continue;
+				
+				do{
+					PropagateBitSlicedMetadata(F);
+				}while(PromoteSlicedArrays(F));
+				
+				//definitions must be transformed before their uses: visit the blocks in
+				//reverse post-order so that loop bodies can be laid out in any order
+				ReversePostOrderTraversal<Function *> RPOT(&F);
+				for(BasicBlock *BB : RPOT){
+					BasicBlock& B = *BB;
 					for(Instruction& I : B){
 						if(I.getMetadata("to_be_bit-sliced")){
 							IRBuilder<> builder(&I);
 							LLVMContext &Context = I.getModule()->getContext();
 							for(auto& U : I.uses()){
+								if(IsBitCall(&I, Intrinsic::bitsliced_i8_lane_bit))
+									break;
 								User *user = U.getUser();
 								//user->dump();
 								auto *Inst = dyn_cast<Instruction>(user);
@@ -1896,8 +4859,9 @@ namespace{
 								
 								GEPOldInstBuff.push_back(gep);
 								
-								Idx = builder.CreateShl(Idx, ConstantInt::get(Idx->getType(), 3)); //I multiply the pointer by 8
-																			//in order to reach the correct octet of slices
+								Idx = builder.CreateShl(Idx, ConstantInt::get(Idx->getType(), Log2_32(SlicesPerByte())));
+																			//I multiply the pointer by the slices per byte
+																			//in order to reach the correct group of slices
 								//FIXME: we are now assuming that the algorithm that we are bit-slicing is designed
 								//to process a single array per time
 								if(cast<IntegerType>(Idx->getType())->getBitWidth() < 64)
@@ -1905,8 +4869,8 @@ namespace{
 								else if(cast<IntegerType>(Idx->getType())->getBitWidth() > 64)
 									Idx = builder.CreateTrunc(Idx, IdxTy);
 								
-								for(i = 0; i < 8; i++){
-									SliceIdxList.at(1) = Idx;
+								for(i = 0; i < (int)SlicesPerByte(); i++){
+									SliceIdxList.at(1) = RingSliceIdx(builder, AllocNewInstBuff.at(nameIdx), Idx);
 									if(gepAlloca->getAllocatedType()->isPointerTy()){
 										//newGEP = builder.CreateLoad(gepAlloca);
 										if(gep->isInBounds())
@@ -1924,6 +4888,8 @@ namespace{
 																	   ArrayRef <Value *>(SliceIdxList));
 									}
 									GEPInstBuff.push_back(newGEP);
+									if(IsRingSlice(newGEP))
+										RingSliceLogicalIdx[newGEP] = Idx;
 									
 									Idx = builder.CreateNSWAdd(Idx, ConstantInt::get(IdxTy, 1));
 									
@@ -1950,6 +4916,21 @@ namespace{
 								//eraseList.push_back(gep);
 							}
 
+		/*---------------------------------------------PHI----------------------------------------------*/
+
+						if(auto *phi = dyn_cast<PHINode>(&I)){
+							if(phi->getType()->isIntegerTy()){
+								//one PHI per slice, the incoming slices are added by ResolveBitSlicedPHIs
+								Type *sliceTy = IntegerType::getInt32Ty(I.getModule()->getContext());
+								int numSlices = NumSlices(phi->getType());
+								PHIOldInstBuff.push_back(phi);
+								for(int i=0; i<numSlices; i++){
+									PHINode *newPHI = builder.CreatePHI(sliceTy, phi->getNumIncomingValues(), "slice.phi");
+									PHIInstBuff.push_back(newPHI);
+								}
+							}
+						}
+
 		/*---------------------------------------------UNARY----------------------------------------------*/
 
 
@@ -1984,7 +4965,7 @@ namespace{
 										Value *tmpGEP, *Idx;
 										Idx = IdxZero;
 										
-										for(i=0; i<7; i++){
+										for(i=0; i<(int)SlicesPerByte()-1; i++){
 											SliceIdxList.at(1) = Idx;
 											tmpGEP = builder.CreateInBoundsGEP(AllocNewInstBuff.at(nameIdx),
 																			  ArrayRef <Value *>(SliceIdxList));
@@ -2013,8 +4994,8 @@ namespace{
 									SliceIdxList.push_back(IdxZero);
 									SliceIdxList.push_back(IdxZero);
 									
-									for(i=0; i<8; i++){
-										newLoad = builder.CreateLoad(GEPInstBuff.at(GEPIdx*8+i)); //FIXME: depends on the type
+									for(i=0; i<(int)SlicesPerByte(); i++){
+										newLoad = builder.CreateLoad(GEPInstBuff.at(GEPIdx*SlicesPerByte()+i)); //FIXME: depends on the type
 										LoadInstBuff.push_back(newLoad);
 									}
 
@@ -2044,8 +5025,8 @@ namespace{
 										//opIdx += cast<IntegerType>(ciLoad->getPointerOperandType())->getBitWidth();
 									}
 									
-									for(i=0; i<8; i++){
-										CastInstBuff.push_back(LoadInstBuff.at(opIdx*8+i)); //TODO: parametric dimension of the original type
+									for(i=0; i<(int)SlicesPerByte(); i++){
+										CastInstBuff.push_back(LoadInstBuff.at(opIdx*SlicesPerByte()+i)); //TODO: parametric dimension of the original type
 									}
 
 									lastSlice = CastInstBuff.size() - 1;
@@ -2063,20 +5044,57 @@ namespace{
 									}
 
 									//int BinWidth = cast<IntegerType>(ci->getDestTy())->getBitWidth();
-									for(i=0; i<8; i++){
-										CastInstBuff.push_back(BinaryOpInstBuff.at(opIdx*8+i)); //TODO: parametric dimension of the original type
+									for(i=0; i<(int)SlicesPerByte(); i++){
+										CastInstBuff.push_back(BinaryOpInstBuff.at(BinaryOpSliceIdx.at(opIdx)+i)); //TODO: parametric dimension of the original type
+									}
+
+									lastSlice = CastInstBuff.size() - 1;
+								}
+								
+								if(isa<PHINode>(ci->getOperand(0))){
+									for(auto *ciPHI : PHIOldInstBuff){
+										if(ciPHI == ci->getOperand(0)){
+											break;
+										}
+										opIdx += NumSlices(ciPHI->getType());
+									}
+									
+									int kept = std::min(NumSlices(ci->getSrcTy()), NumSlices(ci->getDestTy()));
+									for(i=0; i<kept; i++){
+										CastInstBuff.push_back(PHIInstBuff.at(opIdx+i));
 									}
 
 									lastSlice = CastInstBuff.size() - 1;
 								}
+								
+								if((isa<CastInst>(ci->getOperand(0)) || isa<CallInst>(ci->getOperand(0))) && intOp){
+									int kept = std::min(NumSlices(ci->getSrcTy()), NumSlices(ci->getDestTy()));
+									for(i=0; i<kept; i++){
+										Value *slice = GetSlicedValue(ci->getOperand(0), i);
+										if(!slice)
+											report_fatal_error("operand of a bit-sliced cast has no slices");
+										CastInstBuff.push_back(slice);
+									}
+									
+									lastSlice = CastInstBuff.size() - 1;
+								}
 						
 						/*----------------extension----------------*/		
 								if(resize > 0){
-									for(i=0; i < resize; i++){
+									Value *signSlice = nullptr;
+									if(isa<SExtInst>(ci)){		//signed: we replicate the highest slice, that contains the
+										signSlice = CastInstBuff.at(lastSlice);	//highest bit of each element in the
+										if(Layout != BitSliced){				//correspondent position of each block
+											signSlice = builder.CreateLShr(signSlice, Layout - 1);
+											signSlice = builder.CreateAnd(signSlice, LaneRepeat());
+											signSlice = builder.CreateMul(signSlice, ConstantInt::get(sliceTy, (1u << Layout) - 1));
+										}
+									}
+									for(i=0; i < resize/(int)Layout; i++){
 										Value *newLoad;
-										if(isa<SExtInst>(ci)){		//signed: we replicate the highest slice, that contains the
-											newLoad = LoadInstBuff.at(lastSlice);	//highest bit of each element in the
-										}											//correspondent position of each block
+										if(isa<SExtInst>(ci)){
+											newLoad = signSlice;
+										}
 										else if(isa<ZExtInst>(ci)){
 											newLoad = ConstantInt::get(sliceTy, 0);
 										}
@@ -2121,6 +5139,7 @@ namespace{
 						if(auto *bin = dyn_cast<BinaryOperator>(&I)){
 							
 							BinaryOpOldInstBuff.push_back(bin);
+							BinaryOpSliceIdx.push_back(BinaryOpInstBuff.size());
 							
 							Type *sliceTy = IntegerType::getInt32Ty(Context);
 							
@@ -2128,8 +5147,9 @@ namespace{
 							bool opFound = false;
 							bool loadOp1 = false, loadOp2 = false;
 							bool castOp1 = false, castOp2 = false;
+							bool phiOp1 = false, phiOp2 = false;
 							bool BitSlicedOp1 = false, BitSlicedOp2 = false;
-							int numSlices = cast<IntegerType>(bin->getType())->getBitWidth();
+							int numSlices = NumSlices(bin->getType());
 							Value *newBin;
 							
 							if(isa<Instruction>(bin->getOperand(0))){
@@ -2159,7 +5179,7 @@ namespace{
 											loadOp1 = true;
 											break;
 										}
-										op1Idx += 8;
+										op1Idx += SlicesPerByte();
 									}
 									
 									if(!opFound){
@@ -2170,7 +5190,7 @@ namespace{
 												castOp1 = true;
 												break;
 											}
-											op1Idx += cast<IntegerType>(op1->getDestTy())->getBitWidth();
+											op1Idx += NumSlices(op1->getDestTy());
 										}
 									}
 								}
@@ -2188,7 +5208,7 @@ namespace{
 											loadOp2 = true;
 											break;
 										}
-										op2Idx += 8;
+										op2Idx += SlicesPerByte();
 									}
 									
 									if(!opFound){
@@ -2199,10 +5219,33 @@ namespace{
 												castOp2 = true;
 												break;
 											}
-											op2Idx += cast<IntegerType>(op2->getDestTy())->getBitWidth();
+											op2Idx += NumSlices(op2->getDestTy());
 										}
 									}
 								}
+								
+								//loop-carried operands
+								if(BitSlicedOp1 && !loadOp1 && !castOp1){
+									op1Idx = 0;
+									for(auto *op1 : PHIOldInstBuff){
+										if(op1 == bin->getOperand(0)){
+											phiOp1 = true;
+											break;
+										}
+										op1Idx += NumSlices(op1->getType());
+									}
+								}
+								
+								if(BitSlicedOp2 && !loadOp2 && !castOp2){
+									op2Idx = 0;
+									for(auto *op2 : PHIOldInstBuff){
+										if(op2 == bin->getOperand(1)){
+											phiOp2 = true;
+											break;
+										}
+										op2Idx += NumSlices(op2->getType());
+									}
+								}
 						//	}
 						
 						//	if(isa<Instruction>(bin->getOperand(0)) && isa<Instruction>(bin->getOperand(1))){
@@ -2226,12 +5269,28 @@ namespace{
 										else if(castOp1){
 											op1 = CastInstBuff.at(op1Idx+i);
 										}
+										else if(phiOp1){
+											op1 = PHIInstBuff.at(op1Idx+i);
+										}
+										else{				//the result of another bit-sliced operation
+											op1 = GetSlicedValue(bin->getOperand(0), i);
+											if(!op1)
+												report_fatal_error("operand of a bit-sliced operation has no slices");
+										}
 										if(loadOp2){
 											op2 = LoadInstBuff.at(op2Idx+i);
 										}
 										else if(castOp2){
 											op2 = CastInstBuff.at(op2Idx+i);
 										}
+										else if(phiOp2){
+											op2 = PHIInstBuff.at(op2Idx+i);
+										}
+										else{				//the result of another bit-sliced operation
+											op2 = GetSlicedValue(bin->getOperand(1), i);
+											if(!op2)
+												report_fatal_error("operand of a bit-sliced operation has no slices");
+										}
 										
 										switch(bin->getOpcode()){
 											case Instruction::Shl:
@@ -2259,6 +5318,10 @@ namespace{
 							//   !cast<Instruction>(bin->getOperand(1))->getMetadata("to_be_bit-sliced")	 ){
 							if(BitSlicedOp1 && !BitSlicedOp2){
 								Value *op1, *op2;
+								Value *keyIdx = nullptr;
+								GlobalVariable *slicedKey = nullptr;
+								if(PreSliceKeys && Layout == BitSliced && bin->getType() == sliceTy)
+									slicedKey = GetSlicedRoundKey(bin->getOperand(1), bin->getFunction(), keyIdx);
 
 								/*TODO: If we are working with uint8_t we'll always have conversion (extension)
 								  of the operands right before the operation itself. The only case in which
@@ -2281,12 +5344,24 @@ namespace{
 										}*/
 										op1 = CastInstBuff.at(op1Idx+i);
 								
-									}		
+									}
+									else if(phiOp1){
+										op1 = PHIInstBuff.at(op1Idx+i);
+									}
+									else{				//the result of another bit-sliced operation
+										op1 = GetSlicedValue(bin->getOperand(0), i);
+										if(!op1)
+											report_fatal_error("operand of a bit-sliced operation has no slices");
+									}
 									
 									switch(bin->getOpcode()){
 											case Instruction::Shl:
 											case Instruction::LShr:
 											case Instruction::AShr:
+												//the slices are re-indexed bit by bit
+												if(Layout != BitSliced)
+													report_fatal_error("shifts of sliced values are only supported "
+																	   "with the bit layout");
 
 												if(i < 8) {
 													op2 = bin->getOperand(1);
@@ -2329,6 +5404,8 @@ namespace{
 													}
 													
 													shiftGEP = GEPInstBuff.at(GEPIdx);
+													if(IsRingSlice(shiftGEP))
+														report_fatal_error("shifts of the bytes of a ring buffer are not supported");
 													Value *idx = cast<Instruction>(shiftGEP)->getOperand(2);
 													if(cast<IntegerType>(idx->getType())->getBitWidth() > 
 														 cast<IntegerType>(inRangeShift->getType())->getBitWidth())
@@ -2371,11 +5448,11 @@ namespace{
 											case Instruction::Or:
 											case Instruction::Xor:
 
-												op2 = builder.CreateLShr(bin->getOperand(1), ConstantInt::get(bin->getType(), i));
-												op2 = builder.CreateAnd(op2, ConstantInt::get(bin->getType(), 1));
-												op2 = builder.CreateMul(op2, 
-																								ConstantInt::get(bin->getType(), 
-																													 			 cast<IntegerType>(bin->getType())->getBitMask()));
+												if(slicedKey){
+													op2 = PreSlicedKeyBit(builder, slicedKey, keyIdx, i);
+												}else{
+													op2 = BroadcastLaneElement(builder, bin->getOperand(1), i);
+												}
 											//	op2->dump();
 											
 												newBin = builder.CreateBinOp(bin->getOpcode(), op1, op2);
@@ -2392,6 +5469,10 @@ namespace{
 						//	   cast<Instruction>(bin->getOperand(1))->getMetadata("to_be_bit-sliced")	 ){
 							if(!BitSlicedOp1 && BitSlicedOp2){
 								Value *op1, *op2;
+								Value *keyIdx = nullptr;
+								GlobalVariable *slicedKey = nullptr;
+								if(PreSliceKeys && Layout == BitSliced && bin->getType() == sliceTy)
+									slicedKey = GetSlicedRoundKey(bin->getOperand(0), bin->getFunction(), keyIdx);
 								
 								/*TODO: If we are working with uint8_t we'll always have conversion (extension)
 								  of the operands right before the operation itself. The only case in which
@@ -2404,10 +5485,18 @@ namespace{
 								for(int i=0; i<numSlices; i++){		
 									
 									if(loadOp2){
-										op2 = LoadInstBuff.at(op1Idx+i);
+										op2 = LoadInstBuff.at(op2Idx+i);
 									}
 									else if(castOp2){
-										op2 = CastInstBuff.at(op1Idx+i);
+										op2 = CastInstBuff.at(op2Idx+i);
+									}
+									else if(phiOp2){
+										op2 = PHIInstBuff.at(op2Idx+i);
+									}
+									else{				//the result of another bit-sliced operation
+										op2 = GetSlicedValue(bin->getOperand(1), i);
+										if(!op2)
+											report_fatal_error("operand of a bit-sliced operation has no slices");
 									}
 									
 									switch(bin->getOpcode()){
@@ -2420,11 +5509,11 @@ namespace{
 											case Instruction::And:
 											case Instruction::Or:
 											case Instruction::Xor:
-												op1 = builder.CreateLShr(bin->getOperand(0), ConstantInt::get(bin->getType(), i));
-												op1 = builder.CreateAnd(op1, ConstantInt::get(bin->getType(), 1));
-												op1 = builder.CreateMul(op1, 
-																								ConstantInt::get(bin->getType(), 
-																													 			 cast<IntegerType>(bin->getType())->getBitMask()));
+												if(slicedKey){
+													op1 = PreSlicedKeyBit(builder, slicedKey, keyIdx, i);
+												}else{
+													op1 = BroadcastLaneElement(builder, bin->getOperand(0), i);
+												}
 											
 												newBin = builder.CreateBinOp(bin->getOpcode(), op1, op2);
 												BinaryOpInstBuff.push_back(newBin);
@@ -2437,16 +5526,80 @@ namespace{
 						
 						}
 						
-					/*	
+		/*---------------------------------------------BIT-ACCESS----------------------------------------------*/
+					
+						//bit n of each block: slice 0 gets the bit in the position of each lane
+						if(IsBitCall(&I, Intrinsic::bitsliced_i8_bit)){
+							auto *call = cast<CallInst>(&I);
+							Type *sliceTy = IntegerType::getInt32Ty(Context);
+							Value *slice = GetBitSlice(builder, call);
+							if(Layout != BitSliced){
+								Value *shift = builder.CreateAnd(call->getArgOperand(1), Layout - 1);
+								slice = builder.CreateAnd(builder.CreateLShr(slice, shift), LaneRepeat());
+							}
+							BitCallOldInstBuff.push_back(call);
+							BitCallInstBuff.push_back(slice);
+							for(unsigned i=1; i<SlicesPerByte(); i++)
+								BitCallInstBuff.push_back(ConstantInt::get(sliceTy, 0));
+						}
+						
+						//bit n of a single block: the result is a plain byte
+						if(IsBitCall(&I, Intrinsic::bitsliced_i8_lane_bit)){
+							auto *call = cast<CallInst>(&I);
+							Value *slice = GetBitSlice(builder, call);
+							Value *lane = call->getArgOperand(2);
+							if(auto *C = dyn_cast<ConstantInt>(lane)){
+								if(C->getZExtValue() >= LanesPerSlice())
+									report_fatal_error("lane index of a bit-sliced bit access is out of range");
+							}else
+								lane = builder.CreateAnd(lane, LanesPerSlice() - 1, "lane.idx");
+							Value *pos = builder.CreateMul(lane, builder.getInt32(Layout));
+							pos = builder.CreateAdd(pos, builder.CreateAnd(call->getArgOperand(1), Layout - 1));
+							Value *bit = builder.CreateAnd(builder.CreateLShr(slice, pos), 1);
+							call->replaceAllUsesWith(builder.CreateTrunc(bit, call->getType()));
+							eraseList.push_back(call);
+						}
+						
+		/*---------------------------------------------STORE----------------------------------------------*/
+					
+						//a value written back to a bit-sliced buffer is stored slice by slice
 						if(auto *st = dyn_cast<StoreInst>(&I)){
+							if(auto *stGEP = dyn_cast<GetElementPtrInst>(st->getPointerOperand())){
+								auto it = std::find(GEPOldInstBuff.begin(), GEPOldInstBuff.end(), stGEP);
+								if(it != GEPOldInstBuff.end()){
+									unsigned GEPIdx = it - GEPOldInstBuff.begin();
+									auto *stVal = dyn_cast<Instruction>(st->getValueOperand());
+									bool sliced = stVal && stVal->getMetadata("to_be_bit-sliced");
+									for(unsigned i=0; i<SlicesPerByte(); i++){
+										Value *slice;
+										if(sliced){
+											slice = GetSlicedValue(stVal, i);
+											if(!slice)
+												report_fatal_error("value stored to a bit-sliced buffer has no slices");
+										}else{		//the same byte in every block
+											slice = builder.CreateZExt(st->getValueOperand(), builder.getInt32Ty());
+											slice = BroadcastLaneElement(builder, slice, i);
+										}
+										builder.CreateStore(slice, GEPInstBuff.at(GEPIdx*SlicesPerByte()+i));
+									}
+									eraseList.push_back(st);
+								}
+							}
 						}
-					*/
 
 						} //getMetadata
 					} //I : B
 				} //B : F
 			} //F : M
 			
+			StartPhase("finalize", "Resolve the PHIs and round keys");
+			if(!ResolveBitSlicedPHIs())
+				report_fatal_error("resolving the bit-sliced PHIs failed");
+			RefreshRingSlices();
+			
+			if(!RoundKeys.empty())
+				EmitRoundKeySetup(M);
+			
 			/*
 			for(auto *sh : ShiftInstList){
 				IRBuilder<> builder(sh);
@@ -2602,9 +5755,11 @@ namespace{
 			}
 		*/
 		
+			StartPhase("orthogonal", "Emit the orthogonal transformations");
 			for(auto& EP : emitPoints){
 				StringRef Descr = cast<ConstantDataSequential>(cast<User>(cast<User>(EP->getArgOperand(1))
 																->getOperand(0))->getOperand(0))->getAsCString();
+				InstrumentCall(EP, OrthogonalCycles);
 				OrthogonalTransformation(EP, Descr);
 			}
 		
@@ -2653,11 +5808,45 @@ namespace{
 			}
 		
 	//			
+			if(MaskingOrder > 0){
+				StartPhase("masking", "Mask the bit-sliced data and gates");
+				MaskBitSlicedModule(M);
+			}
+			
+			StartPhase("cleanup", "Erase the intrinsics, emit instrumentation and drivers");
+			//the intrinsics can share their buffer pointer, which is listed once per call:
+			//erase the users before the values they use
+			SmallPtrSet<Instruction *, 32> Pending;
 			for(auto &EI: eraseList){
 				if(EI->getParent() != nullptr)
+					Pending.insert(EI);
+			}
+			bool Erased = true;
+			while(!Pending.empty() && Erased){
+				Erased = false;
+				for(auto &EI: eraseList){
+					if(!Pending.count(EI) || !EI->use_empty())
+						continue;
+					Pending.erase(EI);
 					EI -> eraseFromParent();
+					Erased = true;
+				}
+			}
+			for(auto &EI: eraseList){
+				if(Pending.erase(EI))
+					EI -> eraseFromParent();
+			}
+			LowerScalarBitCalls(M);
+			
+			if(Instrument && !InstrumentedFns.empty())
+				EmitCycleRegions(M);
+			
+			for(auto &Name : DriverKernels){
+				if(EmitBatchDriver(M, Name))
+					done = 1;
 			}
 	//
+			Phase.reset();
 			
 			if(done)
 				return true;
@@ -2676,6 +5865,7 @@ int BitSlicer::done = 0;
 static void registerBitSlicerPass(const PassManagerBuilder &,
                          legacy::PassManagerBase &PM) {
   PM.add(new BitSlicer());
+  addConstantTimeCheck(PM);
 }
 static RegisterStandardPasses
   RegisterMyPass(PassManagerBuilder::EP_ModuleOptimizerEarly,
@@ -0,0 +1,237 @@
+#include "ConstantTimeCheck.h"
+#include "llvm/Pass.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/Analysis/OptimizationDiagnosticInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/ADT/SmallPtrSet.h"
+
+#include "llvm/IR/LegacyPassManager.h"
+
+#define DEBUG_TYPE "bitslicer-ct"
+
+//Taint analysis of the code produced by the BitSlicer: every value derived
+//from bit-sliced data (the buffers tagged "bit-sliced", "bit-sliced-multi" and
+//"bit-sliced-data", and the slice parameters of the ".bitsliced" clones) is
+//secret, and a conditional branch, a select or an address computation that
+//depends on a secret value is reported. Secrets flow through memory, the
+//memory intrinsics, and the arguments and return values of direct calls.
+
+using namespace llvm;
+
+static cl::opt<bool> CTError("bitslicer-ct-error", cl::init(false),
+	cl::desc("Report secret-dependent branches, selects and addresses as errors"));
+
+static cl::opt<bool> CTVerify("bitslicer-verify-ct", cl::init(false),
+	cl::desc("Run the constant-time check right after the BitSlicer in the standard pipeline"));
+
+
+namespace{
+
+	struct ConstantTimeCheck : public ModulePass{
+		static char ID;
+		ConstantTimeCheck() : ModulePass(ID) {}
+
+		SmallPtrSet<const Value *, 32> SecretVals;	//values carrying secret data
+		SmallPtrSet<const Value *, 32> SecretObjs;	//memory holding secret data
+		SmallPtrSet<const Value *, 32> PtrObjs;		//memory holding pointers to SecretObjs
+		SmallPtrSet<const Function *, 8> SecretRets;	//functions returning secret values
+		unsigned Violations = 0;
+
+		bool isSecret(const Value *V){
+			return SecretVals.count(V);
+		}
+
+		void report(Instruction &I, OptimizationRemarkEmitter &ORE, StringRef Name, const Twine &Msg){
+			Violations++;
+			if(CTError){
+				I.getContext().emitError(&I, Msg);
+				return;
+			}
+			ORE.emit(OptimizationRemarkAnalysis(DEBUG_TYPE, Name, &I) << Msg.str());
+		}
+
+		void seed(Module &M){
+			for(GlobalVariable &G : M.globals()){
+				if(G.getMetadata("bit-sliced-data"))
+					SecretObjs.insert(&G);
+			}
+
+			for(Function& F : M){
+				for(Argument &Arg : F.args()){
+					if(F.getAttributes().getParamAttributes(Arg.getArgNo()).hasAttribute("bit-sliced"))
+						SecretObjs.insert(&Arg);
+				}
+				for(BasicBlock& B : F){
+					for(Instruction& I : B){
+						if(I.getMetadata("bit-sliced") || I.getMetadata("bit-sliced-multi") ||
+						   I.getMetadata("bit-sliced-data"))
+							SecretObjs.insert(&I);
+					}
+				}
+			}
+		}
+
+		//one step of the propagation, returns true if something new became secret
+		bool propagate(Instruction &I, const DataLayout &DL){
+			if(auto *ld = dyn_cast<LoadInst>(&I)){
+				const Value *obj = GetUnderlyingObject(ld->getPointerOperand(), DL, 0);
+				if(SecretObjs.count(obj) && !ld->getType()->isPointerTy())
+					return SecretVals.insert(ld).second;
+				if(PtrObjs.count(obj) && ld->getType()->isPointerTy())
+					return SecretObjs.insert(ld).second;
+				return false;
+			}
+
+			if(auto *st = dyn_cast<StoreInst>(&I)){
+				const Value *obj = GetUnderlyingObject(st->getPointerOperand(), DL, 0);
+				const Value *val = st->getValueOperand();
+				if(isSecret(val))
+					return SecretObjs.insert(obj).second;
+				if(val->getType()->isPointerTy() && SecretObjs.count(GetUnderlyingObject(val, DL, 0)))
+					return PtrObjs.insert(obj).second;
+				return false;
+			}
+
+			if(auto *mt = dyn_cast<MemTransferInst>(&I)){
+				const Value *src = GetUnderlyingObject(mt->getRawSource(), DL, 0);
+				const Value *dst = GetUnderlyingObject(mt->getRawDest(), DL, 0);
+				bool changed = false;
+				if(SecretObjs.count(src))
+					changed |= SecretObjs.insert(dst).second;
+				if(PtrObjs.count(src))
+					changed |= PtrObjs.insert(dst).second;
+				return changed;
+			}
+			
+			if(auto *ms = dyn_cast<MemSetInst>(&I)){
+				if(isSecret(ms->getValue()))
+					return SecretObjs.insert(GetUnderlyingObject(ms->getRawDest(), DL, 0)).second;
+				return false;
+			}
+			
+			if(auto *ret = dyn_cast<ReturnInst>(&I)){
+				if(ret->getReturnValue() && isSecret(ret->getReturnValue()))
+					return SecretRets.insert(ret->getFunction()).second;
+				return false;
+			}
+			
+			//the parameters of a direct callee take the secrecy of the arguments
+			bool changed = false;
+			CallSite CS(&I);
+			const Function *Callee = CS ? CS.getCalledFunction() : nullptr;
+			if(Callee && !Callee->isDeclaration()){
+				for(const Argument &Arg : Callee->args()){
+					if(Arg.getArgNo() >= CS.arg_size())
+						break;
+					const Value *A = CS.getArgument(Arg.getArgNo());
+					if(isSecret(A))
+						changed |= SecretVals.insert(&Arg).second;
+					if(A->getType()->isPointerTy()){
+						const Value *obj = GetUnderlyingObject(A, DL, 0);
+						if(SecretObjs.count(obj))
+							changed |= SecretObjs.insert(&Arg).second;
+						if(PtrObjs.count(obj))
+							changed |= PtrObjs.insert(&Arg).second;
+					}
+				}
+				if(SecretRets.count(Callee))
+					changed |= SecretVals.insert(&I).second;
+			}
+			
+			//the address itself is checked, the pointed memory is tracked by SecretObjs
+			if(isa<GetElementPtrInst>(&I) || I.getType()->isVoidTy())
+				return changed;
+
+			for(Use &U : I.operands()){
+				if(isSecret(U.get()))
+					return SecretVals.insert(&I).second || changed;
+			}
+			return changed;
+		}
+
+		void check(Instruction &I, OptimizationRemarkEmitter &ORE){
+			if(auto *br = dyn_cast<BranchInst>(&I)){
+				if(br->isConditional() && isSecret(br->getCondition()))
+					report(I, ORE, "SecretBranch", "conditional branch depends on bit-sliced data");
+			}else if(auto *sw = dyn_cast<SwitchInst>(&I)){
+				if(isSecret(sw->getCondition()))
+					report(I, ORE, "SecretBranch", "switch depends on bit-sliced data");
+			}else if(auto *sel = dyn_cast<SelectInst>(&I)){
+				if(isSecret(sel->getCondition()))
+					report(I, ORE, "SecretSelect", "select condition depends on bit-sliced data");
+			}else if(auto *gep = dyn_cast<GetElementPtrInst>(&I)){
+				for(auto Idx = gep->idx_begin(); Idx != gep->idx_end(); Idx++){
+					if(isSecret(Idx->get())){
+						report(I, ORE, "SecretIndex", "address computation depends on bit-sliced data");
+						break;
+					}
+				}
+			}else if(auto *ld = dyn_cast<LoadInst>(&I)){
+				if(isSecret(ld->getPointerOperand()))
+					report(I, ORE, "SecretAddress", "load address depends on bit-sliced data");
+			}else if(auto *st = dyn_cast<StoreInst>(&I)){
+				if(isSecret(st->getPointerOperand()))
+					report(I, ORE, "SecretAddress", "store address depends on bit-sliced data");
+			}
+		}
+
+		bool runOnModule(Module &M) override {
+			const DataLayout &DL = M.getDataLayout();
+			SecretVals.clear();
+			SecretObjs.clear();
+			PtrObjs.clear();
+			SecretRets.clear();
+			Violations = 0;
+			seed(M);
+
+			bool changed = true;
+			while(changed){
+				changed = false;
+				for(Function& F : M){
+					for(BasicBlock& B : F){
+						for(Instruction& I : B){
+							changed |= propagate(I, DL);
+						}
+					}
+				}
+			}
+
+			for(Function& F : M){
+				if(F.isDeclaration())
+					continue;
+				OptimizationRemarkEmitter ORE(&F);
+				for(BasicBlock& B : F){
+					for(Instruction& I : B){
+						check(I, ORE);
+					}
+				}
+			}
+
+			if(Violations && !CTError)
+				errs() << "warning: " << Violations << " secret-dependent branches, selects or addresses\n";
+
+			return false;
+		}
+
+		void getAnalysisUsage(AnalysisUsage &AU) const override {
+			AU.setPreservesAll();
+		}
+	};	//class ModulePass
+} //namespace
+
+char ConstantTimeCheck::ID = 0;
+
+static RegisterPass<ConstantTimeCheck> X("bitslicer-ct-check",
+										 "Constant-time check of bit-sliced code", false, true);
+
+void llvm::addConstantTimeCheck(legacy::PassManagerBase &PM) {
+  if(CTVerify)
+    PM.add(new ConstantTimeCheck());
+}
@@ -0,0 +1,24 @@
+//===- ConstantTimeCheck.h - Constant-time check of bit-sliced code -------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LIB_TRANSFORMS_BITSLICER_CONSTANTTIMECHECK_H
+#define LLVM_LIB_TRANSFORMS_BITSLICER_CONSTANTTIMECHECK_H
+
+namespace llvm {
+namespace legacy {
+class PassManagerBase;
+}
+
+/// Adds the constant-time check to PM when -bitslicer-verify-ct is given. It
+/// must follow the BitSlicer directly: the check is seeded from the metadata
+/// of the sliced buffers, which SROA and mem2reg drop with the allocas.
+void addConstantTimeCheck(legacy::PassManagerBase &PM);
+}
+
+#endif
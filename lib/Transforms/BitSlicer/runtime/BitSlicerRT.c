@@ -0,0 +1,219 @@
+/*===-- BitSlicerRT.c - Runtime of the BitSlicer pass ----------------------===*
+ *
+ *                     The LLVM Compiler Infrastructure
+ *
+ * This file is distributed under the University of Illinois Open Source
+ * License. See LICENSE.TXT for details.
+ *
+ *===----------------------------------------------------------------------===*
+ *
+ * Link this file with the programs built by the BitSlicer plugin. It runs the
+ * batches of the -bitslicer-driver drivers on all the cores, refills the
+ * per-thread buffer the -bitslicer-masking-order kernels draw their random
+ * words from, and tells the -bitslicer-preslice-keys kernels to re-slice
+ * their keys.
+ *
+ *   cc -O2 -pthread -c BitSlicerRT.c
+ *
+ *===----------------------------------------------------------------------===*/
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define BITSLICER_RANDOMNESS_WORDS 4096
+
+/* Also emitted, weak, by the masked modules. */
+__attribute__((weak)) __thread uint32_t *bitslicer_randomness;
+__attribute__((weak)) __thread uint64_t bitslicer_randomness_len;
+__attribute__((weak)) __thread uint64_t bitslicer_randomness_used;
+
+static FILE *Urandom;
+static pthread_once_t UrandomOnce = PTHREAD_ONCE_INIT;
+
+static void openUrandom(void) { Urandom = fopen("/dev/urandom", "rb"); }
+
+/* Called by a masked kernel when it has used all the words of the buffer. */
+void bitslicer_refill_randomness(void) {
+  static __thread uint32_t Words[BITSLICER_RANDOMNESS_WORDS];
+
+  pthread_once(&UrandomOnce, openUrandom);
+  if (!Urandom || fread(Words, sizeof(Words), 1, Urandom) != 1) {
+    fprintf(stderr, "bitslicer: cannot read /dev/urandom\n");
+    abort();
+  }
+  bitslicer_randomness = Words;
+  bitslicer_randomness_len = BITSLICER_RANDOMNESS_WORDS;
+  bitslicer_randomness_used = 0;
+}
+
+/* Also emitted, weak, by the modules with pre-sliced keys. */
+__attribute__((weak)) uint64_t bitslicer_round_key_generation;
+
+/* Call after writing the key arrays: every thread re-slices its copies on its
+   next kernel call. Must not race with running kernels of the old key. */
+void bitslicer_round_keys_changed(void) {
+  __atomic_add_fetch(&bitslicer_round_key_generation, 1, __ATOMIC_RELEASE);
+}
+
+typedef void (*BatchFn)(void *Ctx, uint64_t Batch);
+
+/* The batches [Lo, Hi) a thread has left. Its owner takes them from the
+   front, the other threads steal the back half. */
+struct Deque {
+  pthread_mutex_t Lock;
+  uint64_t Lo, Hi;
+};
+
+/* The workers are started on the first call and live as long as the process.
+   Slot i < Workers belongs to worker i, the last one to the submitting
+   thread. One loop runs at a time. */
+static struct {
+  pthread_mutex_t Lock;
+  pthread_cond_t Wake, Idle;
+  struct Deque *Deques;
+  unsigned Workers;
+  uint64_t Generation; /* bumped for every loop */
+  unsigned Busy;       /* workers that have not finished the current loop */
+  BatchFn Body;
+  void *Ctx;
+} Pool = {.Lock = PTHREAD_MUTEX_INITIALIZER,
+          .Wake = PTHREAD_COND_INITIALIZER,
+          .Idle = PTHREAD_COND_INITIALIZER};
+static pthread_once_t PoolOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t SubmitLock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int InPool;
+
+static int popFront(struct Deque *D, uint64_t *B) {
+  int Got;
+  pthread_mutex_lock(&D->Lock);
+  Got = D->Lo < D->Hi;
+  if (Got)
+    *B = D->Lo++;
+  pthread_mutex_unlock(&D->Lock);
+  return Got;
+}
+
+/* Moves the back half of a victim's batches to Slot. */
+static int steal(unsigned Slot) {
+  unsigned Slots = Pool.Workers + 1, I;
+  for (I = 1; I < Slots; I++) {
+    struct Deque *V = &Pool.Deques[(Slot + I) % Slots];
+    uint64_t Lo, Hi;
+    pthread_mutex_lock(&V->Lock);
+    Hi = V->Hi;
+    Lo = V->Hi - (V->Hi - V->Lo) / 2;
+    if (Lo == Hi && V->Lo < V->Hi)
+      Lo = Hi - 1; /* the last one */
+    V->Hi = Lo;
+    pthread_mutex_unlock(&V->Lock);
+    if (Lo < Hi) {
+      struct Deque *D = &Pool.Deques[Slot];
+      pthread_mutex_lock(&D->Lock);
+      D->Lo = Lo;
+      D->Hi = Hi;
+      pthread_mutex_unlock(&D->Lock);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Runs batches until no slot has any left. */
+static void runSlot(unsigned Slot) {
+  uint64_t B;
+  do {
+    while (popFront(&Pool.Deques[Slot], &B))
+      Pool.Body(Pool.Ctx, B);
+  } while (steal(Slot));
+}
+
+static void *worker(void *Arg) {
+  unsigned Slot = (unsigned)(uintptr_t)Arg;
+  uint64_t Seen = 0;
+  InPool = 1;
+  pthread_mutex_lock(&Pool.Lock);
+  for (;;) {
+    while (Pool.Generation == Seen)
+      pthread_cond_wait(&Pool.Wake, &Pool.Lock);
+    Seen = Pool.Generation;
+    pthread_mutex_unlock(&Pool.Lock);
+    runSlot(Slot);
+    pthread_mutex_lock(&Pool.Lock);
+    if (--Pool.Busy == 0)
+      pthread_cond_signal(&Pool.Idle);
+  }
+  return NULL;
+}
+
+/* BITSLICER_THREADS, or one thread per online core. */
+static unsigned numThreads(void) {
+  const char *Env = getenv("BITSLICER_THREADS");
+  long N = Env ? atol(Env) : sysconf(_SC_NPROCESSORS_ONLN);
+  return N > 0 ? (unsigned)N : 1;
+}
+
+static void startPool(void) {
+  unsigned Workers = numThreads() - 1, I;
+  pthread_attr_t Attr;
+
+  Pool.Deques = calloc(Workers + 1, sizeof(struct Deque));
+  if (!Pool.Deques)
+    return;
+  for (I = 0; I <= Workers; I++)
+    pthread_mutex_init(&Pool.Deques[I].Lock, NULL);
+  pthread_attr_init(&Attr);
+  pthread_attr_setdetachstate(&Attr, PTHREAD_CREATE_DETACHED);
+  for (I = 0; I < Workers; I++) {
+    pthread_t T;
+    if (pthread_create(&T, &Attr, worker, (void *)(uintptr_t)I))
+      break;
+  }
+  pthread_attr_destroy(&Attr);
+  /* The submitting thread takes the slot after the last started worker. */
+  Pool.Workers = I;
+}
+
+/* Overrides the weak serial definition the drivers carry: runs Body(Ctx, b)
+   for b in [0, Batches) on the calling thread and the pool workers, and
+   returns once every batch is done. A call from inside a batch, or while
+   another thread's loop runs, is not worth the wait: it runs serially. */
+void bitslicer_parallel_for(BatchFn Body, void *Ctx, uint64_t Batches) {
+  unsigned Slots, I;
+  uint64_t B;
+
+  pthread_once(&PoolOnce, startPool);
+  if (InPool || Batches < 2 || !Pool.Workers ||
+      pthread_mutex_trylock(&SubmitLock)) {
+    for (B = 0; B < Batches; B++)
+      Body(Ctx, B);
+    return;
+  }
+
+  /* Even shares up front; stealing evens out the rest. */
+  Slots = Pool.Workers + 1;
+  for (I = 0; I < Slots; I++) {
+    Pool.Deques[I].Lo = Batches * I / Slots;
+    Pool.Deques[I].Hi = Batches * (I + 1) / Slots;
+  }
+  pthread_mutex_lock(&Pool.Lock);
+  Pool.Body = Body;
+  Pool.Ctx = Ctx;
+  Pool.Busy = Pool.Workers;
+  Pool.Generation++;
+  pthread_cond_broadcast(&Pool.Wake);
+  pthread_mutex_unlock(&Pool.Lock);
+
+  InPool = 1;
+  runSlot(Pool.Workers);
+  InPool = 0;
+
+  /* The workers read Body and Ctx until they are done. */
+  pthread_mutex_lock(&Pool.Lock);
+  while (Pool.Busy)
+    pthread_cond_wait(&Pool.Idle, &Pool.Lock);
+  pthread_mutex_unlock(&Pool.Lock);
+  pthread_mutex_unlock(&SubmitLock);
+}
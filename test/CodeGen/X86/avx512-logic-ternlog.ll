@@ -0,0 +1,85 @@
+; NOTE: Assertions have been autogenerated by utils/update_llc_test_checks.py
+; RUN: llc < %s -mtriple=x86_64-unknown-unknown -mattr=+avx512f,+avx512vl | FileCheck %s
+
+; Bit-sliced gate cones with at most three inputs fold into one vpternlog.
+
+define <16 x i32> @maj(<16 x i32> %a, <16 x i32> %b, <16 x i32> %c) {
+; CHECK-LABEL: maj:
+; CHECK:       # BB#0:
+; CHECK-NEXT:    vpternlogq $232, %zmm2, %zmm1, %zmm0
+; CHECK-NEXT:    retq
+  %ab = and <16 x i32> %a, %b
+  %ac = and <16 x i32> %a, %c
+  %bc = and <16 x i32> %b, %c
+  %t = or <16 x i32> %ab, %ac
+  %r = or <16 x i32> %t, %bc
+  ret <16 x i32> %r
+}
+
+define <8 x i32> @xor3(<8 x i32> %a, <8 x i32> %b, <8 x i32> %c) {
+; CHECK-LABEL: xor3:
+; CHECK:       # BB#0:
+; CHECK-NEXT:    vpternlogq $150, %ymm2, %ymm1, %ymm0
+; CHECK-NEXT:    retq
+  %t = xor <8 x i32> %a, %b
+  %r = xor <8 x i32> %t, %c
+  ret <8 x i32> %r
+}
+
+define <4 x i32> @mux(<4 x i32> %a, <4 x i32> %b, <4 x i32> %c) {
+; CHECK-LABEL: mux:
+; CHECK:       # BB#0:
+; CHECK-NEXT:    vpternlogq $202, %xmm2, %xmm1, %xmm0
+; CHECK-NEXT:    retq
+  %n = xor <4 x i32> %a, <i32 -1, i32 -1, i32 -1, i32 -1>
+  %x = and <4 x i32> %a, %b
+  %y = and <4 x i32> %n, %c
+  %r = or <4 x i32> %x, %y
+  ret <4 x i32> %r
+}
+
+define <4 x i32> @andn(<4 x i32> %a, <4 x i32> %b) {
+; CHECK-LABEL: andn:
+; CHECK:       # BB#0:
+; CHECK-NEXT:    vpandn %xmm1, %xmm0, %xmm0
+; CHECK-NEXT:    retq
+  %n = xor <4 x i32> %a, <i32 -1, i32 -1, i32 -1, i32 -1>
+  %r = and <4 x i32> %n, %b
+  ret <4 x i32> %r
+}
+
+define <4 x i32> @nand(<4 x i32> %a, <4 x i32> %b) {
+; CHECK-LABEL: nand:
+; CHECK:       # BB#0:
+; CHECK-NEXT:    vpternlogq $119, %xmm0, %xmm1, %xmm0
+; CHECK-NEXT:    retq
+  %x = and <4 x i32> %a, %b
+  %r = xor <4 x i32> %x, <i32 -1, i32 -1, i32 -1, i32 -1>
+  ret <4 x i32> %r
+}
+
+define <16 x i32> @sbox_chain(<16 x i32> %a, <16 x i32> %b, <16 x i32> %c) {
+; CHECK-LABEL: sbox_chain:
+; CHECK:       # BB#0:
+; CHECK-NEXT:    vpternlogq $4, %zmm2, %zmm1, %zmm0
+; CHECK-NEXT:    retq
+  %t0 = xor <16 x i32> %a, %b
+  %t1 = and <16 x i32> %t0, %c
+  %t2 = or <16 x i32> %t1, %a
+  %t3 = xor <16 x i32> %t2, <i32 -1, i32 -1, i32 -1, i32 -1, i32 -1, i32 -1, i32 -1, i32 -1, i32 -1, i32 -1, i32 -1, i32 -1, i32 -1, i32 -1, i32 -1, i32 -1>
+  %t4 = and <16 x i32> %t3, %b
+  ret <16 x i32> %t4
+}
+
+; Four inputs: only a three-input sub-cone is folded.
+define <16 x i32> @four_inputs(<16 x i32> %a, <16 x i32> %b, <16 x i32> %c, <16 x i32> %d) {
+; CHECK-LABEL: four_inputs:
+; CHECK:       # BB#0:
+; CHECK-NEXT:    vpternlogq $40, %zmm2, %zmm1, %zmm0
+; CHECK-NEXT:    vporq %zmm3, %zmm0, %zmm0
+; CHECK-NEXT:    retq
+  %t0 = xor <16 x i32> %a, %b
+  %t1 = and <16 x i32> %t0, %c
+  %t2 = or <16 x i32> %t1, %d
+  ret <16 x i32> %t2
+}
@@ -0,0 +1,70 @@
+; Running the function passes of -passes on several threads gives the same
+; module as running them on one, whatever the number of threads.
+; RUN: opt -S -passes=instcombine,simplify-cfg < %s > %t.seq
+; RUN: opt -S -passes=instcombine,simplify-cfg -j 1 -j-partition-size=1 < %s > %t.j1
+; RUN: opt -S -passes=instcombine,simplify-cfg -j 4 -j-partition-size=1 < %s > %t.j4
+; RUN: opt -S -passes=instcombine,simplify-cfg -j4 < %s > %t.j4big
+; RUN: diff %t.seq %t.j1
+; RUN: diff %t.seq %t.j4
+; RUN: diff %t.seq %t.j4big
+; RUN: FileCheck %s < %t.j4
+
+; RUN: not opt -S -passes=globaldce -j 2 < %s 2>&1 | FileCheck %s --check-prefix=ERR
+; ERR: -j takes a pipeline of function passes.
+
+%pair = type { i32, i32 }
+
+@counter = internal global i32 0
+@table = global [2 x i32] [i32 1, i32 2]
+@second = alias i32, getelementptr ([2 x i32], [2 x i32]* @table, i64 0, i64 1)
+
+; CHECK: @counter = internal global i32 0
+; CHECK: @second = alias i32
+; CHECK-LABEL: define internal i32 @helper(
+; CHECK-NEXT: ret i32 %x
+define internal i32 @helper(i32 %x) {
+  %a = add i32 %x, 0
+  ret i32 %a
+}
+
+; CHECK-LABEL: define i32 @uses_helper(
+; CHECK: call i32 @helper(i32 %y)
+; CHECK: store i32 {{%.*}}, i32* @counter
+define i32 @uses_helper(i32 %y) {
+  %r = call i32 @helper(i32 %y)
+  %c = load i32, i32* @counter
+  %n = add i32 %c, 1
+  store i32 %n, i32* @counter
+  ret i32 %r
+}
+
+declare void @external(%pair*)
+
+; CHECK-LABEL: define void @uses_type(
+; CHECK: %p = alloca %pair
+; CHECK-NEXT: call void @external(%pair* nonnull %p)
+define void @uses_type() {
+  %p = alloca %pair
+  call void @external(%pair* %p)
+  br label %next
+
+next:
+  ret void
+}
+
+; CHECK-LABEL: define i32 @folds(
+; CHECK-NEXT: ret i32 3
+define i32 @folds() {
+  %a = getelementptr [2 x i32], [2 x i32]* @table, i64 0, i64 0
+  %b = mul i32 1, 3
+  ret i32 %b
+}
+
+; A task only declares the globals out of its range, an alias included.
+; CHECK-LABEL: define i32 @uses_alias(
+; CHECK-NEXT: load i32, i32* @second
+define i32 @uses_alias() {
+  %v = load i32, i32* @second
+  %r = add i32 %v, 0
+  ret i32 %r
+}
@@ -0,0 +1,38 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -bitslicer-driver=enc -bitslicer-driver-block-len=16 -O0 -S | FileCheck %s
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -bitslicer-driver=nope -O0 -S 2>&1 | FileCheck %s --check-prefix=ERR
+; REQUIRES: loadable_module
+
+; A batch of @enc is 32 blocks of 16 bytes. The driver hands one task per
+; batch to bitslicer_parallel_for, whose weak serial definition keeps the
+; module linkable without the runtime. The last partial batch goes through
+; zeroed 512-byte buffers and only its valid bytes are copied back.
+
+; ERR: ERROR: batch driver kernel nope is not defined in the module
+
+; CHECK-LABEL: define weak void @bitslicer_parallel_for(void (i8*, i64)*, i8*, i64)
+; CHECK: call void %0(i8* %1, i64 %b)
+
+; CHECK-LABEL: define internal void @enc.batch(i8*, i64)
+; CHECK: %tailIn = alloca [512 x i8]
+; CHECK: %tailOut = alloca [512 x i8]
+; CHECK: %totalBytes = mul i64 {{%[0-9]+}}, 16
+; CHECK: %offset = mul i64 %1, 512
+; CHECK: %left = sub i64 %totalBytes, %offset
+; CHECK: icmp uge i64 %left, 512
+; CHECK: batch.full:
+; CHECK-NEXT: call void @enc(
+; CHECK: batch.tail:
+; CHECK: call void @llvm.memset.p0i8.i64(i8* [[TIN:%[0-9]+]], i8 0, i64 512,
+; CHECK-NEXT: call void @llvm.memcpy.p0i8.p0i8.i64(i8* [[TIN]], i8* {{%[0-9]+}}, i64 %left,
+; CHECK-NEXT: call void @enc(i8* [[TIN]], i8* [[TOUT:%[0-9]+]])
+; CHECK-NEXT: call void @llvm.memcpy.p0i8.p0i8.i64(i8* {{%[0-9]+}}, i8* [[TOUT]], i64 %left,
+
+; CHECK-LABEL: define void @enc.batched(i8*, i8*, i64)
+; CHECK: %ctx = alloca { i8*, i8*, i64 }
+; CHECK: [[N:%[0-9]+]] = add i64 %2, 31
+; CHECK-NEXT: %batches = udiv i64 [[N]], 32
+; CHECK: call void @bitslicer_parallel_for(void (i8*, i64)* @enc.batch, i8* {{%[0-9]+}}, i64 %batches)
+define void @enc(i8* %in, i8* %out) {
+entry:
+  ret void
+}
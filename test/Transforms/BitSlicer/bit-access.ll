@@ -0,0 +1,102 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -S | FileCheck %s
+; RUN: sed -e 's/%y, i32 6,/%y, i32 8,/' %s \
+; RUN:   | not opt -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -S 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=BIT
+; RUN: sed -e 's/i32 %n, i32 7)/i32 %n, i32 32)/' %s \
+; RUN:   | not opt -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -S 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=LANE
+; REQUIRES: loadable_module
+
+; Bit 5 of byte 3 of a bit-sliced state lives in slice 3*8+5: a single load
+; of that slice, shifted to the lane, replaces the per-bit accessors. A
+; runtime lane is taken modulo the 32 lanes.
+
+; CHECK-LABEL: @lane_bit(
+; CHECK: [[BASE:%.*]] = getelementptr inbounds [128 x i32], [128 x i32]* %SLICES, i64 0, i64 24
+; CHECK: [[ADDR:%.*]] = getelementptr inbounds i32, i32* [[BASE]], i64 5
+; CHECK: %bit.slice = load i32, i32* [[ADDR]]
+; CHECK: %lane.idx = and i32 %lane, 31
+; CHECK-NEXT: [[POS:%.*]] = mul i32 %lane.idx, 1
+; CHECK: lshr i32 %bit.slice, {{%.*}}
+; CHECK-NOT: call i8 @llvm.bitsliced.i8.lane.bit
+; CHECK: ret i8
+define i8 @lane_bit(i32 %lane) {
+entry:
+  %state = alloca [512 x i8]
+  %p = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %p, i32 32, i32 16)
+  %g = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 3
+  %x = load i8, i8* %g
+  %b = call i8 @llvm.bitsliced.i8.lane.bit(i8 %x, i32 5, i32 %lane)
+  ret i8 %b
+}
+
+; The sliced accessor yields a sliced byte: slice 0 is the loaded slice and
+; is stored back through the xor, the higher slices are zero. Sliced buffers
+; are looked up by name, so the state of each function has its own.
+
+; CHECK-LABEL: @bit(
+; CHECK: %bit.slice = load i32, i32*
+; CHECK: xor i32 {{%.*}}, %bit.slice
+; CHECK-NOT: call i8 @llvm.bitsliced.i8.bit
+; CHECK: ret void
+define void @bit() {
+entry:
+  %bstate = alloca [512 x i8]
+  %p = getelementptr inbounds [512 x i8], [512 x i8]* %bstate, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %p, i32 32, i32 16)
+  %g = getelementptr inbounds [512 x i8], [512 x i8]* %bstate, i64 0, i64 3
+  %x = load i8, i8* %g
+  %b = call i8 @llvm.bitsliced.i8.bit(i8 %x, i32 5)
+  %g2 = getelementptr inbounds [512 x i8], [512 x i8]* %bstate, i64 0, i64 4
+  %y = load i8, i8* %g2
+  %yz = zext i8 %y to i32
+  %bz = zext i8 %b to i32
+  %z = xor i32 %yz, %bz
+  %t = trunc i32 %z to i8
+  store i8 %t, i8* %g2
+  ret void
+}
+
+; A runtime bit index is taken modulo 8 before it picks the slice; constant
+; bit indices past 7 and lanes past 31 are rejected.
+
+; CHECK-LABEL: @runtime_bit(
+; CHECK: %bit.idx = and i32 %n, 7
+; CHECK-NEXT: [[S:%.*]] = lshr i32 %bit.idx, 0
+; CHECK-NEXT: [[I:%.*]] = zext i32 [[S]] to i64
+; CHECK-NEXT: getelementptr inbounds i32, i32* {{%.*}}, i64 [[I]]
+; CHECK-NOT: call i8 @llvm.bitsliced.i8.lane.bit
+; CHECK: ret i8
+; BIT: LLVM ERROR: bit index into a bit-sliced byte is out of range
+; LANE: LLVM ERROR: lane index of a bit-sliced bit access is out of range
+define i8 @runtime_bit(i32 %n) {
+entry:
+  %rstate = alloca [512 x i8]
+  %p = getelementptr inbounds [512 x i8], [512 x i8]* %rstate, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %p, i32 32, i32 16)
+  %g = getelementptr inbounds [512 x i8], [512 x i8]* %rstate, i64 0, i64 1
+  %x = load i8, i8* %g
+  %b = call i8 @llvm.bitsliced.i8.lane.bit(i8 %x, i32 %n, i32 7)
+  %g2 = getelementptr inbounds [512 x i8], [512 x i8]* %rstate, i64 0, i64 2
+  %y = load i8, i8* %g2
+  %c = call i8 @llvm.bitsliced.i8.lane.bit(i8 %y, i32 6, i32 0)
+  %r = or i8 %b, %c
+  ret i8 %r
+}
+
+; On plain bytes the accessors are a scalar shift and mask.
+
+; CHECK-LABEL: @scalar(
+; CHECK: [[SH:%.*]] = lshr i8 %v, 3
+; CHECK: and i8 [[SH]], 1
+; CHECK-NOT: call i8 @llvm.bitsliced
+define i8 @scalar(i8 %v) {
+entry:
+  %b = call i8 @llvm.bitsliced.i8.bit(i8 %v, i32 3)
+  ret i8 %b
+}
+
+declare void @llvm.bitslice.i32(i8*, i32, i32)
+declare i8 @llvm.bitsliced.i8.bit(i8, i32)
+declare i8 @llvm.bitsliced.i8.lane.bit(i8, i32, i32)
@@ -0,0 +1,45 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -S | FileCheck %s
+; REQUIRES: loadable_module
+
+; A bit-sliced buffer passed to a defined function: the call goes to a clone
+; of the callee that takes the slice array, and the body of the clone is
+; rewritten like the caller. Byte 1 of the buffer is slices 8 to 15.
+
+; CHECK-LABEL: define void @caller(
+; CHECK: %SLICES = alloca [128 x i32]
+; CHECK: call void @add_key.bitsliced.0([128 x i32]* %SLICES, i8 %k)
+; CHECK-NOT: call void @add_key(
+; CHECK: ret void
+define void @caller(i8 %k) {
+entry:
+  %state = alloca [512 x i8]
+  %p = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %p, i32 32, i32 16)
+  %d = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 0
+  call void @add_key(i8* %d, i8 %k)
+  %q = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 0
+  call void @llvm.unbitslice.i32(i8* %q)
+  ret void
+}
+
+; CHECK-LABEL: define internal void @add_key.bitsliced.0([128 x i32]* "bit-sliced" %s, i8 %k)
+; CHECK: [[S8:%.*]] = getelementptr inbounds [128 x i32], [128 x i32]* %s, i64 0, i64 8
+; CHECK: [[S15:%.*]] = getelementptr inbounds [128 x i32], [128 x i32]* %s, i64 0, i64 15
+; CHECK: [[X:%.*]] = xor i32
+; CHECK: store i32 [[X]], i32* [[S8]]
+; CHECK: store i32 {{%.*}}, i32* [[S15]]
+; CHECK-NEXT: ret void
+define internal void @add_key(i8* %s, i8 %k) {
+entry:
+  %g = getelementptr inbounds i8, i8* %s, i64 1
+  %x = load i8, i8* %g
+  %xz = zext i8 %x to i32
+  %kz = zext i8 %k to i32
+  %y = xor i32 %xz, %kz
+  %yt = trunc i32 %y to i8
+  store i8 %yt, i8* %g
+  ret void
+}
+
+declare void @llvm.bitslice.i32(i8*, i32, i32)
+declare void @llvm.unbitslice.i32(i8*)
@@ -0,0 +1,39 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -bitslicer-ct-check \
+; RUN:   -pass-remarks-analysis=bitslicer-ct -disable-output 2>&1 | FileCheck %s -allow-empty
+; REQUIRES: loadable_module
+
+; A bit-sliced kernel only computes on the slices with logic operations, and
+; indexes the buffers with public loop counters: nothing is reported.
+
+; CHECK-NOT: remark
+; CHECK-NOT: warning
+
+define void @kernel(i32* %out) {
+entry:
+  %slices = alloca [8 x i32], !bit-sliced-data !0
+  br label %for.cond
+
+for.cond:
+  %i = phi i64 [ 0, %entry ], [ %inc, %for.body ]
+  %cmp = icmp slt i64 %i, 7
+  br i1 %cmp, label %for.body, label %for.end
+
+for.body:
+  %p = getelementptr inbounds [8 x i32], [8 x i32]* %slices, i64 0, i64 %i
+  %s = load i32, i32* %p
+  %inc = add nsw i64 %i, 1
+  %q = getelementptr inbounds [8 x i32], [8 x i32]* %slices, i64 0, i64 %inc
+  %t = load i32, i32* %q
+  %x = xor i32 %s, %t
+  %y = and i32 %x, %s
+  store i32 %y, i32* %p
+  br label %for.cond
+
+for.end:
+  %r = getelementptr inbounds [8 x i32], [8 x i32]* %slices, i64 0, i64 0
+  %v = load i32, i32* %r
+  store i32 %v, i32* %out
+  ret void
+}
+
+!0 = !{!"bit-sliced-data"}
@@ -0,0 +1,64 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -bitslicer-ct-check \
+; RUN:   -pass-remarks-analysis=bitslicer-ct -disable-output 2>&1 | FileCheck %s
+; REQUIRES: loadable_module
+
+; Secrets reach a branch directly, a table index through a memcpy of the
+; sliced buffer, and a branch of a callee through its argument.
+
+; CHECK-DAG: remark: <unknown>:0:0: conditional branch depends on bit-sliced data
+; CHECK-DAG: remark: <unknown>:0:0: address computation depends on bit-sliced data
+; CHECK-DAG: remark: <unknown>:0:0: select condition depends on bit-sliced data
+; CHECK: warning: 3 secret-dependent branches, selects or addresses
+
+@sbox = internal constant [256 x i8] zeroinitializer
+
+declare void @llvm.memcpy.p0i8.p0i8.i64(i8*, i8*, i64, i32, i1)
+
+define void @branch(i32* %out) {
+entry:
+  %slices = alloca [8 x i32], !bit-sliced-data !0
+  %p = getelementptr inbounds [8 x i32], [8 x i32]* %slices, i64 0, i64 0
+  %s = load i32, i32* %p
+  %z = icmp eq i32 %s, 0
+  br i1 %z, label %zero, label %done
+
+zero:
+  store i32 0, i32* %out
+  br label %done
+
+done:
+  ret void
+}
+
+define i8 @lookup() {
+entry:
+  %slices = alloca [8 x i32], !bit-sliced-data !0
+  %copy = alloca [8 x i32]
+  %src = bitcast [8 x i32]* %slices to i8*
+  %dst = bitcast [8 x i32]* %copy to i8*
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* %dst, i8* %src, i64 32, i32 4, i1 false)
+  %p = getelementptr inbounds [8 x i32], [8 x i32]* %copy, i64 0, i64 3
+  %s = load i32, i32* %p
+  %idx = and i32 %s, 255
+  %e = getelementptr inbounds [256 x i8], [256 x i8]* @sbox, i32 0, i32 %idx
+  %v = load i8, i8* %e
+  ret i8 %v
+}
+
+define internal i32 @pick(i32 %s, i32 %a, i32 %b) {
+entry:
+  %z = icmp eq i32 %s, 0
+  %r = select i1 %z, i32 %a, i32 %b
+  ret i32 %r
+}
+
+define i32 @caller() {
+entry:
+  %slices = alloca [8 x i32], !bit-sliced-data !0
+  %p = getelementptr inbounds [8 x i32], [8 x i32]* %slices, i64 0, i64 1
+  %s = load i32, i32* %p
+  %r = call i32 @pick(i32 %s, i32 1, i32 2)
+  ret i32 %r
+}
+
+!0 = !{!"bit-sliced-data"}
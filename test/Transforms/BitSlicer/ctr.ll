@@ -0,0 +1,70 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -S | FileCheck %s
+; REQUIRES: loadable_module
+
+; Two-byte CTR blocks with a one-byte counter. Byte 0 is nonce: its bits are
+; broadcast to the 32 lanes. Byte 1 is the counter: lane j gets IV + j, the
+; broadcast IV bits plus the lane-index slices 0xAAAAAAAA, 0xCCCCCCCC, ...
+; through a ripple-carry adder. Moving to the next batch adds 32, so the
+; counter slices below bit 5 are left alone.
+
+; CHECK-LABEL: @ctr(
+; CHECK: %broadcast = sub i32 0,
+; CHECK: [[S8:%[0-9]+]] = xor i32 [[B8:%broadcast[0-9]+]], -1431655766
+; CHECK-NEXT: %carry = and i32 [[B8]], -1431655766
+; CHECK: xor i32 {{%broadcast[0-9]+}}, -858993460
+; CHECK: xor i32 {{%broadcast[0-9]+}}, -252645136
+; CHECK: xor i32 {{%broadcast[0-9]+}}, -16711936
+; CHECK: xor i32 {{%broadcast[0-9]+}}, -65536
+; CHECK: %sliceAddr = getelementptr inbounds i32, i32* %slices, i64 0
+; CHECK-NEXT: store i32 %broadcast, i32* %sliceAddr
+; CHECK: [[A8:%.*]] = getelementptr inbounds i32, i32* %slices, i64 8
+; CHECK-NEXT: store i32 [[S8]], i32* [[A8]]
+; CHECK: %sliceAddr{{[0-9]+}} = getelementptr inbounds i32, i32* %slices, i64 15
+; CHECK-NEXT: store i32
+
+; CHECK-NOT: getelementptr inbounds i32, i32* %slices, i64 12
+; CHECK: [[A13:%[0-9]+]] = getelementptr inbounds i32, i32* %slices, i64 13
+; CHECK-NEXT: [[C13:%.*]] = load i32, i32* [[A13]]
+; CHECK-NEXT: [[N13:%.*]] = xor i32 [[C13]], -1
+; CHECK-NEXT: store i32 [[N13]], i32* [[A13]]
+; CHECK: getelementptr inbounds i32, i32* %slices, i64 15
+; CHECK: ret void
+
+define void @ctr(i32* %slices, i8* %iv) {
+entry:
+  call void @llvm.bitslice.ctr.i32(i32* %slices, i8* %iv, i32 2, i32 1)
+  call void @llvm.bitslice.ctr.inc.i32(i32* %slices, i32 2, i32 1)
+  ret void
+}
+
+; 16-byte blocks with a 64-bit counter in bytes 8 to 15. Only the 5 low
+; counter bits get a lane-index slice, the carry ripples up to bit 63, which
+; is slice 71. The sliced blocks are marked as bit-sliced data.
+
+; CHECK-LABEL: @ctr64(
+; CHECK: %blocks = alloca [128 x i32], !bit-sliced-data
+; CHECK: xor i32 {{%broadcast[0-9]+}}, -1431655766
+; CHECK: xor i32 {{%broadcast[0-9]+}}, -858993460
+; CHECK: xor i32 {{%broadcast[0-9]+}}, -252645136
+; CHECK: xor i32 {{%broadcast[0-9]+}}, -16711936
+; CHECK: xor i32 {{%broadcast[0-9]+}}, -65536
+; CHECK-NOT: xor i32 {{%broadcast[0-9]+}}, {{-?[0-9]+$}}
+; CHECK: [[A71:%sliceAddr[0-9]+]] = getelementptr inbounds i32, i32* %s, i64 71
+; CHECK-NEXT: store i32 %ctr{{[0-9]+}}, i32* [[A71]]
+; CHECK: [[I71:%[0-9]+]] = getelementptr inbounds i32, i32* %s, i64 71
+; CHECK-NEXT: [[C71:%.*]] = load i32, i32* [[I71]]
+; CHECK-NEXT: [[N71:%.*]] = xor i32 [[C71]], %carry
+; CHECK: store i32 [[N71]], i32* [[I71]]
+; CHECK-NEXT: ret void
+
+define void @ctr64(i8* %iv) {
+entry:
+  %blocks = alloca [128 x i32]
+  %s = getelementptr inbounds [128 x i32], [128 x i32]* %blocks, i64 0, i64 0
+  call void @llvm.bitslice.ctr.i32(i32* %s, i8* %iv, i32 16, i32 8)
+  call void @llvm.bitslice.ctr.inc.i32(i32* %s, i32 16, i32 8)
+  ret void
+}
+
+declare void @llvm.bitslice.ctr.i32(i32*, i8*, i32, i32)
+declare void @llvm.bitslice.ctr.inc.i32(i32*, i32, i32)
@@ -0,0 +1,82 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -S | FileCheck %s
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -S | grep "%clmul[0-9]* = and i32" | count 13824
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 | lli -force-interpreter
+; REQUIRES: loadable_module
+
+; GHASH multiply of a bit-sliced block by a bit-sliced key: three levels of
+; Karatsuba take the 128x128 schoolbook product (16384 ANDs) down to 27
+; 16x16 products, and the reduction is a fixed XOR network. Each of the two
+; multiplies below takes 6912 ANDs.
+
+@.ghash = private unnamed_addr constant [33 x i8] c"x:all:=:x:all::gf128mul::h:ghash\00"
+@.kat = private unnamed_addr constant [36 x i8] c"kx:all:=:kx:all::gf128mul::kh:ghash\00"
+
+; Test case 2 of the GCM specification: C = 0388dace60b6a392f328c2b971b2fe78
+; in blocks 0 and 31 of kx, H = 66e94bd4ef8a2c3b884cfa59ca342b2e in the same
+; blocks of kh, the other blocks zero.
+@kat.c = private unnamed_addr constant <{ [16 x i8], [480 x i8], [16 x i8] }> <{ [16 x i8] c"\03\88\DA\CE\60\B6\A3\92\F3\28\C2\B9\71\B2\FE\78", [480 x i8] zeroinitializer, [16 x i8] c"\03\88\DA\CE\60\B6\A3\92\F3\28\C2\B9\71\B2\FE\78" }>
+@kat.h = private unnamed_addr constant <{ [16 x i8], [480 x i8], [16 x i8] }> <{ [16 x i8] c"\66\E9\4B\D4\EF\8A\2C\3B\88\4C\FA\59\CA\34\2B\2E", [480 x i8] zeroinitializer, [16 x i8] c"\66\E9\4B\D4\EF\8A\2C\3B\88\4C\FA\59\CA\34\2B\2E" }>
+
+; CHECK-LABEL: @ghash(
+; In GHASH order x^0 is the top bit of byte 0.
+; CHECK: %LOper = getelementptr [128 x i32], [128 x i32]* %SLICES, i64 0, i64 {{%.*}}
+; CHECK: %clmul = xor i32
+; CHECK: %gf128red = xor i32
+; CHECK: %DOper = getelementptr [128 x i32], [128 x i32]* %SLICES, i64 0, i64 {{%.*}}
+; CHECK: %inc{{[0-9]*}} = add nsw i64 {{%.*}}, 128
+; CHECK: ret void
+define void @ghash() {
+entry:
+  %x = alloca [16 x i8]
+  %h = alloca [16 x i8]
+  %xp = getelementptr inbounds [16 x i8], [16 x i8]* %x, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %xp, i32 32, i32 16)
+  %hp = getelementptr inbounds [16 x i8], [16 x i8]* %h, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %hp, i32 32, i32 16)
+  call void @llvm.start.bitslice(i8* %xp, i8* getelementptr inbounds ([33 x i8], [33 x i8]* @.ghash, i64 0, i64 0))
+  call void @llvm.unbitslice.i32(i8* %xp)
+  ret void
+}
+
+; main returns 0 when the blocks read back as the known answer.
+define i32 @main() {
+entry:
+  %kx = alloca [512 x i8]
+  %kh = alloca [512 x i8]
+  %out = alloca [512 x i8]
+  %kxin = getelementptr inbounds [512 x i8], [512 x i8]* %kx, i64 0, i64 0
+  %khin = getelementptr inbounds [512 x i8], [512 x i8]* %kh, i64 0, i64 0
+  %outp = getelementptr inbounds [512 x i8], [512 x i8]* %out, i64 0, i64 0
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* %kxin, i8* bitcast (<{ [16 x i8], [480 x i8], [16 x i8] }>* @kat.c to i8*), i64 512, i32 1, i1 false)
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* %khin, i8* bitcast (<{ [16 x i8], [480 x i8], [16 x i8] }>* @kat.h to i8*), i64 512, i32 1, i1 false)
+  %kxp = getelementptr inbounds [512 x i8], [512 x i8]* %kx, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %kxp, i32 32, i32 16)
+  %khp = getelementptr inbounds [512 x i8], [512 x i8]* %kh, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %khp, i32 32, i32 16)
+  call void @llvm.start.bitslice(i8* %kxp, i8* getelementptr inbounds ([36 x i8], [36 x i8]* @.kat, i64 0, i64 0))
+  call void @llvm.unbitslice.i32(i8* %kxp)
+  %kxout = getelementptr inbounds [512 x i8], [512 x i8]* %kx, i64 0, i64 0
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* %outp, i8* %kxout, i64 512, i32 1, i1 false)
+  ; C*H is X1 = 5e2ec746917062882c85b0685353deb7 of the specification, read
+  ; back as little-endian i128s, and 0*0 is 0.
+  %b0 = bitcast i8* %outp to i128*
+  %y0 = load i128, i128* %b0
+  %p1 = getelementptr inbounds [512 x i8], [512 x i8]* %out, i64 0, i64 16
+  %b1 = bitcast i8* %p1 to i128*
+  %y1 = load i128, i128* %b1
+  %p31 = getelementptr inbounds [512 x i8], [512 x i8]* %out, i64 0, i64 496
+  %b31 = bitcast i8* %p31 to i128*
+  %y31 = load i128, i128* %b31
+  %ok0 = icmp eq i128 %y0, 244403103179568769109414233996689616478
+  %ok1 = icmp eq i128 %y1, 0
+  %ok31 = icmp eq i128 %y31, 244403103179568769109414233996689616478
+  %ok01 = and i1 %ok0, %ok1
+  %ok = and i1 %ok01, %ok31
+  %ret = select i1 %ok, i32 0, i32 1
+  ret i32 %ret
+}
+
+declare void @llvm.memcpy.p0i8.p0i8.i64(i8*, i8*, i64, i32, i1)
+declare void @llvm.bitslice.i32(i8*, i32, i32)
+declare void @llvm.unbitslice.i32(i8*)
+declare void @llvm.start.bitslice(i8*, i8*)
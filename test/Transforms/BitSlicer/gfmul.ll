@@ -0,0 +1,66 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -S | FileCheck %s
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -S | grep "%gfmul[0-9]* = xor i32" | count 12
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -bitslicer-gfmul-paar=false -O0 -S | grep "%gfmul[0-9]* = xor i32" | count 14
+; REQUIRES: loadable_module
+
+; Multiplication of every byte by a constant of GF(2^8) with the AES
+; polynomial. xtime (0x02) is a shift of the slices plus three XORs with the
+; top slice. Multiplying by 0x03 takes 11 XORs row by row; Paar's heuristic
+; shares the pairs (s0,s7) and (s3,s7), which two rows each need, and brings
+; it down to 9.
+
+@.xtime = private unnamed_addr constant [33 x i8] c"m:all:=:m:all::gfmul::0x11b:0x02\00"
+@.mul3 = private unnamed_addr constant [33 x i8] c"c:all:=:c:all::gfmul::0x11b:0x03\00"
+
+; CHECK-LABEL: define void @xtime(
+; CHECK: icmp slt i64 {{%.*}}, 128
+; CHECK: [[S0:%[0-9]+]] = load i32, i32* %LOper
+; CHECK: [[S1:%[0-9]+]] = load i32, i32* %LOper{{[0-9]+}}
+; CHECK: [[S2:%[0-9]+]] = load i32, i32* %LOper{{[0-9]+}}
+; CHECK: [[S3:%[0-9]+]] = load i32, i32* %LOper{{[0-9]+}}
+; CHECK: [[S4:%[0-9]+]] = load i32, i32* %LOper{{[0-9]+}}
+; CHECK: [[S5:%[0-9]+]] = load i32, i32* %LOper{{[0-9]+}}
+; CHECK: [[S6:%[0-9]+]] = load i32, i32* %LOper{{[0-9]+}}
+; CHECK: [[S7:%[0-9]+]] = load i32, i32* %LOper{{[0-9]+}}
+; CHECK-NEXT: [[X1:%gfmul]] = xor i32 [[S0]], [[S7]]
+; CHECK-NEXT: [[X3:%gfmul[0-9]+]] = xor i32 [[S2]], [[S7]]
+; CHECK-NEXT: [[X4:%gfmul[0-9]+]] = xor i32 [[S3]], [[S7]]
+; CHECK: store i32 [[S7]], i32* %DOper
+; CHECK: store i32 [[X1]], i32* %DOper
+; CHECK: store i32 [[S1]], i32* %DOper
+; CHECK: store i32 [[X3]], i32* %DOper
+; CHECK: store i32 [[X4]], i32* %DOper
+; CHECK: store i32 [[S4]], i32* %DOper
+; CHECK: store i32 [[S5]], i32* %DOper
+; CHECK: store i32 [[S6]], i32* %DOper
+; CHECK: add nsw i64 {{%.*}}, 8
+; CHECK: ret void
+define void @xtime() {
+entry:
+  %m = alloca [512 x i8]
+  %mp = getelementptr inbounds [512 x i8], [512 x i8]* %m, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %mp, i32 32, i32 16)
+  %mp.u1 = getelementptr inbounds [512 x i8], [512 x i8]* %m, i64 0, i64 0
+  call void @llvm.start.bitslice(i8* %mp.u1, i8* getelementptr inbounds ([33 x i8], [33 x i8]* @.xtime, i64 0, i64 0))
+  %mp.u2 = getelementptr inbounds [512 x i8], [512 x i8]* %m, i64 0, i64 0
+  call void @llvm.unbitslice.i32(i8* %mp.u2)
+  ret void
+}
+
+; CHECK-LABEL: define void @mul3(
+; CHECK: ret void
+define void @mul3() {
+entry:
+  %c = alloca [512 x i8]
+  %cp = getelementptr inbounds [512 x i8], [512 x i8]* %c, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %cp, i32 32, i32 16)
+  %cp.u3 = getelementptr inbounds [512 x i8], [512 x i8]* %c, i64 0, i64 0
+  call void @llvm.start.bitslice(i8* %cp.u3, i8* getelementptr inbounds ([33 x i8], [33 x i8]* @.mul3, i64 0, i64 0))
+  %cp.u4 = getelementptr inbounds [512 x i8], [512 x i8]* %c, i64 0, i64 0
+  call void @llvm.unbitslice.i32(i8* %cp.u4)
+  ret void
+}
+
+declare void @llvm.bitslice.i32(i8*, i32, i32)
+declare void @llvm.unbitslice.i32(i8*)
+declare void @llvm.start.bitslice(i8*, i8*)
@@ -0,0 +1,79 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -bitslicer-instrument -O0 -S | FileCheck %s
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -S | FileCheck %s --check-prefix=OFF
+; REQUIRES: loadable_module
+
+; With -bitslicer-instrument the transposition adds its cycles to entry 0 of
+; the thread-local bitslicer_cycles table, the inverse one to entry 1, and
+; the whole function to entry 3. The first run on a thread registers
+; bitslicer_flush_cycles for the exit of the thread, which moves its counters
+; to bitslicer_cycles_total; bitslicer_dump_cycles flushes its own thread and
+; prints the totals once from llvm.global_dtors.
+
+; OFF-NOT: bitslicer_cycles
+; OFF-NOT: readcyclecounter
+
+; CHECK: @bitslicer_cycles = weak thread_local global [4 x i64] zeroinitializer
+; CHECK: @bitslicer_cycles_registered = weak thread_local global i8 0
+; CHECK: @__dso_handle = external hidden global i8
+; CHECK: @bitslicer_cycles_total = weak global [4 x i64] zeroinitializer
+; CHECK: @llvm.global_dtors = appending global {{.*}} @bitslicer_dump_cycles
+
+; CHECK-LABEL: define void @xor_bytes(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: %start = call i64 @llvm.readcyclecounter()
+; CHECK: [[T0:%[0-9]+]] = call i64 @llvm.readcyclecounter()
+; CHECK-NEXT: %SLICES = alloca [128 x i32]
+; CHECK: for.end:
+; CHECK-NEXT: [[T1:%[0-9]+]] = call i64 @llvm.readcyclecounter()
+; CHECK-NEXT: [[D:%[0-9]+]] = sub i64 [[T1]], [[T0]]
+; CHECK-NEXT: [[C:%[0-9]+]] = load i64, i64* getelementptr inbounds ([4 x i64], [4 x i64]* @bitslicer_cycles, i64 0, i64 0)
+; CHECK-NEXT: [[S:%[0-9]+]] = add i64 [[C]], [[D]]
+; CHECK-NEXT: store i64 [[S]], i64* getelementptr inbounds ([4 x i64], [4 x i64]* @bitslicer_cycles, i64 0, i64 0)
+; CHECK: [[U0:%[0-9]+]] = call i64 @llvm.readcyclecounter()
+; CHECK-NEXT: %idx_i{{[0-9]+}} = alloca i64
+; CHECK: [[U1:%[0-9]+]] = call i64 @llvm.readcyclecounter()
+; CHECK-NEXT: sub i64 [[U1]], [[U0]]
+; CHECK: store i64 {{%[0-9]+}}, i64* getelementptr inbounds ([4 x i64], [4 x i64]* @bitslicer_cycles, i64 0, i64 1)
+; CHECK-NEXT: [[R1:%[0-9]+]] = call i64 @llvm.readcyclecounter()
+; CHECK-NEXT: sub i64 [[R1]], %start
+; CHECK: store i64 {{%[0-9]+}}, i64* getelementptr inbounds ([4 x i64], [4 x i64]* @bitslicer_cycles, i64 0, i64 3)
+; CHECK-NEXT: [[R:%[0-9]+]] = load i8, i8* @bitslicer_cycles_registered
+; CHECK-NEXT: %first = icmp eq i8 [[R]], 0
+; CHECK-NEXT: br i1 %first, label %cycles.register, label %cycles.registered
+; CHECK: cycles.register:
+; CHECK-NEXT: store i8 1, i8* @bitslicer_cycles_registered
+; CHECK-NEXT: call i32 @__cxa_thread_atexit(void (i8*)* @bitslicer_flush_cycles, i8* null, i8* @__dso_handle)
+; CHECK: cycles.registered:
+; CHECK-NEXT: ret void
+
+; CHECK-LABEL: define weak void @bitslicer_flush_cycles(i8*)
+; CHECK: atomicrmw add i64* getelementptr inbounds ([4 x i64], [4 x i64]* @bitslicer_cycles_total, i64 0, i64 0)
+; CHECK: atomicrmw add i64* getelementptr inbounds ([4 x i64], [4 x i64]* @bitslicer_cycles_total, i64 0, i64 3)
+; CHECK-NEXT: store i64 0, i64* getelementptr inbounds ([4 x i64], [4 x i64]* @bitslicer_cycles, i64 0, i64 3)
+; CHECK-NEXT: ret void
+
+; CHECK-LABEL: define weak void @bitslicer_dump_cycles()
+; CHECK: atomicrmw xchg i32* @bitslicer_cycles_dumped, i32 1
+; CHECK: call void @bitslicer_flush_cycles(i8* null)
+; CHECK: call i32 (i32, i8*, ...) @dprintf(i32 2,
+define void @xor_bytes() {
+entry:
+  %state = alloca [128 x i8]
+  %p = getelementptr inbounds [128 x i8], [128 x i8]* %state, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %p, i32 8, i32 16)
+  %g0 = getelementptr inbounds [128 x i8], [128 x i8]* %state, i64 0, i64 0
+  %g1 = getelementptr inbounds [128 x i8], [128 x i8]* %state, i64 0, i64 1
+  %a = load i8, i8* %g0
+  %az = zext i8 %a to i32
+  %b = load i8, i8* %g1
+  %bz = zext i8 %b to i32
+  %x = xor i32 %az, %bz
+  %t = trunc i32 %x to i8
+  store i8 %t, i8* %g0
+  %p.u1 = getelementptr inbounds [128 x i8], [128 x i8]* %state, i64 0, i64 0
+  call void @llvm.unbitslice.i32(i8* %p.u1)
+  ret void
+}
+
+declare void @llvm.bitslice.i32(i8*, i32, i32)
+declare void @llvm.unbitslice.i32(i8*)
@@ -0,0 +1,45 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -S | opt -sroa -globalopt -sccp -instcombine -gvn -dse -simplifycfg -instcombine -S | FileCheck %s
+; REQUIRES: loadable_module
+
+; The module BitSlicedJIT compiles for a key: the key global is an internal
+; constant and the scalar passes of the JIT run after the BitSlicer. The key
+; 5 has bits 0 and 2 set, so the key XOR becomes the inversion of slices 0
+; and 2 and the other slices are left alone.
+
+; CHECK-LABEL: define void @enc(
+; CHECK: for.end:
+; CHECK-NEXT: [[G0:%[0-9]+]] = getelementptr inbounds [128 x i32], [128 x i32]* %SLICES, i64 0, i64 0
+; CHECK-NEXT: [[G2:%[0-9]+]] = getelementptr inbounds [128 x i32], [128 x i32]* %SLICES, i64 0, i64 2
+; CHECK-NEXT: [[L0:%[0-9]+]] = load i32, i32* [[G0]]
+; CHECK-NEXT: [[L2:%[0-9]+]] = load i32, i32* [[G2]]
+; CHECK-NEXT: [[X0:%[0-9]+]] = xor i32 [[L0]], -1
+; CHECK-NEXT: [[X2:%[0-9]+]] = xor i32 [[L2]], -1
+; CHECK-NEXT: store i32 [[X0]], i32* [[G0]]
+; CHECK-NEXT: store i32 [[X2]], i32* [[G2]]
+; CHECK-NEXT: br label
+; CHECK-NOT: @key
+; CHECK: ret void
+
+@key = internal constant [16 x i8] c"\05\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00"
+
+define void @enc() {
+entry:
+  %state = alloca [512 x i8]
+  %p = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %p, i32 32, i32 16)
+  %g0 = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 0
+  %s = load i8, i8* %g0
+  %sz = zext i8 %s to i32
+  %kg = getelementptr inbounds [16 x i8], [16 x i8]* @key, i64 0, i64 0
+  %k = load i8, i8* %kg
+  %kz = zext i8 %k to i32
+  %x = xor i32 %sz, %kz
+  %t = trunc i32 %x to i8
+  store i8 %t, i8* %g0
+  %p.u1 = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 0
+  call void @llvm.unbitslice.i32(i8* %p.u1)
+  ret void
+}
+
+declare void @llvm.bitslice.i32(i8*, i32, i32)
+declare void @llvm.unbitslice.i32(i8*)
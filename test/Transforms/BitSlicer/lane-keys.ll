@@ -0,0 +1,60 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -S | FileCheck %s
+; REQUIRES: loadable_module
+
+; One key per lane: the key array is sliced like the state, and the round
+; key array expanded from it becomes a sliced buffer of its own, so the
+; round key xor reads per-lane slices instead of broadcasting a byte.
+
+; CHECK-LABEL: @per_lane_keys(
+; CHECK: [[RK:%SLICES[0-9]*]] = alloca [256 x i32]
+; CHECK-NEXT: %rk = alloca [32 x i8]
+
+; A constant stored to the schedule is the same byte in every lane: 5 has
+; bits 0 and 2 set.
+; CHECK: [[C0:%.*]] = getelementptr inbounds [256 x i32], [256 x i32]* [[RK]], i64 0, i64 0
+; CHECK-NEXT: [[C1:%.*]] = getelementptr inbounds [256 x i32], [256 x i32]* [[RK]], i64 0, i64 1
+; CHECK: store i32 -1, i32* [[C0]]
+; CHECK-NEXT: store i32 0, i32* [[C1]]
+
+; The expanded byte is stored slice by slice and read back from the slices.
+; CHECK: [[W:%.*]] = getelementptr inbounds [256 x i32], [256 x i32]* [[RK]], i64 0, i64 8
+; CHECK: store i32 {{%.*}}, i32* [[W]]
+; CHECK: [[R:%.*]] = getelementptr inbounds [256 x i32], [256 x i32]* [[RK]], i64 0, i64 8
+; CHECK: [[RS:%.*]] = load i32, i32* [[R]]
+; CHECK: xor i32 {{%.*}}, [[RS]]
+; CHECK: ret void
+define void @per_lane_keys() {
+entry:
+  %state = alloca [512 x i8]
+  %keys = alloca [512 x i8]
+  %rk = alloca [32 x i8]
+  %sp = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %sp, i32 32, i32 16)
+  %kp = getelementptr inbounds [512 x i8], [512 x i8]* %keys, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %kp, i32 32, i32 16)
+
+  ; rk[0] = 5; rk[1] = keys[0] ^ 0x63
+  %rk0 = getelementptr inbounds [32 x i8], [32 x i8]* %rk, i64 0, i64 0
+  store i8 5, i8* %rk0
+  %kg = getelementptr inbounds [512 x i8], [512 x i8]* %keys, i64 0, i64 0
+  %k = load i8, i8* %kg
+  %kz = zext i8 %k to i32
+  %e = xor i32 %kz, 99
+  %et = trunc i32 %e to i8
+  %rk1 = getelementptr inbounds [32 x i8], [32 x i8]* %rk, i64 0, i64 1
+  store i8 %et, i8* %rk1
+
+  ; state[0] ^= rk[1]
+  %rg = getelementptr inbounds [32 x i8], [32 x i8]* %rk, i64 0, i64 1
+  %r = load i8, i8* %rg
+  %rz = zext i8 %r to i32
+  %sg = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 0
+  %s = load i8, i8* %sg
+  %sz = zext i8 %s to i32
+  %x = xor i32 %sz, %rz
+  %xt = trunc i32 %x to i8
+  store i8 %xt, i8* %sg
+  ret void
+}
+
+declare void @llvm.bitslice.i32(i8*, i32, i32)
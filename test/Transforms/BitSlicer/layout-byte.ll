@@ -0,0 +1,41 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -bitslicer-layout=byte -O0 -S | FileCheck %s
+; REQUIRES: loadable_module
+
+; With the byte layout a slice holds byte i of 4 blocks, so a 16-byte block
+; takes 16 slices and a byte operation is a single slice operation.
+
+; CHECK-LABEL: define void @xor_bytes(
+; CHECK: %SLICES = alloca [16 x i32]
+; CHECK: icmp slt i64 {{%.*}}, 16
+; CHECK: icmp slt i64 {{%.*}}, 4
+; CHECK: and i32 {{%.*}}, 255
+; CHECK: [[B0:%.*]] = getelementptr inbounds [16 x i32], [16 x i32]* %SLICES, i64 0, i64 0
+; CHECK: [[B1:%.*]] = getelementptr inbounds [16 x i32], [16 x i32]* %SLICES, i64 0, i64 1
+; CHECK: [[L0:%.*]] = load i32, i32* [[B0]]
+; CHECK: [[L1:%.*]] = load i32, i32* [[B1]]
+; CHECK: [[X:%.*]] = xor i32 [[L0]], [[L1]]
+; CHECK: store i32 [[X]], i32* [[B0]]
+; CHECK-NOT: store i32 {{%.*}}, i32* [[B1]]
+; CHECK: %idx_mul = mul nsw i64 %idx_mod, 1
+; CHECK: ret void
+define void @xor_bytes() {
+entry:
+  %state = alloca [64 x i8]
+  %p = getelementptr inbounds [64 x i8], [64 x i8]* %state, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %p, i32 4, i32 16)
+  %g0 = getelementptr inbounds [64 x i8], [64 x i8]* %state, i64 0, i64 0
+  %g1 = getelementptr inbounds [64 x i8], [64 x i8]* %state, i64 0, i64 1
+  %a = load i8, i8* %g0
+  %az = zext i8 %a to i32
+  %b = load i8, i8* %g1
+  %bz = zext i8 %b to i32
+  %x = xor i32 %az, %bz
+  %t = trunc i32 %x to i8
+  store i8 %t, i8* %g0
+  %p.u1 = getelementptr inbounds [64 x i8], [64 x i8]* %state, i64 0, i64 0
+  call void @llvm.unbitslice.i32(i8* %p.u1)
+  ret void
+}
+
+declare void @llvm.bitslice.i32(i8*, i32, i32)
+declare void @llvm.unbitslice.i32(i8*)
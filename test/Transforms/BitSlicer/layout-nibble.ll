@@ -0,0 +1,75 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -bitslicer-layout=nibble -O0 -S | FileCheck %s
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -bitslicer-layout=bit -O0 -S 2>&1 | FileCheck %s --check-prefix=ERR
+; REQUIRES: loadable_module
+
+; With the nibble layout a slice holds one nibble position of 8 blocks, so a
+; 16-byte block takes 32 slices and byte i is slices 2*i and 2*i+1. Byte
+; operations become two slice operations, and an sbox description looks up
+; each nibble of a slice in a 16-entry table packed in an i64.
+
+; CHECK-LABEL: define void @xor_bytes(
+; CHECK: %SLICES = alloca [32 x i32]
+; CHECK: icmp slt i64 {{%.*}}, 32
+; CHECK: icmp slt i64 {{%.*}}, 8
+; CHECK: sdiv i64 {{%.*}}, 2
+; CHECK: and i32 {{%.*}}, 15
+; CHECK: [[B0L:%.*]] = getelementptr inbounds [32 x i32], [32 x i32]* %SLICES, i64 0, i64 0
+; CHECK: [[B0H:%.*]] = getelementptr inbounds [32 x i32], [32 x i32]* %SLICES, i64 0, i64 1
+; CHECK: getelementptr inbounds [32 x i32], [32 x i32]* %SLICES, i64 0, i64 2
+; CHECK: getelementptr inbounds [32 x i32], [32 x i32]* %SLICES, i64 0, i64 3
+; CHECK: [[XL:%.*]] = xor i32
+; CHECK-NEXT: [[XH:%.*]] = xor i32
+; CHECK: store i32 [[XL]], i32* [[B0L]]
+; CHECK-NEXT: store i32 [[XH]], i32* [[B0H]]
+; CHECK: %idx_mul = mul nsw i64 %idx_mod, 2
+; CHECK: ret void
+define void @xor_bytes() {
+entry:
+  %state = alloca [128 x i8]
+  %p = getelementptr inbounds [128 x i8], [128 x i8]* %state, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %p, i32 8, i32 16)
+  %g0 = getelementptr inbounds [128 x i8], [128 x i8]* %state, i64 0, i64 0
+  %g1 = getelementptr inbounds [128 x i8], [128 x i8]* %state, i64 0, i64 1
+  %a = load i8, i8* %g0
+  %az = zext i8 %a to i32
+  %b = load i8, i8* %g1
+  %bz = zext i8 %b to i32
+  %x = xor i32 %az, %bz
+  %t = trunc i32 %x to i8
+  store i8 %t, i8* %g0
+  %p.u1 = getelementptr inbounds [128 x i8], [128 x i8]* %state, i64 0, i64 0
+  call void @llvm.unbitslice.i32(i8* %p.u1)
+  ret void
+}
+
+@.sbox = private unnamed_addr constant [40 x i8] c"n:all:=:n:all::sbox::0x21748fe3da09b65c\00"
+
+; 0x21748fe3da09b65c is 2410709909328475740; the eight nibbles of a slice
+; are looked up at shifts 0 to 28.
+; CHECK-LABEL: define void @sbox_layer(
+; CHECK: %LOper = getelementptr [32 x i32], [32 x i32]* %SLICES, i64 0, i64 [[I:%.*]]
+; CHECK: lshr i64 2410709909328475740,
+; CHECK: %sbox = or i32 0,
+; CHECK: lshr i64 2410709909328475740,
+; CHECK: %sbox30 = or i32 %sbox,
+; CHECK: shl i32 {{%.*}}, 28
+; CHECK-NEXT: [[S:%sbox[0-9]+]] = or i32
+; CHECK-NEXT: %DOper = getelementptr [32 x i32], [32 x i32]* %SLICES, i64 0, i64 [[I]]
+; CHECK-NEXT: store i32 [[S]], i32* %DOper
+; CHECK: ret void
+; ERR: error: sbox is only supported with the nibble layout
+define void @sbox_layer() {
+entry:
+  %n = alloca [128 x i8]
+  %np = getelementptr inbounds [128 x i8], [128 x i8]* %n, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %np, i32 8, i32 16)
+  %np.u2 = getelementptr inbounds [128 x i8], [128 x i8]* %n, i64 0, i64 0
+  call void @llvm.start.bitslice(i8* %np.u2, i8* getelementptr inbounds ([40 x i8], [40 x i8]* @.sbox, i64 0, i64 0))
+  %np.u3 = getelementptr inbounds [128 x i8], [128 x i8]* %n, i64 0, i64 0
+  call void @llvm.unbitslice.i32(i8* %np.u3)
+  ret void
+}
+
+declare void @llvm.bitslice.i32(i8*, i32, i32)
+declare void @llvm.unbitslice.i32(i8*)
+declare void @llvm.start.bitslice(i8*, i8*)
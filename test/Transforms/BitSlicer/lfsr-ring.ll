@@ -0,0 +1,102 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -S | FileCheck %s
+; REQUIRES: loadable_module
+
+; A register that is only clocked by constant rotations is a ring of slices:
+; the rotation moves the head index and copies nothing, the feedback tap is
+; the only gate and reads its slices through the head.
+
+@.clock = private unnamed_addr constant [31 x i8] c"state:all:=:state:all::rotL::1\00"
+@.lclock = private unnamed_addr constant [33 x i8] c"lstate:all:=:lstate:all::rotL::1\00"
+
+; CHECK-LABEL: @clock(
+; CHECK: %ring.head = alloca i64
+; CHECK: %SLICES = alloca [96 x i32]
+; CHECK-NEXT: store i64 0, i64* %ring.head
+
+; CHECK: [[H:%ring.head[0-9]+]] = load i64, i64* %ring.head
+; CHECK-NEXT: [[S:%ring.idx[0-9]*]] = add i64 {{[0-9]+}}, [[H]]
+; CHECK-NEXT: [[W:%ring.wrap[0-9]*]] = icmp uge i64 [[S]], 96
+; CHECK: [[I:%ring.idx[0-9]*]] = select i1 [[W]]
+; CHECK-NEXT: getelementptr inbounds [96 x i32], [96 x i32]* %SLICES, i64 0, i64 [[I]]
+; CHECK: xor i32
+
+; Rotating left by one slice moves the head back by one.
+; CHECK: [[H2:%ring.head[0-9]+]] = load i64, i64* %ring.head
+; CHECK-NEXT: [[S2:%ring.idx[0-9]*]] = add i64 95, [[H2]]
+; CHECK-NEXT: [[W2:%ring.wrap[0-9]*]] = icmp uge i64 [[S2]], 96
+; CHECK: [[N:%ring.idx[0-9]*]] = select i1 [[W2]]
+; CHECK-NEXT: store i64 [[N]], i64* %ring.head
+; CHECK-NOT: tmpArray
+; CHECK: ret void
+define void @clock() {
+entry:
+  %state = alloca [12 x i8]
+  %p = getelementptr inbounds [12 x i8], [12 x i8]* %state, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %p, i32 32, i32 12)
+
+  ; state[0] ^= state[5]
+  %g5 = getelementptr inbounds [12 x i8], [12 x i8]* %state, i64 0, i64 5
+  %a = load i8, i8* %g5
+  %az = zext i8 %a to i32
+  %g0 = getelementptr inbounds [12 x i8], [12 x i8]* %state, i64 0, i64 0
+  %b = load i8, i8* %g0
+  %bz = zext i8 %b to i32
+  %x = xor i32 %bz, %az
+  %xt = trunc i32 %x to i8
+  store i8 %xt, i8* %g0
+
+  call void @llvm.start.bitslice(i8* %p, i8* getelementptr inbounds ([31 x i8], [31 x i8]* @.clock, i64 0, i64 0))
+  call void @llvm.unbitslice.i32(i8* %p)
+  ret void
+}
+
+; Clocked in a loop, the ring keeps its accesses in step with the rotations:
+; the GEPs of the taps are defined ahead of the loop, but every slice access in the
+; body reads the head again, and the rotation at the end of the body moves it
+; for the next iteration.
+
+; CHECK-LABEL: @clock_loop(
+; CHECK: for.end:
+; CHECK-NOT: %ring.idx
+; CHECK: loop:
+; CHECK: [[H5:%ring.head[0-9]+]] = load i64, i64* %ring.head
+; CHECK-NEXT: add i64 40, [[H5]]
+; CHECK: load i32, i32*
+; CHECK: xor i32
+; CHECK: [[H0:%ring.head[0-9]+]] = load i64, i64* %ring.head
+; CHECK-NEXT: add i64 0, [[H0]]
+; CHECK: store i32
+; CHECK: add i64 95, {{%ring.head[0-9]+}}
+; CHECK: store i64 {{%ring.idx[0-9]+}}, i64* %ring.head
+; CHECK-NEXT: %r.next = add i32 %r, 1
+define void @clock_loop() {
+entry:
+  %lstate = alloca [12 x i8]
+  %p = getelementptr inbounds [12 x i8], [12 x i8]* %lstate, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %p, i32 32, i32 12)
+  %g5 = getelementptr inbounds [12 x i8], [12 x i8]* %lstate, i64 0, i64 5
+  %g0 = getelementptr inbounds [12 x i8], [12 x i8]* %lstate, i64 0, i64 0
+  br label %loop
+
+loop:
+  %r = phi i32 [ 0, %entry ], [ %r.next, %loop ]
+  %a = load i8, i8* %g5
+  %az = zext i8 %a to i32
+  %b = load i8, i8* %g0
+  %bz = zext i8 %b to i32
+  %x = xor i32 %bz, %az
+  %xt = trunc i32 %x to i8
+  store i8 %xt, i8* %g0
+  call void @llvm.start.bitslice(i8* %p, i8* getelementptr inbounds ([33 x i8], [33 x i8]* @.lclock, i64 0, i64 0))
+  %r.next = add i32 %r, 1
+  %done = icmp eq i32 %r.next, 16
+  br i1 %done, label %exit, label %loop
+
+exit:
+  call void @llvm.unbitslice.i32(i8* %p)
+  ret void
+}
+
+declare void @llvm.bitslice.i32(i8*, i32, i32)
+declare void @llvm.unbitslice.i32(i8*)
+declare void @llvm.start.bitslice(i8*, i8*)
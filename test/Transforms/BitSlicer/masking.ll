@@ -0,0 +1,63 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -bitslicer-masking-order=1 -O0 -S | FileCheck %s
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -bitslicer-masking-order=1 -O2 -S | FileCheck %s --check-prefix=O2
+; REQUIRES: loadable_module
+
+; First-order masking: the slices are kept in two shares, the transposition
+; splits every slice with a fresh random word, and an AND is an ISW product
+; whose cross-term is refreshed with a random word. An empty inline asm hides
+; the masked values from the optimizer.
+
+; CHECK: @bitslicer_randomness = weak thread_local global i32* null
+; CHECK-NOT: @bitslicer_randomness_words
+; CHECK-LABEL: define void @masked(
+; CHECK: %SLICES.share = alloca [128 x i32]
+; CHECK: [[R:%rnd[0-9]*]] = call i32 @bitslicer.random()
+; CHECK-NEXT: [[M:%.*]] = xor i32 {{%.*}}, [[R]]
+; CHECK-NEXT: [[S:%share[0-9]*]] = call i32 asm "", "=r,0"(i32 [[M]])
+; CHECK: store i32 [[R]], i32*
+; CHECK-NEXT: store i32 [[S]], i32* %sliceAddr
+
+; CHECK: %isw = and i32
+; CHECK-NEXT: %isw{{[0-9]+}} = and i32 %share, %share{{[0-9]+}}
+; CHECK-NEXT: [[Z:%rnd[0-9]*]] = call i32 @bitslicer.random()
+; CHECK-NEXT: [[C:%[0-9]+]] = and i32
+; CHECK-NEXT: [[T:%isw[0-9]+]] = xor i32 [[Z]], [[C]]
+; CHECK-NEXT: %share{{[0-9]+}} = call i32 asm "", "=r,0"(i32 [[T]])
+; CHECK: ret void
+
+; CHECK-LABEL: define internal i32 @bitslicer.random(
+; CHECK: call void @bitslicer_refill_randomness()
+
+; At -O2 the address of byte 0 is merged with the buffer pointer before the
+; pass runs. The randomness and the asm barriers survive the optimizer: the
+; cross-term is still computed from a random word before the barrier.
+
+; O2-NOT: @bitslicer_randomness_words
+; O2-LABEL: define void @masked(
+; O2: %share{{[0-9]+}} = tail call i32 asm "", "=r,0"
+; O2: call void @bitslicer_refill_randomness()
+; O2: %rnd.i{{[0-9]*}} = load i32, i32*
+; O2: [[T:%isw[0-9]+]] = xor i32 %rnd.i{{[0-9]*}}, {{%[0-9]+}}
+; O2-NEXT: %share{{[0-9]+}} = tail call i32 asm "", "=r,0"(i32 [[T]])
+; O2: ret void
+define void @masked() {
+entry:
+  %mstate = alloca [512 x i8]
+  %p = getelementptr inbounds [512 x i8], [512 x i8]* %mstate, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %p, i32 32, i32 16)
+  %g0 = getelementptr inbounds [512 x i8], [512 x i8]* %mstate, i64 0, i64 0
+  %g1 = getelementptr inbounds [512 x i8], [512 x i8]* %mstate, i64 0, i64 1
+  %a = load i8, i8* %g0
+  %az = zext i8 %a to i32
+  %b = load i8, i8* %g1
+  %bz = zext i8 %b to i32
+  %x = and i32 %az, %bz
+  %y = xor i32 %x, %az
+  %t = trunc i32 %y to i8
+  store i8 %t, i8* %g0
+  call void @llvm.unbitslice.i32(i8* %p)
+  ret void
+}
+
+declare void @llvm.bitslice.i32(i8*, i32, i32)
+declare void @llvm.unbitslice.i32(i8*)
@@ -0,0 +1,123 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -bitslicer-pipeline -O0 -S 2>%t.err | FileCheck %s
+; RUN: FileCheck %s --check-prefix=ERR < %t.err
+; REQUIRES: loadable_module
+
+; The batch loop gets a spare slice buffer: batch 0 is transposed ahead of
+; the loop, every iteration transposes the next batch into the spare buffer
+; and computes on the current one, and the buffers swap at the latch.
+
+; CHECK-LABEL: @batches(
+; CHECK: %S = alloca [128 x i32]
+; CHECK-NEXT: %S.next = alloca [128 x i32]
+; CHECK: %any = icmp ne i64 {{%.*}}, 0
+; Batch 0 is transposed from %in into %S ahead of the loop.
+; CHECK: [[S0:%[0-9]+]] = bitcast [128 x i32]* %S to i32*
+; CHECK: getelementptr inbounds i8, i8* %in, i64
+; CHECK: getelementptr inbounds i32, i32* [[S0]], i64
+; CHECK: %slices.next = phi [128 x i32]* [ %S.next, {{%.*}} ], [ %slices.cur, {{%.*}} ]
+; CHECK-NEXT: %slices.cur = phi [128 x i32]* [ %S, {{%.*}} ], [ %slices.next, {{%.*}} ]
+; In the loop: the next batch goes into the spare buffer, then the logic and
+; the inverse transposition run on the current one.
+; CHECK: %scevgep = getelementptr i8, i8* %in, i64
+; CHECK: %sp = getelementptr inbounds [128 x i32], [128 x i32]* %slices.cur, i64 0, i64 0
+; CHECK: %more = icmp ne i64
+; CHECK: [[SN:%[0-9]+]] = bitcast [128 x i32]* %slices.next to i32*
+; CHECK: getelementptr inbounds i8, i8* %scevgep, i64
+; CHECK: getelementptr inbounds i32, i32* [[SN]], i64
+; CHECK: %x = xor i32 %a, %b
+; CHECK-NEXT: store i32 %x, i32* %sp
+; CHECK: getelementptr inbounds i32, i32* %sp, i64
+; CHECK: getelementptr inbounds i8, i8* %dst, i64
+; CHECK-NOT: call void @llvm.getbitsliced.n.i32
+; CHECK: ret void
+define void @batches(i8* noalias %in, i8* noalias %out, i64 %n) {
+entry:
+  %S = alloca [128 x i32]
+  br label %for.cond
+
+for.cond:
+  %k = phi i64 [ 0, %entry ], [ %k.next, %for.body ]
+  %cmp = icmp ult i64 %k, %n
+  br i1 %cmp, label %for.body, label %for.end
+
+for.body:
+  %off = mul i64 %k, 512
+  %src = getelementptr inbounds i8, i8* %in, i64 %off
+  %dst = getelementptr inbounds i8, i8* %out, i64 %off
+  %sp = getelementptr inbounds [128 x i32], [128 x i32]* %S, i64 0, i64 0
+  call void @llvm.getbitsliced.n.i32(i8* %src, i32* %sp, i32 512)
+  %s1p = getelementptr inbounds [128 x i32], [128 x i32]* %S, i64 0, i64 1
+  %a = load i32, i32* %sp
+  %b = load i32, i32* %s1p
+  %x = xor i32 %a, %b
+  store i32 %x, i32* %sp
+  call void @llvm.getunbitsliced.n.i32(i32* %sp, i8* %dst, i32 512)
+  %k.next = add i64 %k, 1
+  br label %for.cond
+
+for.end:
+  ret void
+}
+
+; The output may overlap the input of the next batch: left alone.
+
+; CHECK-LABEL: @may_alias(
+; CHECK-NOT: %slices.cur
+; CHECK: ret void
+define void @may_alias(i8* %in, i8* %out, i64 %n) {
+entry:
+  %S = alloca [128 x i32]
+  br label %for.cond
+
+for.cond:
+  %k = phi i64 [ 0, %entry ], [ %k.next, %for.body ]
+  %cmp = icmp ult i64 %k, %n
+  br i1 %cmp, label %for.body, label %for.end
+
+for.body:
+  %off = mul i64 %k, 512
+  %src = getelementptr inbounds i8, i8* %in, i64 %off
+  %dst = getelementptr inbounds i8, i8* %out, i64 %off
+  %sp = getelementptr inbounds [128 x i32], [128 x i32]* %S, i64 0, i64 0
+  call void @llvm.getbitsliced.n.i32(i8* %src, i32* %sp, i32 512)
+  call void @llvm.getunbitsliced.n.i32(i32* %sp, i8* %dst, i32 512)
+  %k.next = add i64 %k, 1
+  br label %for.cond
+
+for.end:
+  ret void
+}
+
+; Batches 256 bytes apart overlap: the transposition of the next batch
+; would read bytes of the current one. Reported and left alone.
+
+; ERR: ERROR: batches of 512 bytes 256 bytes apart overlap, not pipelining the loop in short_stride
+; CHECK-LABEL: @short_stride(
+; CHECK-NOT: %slices.cur
+; CHECK: ret void
+define void @short_stride(i8* noalias %in, i8* noalias %out, i64 %n) {
+entry:
+  %S = alloca [128 x i32]
+  br label %for.cond
+
+for.cond:
+  %k = phi i64 [ 0, %entry ], [ %k.next, %for.body ]
+  %cmp = icmp ult i64 %k, %n
+  br i1 %cmp, label %for.body, label %for.end
+
+for.body:
+  %off = mul i64 %k, 256
+  %src = getelementptr inbounds i8, i8* %in, i64 %off
+  %dst = getelementptr inbounds i8, i8* %out, i64 %off
+  %sp = getelementptr inbounds [128 x i32], [128 x i32]* %S, i64 0, i64 0
+  call void @llvm.getbitsliced.n.i32(i8* %src, i32* %sp, i32 512)
+  call void @llvm.getunbitsliced.n.i32(i32* %sp, i8* %dst, i32 512)
+  %k.next = add i64 %k, 1
+  br label %for.cond
+
+for.end:
+  ret void
+}
+
+declare void @llvm.getbitsliced.n.i32(i8*, i32*, i32)
+declare void @llvm.getunbitsliced.n.i32(i32*, i8*, i32)
@@ -0,0 +1,54 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -S 2>/dev/null | FileCheck %s
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -disable-output 2>&1 | FileCheck %s --check-prefix=ERR
+; REQUIRES: loadable_module
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+
+; Blocks behind a pointer, with a length only known at run time: the length
+; must split evenly between the 32 lanes or the kernel traps, and the slices
+; are written by a loop over the 8 slices of each block byte.
+
+; CHECK-LABEL: @runtime_len(
+; CHECK: %idx_i = alloca i64
+; CHECK: %rem = urem i32 %len, 32
+; CHECK-NEXT: %uneven = icmp ne i32 %rem, 0
+; CHECK: call void @llvm.trap()
+; CHECK: %blockLen = udiv i64 %len1, 32
+; CHECK-NEXT: %slicesNum = mul i64 %blockLen, 8
+; CHECK: for.body:
+; CHECK: %Block = getelementptr inbounds i8, i8* %in, i64
+; CHECK: %sliceAddr = getelementptr inbounds i32, i32* %out, i64 %idxprom
+; CHECK-NOT: call void @llvm.getbitsliced.n.i32
+; CHECK: ret void
+define void @runtime_len(i8* %in, i32* %out, i32 %len) {
+entry:
+  call void @llvm.getbitsliced.n.i32(i8* %in, i32* %out, i32 %len)
+  ret void
+}
+
+; A constant length is checked at compile time.
+
+; ERR: ERROR: the length 100 of the blocks is not a multiple of the 32 lanes of a slice
+define void @const_len(i8* %in, i32* %out) {
+entry:
+  call void @llvm.getbitsliced.n.i32(i8* %in, i32* %out, i32 100)
+  ret void
+}
+
+; In place, the 32 words of every column are loaded as a 32x32 bit tile.
+
+; CHECK-LABEL: @in_place(
+; CHECK: %words = bitcast i8* %buf to i32*
+; CHECK: [[W0:%.*]] = getelementptr inbounds i32, i32* %words, i64 0
+; CHECK-NEXT: load i32, i32* [[W0]], align 1
+; CHECK-NOT: alloca
+; CHECK-NOT: call void @llvm.getbitsliced.inplace.i32
+; CHECK: ret void
+define void @in_place(i8* %buf) {
+entry:
+  call void @llvm.getbitsliced.inplace.i32(i8* %buf, i32 128)
+  ret void
+}
+
+declare void @llvm.getbitsliced.n.i32(i8*, i32*, i32)
+declare void @llvm.getbitsliced.inplace.i32(i8*, i32)
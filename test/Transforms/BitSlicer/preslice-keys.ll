@@ -0,0 +1,95 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -bitslicer-preslice-keys -O0 -S | FileCheck %s
+; REQUIRES: loadable_module
+
+; Key bytes xored into the state are read as broadcast slices from a
+; pre-sliced copy of the key array. A constant key is sliced at compile
+; time: 5 has bits 0 and 2 set. Other keys get a thread-local copy that
+; bitslicer_setup_round_keys() re-slices on entry to the kernel, only when
+; bitslicer_round_key_generation moved since the thread last sliced them.
+
+; CHECK: @key.sliced = internal thread_local global [128 x i32] zeroinitializer, align 64
+; CHECK: @ckey.sliced = internal constant [128 x i32] [i32 -1, i32 0, i32 -1, i32 0, i32 0,
+; CHECK-NOT: @wkey.sliced
+; CHECK: @bitslicer_round_key_generation = weak global i64 0
+; CHECK: @bitslicer_round_key_seen = internal thread_local global i64 -1
+
+; CHECK-LABEL: define void @enc(
+; CHECK-NEXT: entry:
+; CHECK-NEXT: call void @bitslicer_setup_round_keys()
+; Byte 3 of the key is slices 24 to 31.
+; CHECK: %keySlice = load i32, i32* getelementptr inbounds ([128 x i32], [128 x i32]* @key.sliced, i64 0, i64 24)
+; CHECK-NEXT: xor i32 {{%.*}}, %keySlice
+; CHECK: load i32, i32* getelementptr inbounds ([128 x i32], [128 x i32]* @ckey.sliced, i64 0, i64 0)
+; CHECK: ret void
+
+@ckey = internal constant [16 x i8] c"\05\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00"
+@key = global [16 x i8] zeroinitializer
+@wkey = global [16 x i8] zeroinitializer
+
+define void @enc() {
+entry:
+  %state = alloca [512 x i8]
+  %p = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %p, i32 32, i32 16)
+  %g0 = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 0
+  %s = load i8, i8* %g0
+  %sz = zext i8 %s to i32
+  %kg = getelementptr inbounds [16 x i8], [16 x i8]* @key, i64 0, i64 3
+  %k = load i8, i8* %kg
+  %kz = zext i8 %k to i32
+  %x = xor i32 %sz, %kz
+  %cg = getelementptr inbounds [16 x i8], [16 x i8]* @ckey, i64 0, i64 0
+  %c = load i8, i8* %cg
+  %cz = zext i8 %c to i32
+  %y = xor i32 %x, %cz
+  %t = trunc i32 %y to i8
+  store i8 %t, i8* %g0
+  %p.u1 = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 0
+  call void @llvm.unbitslice.i32(i8* %p.u1)
+  ret void
+}
+
+; A key the kernel writes to is not batch-invariant: its bits are broadcast
+; from the byte.
+
+; CHECK-LABEL: define void @rekey(
+; CHECK-NOT: call void @bitslicer_setup_round_keys()
+; CHECK: store i8 %n, i8* getelementptr inbounds ([16 x i8], [16 x i8]* @wkey, i64 0, i64 0)
+; CHECK: %wk = load i8, i8* %wg
+; CHECK: lshr i32 %wkz, 0
+; CHECK: ret void
+define void @rekey(i8 %n) {
+entry:
+  %wstate = alloca [512 x i8]
+  %p = getelementptr inbounds [512 x i8], [512 x i8]* %wstate, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %p, i32 32, i32 16)
+  store i8 %n, i8* getelementptr inbounds ([16 x i8], [16 x i8]* @wkey, i64 0, i64 0)
+  %g0 = getelementptr inbounds [512 x i8], [512 x i8]* %wstate, i64 0, i64 0
+  %s = load i8, i8* %g0
+  %sz = zext i8 %s to i32
+  %wg = getelementptr inbounds [16 x i8], [16 x i8]* @wkey, i64 0, i64 0
+  %wk = load i8, i8* %wg
+  %wkz = zext i8 %wk to i32
+  %x = xor i32 %sz, %wkz
+  %t = trunc i32 %x to i8
+  store i8 %t, i8* %g0
+  %p.u2 = getelementptr inbounds [512 x i8], [512 x i8]* %wstate, i64 0, i64 0
+  call void @llvm.unbitslice.i32(i8* %p.u2)
+  ret void
+}
+
+; CHECK-LABEL: define internal void @bitslicer_setup_round_keys(
+; CHECK: %generation = load atomic i64, i64* @bitslicer_round_key_generation acquire
+; CHECK-NEXT: %seen = load i64, i64* @bitslicer_round_key_seen
+; CHECK-NEXT: %fresh = icmp eq i64 %generation, %seen
+; CHECK-NEXT: br i1 %fresh, label %done, label %refresh
+; CHECK: done:
+; CHECK-NEXT: ret void
+; CHECK: load i8, i8* {{%.*}}
+; CHECK: %mask = sub i32 0,
+; CHECK: store i64 %generation, i64* @bitslicer_round_key_seen
+; CHECK-NEXT: br label %done
+
+declare void @llvm.bitslice.i32(i8*, i32, i32)
+declare void @llvm.unbitslice.i32(i8*)
+
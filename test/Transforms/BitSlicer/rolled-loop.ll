@@ -0,0 +1,127 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -S | FileCheck %s
+; REQUIRES: loadable_module
+
+; A round loop over bit-sliced data stays rolled: the accumulator PHI is
+; split into one PHI per slice, fed by the slices of byte 0 on entry and by
+; the xor of the previous round on the back edge. The 24 slices above the
+; byte enter as zero.
+
+; CHECK-LABEL: @rounds(
+; CHECK: %a = load i8
+; CHECK-NEXT: [[B0:%.*]] = load i32, i32* {{%.*}}
+; CHECK: br label %loop
+; CHECK: loop:
+; CHECK-NEXT: %slice.phi = phi i32 [ [[B0]], {{%.*}} ], [ [[X0:%.*]], %loop ]
+; CHECK-NEXT: %slice.phi{{[0-9]+}} = phi i32 [ {{%[0-9]+}}, {{%.*}} ], [ {{%[0-9]+}}, %loop ]
+; CHECK-NEXT: %slice.phi{{[0-9]+}} = phi i32 [ {{%[0-9]+}}, {{%.*}} ], [ {{%[0-9]+}}, %loop ]
+; CHECK-NEXT: %slice.phi{{[0-9]+}} = phi i32 [ {{%[0-9]+}}, {{%.*}} ], [ {{%[0-9]+}}, %loop ]
+; CHECK-NEXT: %slice.phi{{[0-9]+}} = phi i32 [ {{%[0-9]+}}, {{%.*}} ], [ {{%[0-9]+}}, %loop ]
+; CHECK-NEXT: %slice.phi{{[0-9]+}} = phi i32 [ {{%[0-9]+}}, {{%.*}} ], [ {{%[0-9]+}}, %loop ]
+; CHECK-NEXT: %slice.phi{{[0-9]+}} = phi i32 [ {{%[0-9]+}}, {{%.*}} ], [ {{%[0-9]+}}, %loop ]
+; CHECK-NEXT: %slice.phi{{[0-9]+}} = phi i32 [ {{%[0-9]+}}, {{%.*}} ], [ {{%[0-9]+}}, %loop ]
+; CHECK-NEXT: %slice.phi{{[0-9]+}} = phi i32 [ 0, {{%.*}} ], [ {{%[0-9]+}}, %loop ]
+; CHECK: %r = phi i32 [ 0, {{%.*}} ], [ %r.next, %loop ]
+; CHECK-NOT: %acc = phi
+; CHECK: [[X0]] = xor i32 %slice.phi, {{%[0-9]+}}
+; CHECK: br i1 %done, label %exit, label %loop
+; CHECK: exit:
+; CHECK: store i32 [[X0]], i32*
+
+define void @rounds() {
+entry:
+  %state = alloca [512 x i8]
+  %p = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %p, i32 32, i32 16)
+  %g0 = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 0
+  %g1 = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 1
+  %a = load i8, i8* %g0
+  %az = zext i8 %a to i32
+  br label %loop
+
+loop:
+  %acc = phi i32 [ %az, %entry ], [ %acc.next, %loop ]
+  %r = phi i32 [ 0, %entry ], [ %r.next, %loop ]
+  %b = load i8, i8* %g1
+  %bz = zext i8 %b to i32
+  %acc.next = xor i32 %acc, %bz
+  %r.next = add i32 %r, 1
+  %done = icmp eq i32 %r.next, 10
+  br i1 %done, label %exit, label %loop
+
+exit:
+  %t = trunc i32 %acc.next to i8
+  store i8 %t, i8* %g0
+  %p.u1 = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 0
+  call void @llvm.unbitslice.i32(i8* %p.u1)
+  ret void
+}
+
+; A PHI wider than a byte keeps all its slices through a cast: the i16
+; accumulator has 16 slice PHIs, and the sext copies slice 15 into the 16
+; slices above it.
+
+; CHECK-LABEL: @wide(
+; CHECK: loop:
+; CHECK: %slice.phi{{[0-9]+}} = phi i32 [ 0, {{%.*}} ], [ {{%[0-9]+}}, %loop ]
+; CHECK-NEXT: %slice.phi{{[0-9]+}} = phi i32 [ 0, {{%.*}} ], [ {{%[0-9]+}}, %loop ]
+; CHECK-NEXT: %slice.phi{{[0-9]+}} = phi i32 [ 0, {{%.*}} ], [ {{%[0-9]+}}, %loop ]
+; CHECK-NEXT: %slice.phi{{[0-9]+}} = phi i32 [ 0, {{%.*}} ], [ {{%[0-9]+}}, %loop ]
+; CHECK-NEXT: %slice.phi{{[0-9]+}} = phi i32 [ 0, {{%.*}} ], [ {{%[0-9]+}}, %loop ]
+; CHECK-NEXT: %slice.phi{{[0-9]+}} = phi i32 [ 0, {{%.*}} ], [ {{%[0-9]+}}, %loop ]
+; CHECK-NEXT: %slice.phi{{[0-9]+}} = phi i32 [ 0, {{%.*}} ], [ {{%[0-9]+}}, %loop ]
+; CHECK-NEXT: [[TOP:%slice.phi[0-9]+]] = phi i32 [ 0, {{%.*}} ], [ {{%[0-9]+}}, %loop ]
+; CHECK-NEXT: %r = phi i32
+; CHECK: {{^}}exit:
+; CHECK: xor i32 [[TOP]], 0
+; CHECK-NEXT: xor i32 [[TOP]], 0
+; CHECK-NEXT: xor i32 [[TOP]], 0
+; CHECK-NEXT: xor i32 [[TOP]], 0
+; CHECK-NEXT: xor i32 [[TOP]], 0
+; CHECK-NEXT: xor i32 [[TOP]], 0
+; CHECK-NEXT: xor i32 [[TOP]], 0
+; CHECK-NEXT: xor i32 [[TOP]], 0
+; CHECK-NEXT: xor i32 [[TOP]], 0
+; CHECK-NEXT: xor i32 [[TOP]], 0
+; CHECK-NEXT: xor i32 [[TOP]], 0
+; CHECK-NEXT: xor i32 [[TOP]], 0
+; CHECK-NEXT: xor i32 [[TOP]], 0
+; CHECK-NEXT: xor i32 [[TOP]], 0
+; CHECK-NEXT: xor i32 [[TOP]], 0
+; CHECK-NEXT: xor i32 [[TOP]], 0
+; CHECK-NEXT: xor i32 [[TOP]], 0
+; CHECK-NEXT: %m = xor i32 %accz, %bz
+
+define void @wide() {
+entry:
+  %wide.state = alloca [512 x i8]
+  %p = getelementptr inbounds [512 x i8], [512 x i8]* %wide.state, i64 0, i64 0
+  call void @llvm.bitslice.i32(i8* %p, i32 32, i32 16)
+  %g0 = getelementptr inbounds [512 x i8], [512 x i8]* %wide.state, i64 0, i64 0
+  %g1 = getelementptr inbounds [512 x i8], [512 x i8]* %wide.state, i64 0, i64 1
+  %a = load i8, i8* %g0
+  %aw = zext i8 %a to i16
+  br label %loop
+
+loop:
+  %acc = phi i16 [ %aw, %entry ], [ %acc.next, %loop ]
+  %r = phi i32 [ 0, %entry ], [ %r.next, %loop ]
+  %b = load i8, i8* %g1
+  %bw = zext i8 %b to i16
+  %acc.next = xor i16 %acc, %bw
+  %r.next = add i32 %r, 1
+  %done = icmp eq i32 %r.next, 10
+  br i1 %done, label %exit, label %loop
+
+exit:
+  %accz = sext i16 %acc to i32
+  %bz = zext i8 %b to i32
+  %m = xor i32 %accz, %bz
+  %t = trunc i32 %m to i8
+  store i8 %t, i8* %g0
+  %p.u1 = getelementptr inbounds [512 x i8], [512 x i8]* %wide.state, i64 0, i64 0
+  call void @llvm.unbitslice.i32(i8* %p.u1)
+  ret void
+}
+
+declare void @llvm.bitslice.i32(i8*, i32, i32)
+declare void @llvm.unbitslice.i32(i8*)
@@ -0,0 +1,58 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -S 2>&1 | FileCheck %s
+; REQUIRES: loadable_module
+
+; Range scan of 4-bit codes: every chunk of 32 codes is transposed in
+; registers and compared against both bounds from bit 3 down to bit 0, with
+; an early exit after each bit but the last. The bounds are runtime values,
+; the upper one clamped to the largest 4-bit code. The partial chunk is read
+; from a zeroed copy and masked with tailMask.
+
+; CHECK: ERROR: the code width of a scan must be a constant between 1 and 32 bits
+
+; CHECK-LABEL: define void @range(
+; CHECK: %tail = alloca [32 x i32]
+; CHECK: %count = zext i32 %n to i64
+; CHECK: %full = lshr i64 %count, 5
+; CHECK: %rem = and i64 %count, 31
+; CHECK: %chunks = add i64 %full,
+; CHECK: %tailMask = trunc i64
+; CHECK: [[C:%[0-9]+]] = icmp ugt i32 %hi, 15
+; CHECK-NEXT: %hi1 = select i1 [[C]], i32 15, i32 %hi
+; CHECK: %rangeMask = select i1
+; CHECK: getelementptr inbounds [32 x i32], [32 x i32]* %tail
+; CHECK: %chunk = select i1 [[FULL:%[0-9]+]], i32* {{%[0-9]+}}, i32* {{%[0-9]+}}
+; CHECK: and i32 {{%.*}}, 65535
+; CHECK: and i32 {{%.*}}, 1431655765
+; CHECK: lshr i32 %lo, 3
+; CHECK: lshr i32 %hi1, 3
+; CHECK: %decided = icmp eq i32
+; CHECK-NEXT: br i1 %decided, label %scan.end, label %scan.bit
+; CHECK: scan.bit:
+; CHECK: lshr i32 %lo, 2
+; CHECK: br i1 %decided{{[0-9]+}}, label %scan.end, label %scan.bit{{[0-9]+}}
+; CHECK: lshr i32 %lo, 1
+; CHECK: br i1 %decided{{[0-9]+}}, label %scan.end, label %scan.bit{{[0-9]+}}
+; CHECK: lshr i32 %lo, 0
+; CHECK-NOT: %decided
+; CHECK: br label %scan.end
+; CHECK: scan.end:
+; CHECK: %inRange = xor i32 {{%[0-9]+}}, -1
+; CHECK-NEXT: [[M:%[0-9]+]] = select i1 [[FULL]], i32 -1, i32 %tailMask
+; CHECK-NEXT: [[R:%[0-9]+]] = and i32 %inRange, [[M]]
+; CHECK-NEXT: [[R2:%[0-9]+]] = and i32 [[R]], %rangeMask
+; CHECK-NEXT: [[W:%[0-9]+]] = getelementptr inbounds i32, i32* %bitmap, i64
+; CHECK-NEXT: store i32 [[R2]], i32* [[W]]
+; CHECK-NOT: call void @llvm.bitsliced.scan.i32
+define void @range(i32* %codes, i32* %bitmap, i32 %n, i32 %lo, i32 %hi) {
+entry:
+  call void @llvm.bitsliced.scan.i32(i32* %codes, i32* %bitmap, i32 %n, i32 4, i32 %lo, i32 %hi)
+  ret void
+}
+
+define void @bad_width(i32* %codes, i32* %bitmap, i32 %n, i32 %w) {
+entry:
+  call void @llvm.bitsliced.scan.i32(i32* %codes, i32* %bitmap, i32 %n, i32 %w, i32 0, i32 1)
+  ret void
+}
+
+declare void @llvm.bitsliced.scan.i32(i32*, i32*, i32, i32, i32, i32)
@@ -0,0 +1,30 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -S | FileCheck %s
+; REQUIRES: loadable_module
+
+; On a big-endian target the words of the blocks are byte-swapped on their
+; way into the tiles, and back on their way out.
+
+target datalayout = "E-m:e-i64:64-n32:64-S128"
+
+; CHECK-LABEL: @forward(
+; CHECK: [[W:%.*]] = load i32, i32* {{%.*}}, align 1
+; CHECK-NEXT: call i32 @llvm.bswap.i32(i32 [[W]])
+; CHECK-NOT: call void @llvm.getbitsliced.inplace.i32
+define void @forward(i8* %buf) {
+entry:
+  call void @llvm.getbitsliced.inplace.i32(i8* %buf, i32 512)
+  ret void
+}
+
+; CHECK-LABEL: @inverse(
+; CHECK: [[S:%.*]] = call i32 @llvm.bswap.i32(i32 {{%.*}})
+; CHECK-NEXT: store i32 [[S]], i32* {{%.*}}, align 1
+; CHECK-NOT: call void @llvm.getunbitsliced.inplace.i32
+define void @inverse(i8* %buf) {
+entry:
+  call void @llvm.getunbitsliced.inplace.i32(i8* %buf, i32 512)
+  ret void
+}
+
+declare void @llvm.getbitsliced.inplace.i32(i8*, i32)
+declare void @llvm.getunbitsliced.inplace.i32(i8*, i32)
@@ -0,0 +1,35 @@
+; RUN: opt < %s -load=%llvmshlibdir/LLVMBitSlicer%shlibext -O0 -S | FileCheck %s
+; REQUIRES: loadable_module
+
+; Blocks of big-endian 32-bit words with MSB-first bits (order 0x401): the
+; byte index is reversed within its word and the element shift counted from
+; the top of the byte, inside the transposition loops.
+
+; CHECK-LABEL: @ordered(
+; CHECK: %div = sdiv i64 {{%.*}}, 8
+; CHECK-NEXT: {{%.*}} = xor i64 %div, 3
+; CHECK: [[E:%.*]] = srem i64 {{%.*}}, 8
+; CHECK-NEXT: [[M:%.*]] = mul nsw i64 [[E]], 1
+; CHECK-NEXT: sub i64 7, [[M]]
+; CHECK: %idx_mod = srem i64 {{%.*}}, 16
+; CHECK-NEXT: {{%.*}} = xor i64 %idx_mod, 3
+; CHECK-NOT: call void @llvm.bitslice.order.i32
+; CHECK-NOT: call void @llvm.unbitslice.order.i32
+; CHECK: ret void
+define void @ordered() {
+entry:
+  %state = alloca [512 x i8]
+  %p = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 0
+  call void @llvm.bitslice.order.i32(i8* %p, i32 32, i32 16, i32 1025)
+  %g = getelementptr inbounds [512 x i8], [512 x i8]* %state, i64 0, i64 0
+  %x = load i8, i8* %g
+  %xz = zext i8 %x to i32
+  %n = xor i32 %xz, 255
+  %t = trunc i32 %n to i8
+  store i8 %t, i8* %g
+  call void @llvm.unbitslice.order.i32(i8* %p, i32 1025)
+  ret void
+}
+
+declare void @llvm.bitslice.order.i32(i8*, i32, i32, i32)
+declare void @llvm.unbitslice.order.i32(i8*, i32)
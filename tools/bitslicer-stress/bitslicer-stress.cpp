@@ -0,0 +1,195 @@
+//===-- bitslicer-stress.cpp - Generate inputs for the BitSlicer pass -----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This program generates random modules shaped like the input of the
+// BitSlicer plugin, to measure how the compile time and memory of the pass
+// scale with the number of functions, bit-sliced regions, slices and
+// operations:
+//
+//   bitslicer-stress -functions=8 -regions=4 -block-len=16 -ops=256 -o t.ll
+//   opt -load LLVMBitSlicer.so -O0 -time-passes t.ll -disable-output
+//
+// Every region copies a state buffer from the input, bit-slices it with
+// llvm.bitslice.i32, computes random XOR/AND/OR expressions of its bytes and
+// constants, stores them back into the state, restores it with
+// llvm.unbitslice.i32 and copies it to the output.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IRPrintingPasses.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include <random>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<unsigned> SeedCL("seed",
+  cl::desc("Seed used for randomness"), cl::init(0));
+static cl::opt<unsigned> NumFunctions("functions",
+  cl::desc("Number of generated kernels"), cl::init(1));
+static cl::opt<unsigned> NumRegions("regions",
+  cl::desc("Bit-sliced regions per kernel"), cl::init(1));
+static cl::opt<unsigned> NumBlocks("blocks",
+  cl::desc("Blocks sliced together, at most 32"), cl::init(32));
+static cl::opt<unsigned> BlockLen("block-len",
+  cl::desc("Bytes per block, the region has 8 slices per byte"),
+  cl::init(16));
+static cl::opt<unsigned> NumOps("ops",
+  cl::desc("Operations on the sliced state per region"), cl::init(64));
+static cl::opt<std::string>
+OutputFilename("o", cl::desc("Override output filename"),
+               cl::value_desc("filename"));
+
+namespace {
+
+class Generator {
+  Module &M;
+  LLVMContext &Context;
+  std::minstd_rand Rand;
+  Function *BitSlice, *UnBitSlice;
+
+  unsigned pick(unsigned N) { return Rand() % N; }
+
+public:
+  Generator(Module &M, unsigned Seed)
+      : M(M), Context(M.getContext()), Rand(Seed) {
+    BitSlice = Intrinsic::getDeclaration(&M, Intrinsic::bitslice_i32);
+    UnBitSlice = Intrinsic::getDeclaration(&M, Intrinsic::unbitslice_i32);
+  }
+
+  // void kernel(i8 *in, i8 *out), the regions follow each other in the
+  // entry block and work on consecutive parts of the buffers.
+  void genKernel(unsigned N) {
+    Type *I8PtrTy = Type::getInt8PtrTy(Context);
+    FunctionType *FTy = FunctionType::get(Type::getVoidTy(Context),
+                                          {I8PtrTy, I8PtrTy}, false);
+    Function *F = Function::Create(FTy, GlobalValue::ExternalLinkage,
+                                   "kernel" + Twine(N), &M);
+    auto AI = F->arg_begin();
+    Value *In = &*AI++;
+    Value *Out = &*AI;
+    In->setName("in");
+    Out->setName("out");
+
+    IRBuilder<> Builder(BasicBlock::Create(Context, "entry", F));
+    for (unsigned R = 0; R < NumRegions; R++)
+      genRegion(Builder, In, Out, N, R);
+    Builder.CreateRetVoid();
+  }
+
+  // Stores the low byte of V to a random byte of the state.
+  void storeByte(IRBuilder<> &Builder, Value *State, Value *V) {
+    Value *Ptr = Builder.CreateConstGEP2_32(nullptr, State, 0, pick(BlockLen));
+    Builder.CreateStore(Builder.CreateTrunc(V, Builder.getInt8Ty()), Ptr);
+  }
+
+  void genRegion(IRBuilder<> &Builder, Value *In, Value *Out, unsigned N,
+                 unsigned R) {
+    unsigned Size = NumBlocks * BlockLen;
+    Type *I32Ty = Builder.getInt32Ty();
+    // The pass looks the sliced buffers up by name, they must be unique in
+    // the module and not only in the kernel.
+    Value *State = Builder.CreateAlloca(
+        ArrayType::get(Builder.getInt8Ty(), Size), nullptr,
+        "state" + Twine(N) + "." + Twine(R));
+
+    Value *Src = Builder.CreateConstGEP1_32(In, R * Size);
+    Builder.CreateMemCpy(Builder.CreateConstGEP2_32(nullptr, State, 0, 0),
+                         Src, Size, 1);
+    // The pass erases the pointer operands of the slicing calls with them.
+    Builder.CreateCall(BitSlice,
+                       {Builder.CreateConstGEP2_32(nullptr, State, 0, 0),
+                        Builder.getInt32(NumBlocks),
+                        Builder.getInt32(BlockLen)});
+
+    std::vector<Value *> Vals;
+    for (unsigned I = 0; I < NumOps; I++) {
+      unsigned Op = Vals.size() < 2 ? 0 : pick(5);
+      if (Op == 0) {
+        Value *Ptr = Builder.CreateConstGEP2_32(nullptr, State, 0,
+                                                pick(BlockLen));
+        Vals.push_back(Builder.CreateZExt(Builder.CreateLoad(Ptr), I32Ty));
+        continue;
+      }
+      Value *LHS = Vals[pick(Vals.size())];
+      Value *RHS = pick(4) ? Vals[pick(Vals.size())]
+                           : Builder.getInt32(pick(256));
+      switch (Op) {
+      case 1:
+      case 2:
+        Vals.push_back(Builder.CreateXor(LHS, RHS));
+        break;
+      case 3:
+        Vals.push_back(Builder.CreateAnd(LHS, RHS));
+        break;
+      default:
+        Vals.push_back(Builder.CreateOr(LHS, RHS));
+        break;
+      }
+      if (!pick(4))
+        storeByte(Builder, State, Vals.back());
+    }
+    storeByte(Builder, State, Vals.back());
+
+    Builder.CreateCall(UnBitSlice,
+                       {Builder.CreateConstGEP2_32(nullptr, State, 0, 0)});
+    Value *Dst = Builder.CreateConstGEP1_32(Out, R * Size);
+    Builder.CreateMemCpy(Dst, Builder.CreateConstGEP2_32(nullptr, State, 0, 0),
+                         Size, 1);
+  }
+};
+
+} // end anonymous namespace
+
+int main(int argc, char **argv) {
+  PrettyStackTraceProgram X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "BitSlicer input generator\n");
+  llvm_shutdown_obj Y;
+
+  if (NumBlocks == 0 || NumBlocks > 32 || BlockLen == 0) {
+    errs() << argv[0] << ": -blocks must be in [1, 32] and -block-len "
+                         "positive\n";
+    return 1;
+  }
+
+  LLVMContext Context;
+  auto M = make_unique<Module>("bitslicer-stress", Context);
+  Generator G(*M, SeedCL);
+  for (unsigned N = 0; N < NumFunctions; N++)
+    G.genKernel(N);
+
+  if (OutputFilename.empty())
+    OutputFilename = "-";
+
+  std::error_code EC;
+  tool_output_file Out(OutputFilename, EC, sys::fs::F_None);
+  if (EC) {
+    errs() << EC.message() << '\n';
+    return 1;
+  }
+
+  legacy::PassManager Passes;
+  Passes.add(createVerifierPass());
+  Passes.add(createPrintModulePass(Out.os()));
+  Passes.run(*M);
+  Out.keep();
+
+  return 0;
+}
@@ -14,9 +14,15 @@
 //===----------------------------------------------------------------------===//
 
 #include "NewPMDriver.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/Analysis/CGSCCPassManager.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/Bitcode/BitcodeWriterPass.h"
 #include "llvm/IR/Dominators.h"
 #include "llvm/IR/IRPrintingPasses.h"
@@ -24,12 +30,15 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Linker/IRMover.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Transforms/Scalar/LoopPassManager.h"
+#include <set>
 
 using namespace llvm;
 using namespace opt_tool;
@@ -47,13 +56,435 @@ static cl::opt<std::string>
                         "pipeline for handling managed aliasing queries"),
                cl::Hidden);
 
+static cl::opt<unsigned>
+    Threads("j", cl::Prefix,
+            cl::desc("Run the function passes of -passes on <N> threads"),
+            cl::value_desc("N"), cl::init(0));
+
+static cl::opt<unsigned> PartitionSize(
+    "j-partition-size", cl::Hidden, cl::init(2000),
+    cl::desc("Instructions per range of functions optimized as one task "
+             "under -j"));
+
+namespace {
+/// The number of globals of each kind of the input module. Passes append the
+/// globals they create to the lists of the module, so the first ones of each
+/// list are the globals of the input.
+struct InputGlobals {
+  size_t Vars, Functions, Aliases, IFuncs;
+
+  explicit InputGlobals(Module &M)
+      : Vars(M.getGlobalList().size()), Functions(M.size()),
+        Aliases(M.getAliasList().size()), IFuncs(M.getIFuncList().size()) {}
+
+  /// Call \p Fn on every global of \p M, with whether it was in the input.
+  void forEach(Module &M, function_ref<void(GlobalValue &, bool)> Fn) const {
+    size_t Idx = 0;
+    for (GlobalVariable &GV : M.globals())
+      Fn(GV, Idx++ < Vars);
+    Idx = 0;
+    for (Function &F : M)
+      Fn(F, Idx++ < Functions);
+    Idx = 0;
+    for (GlobalAlias &GA : M.aliases())
+      Fn(GA, Idx++ < Aliases);
+    Idx = 0;
+    for (GlobalIFunc &GI : M.ifuncs())
+      Fn(GI, Idx++ < IFuncs);
+  }
+};
+
+/// Name of the array through which a task hands the globals its passes
+/// created over to the merge.
+const char NewGlobalsName[] = "opt.j.new.globals";
+
+/// A range of the function list of a module, optimized as one task.
+struct FunctionRange {
+  unsigned Begin, End;
+  /// Instructions of the functions of the range.
+  unsigned Size = 0;
+  /// Bitcode of the module of the task once it ran.
+  SmallVector<char, 0> Bitcode;
+  /// Globals of the input out of the range whose alignment or attributes the
+  /// passes changed.
+  std::vector<std::string> Changed;
+  std::string Error;
+};
+
+/// Runs a pipeline of function passes over ranges of the functions of the
+/// module on a thread pool.
+///
+/// Constants, types and metadata are uniqued in the LLVMContext, which is not
+/// thread safe, so every task works on a module of its own: it loads the
+/// bitcode of the module into a context of its own and drops the bodies of
+/// the functions out of its range. The functions are then moved back one range
+/// after the other in the order of the module. The ranges are cut by size and
+/// not by number of threads, so the output does not depend on the number of
+/// threads nor on which task finished first.
+class ParallelFunctionPipelinePass
+    : public PassInfoMixin<ParallelFunctionPipelinePass> {
+public:
+  ParallelFunctionPipelinePass(StringRef Pipeline, bool VerifyEachPass,
+                               std::function<TargetMachine *()> CreateTM)
+      : Pipeline(Pipeline), VerifyEachPass(VerifyEachPass),
+        CreateTM(std::move(CreateTM)) {}
+
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM);
+
+private:
+  /// Whether the module can be split: the tasks and the merge find the
+  /// globals by name, a body can't be dropped under a blockaddress and the
+  /// merge would fold isomorphic struct types into one.
+  static bool canSplit(Module &M);
+  void optimizeRange(MemoryBufferRef Input, FunctionRange &Range,
+                     const InputGlobals &Globals);
+  bool runPipeline(Module &M, TargetMachine *TM);
+
+  std::string Pipeline;
+  bool VerifyEachPass;
+  std::function<TargetMachine *()> CreateTM;
+};
+} // end anonymous namespace
+
+/// Build the analysis managers for \p PB, with the AA pipeline of the command
+/// line, and run \p PassPipeline over \p M.
+static bool runPipelineWith(PassBuilder &PB, Module &M, StringRef PassPipeline,
+                            bool VerifyEachPass) {
+  AAManager AA;
+  if (!PB.parseAAPipeline(AA, AAPipeline))
+    return false;
+
+  LoopAnalysisManager LAM(DebugPM);
+  FunctionAnalysisManager FAM(DebugPM);
+  CGSCCAnalysisManager CGAM(DebugPM);
+  ModuleAnalysisManager MAM(DebugPM);
+  FAM.registerPass([&] { return std::move(AA); });
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  ModulePassManager MPM(DebugPM);
+  if (!PB.parsePassPipeline(MPM, PassPipeline, VerifyEachPass, DebugPM))
+    return false;
+  MPM.run(M, MAM);
+  return true;
+}
+
+bool ParallelFunctionPipelinePass::runPipeline(Module &M, TargetMachine *TM) {
+  PassBuilder PB(TM);
+  return runPipelineWith(PB, M, "function(" + Pipeline + ")", VerifyEachPass);
+}
+
+bool ParallelFunctionPipelinePass::canSplit(Module &M) {
+  for (GlobalValue &GV : M.global_values())
+    if (!GV.hasName())
+      return false;
+  for (Function &F : M)
+    for (BasicBlock &BB : F)
+      if (BB.hasAddressTaken())
+        return false;
+  std::set<std::pair<std::vector<Type *>, bool>> Bodies;
+  for (StructType *ST : M.getIdentifiedStructTypes())
+    if (!ST->isOpaque() &&
+        !Bodies.insert(std::make_pair(std::vector<Type *>(ST->element_begin(),
+                                                          ST->element_end()),
+                                      ST->isPacked()))
+             .second)
+      return false;
+  return true;
+}
+
+void ParallelFunctionPipelinePass::optimizeRange(MemoryBufferRef Input,
+                                                 FunctionRange &Range,
+                                                 const InputGlobals &Globals) {
+  LLVMContext Context;
+  Expected<std::unique_ptr<Module>> MOrErr =
+      getLazyBitcodeModule(Input, Context);
+  if (!MOrErr) {
+    Range.Error = toString(MOrErr.takeError());
+    return;
+  }
+  Module &M = **MOrErr;
+
+  // As in SplitModule, the functions out of the range become declarations
+  // and their bodies are never read. Declaring a local function makes it
+  // external, function passes don't look at the linkage of a callee.
+  unsigned Idx = 0;
+  for (Function &F : M) {
+    if (Idx >= Range.Begin && Idx < Range.End) {
+      if (Error E = F.materialize()) {
+        Range.Error = toString(std::move(E));
+        return;
+      }
+    } else if (!F.isDeclaration()) {
+      F.deleteBody();
+    }
+    ++Idx;
+  }
+  if (Error E = M.materializeAll()) {
+    Range.Error = toString(std::move(E));
+    return;
+  }
+
+  // Passes raise the alignment of the globals they access and add attributes
+  // to the library functions they call: note them to find what changed.
+  struct GlobalState {
+    GlobalObject *GO;
+    unsigned Alignment;
+    AttributeList Attrs;
+  };
+  std::vector<GlobalState> Before;
+  std::vector<GlobalValue *> OutOfRange;
+  Globals.forEach(M, [&](GlobalValue &GV, bool IsInput) {
+    if (!IsInput || (isa<Function>(GV) && !GV.isDeclaration()))
+      return;
+    OutOfRange.push_back(&GV);
+    if (auto *GO = dyn_cast<GlobalObject>(&GV)) {
+      auto *F = dyn_cast<Function>(GO);
+      Before.push_back({GO, GO->getAlignment(),
+                        F ? F->getAttributes() : AttributeList()});
+    }
+  });
+
+  std::unique_ptr<TargetMachine> TM(CreateTM());
+  if (!runPipeline(M, TM.get())) {
+    Range.Error = "unable to parse pass pipeline description";
+    return;
+  }
+
+  for (const GlobalState &S : Before) {
+    auto *F = dyn_cast<Function>(S.GO);
+    if (S.GO->getAlignment() != S.Alignment ||
+        (F && F->getAttributes() != S.Attrs))
+      Range.Changed.push_back(S.GO->getName());
+  }
+
+  // The globals of the input are found by name when merging, so the local
+  // ones are made external. The ones created by the passes are moved in the
+  // order they were created, even if nothing refers to them any more, and
+  // the local ones under a fresh name.
+  std::vector<Constant *> Created;
+  Type *Int8PtrTy = Type::getInt8PtrTy(Context);
+  Globals.forEach(M, [&](GlobalValue &GV, bool IsInput) {
+    if (!IsInput)
+      Created.push_back(
+          ConstantExpr::getPointerBitCastOrAddrSpaceCast(&GV, Int8PtrTy));
+    else if (GV.hasLocalLinkage())
+      GV.setLinkage(GlobalValue::ExternalLinkage);
+  });
+  if (!Created.empty()) {
+    ArrayType *Ty = ArrayType::get(Int8PtrTy, Created.size());
+    new GlobalVariable(M, Ty, /*isConstant=*/true, GlobalValue::ExternalLinkage,
+                       ConstantArray::get(Ty, Created), NewGlobalsName);
+  }
+
+  // The merge only reads the functions of the range and what they refer to,
+  // so the other globals of the input are left as declarations, or dropped
+  // if nothing refers to them: the bitcode of a task grows with its range
+  // and not with the module. An alias can't be declared, its uses go to a
+  // declaration of its name.
+  StringSet<> Keep;
+  for (const std::string &Name : Range.Changed)
+    Keep.insert(Name);
+  for (GlobalValue *&GV : OutOfRange) {
+    if (auto *GVar = dyn_cast<GlobalVariable>(GV)) {
+      GVar->setInitializer(nullptr);
+      GVar->setLinkage(GlobalValue::ExternalLinkage);
+      GVar->setComdat(nullptr);
+    } else if (isa<GlobalIndirectSymbol>(GV)) {
+      GlobalValue *Decl;
+      if (auto *FTy = dyn_cast<FunctionType>(GV->getValueType()))
+        Decl = Function::Create(FTy, GlobalValue::ExternalLinkage, "", &M);
+      else
+        Decl = new GlobalVariable(M, GV->getValueType(), /*isConstant=*/false,
+                                  GlobalValue::ExternalLinkage, nullptr, "",
+                                  nullptr, GV->getThreadLocalMode(),
+                                  GV->getType()->getAddressSpace());
+      Decl->takeName(GV);
+      GV->replaceAllUsesWith(
+          ConstantExpr::getPointerBitCastOrAddrSpaceCast(Decl, GV->getType()));
+      GV->eraseFromParent();
+      GV = Decl;
+    }
+  }
+  for (GlobalValue *GV : OutOfRange) {
+    GV->removeDeadConstantUsers();
+    if (GV->use_empty() && !Keep.count(GV->getName()))
+      GV->eraseFromParent();
+  }
+
+  // What is not attached to a function is already in the module merged into.
+  M.setModuleInlineAsm("");
+  for (auto I = M.named_metadata_begin(), E = M.named_metadata_end();
+       I != E;) {
+    NamedMDNode *NMD = &*I++;
+    if (NMD->getName() != "llvm.module.flags")
+      M.eraseNamedMetadata(NMD);
+  }
+
+  raw_svector_ostream OS(Range.Bitcode);
+  WriteBitcodeToFile(&M, OS, /*ShouldPreserveUseListOrder=*/true);
+}
+
+PreservedAnalyses ParallelFunctionPipelinePass::run(Module &M,
+                                                    ModuleAnalysisManager &) {
+  // Debug info ties the functions to compile units shared by the whole
+  // module, moving them back one range at a time would duplicate it.
+  if (M.getNamedMetadata("llvm.dbg.cu") || !canSplit(M)) {
+    errs() << "warning: running the function passes on one thread, the "
+              "module can't be split\n";
+    std::unique_ptr<TargetMachine> TM(CreateTM());
+    runPipeline(M, TM.get());
+    return PreservedAnalyses::none();
+  }
+
+  std::vector<FunctionRange> Ranges;
+  unsigned Idx = 0;
+  for (Function &F : M) {
+    if (Ranges.empty() || Ranges.back().Size >= PartitionSize) {
+      Ranges.emplace_back();
+      Ranges.back().Begin = Idx;
+    }
+    for (BasicBlock &BB : F)
+      Ranges.back().Size += BB.size();
+    Ranges.back().End = ++Idx;
+  }
+
+  SmallVector<char, 0> Input;
+  {
+    raw_svector_ostream OS(Input);
+    WriteBitcodeToFile(&M, OS, /*ShouldPreserveUseListOrder=*/true);
+  }
+  MemoryBufferRef InputRef(StringRef(Input.data(), Input.size()),
+                           M.getModuleIdentifier());
+  InputGlobals Globals(M);
+  {
+    ThreadPool Pool(Threads);
+    for (FunctionRange &Range : Ranges)
+      if (Range.Size)
+        Pool.spawn([&, InputRef] { optimizeRange(InputRef, Range, Globals); });
+    Pool.wait();
+  }
+  for (FunctionRange &Range : Ranges)
+    if (!Range.Error.empty())
+      report_fatal_error("-j: " + Range.Error);
+
+  // The mover links an external symbol to its namesake, local symbols are
+  // externalized while it runs and their linkage restored once it is done.
+  StringMap<GlobalValue::LinkageTypes> Locals;
+  for (GlobalValue &GV : M.global_values())
+    if (GV.hasLocalLinkage()) {
+      Locals[GV.getName()] = GV.getLinkage();
+      GV.setLinkage(GlobalValue::ExternalLinkage);
+    }
+  std::vector<std::string> Order;
+  for (Function &F : M)
+    Order.push_back(F.getName());
+
+  IRMover Mover(M);
+  for (FunctionRange &Range : Ranges) {
+    if (!Range.Size)
+      continue;
+    MemoryBufferRef Output(StringRef(Range.Bitcode.data(), Range.Bitcode.size()),
+                           M.getModuleIdentifier());
+    Expected<std::unique_ptr<Module>> ROrErr =
+        getLazyBitcodeModule(Output, M.getContext());
+    if (!ROrErr)
+      report_fatal_error("-j: " + toString(ROrErr.takeError()));
+    Module &R = **ROrErr;
+    if (Error E = R.materializeAll())
+      report_fatal_error("-j: " + toString(std::move(E)));
+
+    // The globals the passes created go first, then the functions of the
+    // range.
+    std::vector<GlobalValue *> ToMove;
+    if (GlobalVariable *New = R.getNamedGlobal(NewGlobalsName))
+      ToMove.push_back(New);
+
+    // Take what the passes learnt about the other globals of the input.
+    for (const std::string &Name : Range.Changed) {
+      auto *GO = cast<GlobalObject>(R.getNamedValue(Name));
+      auto *Dst = cast<GlobalObject>(M.getNamedValue(Name));
+      if (GO->getAlignment() > Dst->getAlignment())
+        Dst->setAlignment(GO->getAlignment());
+      if (auto *F = dyn_cast<Function>(GO))
+        cast<Function>(Dst)->setAttributes(F->getAttributes());
+    }
+
+    // The mover moves the blocks of a function but sets every operand again,
+    // which reorders the use lists: note their order to restore it after.
+    DenseMap<const Use *, unsigned> UseOrder;
+    std::vector<Value *> Reordered;
+    auto NoteUses = [&](Value &V) {
+      unsigned N = 0;
+      for (const Use &U : V.uses())
+        UseOrder[&U] = N++;
+      if (N > 1)
+        Reordered.push_back(&V);
+    };
+    for (unsigned I = Range.Begin; I != Range.End; ++I) {
+      Function *F = R.getFunction(Order[I]);
+      if (!F || F->isDeclaration())
+        continue;
+      ToMove.push_back(F);
+      for (Argument &A : F->args())
+        NoteUses(A);
+      for (BasicBlock &BB : *F) {
+        NoteUses(BB);
+        for (Instruction &I : BB)
+          NoteUses(I);
+      }
+    }
+    if (Error E = Mover.move(std::move(*ROrErr), ToMove,
+                             [](GlobalValue &, IRMover::ValueAdder) {},
+                             /*IsPerformingImport=*/false))
+      report_fatal_error("-j: " + toString(std::move(E)));
+    for (Value *V : Reordered)
+      V->sortUseList([&](const Use &L, const Use &R) {
+        return UseOrder.lookup(&L) < UseOrder.lookup(&R);
+      });
+
+    // The globals the passes created stay, the array that moved them goes.
+    if (GlobalVariable *New = M.getNamedGlobal(NewGlobalsName)) {
+      std::vector<GlobalValue *> Created;
+      for (Value *Op : New->getInitializer()->operands())
+        Created.push_back(cast<GlobalValue>(Op->stripPointerCasts()));
+      New->eraseFromParent();
+      for (GlobalValue *GV : Created)
+        GV->removeDeadConstantUsers();
+    }
+  }
+
+  for (auto &L : Locals)
+    M.getNamedValue(L.getKey())->setLinkage(L.getValue());
+
+  // The moved functions took the place of the originals at the end of the
+  // list: put them back in order, followed by the declarations the passes
+  // added.
+  unsigned NumAdded = M.size() - Order.size();
+  for (const std::string &Name : Order) {
+    Function *F = M.getFunction(Name);
+    M.getFunctionList().remove(F);
+    M.getFunctionList().push_back(F);
+  }
+  for (unsigned I = 0; I < NumAdded; ++I) {
+    Function *F = &M.getFunctionList().front();
+    M.getFunctionList().remove(F);
+    M.getFunctionList().push_back(F);
+  }
+  return PreservedAnalyses::none();
+}
+
 bool llvm::runPassPipeline(StringRef Arg0, Module &M,
                            TargetMachine *TM, tool_output_file *Out,
                            StringRef PassPipeline, OutputKind OK,
                            VerifierKind VK,
                            bool ShouldPreserveAssemblyUseListOrder,
                            bool ShouldPreserveBitcodeUseListOrder,
-                           bool EmitSummaryIndex, bool EmitModuleHash) {
+                           bool EmitSummaryIndex, bool EmitModuleHash,
+                           std::function<TargetMachine *()> CreateTM) {
   PassBuilder PB(TM);
 
   // Specially handle the alias analysis manager so that we can register
@@ -83,8 +514,18 @@ bool llvm::runPassPipeline(StringRef Arg0, Module &M,
   if (VK > VK_NoVerifier)
     MPM.addPass(VerifierPass());
 
-  if (!PB.parsePassPipeline(MPM, PassPipeline, VK == VK_VerifyEachPass,
-                            DebugPM)) {
+  if (Threads) {
+    // Every task parses the pipeline again, check it once here.
+    ModulePassManager Check(DebugPM);
+    if (!PB.parsePassPipeline(Check, ("function(" + PassPipeline + ")").str(),
+                              VK == VK_VerifyEachPass, DebugPM)) {
+      errs() << Arg0 << ": -j takes a pipeline of function passes.\n";
+      return false;
+    }
+    MPM.addPass(ParallelFunctionPipelinePass(
+        PassPipeline, VK == VK_VerifyEachPass, std::move(CreateTM)));
+  } else if (!PB.parsePassPipeline(MPM, PassPipeline, VK == VK_VerifyEachPass,
+                                   DebugPM)) {
     errs() << Arg0 << ": unable to parse pass pipeline description.\n";
     return false;
   }
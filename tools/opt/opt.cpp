@@ -529,7 +529,13 @@ int main(int argc, char **argv) {
     return runPassPipeline(argv[0], *M, TM.get(), Out.get(),
                            PassPipeline, OK, VK, PreserveAssemblyUseListOrder,
                            PreserveBitcodeUseListOrder, EmitSummaryIndex,
-                           EmitModuleHash)
+                           EmitModuleHash,
+                           [&]() -> TargetMachine * {
+                             if (!ModuleTriple.getArch())
+                               return nullptr;
+                             return GetTargetMachine(ModuleTriple, CPUStr,
+                                                     FeaturesStr, Options);
+                           })
                ? 0
                : 1;
   }
@@ -0,0 +1,166 @@
+//===- llvm/unittest/IR/LLVMContextTest.cpp - LLVMContext unit tests ------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace llvm;
+
+namespace {
+
+TEST(LLVMContextTest, ConcurrencyMode) {
+  LLVMContext Default;
+  EXPECT_FALSE(Default.isConcurrent());
+  LLVMContext Concurrent(LLVMContext::Concurrent);
+  EXPECT_TRUE(Concurrent.isConcurrent());
+}
+
+#if LLVM_ENABLE_THREADS
+// Threads uniquing the same types, constants and metadata in a concurrent
+// context all get the same objects, and the constants they share keep no use
+// lists.
+TEST(LLVMContextTest, ConcurrentUniquing) {
+  LLVMContext C(LLVMContext::Concurrent);
+  const unsigned NumThreads = 4, NumValues = 1024;
+  std::vector<std::vector<const void *>> Results(NumThreads);
+  std::vector<std::thread> Threads;
+  for (unsigned T = 0; T < NumThreads; ++T)
+    Threads.emplace_back([&, T] {
+      std::vector<const void *> &R = Results[T];
+      R.resize(NumValues * 4);
+      for (unsigned I = 0; I < NumValues; ++I) {
+        // Each thread walks the values in its own order.
+        unsigned V = (I * (2 * T + 1)) % NumValues;
+        Type *Ty = VectorType::get(Type::getInt8Ty(C), V % 64 + 1);
+        Constant *Idx = ConstantInt::get(Type::getInt64Ty(C), V + 1);
+        Constant *Ptr =
+            ConstantExpr::getIntToPtr(Idx, Type::getInt32PtrTy(C));
+        MDString *S = MDString::get(C, std::to_string(V));
+        MDNode *N = MDTuple::get(C, {S, ConstantAsMetadata::get(Ptr)});
+        R[V * 4] = Ty;
+        R[V * 4 + 1] = Idx;
+        R[V * 4 + 2] = Ptr;
+        R[V * 4 + 3] = N;
+      }
+    });
+  for (std::thread &T : Threads)
+    T.join();
+
+  for (unsigned T = 1; T < NumThreads; ++T)
+    EXPECT_EQ(Results[0], Results[T]);
+  for (unsigned V = 0; V < NumValues; ++V) {
+    auto *Ptr = static_cast<const Constant *>(Results[0][V * 4 + 2]);
+    EXPECT_TRUE(Ptr->isSharedByThreads());
+    EXPECT_TRUE(Ptr->use_empty());
+  }
+}
+
+// Threads building, rewriting and erasing modules of their own over the same
+// constants in a concurrent context see exact use lists for their own values.
+TEST(LLVMContextTest, ConcurrentUseLists) {
+  LLVMContext C(LLVMContext::Concurrent);
+  const unsigned NumThreads = 4, NumInsts = 256, NumRounds = 8;
+  std::vector<std::thread> Threads;
+  for (unsigned T = 0; T < NumThreads; ++T)
+    Threads.emplace_back([&] {
+      Type *I32 = Type::getInt32Ty(C);
+      PointerType *I32Ptr = Type::getInt32PtrTy(C);
+      Constant *One = ConstantInt::get(Type::getInt64Ty(C), 1);
+      for (unsigned Round = 0; Round < NumRounds; ++Round) {
+        Module M("m", C);
+        auto *G = new GlobalVariable(M, I32, false,
+                                     GlobalValue::ExternalLinkage, nullptr,
+                                     "g");
+        auto *G2 = new GlobalVariable(M, I32, false,
+                                      GlobalValue::ExternalLinkage, nullptr,
+                                      "g2");
+        Function *F =
+            Function::Create(FunctionType::get(I32, false),
+                             GlobalValue::ExternalLinkage, "f", &M);
+        F->addFnAttr(Attribute::NoUnwind);
+        IRBuilder<> B(BasicBlock::Create(C, "entry", F));
+
+        // The global and the expression on it are the module's, the integers
+        // and the pointers made of them are shared.
+        Constant *GEnd = ConstantExpr::getGetElementPtr(I32, G, One);
+        Value *Sum = B.CreateLoad(G);
+        std::vector<WeakVH> Handles;
+        for (unsigned I = 0; I < NumInsts; ++I) {
+          Constant *K = ConstantInt::get(I32, I % 16);
+          Sum = B.CreateAdd(Sum, K);
+          cast<Instruction>(Sum)->setMetadata(
+              "k", MDNode::get(C, ConstantAsMetadata::get(K)));
+          B.CreateStore(Sum, ConstantExpr::getIntToPtr(K, I32Ptr));
+          B.CreateStore(Sum, GEnd);
+          Handles.emplace_back(K);
+        }
+        WeakVH SumVH(Sum);
+        B.CreateRet(Sum);
+
+        EXPECT_FALSE(GEnd->isSharedByThreads());
+        EXPECT_EQ(NumInsts, GEnd->getNumUses());
+        EXPECT_TRUE(G->hasNUses(2));
+        EXPECT_TRUE(Sum->hasNUses(3));
+        EXPECT_TRUE(ConstantInt::get(I32, 0)->use_empty());
+        EXPECT_FALSE(verifyModule(M, &errs()));
+
+        // The load and the expression follow the global, and the stores
+        // follow the expression.
+        G->replaceAllUsesWith(G2);
+        EXPECT_TRUE(G->use_empty());
+        EXPECT_TRUE(G2->hasNUses(2));
+        Constant *G2End = ConstantExpr::getGetElementPtr(I32, G2, One);
+        EXPECT_EQ(NumInsts, G2End->getNumUses());
+
+        // Made of shared constants only, the expression becomes a shared one.
+        G2->replaceAllUsesWith(
+            ConstantExpr::getIntToPtr(ConstantInt::get(I32, 64), I32Ptr));
+        EXPECT_TRUE(G2->use_empty());
+        auto *Last = cast<StoreInst>(F->getEntryBlock().getTerminator()
+                                         ->getPrevNode());
+        EXPECT_TRUE(Last->getPointerOperand()->isSharedByThreads());
+        EXPECT_FALSE(verifyModule(M, &errs()));
+
+        // Shared constants outlive destroyConstant.
+        Constant *K0 = ConstantInt::get(I32, 0);
+        Constant *P0 = ConstantExpr::getIntToPtr(K0, I32Ptr);
+        P0->destroyConstant();
+        EXPECT_EQ(P0, ConstantExpr::getIntToPtr(K0, I32Ptr));
+
+        Sum->replaceAllUsesWith(UndefValue::get(I32));
+        EXPECT_EQ(UndefValue::get(I32), static_cast<Value *>(SumVH));
+        EXPECT_TRUE(Sum->use_empty());
+        cast<Instruction>(Sum)->eraseFromParent();
+        for (unsigned I = 0; I < NumInsts; ++I)
+          EXPECT_EQ(ConstantInt::get(I32, I % 16),
+                    static_cast<Value *>(Handles[I]));
+      }
+    });
+  for (std::thread &T : Threads)
+    T.join();
+}
+#endif
+
+} // end anonymous namespace
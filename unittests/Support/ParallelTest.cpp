@@ -0,0 +1,103 @@
+//===- unittests/Support/ParallelTest.cpp - Parallel algorithms tests -----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Support/Parallel.h"
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <random>
+
+using namespace llvm;
+using namespace llvm::parallel;
+
+namespace {
+
+TEST(Parallel, ForEach) {
+  std::vector<int> V(10000, 1);
+  for (Order O : {Order::Any, Order::Deterministic, Order::Sequential}) {
+    std::atomic<int> Sum(0);
+    parallel_for_each(V.begin(), V.end(), [&Sum](int X) { Sum += X; }, O);
+    EXPECT_EQ(10000, Sum);
+  }
+
+  std::vector<int> Squares(5000);
+  parallel_for_each_n(0, 5000, [&Squares](int I) { Squares[I] = I * I; },
+                      Order::Any, 7);
+  for (int I = 0; I < 5000; ++I)
+    EXPECT_EQ(I * I, Squares[I]);
+}
+
+TEST(Parallel, Sort) {
+  std::mt19937 Generator(42);
+  std::vector<unsigned> V(100000);
+  for (unsigned &X : V)
+    X = Generator() % 1000;
+  std::vector<unsigned> Expected = V;
+  std::sort(Expected.begin(), Expected.end());
+  parallel_sort(V.begin(), V.end());
+  EXPECT_EQ(Expected, V);
+
+  // All equal keys must not send the partitioning quadratic.
+  std::vector<int> Same(100000, 3);
+  parallel_sort(Same.begin(), Same.end(), std::greater<int>());
+  EXPECT_TRUE(std::all_of(Same.begin(), Same.end(),
+                          [](int X) { return X == 3; }));
+}
+
+TEST(Parallel, TransformReduce) {
+  std::vector<unsigned> V(100000);
+  for (unsigned I = 0; I < V.size(); ++I)
+    V[I] = I;
+  auto Square = [](unsigned X) { return uint64_t(X) * X; };
+  uint64_t Expected = 0;
+  for (unsigned X : V)
+    Expected += Square(X);
+  for (Order O : {Order::Any, Order::Deterministic, Order::Sequential})
+    EXPECT_EQ(Expected, parallel_transform_reduce(V.begin(), V.end(),
+                                                  uint64_t(0),
+                                                  std::plus<uint64_t>(),
+                                                  Square, O));
+
+  // Init is reduced once, not once per chunk.
+  EXPECT_EQ(V.size() + 100,
+            parallel_transform_reduce(V.begin(), V.end(), size_t(100),
+                                      std::plus<size_t>(),
+                                      [](unsigned) { return size_t(1); },
+                                      Order::Any, 10));
+
+  // The chunks of a deterministic reduction are cut by size and combined in
+  // order: the rounding of a floating point sum is the one of a sequential
+  // sum of the chunk sums.
+  std::vector<float> F(5000);
+  for (unsigned I = 0; I < F.size(); ++I)
+    F[I] = 1.0f / (I + 1);
+  float ChunkSum = 0, Sum = 0;
+  for (unsigned I = 0; I < F.size(); ++I) {
+    ChunkSum = (I % 1024) ? ChunkSum + F[I] : F[I];
+    if (I % 1024 == 1023 || I + 1 == F.size())
+      Sum += ChunkSum;
+  }
+  auto Identity = [](float X) { return X; };
+  EXPECT_EQ(Sum, parallel_transform_reduce(F.begin(), F.end(), 0.0f,
+                                           std::plus<float>(), Identity,
+                                           Order::Deterministic));
+}
+
+TEST(Parallel, Nested) {
+  // Algorithms called from a task of the shared pool help with the queued
+  // chunks rather than waiting for a thread of the pool.
+  std::atomic<int> Count(0);
+  std::vector<int> Outer(64), Inner(256);
+  parallel_for_each(Outer.begin(), Outer.end(), [&](int) {
+    parallel_for_each(Inner.begin(), Inner.end(), [&](int) { ++Count; });
+  });
+  EXPECT_EQ(64 * 256, Count);
+}
+
+} // end anonymous namespace
@@ -17,6 +17,8 @@
 
 #include "gtest/gtest.h"
 
+#include <array>
+
 using namespace llvm;
 
 // Fixture for the unittests, allowing to *temporarily* disable the unittests
@@ -164,3 +166,65 @@ TEST_F(ThreadPoolTest, PoolDestruction) {
   }
   ASSERT_EQ(5, checked_in);
 }
+
+TEST_F(ThreadPoolTest, Priorities) {
+  CHECK_UNSUPPORTED();
+  // With a single thread busy, the queued tasks run by priority once it is
+  // free, whatever the order they were submitted in.
+  ThreadPool Pool(1);
+  std::vector<int> Order;
+  Pool.async([this] { waitForMainThread(); });
+  Pool.asyncWithPriority(TaskPriority::Low, [&Order] { Order.push_back(2); });
+  Pool.asyncWithPriority(TaskPriority::Normal, [&Order] { Order.push_back(1); });
+  auto Last = Pool.asyncWithPriority(TaskPriority::Low,
+                                     [&Order] { Order.push_back(3); });
+  Pool.asyncWithPriority(TaskPriority::High, [&Order] { Order.push_back(0); });
+  setMainThreadReady();
+  // Waiting on the future directly does not help, the pool thread runs them.
+  Last.get();
+  Pool.wait();
+  ASSERT_EQ(std::vector<int>({0, 1, 2, 3}), Order);
+}
+
+TEST_F(ThreadPoolTest, NestedWaitFor) {
+  CHECK_UNSUPPORTED();
+  // The only thread of the pool waits for tasks it submitted: it has to run
+  // them itself.
+  ThreadPool Pool(1);
+  std::atomic_int checked_in{0};
+  Pool.async([&Pool, &checked_in] {
+        std::vector<std::shared_future<ThreadPool::VoidTy>> Futures;
+        for (size_t i = 0; i < 10; ++i)
+          Futures.push_back(Pool.async([&checked_in] { ++checked_in; }));
+        for (auto &F : Futures)
+          Pool.waitFor(F);
+      })
+      .get();
+  ASSERT_EQ(10, checked_in);
+}
+
+TEST_F(ThreadPoolTest, Spawn) {
+  CHECK_UNSUPPORTED();
+  std::atomic_int checked_in{0};
+  ThreadPool Pool;
+  for (size_t i = 0; i < 100; ++i)
+    Pool.spawn([&checked_in] { ++checked_in; });
+  // A callable too large to be stored in place.
+  std::array<int, 64> Large;
+  Large.fill(1);
+  Pool.spawn([Large, &checked_in] { checked_in += Large[63]; },
+             TaskPriority::High);
+  Pool.wait();
+  ASSERT_EQ(101, checked_in);
+}
+
+TEST_F(ThreadPoolTest, NoThreads) {
+  CHECK_UNSUPPORTED();
+  // A pool without threads runs its tasks in wait().
+  std::atomic_int checked_in{0};
+  ThreadPool Pool(0);
+  for (size_t i = 0; i < 5; ++i)
+    Pool.async([&checked_in] { ++checked_in; });
+  Pool.wait();
+  ASSERT_EQ(5, checked_in);
+}
@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+"""Compile-time scaling benchmark of the BitSlicer pass.
+
+Generates modules of increasing size with bitslicer-stress, doubling one of
+the number of functions, bit-sliced regions, slices (block length) or
+operations per region at a time, runs them through opt with the BitSlicer
+plugin and reports, for every size, the wall time and peak resident memory of
+opt, the instruction counts before and after the pass, and the time spent in
+each phase of the pass as reported by -time-passes.
+
+  bitslicer-bench.py --opt bin/opt --plugin lib/LLVMBitSlicer.so \\
+      --stress bin/bitslicer-stress --steps 5
+
+The runs of an axis should grow about linearly; a superlinear row points at
+the phase to look at.
+"""
+
+import argparse
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+AXES = ['functions', 'regions', 'block-len', 'ops']
+BASE = {'functions': 1, 'regions': 1, 'block-len': 4, 'ops': 32}
+
+
+def count_instructions(path):
+  """Number of instructions in the function bodies of a .ll file."""
+  count = 0
+  in_body = False
+  with open(path) as f:
+    for line in f:
+      if line.startswith('define '):
+        in_body = True
+      elif line.startswith('}'):
+        in_body = False
+      elif in_body and line.startswith('  ') and not line.lstrip().startswith(';'):
+        count += 1
+  return count
+
+
+def parse_phases(report):
+  """Wall time of every BitSlicer phase in a -time-passes report."""
+  phases = []
+  in_group = False
+  for line in report.splitlines():
+    if 'BitSlicer phases' in line:
+      in_group = True
+      continue
+    if not in_group:
+      continue
+    times = re.findall(r'([\d.]+) \(\s*[\d.]+%\)', line)
+    if not times:
+      continue
+    name = line[line.rfind(')') + 1:].strip()
+    if name == 'Total':
+      break
+    phases.append((name, float(times[-1])))
+  return phases
+
+
+def run_opt(args, input_path, output_path):
+  """Runs opt, returns its wall time, peak RSS in KiB and stderr."""
+  cmd = [args.opt, '-load', args.plugin, '-O0', '-time-passes',
+         input_path, '-S', '-o', output_path]
+  err_path = output_path + '.err'
+  with open(err_path, 'w') as err:
+    start = time.time()
+    proc = subprocess.Popen(cmd, stderr=err)
+    _, status, usage = os.wait4(proc.pid, 0)
+    wall = time.time() - start
+  with open(err_path) as err:
+    report = err.read()
+  if status != 0:
+    sys.stderr.write(report)
+    raise SystemExit('error: %s failed' % ' '.join(cmd))
+  # ru_maxrss is in bytes on Darwin, in KiB elsewhere.
+  rss = usage.ru_maxrss
+  if sys.platform == 'darwin':
+    rss //= 1024
+  return wall, rss, report
+
+
+def main():
+  parser = argparse.ArgumentParser(
+      description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+  parser.add_argument('--opt', required=True, help='opt binary')
+  parser.add_argument('--plugin', required=True, help='LLVMBitSlicer plugin')
+  parser.add_argument('--stress', required=True, help='bitslicer-stress binary')
+  parser.add_argument('--axis', choices=AXES, action='append',
+                      help='axis to scale, all of them by default')
+  parser.add_argument('--steps', type=int, default=4,
+                      help='sizes per axis, each twice the previous one')
+  parser.add_argument('--seed', type=int, default=0)
+  args = parser.parse_args()
+
+  tmpdir = tempfile.mkdtemp(prefix='bitslicer-bench')
+  try:
+    print('%-10s %6s %9s %9s %7s %9s %9s  %s' %
+          ('axis', 'size', 'insts', 'out', 'growth', 'wall(s)', 'rss(MiB)',
+           'phases (s)'))
+    for axis in args.axis or AXES:
+      for step in range(args.steps):
+        size = dict(BASE)
+        size[axis] = BASE[axis] << step
+        input_path = os.path.join(tmpdir, 'in.ll')
+        output_path = os.path.join(tmpdir, 'out.ll')
+        subprocess.check_call(
+            [args.stress, '-seed=%d' % args.seed, '-o', input_path] +
+            ['-%s=%d' % (k, v) for k, v in sorted(size.items())])
+
+        wall, rss, report = run_opt(args, input_path, output_path)
+        insts = count_instructions(input_path)
+        out = count_instructions(output_path)
+        phases = ' '.join('%s=%.3f' % (name, t)
+                          for name, t in parse_phases(report))
+        print('%-10s %6d %9d %9d %6.1fx %9.3f %9.1f  %s' %
+              (axis, size[axis], insts, out, float(out) / max(insts, 1), wall,
+               rss / 1024.0, phases))
+        sys.stdout.flush()
+  finally:
+    shutil.rmtree(tmpdir)
+
+
+if __name__ == '__main__':
+  main()